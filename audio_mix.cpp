@@ -0,0 +1,247 @@
+/**
+ * audio_mix.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "audio_mix.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+namespace {
+  /**
+   * Add or write (if Add is false) the scaled samples with SIMD.
+   *
+   * Returns the number of samples processed, the rest is left for the
+   * scalar loop.
+   */
+  template<bool Add>
+  std::size_t mix_simd(float* dst,const float* src,const float gain,
+                       const std::size_t samples) {
+#if defined(__AVX__)
+    const __m256 vgain = _mm256_set1_ps(gain);
+    const std::size_t n = samples & ~std::size_t(7u);
+    for (std::size_t i=0;i<n;i+=8) {
+      __m256 v = _mm256_mul_ps(_mm256_loadu_ps(src+i),vgain);
+      if constexpr (Add) {
+        v = _mm256_add_ps(v,_mm256_loadu_ps(dst+i));
+      }
+      _mm256_storeu_ps(dst+i,v);
+    }
+    return n;
+#elif defined(__SSE__)
+    const __m128 vgain = _mm_set1_ps(gain);
+    const std::size_t n = samples & ~std::size_t(3u);
+    for (std::size_t i=0;i<n;i+=4) {
+      __m128 v = _mm_mul_ps(_mm_loadu_ps(src+i),vgain);
+      if constexpr (Add) {
+        v = _mm_add_ps(v,_mm_loadu_ps(dst+i));
+      }
+      _mm_storeu_ps(dst+i,v);
+    }
+    return n;
+#else
+    (void)dst; (void)src; (void)gain; (void)samples;
+    return 0u;
+#endif
+  }
+
+  /**
+   * Crossfade with SIMD.  Returns the number of samples processed.
+   */
+  std::size_t crossfade_simd(float* dst,
+                             const float* a,const float* ga,
+                             const float* b,const float* gb,
+                             const std::size_t samples) {
+#if defined(__AVX__)
+    const std::size_t n = samples & ~std::size_t(7u);
+    for (std::size_t i=0;i<n;i+=8) {
+      const __m256 va = _mm256_mul_ps(_mm256_loadu_ps(a+i),
+                                      _mm256_loadu_ps(ga+i));
+      const __m256 vb = _mm256_mul_ps(_mm256_loadu_ps(b+i),
+                                      _mm256_loadu_ps(gb+i));
+      _mm256_storeu_ps(dst+i,_mm256_add_ps(va,vb));
+    }
+    return n;
+#elif defined(__SSE__)
+    const std::size_t n = samples & ~std::size_t(3u);
+    for (std::size_t i=0;i<n;i+=4) {
+      const __m128 va = _mm_mul_ps(_mm_loadu_ps(a+i),_mm_loadu_ps(ga+i));
+      const __m128 vb = _mm_mul_ps(_mm_loadu_ps(b+i),_mm_loadu_ps(gb+i));
+      _mm_storeu_ps(dst+i,_mm_add_ps(va,vb));
+    }
+    return n;
+#else
+    (void)dst; (void)a; (void)ga; (void)b; (void)gb; (void)samples;
+    return 0u;
+#endif
+  }
+
+  /**
+   * Peak and energy with SIMD.  Returns the number of samples processed.
+   */
+  std::size_t levels_simd(const float* src,const std::size_t samples,
+                          float& peak,float& energy) {
+#if defined(__AVX__)
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 vpeak = _mm256_setzero_ps();
+    __m256 venergy = _mm256_setzero_ps();
+    const std::size_t n = samples & ~std::size_t(7u);
+    for (std::size_t i=0;i<n;i+=8) {
+      const __m256 v = _mm256_loadu_ps(src+i);
+      vpeak = _mm256_max_ps(vpeak,_mm256_andnot_ps(sign,v));
+      venergy = _mm256_add_ps(venergy,_mm256_mul_ps(v,v));
+    }
+    alignas(32) float p[8], e[8];
+    _mm256_store_ps(p,vpeak);
+    _mm256_store_ps(e,venergy);
+    for (int i=0;i<8;++i) {
+      peak = (p[i] > peak) ? p[i] : peak;
+      energy += e[i];
+    }
+    return n;
+#elif defined(__SSE__)
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 vpeak = _mm_setzero_ps();
+    __m128 venergy = _mm_setzero_ps();
+    const std::size_t n = samples & ~std::size_t(3u);
+    for (std::size_t i=0;i<n;i+=4) {
+      const __m128 v = _mm_loadu_ps(src+i);
+      vpeak = _mm_max_ps(vpeak,_mm_andnot_ps(sign,v));
+      venergy = _mm_add_ps(venergy,_mm_mul_ps(v,v));
+    }
+    alignas(16) float p[4], e[4];
+    _mm_store_ps(p,vpeak);
+    _mm_store_ps(e,venergy);
+    for (int i=0;i<4;++i) {
+      peak = (p[i] > peak) ? p[i] : peak;
+      energy += e[i];
+    }
+    return n;
+#else
+    (void)src; (void)samples; (void)peak; (void)energy;
+    return 0u;
+#endif
+  }
+
+  /**
+   * Compare the magnitudes with the threshold using SIMD, until a loud
+   * sample appears.  Returns the number of samples checked.
+   */
+  std::size_t silent_simd(const float* src,const std::size_t samples,
+                          const float threshold,bool& loud) {
+#if defined(__AVX__)
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 vthreshold = _mm256_set1_ps(threshold);
+    const std::size_t n = samples & ~std::size_t(7u);
+    for (std::size_t i=0;i<n;i+=8) {
+      const __m256 a = _mm256_andnot_ps(sign,_mm256_loadu_ps(src+i));
+      if (_mm256_movemask_ps(_mm256_cmp_ps(a,vthreshold,_CMP_GT_OQ)) != 0) {
+        loud = true;
+        return i;
+      }
+    }
+    return n;
+#elif defined(__SSE__)
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 vthreshold = _mm_set1_ps(threshold);
+    const std::size_t n = samples & ~std::size_t(3u);
+    for (std::size_t i=0;i<n;i+=4) {
+      const __m128 a = _mm_andnot_ps(sign,_mm_loadu_ps(src+i));
+      if (_mm_movemask_ps(_mm_cmpgt_ps(a,vthreshold)) != 0) {
+        loud = true;
+        return i;
+      }
+    }
+    return n;
+#else
+    (void)src; (void)samples; (void)threshold; (void)loud;
+    return 0u;
+#endif
+  }
+}
+
+void mix_add(float* dst,const float* src,const float gain,
+             const std::size_t samples) {
+  for (std::size_t i=mix_simd<true>(dst,src,gain,samples);i<samples;++i) {
+    dst[i] += gain*src[i];
+  }
+}
+
+void mix_scale(float* dst,const float* src,const float gain,
+               const std::size_t samples) {
+  for (std::size_t i=mix_simd<false>(dst,src,gain,samples);i<samples;++i) {
+    dst[i] = gain*src[i];
+  }
+}
+
+void mix_crossfade(float* dst,
+                   const float* a,const float* ga,
+                   const float* b,const float* gb,
+                   const std::size_t samples) {
+  for (std::size_t i=crossfade_simd(dst,a,ga,b,gb,samples);i<samples;++i) {
+    dst[i] = a[i]*ga[i] + b[i]*gb[i];
+  }
+}
+
+void mix_levels(const float* src,const std::size_t samples,
+                float& peak,float& energy) {
+  peak = 0.0f;
+  energy = 0.0f;
+  for (std::size_t i=levels_simd(src,samples,peak,energy);i<samples;++i) {
+    const float a = (src[i] < 0.0f) ? -src[i] : src[i];
+    peak = (a > peak) ? a : peak;
+    energy += src[i]*src[i];
+  }
+}
+
+bool mix_silent(const float* src,const std::size_t samples,
+                const float threshold) {
+  bool loud = false;
+  std::size_t i = silent_simd(src,samples,threshold,loud);
+  if (loud) {
+    return false;
+  }
+  for (;i<samples;++i) {
+    const float a = (src[i] < 0.0f) ? -src[i] : src[i];
+    if (a > threshold) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,83 @@
+/**
+ * audio_mix.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _AUDIO_MIX_H
+#define _AUDIO_MIX_H
+
+#include <cstddef>
+
+/**
+ * Add the samples of src, scaled by gain, to the samples in dst.
+ *
+ * It is used by jack's process to mix the voices, so it does not
+ * allocate nor block.  Eight samples are added at a time with AVX, or
+ * four with SSE, if the compiler targets them.
+ */
+void mix_add(float* dst,const float* src,const float gain,
+             const std::size_t samples);
+
+/**
+ * Write the samples of src, scaled by gain, on dst.
+ */
+void mix_scale(float* dst,const float* src,const float gain,
+               const std::size_t samples);
+
+/**
+ * Crossfade two signals with the given gain curves:
+ * dst[i] = a[i]*ga[i] + b[i]*gb[i].
+ *
+ * dst may be a or b.
+ */
+void mix_crossfade(float* dst,
+                   const float* a,const float* ga,
+                   const float* b,const float* gb,
+                   const std::size_t samples);
+
+/**
+ * Peak absolute value and sum of squares of the samples, for meters.
+ */
+void mix_levels(const float* src,const std::size_t samples,
+                float& peak,float& energy);
+
+/**
+ * True if no sample has a magnitude above threshold.  It stops at the
+ * first loud samples, so that checking a live signal costs little.
+ */
+bool mix_silent(const float* src,const std::size_t samples,
+                const float threshold);
+
+#endif
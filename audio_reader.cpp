@@ -0,0 +1,117 @@
+/**
+ * audio_reader.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "audio_reader.h"
+
+#include <cstdio>
+
+/******************************
+ * audio_reader
+ ******************************/
+
+audio_reader::audio_reader()
+  : _channels(0u)
+  , _sample_rate(0u)
+  , _frames(0u) {
+}
+
+audio_reader::~audio_reader() {
+}
+
+bool audio_reader::ready(const std::size_t) {
+  return true;
+}
+
+bool audio_reader::seek(const std::size_t) {
+  return false;
+}
+
+/******************************
+ * sndfile_reader
+ ******************************/
+
+sndfile_reader::sndfile_reader()
+  : audio_reader()
+  , _file_handler(nullptr) {
+}
+
+sndfile_reader::~sndfile_reader() {
+  close();
+}
+
+bool sndfile_reader::open(const std::filesystem::path& file) {
+  close();
+  
+  SF_INFO info;
+  info.format = 0; // this has to be set to zero before calling sf_open
+  _file_handler = sf_open(file.c_str(),SFM_READ,&info);
+  
+  if (_file_handler == nullptr) {
+    return false;
+  }
+  
+  _sample_rate = info.samplerate;
+  _channels    = info.channels;
+  _frames      = (info.frames > 0) ? std::size_t(info.frames) : 0u;
+  
+  return true;
+}
+
+std::size_t sndfile_reader::read(float* dst,const std::size_t frames) {
+  if (_file_handler == nullptr) {
+    return 0u;
+  }
+  
+  // this reads the buffer from the file, and returns the read "frames"
+  const sf_count_t cnt = sf_readf_float(_file_handler,dst,frames);
+  return (cnt > 0) ? std::size_t(cnt) : 0u;
+}
+
+bool sndfile_reader::seek(const std::size_t frame) {
+  if (_file_handler == nullptr) {
+    return false;
+  }
+  // libsndfile seeks exactly to the frame, also in compressed formats
+  return sf_seek(_file_handler,sf_count_t(frame),SEEK_SET) == sf_count_t(frame);
+}
+
+void sndfile_reader::close() {
+  if (_file_handler != nullptr) {
+    sf_close(_file_handler);
+    _file_handler = nullptr;
+  }
+}
@@ -0,0 +1,124 @@
+/**
+ * audio_reader.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _AUDIO_READER_H
+#define _AUDIO_READER_H
+
+#include <cstddef>
+#include <filesystem>
+
+#include <sndfile.h>
+
+/**
+ * Interface of the backends used by sndfile_thread to read audio files.
+ *
+ * A reader delivers interleaved float frames, in the sampling rate and
+ * number of channels of the file.  Resampling and mixdown are left to
+ * the caller.
+ */
+class audio_reader {
+public:
+  audio_reader();
+  virtual ~audio_reader();
+
+  audio_reader(const audio_reader&) = delete; // not copyable
+  audio_reader& operator=(const audio_reader&) = delete; // not copyable
+
+  /**
+   * Open the given file.
+   *
+   * Returns false if this backend cannot read the file.
+   */
+  virtual bool open(const std::filesystem::path& file) = 0;
+
+  /**
+   * Read up to frames interleaved frames into dst.
+   *
+   * Returns the number of frames read, which is less than the requested
+   * number only at the end of the file.
+   */
+  virtual std::size_t read(float* dst,const std::size_t frames) = 0;
+
+  /**
+   * Check if the next read of the given number of frames can be done
+   * without waiting for the storage device.
+   *
+   * Synchronous backends always return true.
+   */
+  virtual bool ready(const std::size_t frames);
+
+  /**
+   * Move to the given frame of the file, so that the next read starts
+   * there.
+   *
+   * Returns false if the file cannot seek (e.g. streams).
+   */
+  virtual bool seek(const std::size_t frame);
+
+  /// Close the file
+  virtual void close() = 0;
+
+  inline std::size_t channels() const {return _channels;}
+  inline std::size_t sample_rate() const {return _sample_rate;}
+  /// Total number of frames in the file
+  inline std::size_t frames() const {return _frames;}
+  
+protected:
+  std::size_t _channels;
+  std::size_t _sample_rate;
+  std::size_t _frames;
+};
+
+/**
+ * Synchronous reader using libsndfile.  It supports all formats of the
+ * library, including compressed ones.
+ */
+class sndfile_reader : public audio_reader {
+public:
+  sndfile_reader();
+  virtual ~sndfile_reader();
+
+  virtual bool open(const std::filesystem::path& file) override;
+  virtual std::size_t read(float* dst,const std::size_t frames) override;
+  virtual bool seek(const std::size_t frame) override;
+  virtual void close() override;
+  
+private:
+  SNDFILE* _file_handler;
+};
+
+#endif
@@ -0,0 +1,161 @@
+/**
+ * block_arena.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "block_arena.h"
+
+#include <sys/mman.h>
+
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+
+namespace {
+  /// Usual size of a huge page on x86_64 and aarch64
+  constexpr std::size_t huge_page_size = 2u*1024u*1024u;
+
+  inline std::size_t round_up(const std::size_t n,const std::size_t m) {
+    return ((n + m - 1u)/m)*m;
+  }
+}
+
+block_arena::block_arena()
+  : _slab(nullptr)
+  , _bytes(0u)
+  , _used(0u)
+  , _huge(false)
+  , _locked(false) {
+}
+
+block_arena::~block_arena() {
+  release();
+}
+
+std::size_t block_arena::padded(const std::size_t n) {
+  return round_up(n,alignment/sizeof(float));
+}
+
+bool block_arena::allocate(const std::size_t floats,
+                           const unsigned int options) {
+  release();
+
+  if (floats == 0u) {
+    return true;
+  }
+
+  std::size_t bytes = round_up(floats*sizeof(float),alignment);
+  void* mem = MAP_FAILED;
+  
+  if (options & HugePages) {
+    // Explicit huge pages must be reserved by the administrator
+    // (vm.nr_hugepages).  If there are none, try with transparent ones.
+    const std::size_t hbytes = round_up(bytes,huge_page_size);
+    mem = mmap(nullptr,hbytes,PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,-1,0);
+    if (mem != MAP_FAILED) {
+      bytes = hbytes;
+      _huge = true;
+    }
+  }
+
+  if (mem == MAP_FAILED) {
+    // mmap returns page aligned memory, which is always cache-line aligned
+    mem = mmap(nullptr,bytes,PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    if (mem == MAP_FAILED) {
+      std::cerr << "E> Unable to allocate " << bytes
+                << " bytes for the audio blocks: "
+                << std::strerror(errno) << std::endl;
+      return false;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if ((options & HugePages) &&
+        (madvise(mem,bytes,MADV_HUGEPAGE) == 0)) {
+      std::cerr << "I> Using transparent huge pages for audio blocks"
+                << std::endl;
+    }
+#endif
+  }
+
+  _slab  = mem;
+  _bytes = bytes;
+  _used  = 0u;
+  
+  if (options & Lock) {
+    if (mlock(_slab,_bytes) == 0) {
+      _locked = true;
+    } else {
+      std::cerr << "E> Unable to lock audio blocks in RAM: "
+                << std::strerror(errno) << std::endl;
+    }
+  }
+
+  if (options & Prefault) {
+    // Anonymous memory is already zeroed, but each page is only mapped
+    // at its first write access.  Do that here, and not in jack's thread
+    std::memset(_slab,0,_bytes);
+  }
+  
+  return true;
+}
+
+void block_arena::release() {
+  if (_slab != nullptr) {
+    if (_locked) {
+      munlock(_slab,_bytes);
+    }
+    munmap(_slab,_bytes);
+  }
+  
+  _slab   = nullptr;
+  _bytes  = 0u;
+  _used   = 0u;
+  _huge   = false;
+  _locked = false;
+}
+
+float* block_arena::carve(const std::size_t n) {
+  const std::size_t bytes = padded(n)*sizeof(float);
+  
+  if ((_slab == nullptr) || (_used + bytes > _bytes)) {
+    return nullptr;
+  }
+  
+  float* ptr = reinterpret_cast<float*>(static_cast<char*>(_slab) + _used);
+  _used += bytes;
+  return ptr;
+}
@@ -0,0 +1,121 @@
+/**
+ * block_arena.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _BLOCK_ARENA_H
+#define _BLOCK_ARENA_H
+
+#include <cstddef>
+
+/**
+ * Slab of memory holding all audio blocks that the realtime thread reads.
+ *
+ * Instead of allocating each block on its own in the heap, all blocks
+ * are carved from one contiguous, 64-byte aligned region, so that each
+ * block starts on its own cache line and SIMD loads of the blocks are
+ * always aligned.
+ *
+ * Optionally, the slab can be backed by huge pages, locked in RAM with
+ * mlock(), and prefaulted, so that the jack thread never pays for a page
+ * fault on the first touch of a block.
+ *
+ * The arena does not keep track of individual blocks: everything carved
+ * from it is released at once with release() or with the destructor.
+ */
+class block_arena {
+public:
+  /// Options for the allocation of the slab (can be or-ed)
+  enum flags : unsigned int {
+    None      = 0u,
+    HugePages = 1u, ///< try to back the slab with huge pages
+    Lock      = 2u, ///< lock the slab in RAM with mlock()
+    Prefault  = 4u  ///< touch all pages right after allocation
+  };
+
+  /// Alignment in bytes of the slab and of each carved block
+  static constexpr std::size_t alignment = 64u;
+
+  /// Creates an empty arena
+  block_arena();
+  /// Releases the slab
+  ~block_arena();
+
+  block_arena(const block_arena&) = delete; // not copyable
+  block_arena& operator=(const block_arena&) = delete; // not copyable
+
+  /**
+   * Discard the current slab, and allocate a new one with room for at
+   * least the given number of floats.
+   *
+   * Returns false if the memory could not be allocated.  Failing to
+   * use huge pages or to lock the memory is not an error: those are
+   * just reported and the slab is used as normal memory.
+   */
+  bool allocate(const std::size_t floats,
+                const unsigned int options = Prefault);
+
+  /// Release the slab.  All blocks carved from it become invalid.
+  void release();
+
+  /**
+   * Get a chunk of n floats from the slab, aligned to the alignment
+   * boundary.
+   *
+   * Returns nullptr if there is not enough space left.
+   */
+  float* carve(const std::size_t n);
+
+  /// Number of floats really reserved for a block of n floats
+  static std::size_t padded(const std::size_t n);
+
+  /// Total capacity of the slab, in bytes
+  inline std::size_t capacity() const {return _bytes;}
+  /// Bytes already carved from the slab
+  inline std::size_t used() const {return _used;}
+  /// True if the slab is backed by huge pages
+  inline bool huge_pages() const {return _huge;}
+  /// True if the slab is locked in RAM
+  inline bool locked() const {return _locked;}
+
+private:
+  void* _slab;
+  std::size_t _bytes;
+  std::size_t _used;
+  bool _huge;
+  bool _locked;
+};
+
+#endif
@@ -0,0 +1,405 @@
+/**
+ * compressor.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "compressor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+  /// Samples computed at once, in buffers on the stack
+  constexpr std::size_t chunk = 64u;
+
+  /// Lowest level seen by the detector (-400 dB), to avoid log2(0)
+  constexpr float floor_level = 1e-20f;
+
+  /// Decibels of a factor 2 in amplitude and in power
+  constexpr float amplitude_db = 6.0205999f;
+  constexpr float power_db = 3.0103f;
+
+  /// log2(1+t) ~ t*(l1 + t*(l2 + t*(l3 + t*(l4 + t*l5)))), t in [0,1)
+  constexpr float l1 =  1.4418799f;
+  constexpr float l2 = -0.70886522f;
+  constexpr float l3 =  0.41524556f;
+  constexpr float l4 = -0.19351653f;
+  constexpr float l5 =  0.045268294f;
+
+  /// 2^t ~ 1 + t*(e1 + t*(e2 + t*(e3 + t*(e4 + t*e5)))), t in [0,1)
+  constexpr float e1 = 0.69315254f;
+  constexpr float e2 = 0.24015245f;
+  constexpr float e3 = 0.055836598f;
+  constexpr float e4 = 0.0089728999f;
+  constexpr float e5 = 0.0018854036f;
+
+  /**
+   * Gain reduction of the static curve, in dB, for a level given in
+   * linear units: min(0,threshold - scale*log2(|x|))*slope.  The SIMD
+   * versions below follow the same steps.
+   */
+  inline float curve(const float x,const float scale,
+                     const float threshold,const float slope) {
+    const float a = std::max((x < 0.0f) ? -x : x,floor_level);
+    std::uint32_t bits;
+    std::memcpy(&bits,&a,sizeof(bits));
+    const float e = float(std::int32_t(bits >> 23) - 127);
+    bits = (bits & 0x007fffffu) | 0x3f800000u;
+    float m;
+    std::memcpy(&m,&bits,sizeof(m));
+    const float t = m - 1.0f;
+    float p = l5;
+    p = l4 + t*p;
+    p = l3 + t*p;
+    p = l2 + t*p;
+    p = l1 + t*p;
+    const float level = scale*(e + t*p);
+    return std::min(0.0f,threshold - level)*slope;
+  }
+
+  /// 2^(x*scale + offset)
+  inline float gain(const float x,const float scale,const float offset) {
+    const float y = std::clamp(x*scale + offset,-126.0f,126.0f);
+    const float fl = std::floor(y);
+    const float t = y - fl;
+    float p = e5;
+    p = e4 + t*p;
+    p = e3 + t*p;
+    p = e2 + t*p;
+    p = e1 + t*p;
+    p = 1.0f + t*p;
+    std::uint32_t bits;
+    std::memcpy(&bits,&p,sizeof(bits));
+    bits += std::uint32_t(std::int32_t(fl)) << 23;
+    float g;
+    std::memcpy(&g,&bits,sizeof(g));
+    return g;
+  }
+
+  /**
+   * Static curve with SIMD.  Returns the number of samples processed,
+   * the rest is left for the scalar loop.
+   */
+  std::size_t curve_simd(const float* src,float* dst,const float scale,
+                         const float threshold,const float slope,
+                         const std::size_t samples) {
+#if defined(__AVX2__)
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 lowest = _mm256_set1_ps(floor_level);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 vscale = _mm256_set1_ps(scale);
+    const __m256 vthreshold = _mm256_set1_ps(threshold);
+    const __m256 vslope = _mm256_set1_ps(slope);
+    const __m256i mantissa = _mm256_set1_epi32(0x007fffff);
+    const __m256i one_bits = _mm256_set1_epi32(0x3f800000);
+    const __m256i bias = _mm256_set1_epi32(127);
+    const std::size_t n = samples & ~std::size_t(7u);
+    for (std::size_t i=0;i<n;i+=8) {
+      const __m256 a = _mm256_max_ps(_mm256_andnot_ps(sign,
+                                                      _mm256_loadu_ps(src+i)),
+                                     lowest);
+      const __m256i bits = _mm256_castps_si256(a);
+      const __m256 e = _mm256_cvtepi32_ps(
+        _mm256_sub_epi32(_mm256_srli_epi32(bits,23),bias));
+      const __m256 t = _mm256_sub_ps(_mm256_castsi256_ps(
+        _mm256_or_si256(_mm256_and_si256(bits,mantissa),one_bits)),one);
+      __m256 p = _mm256_set1_ps(l5);
+      p = _mm256_add_ps(_mm256_set1_ps(l4),_mm256_mul_ps(t,p));
+      p = _mm256_add_ps(_mm256_set1_ps(l3),_mm256_mul_ps(t,p));
+      p = _mm256_add_ps(_mm256_set1_ps(l2),_mm256_mul_ps(t,p));
+      p = _mm256_add_ps(_mm256_set1_ps(l1),_mm256_mul_ps(t,p));
+      const __m256 level =
+        _mm256_mul_ps(vscale,_mm256_add_ps(e,_mm256_mul_ps(t,p)));
+      _mm256_storeu_ps(dst+i,_mm256_mul_ps(
+        _mm256_min_ps(zero,_mm256_sub_ps(vthreshold,level)),vslope));
+    }
+    return n;
+#elif defined(__SSE2__)
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 lowest = _mm_set1_ps(floor_level);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 vscale = _mm_set1_ps(scale);
+    const __m128 vthreshold = _mm_set1_ps(threshold);
+    const __m128 vslope = _mm_set1_ps(slope);
+    const __m128i mantissa = _mm_set1_epi32(0x007fffff);
+    const __m128i one_bits = _mm_set1_epi32(0x3f800000);
+    const __m128i bias = _mm_set1_epi32(127);
+    const std::size_t n = samples & ~std::size_t(3u);
+    for (std::size_t i=0;i<n;i+=4) {
+      const __m128 a = _mm_max_ps(_mm_andnot_ps(sign,_mm_loadu_ps(src+i)),
+                                  lowest);
+      const __m128i bits = _mm_castps_si128(a);
+      const __m128 e = _mm_cvtepi32_ps(
+        _mm_sub_epi32(_mm_srli_epi32(bits,23),bias));
+      const __m128 t = _mm_sub_ps(_mm_castsi128_ps(
+        _mm_or_si128(_mm_and_si128(bits,mantissa),one_bits)),one);
+      __m128 p = _mm_set1_ps(l5);
+      p = _mm_add_ps(_mm_set1_ps(l4),_mm_mul_ps(t,p));
+      p = _mm_add_ps(_mm_set1_ps(l3),_mm_mul_ps(t,p));
+      p = _mm_add_ps(_mm_set1_ps(l2),_mm_mul_ps(t,p));
+      p = _mm_add_ps(_mm_set1_ps(l1),_mm_mul_ps(t,p));
+      const __m128 level = _mm_mul_ps(vscale,_mm_add_ps(e,_mm_mul_ps(t,p)));
+      _mm_storeu_ps(dst+i,_mm_mul_ps(
+        _mm_min_ps(zero,_mm_sub_ps(vthreshold,level)),vslope));
+    }
+    return n;
+#else
+    (void)src; (void)dst; (void)scale; (void)threshold; (void)slope;
+    (void)samples;
+    return 0u;
+#endif
+  }
+
+  /**
+   * Linear gains with SIMD, in place.  Returns the number of samples
+   * processed.
+   */
+  std::size_t gain_simd(float* x,const float scale,const float offset,
+                        const std::size_t samples) {
+#if defined(__AVX2__)
+    const __m256 vscale = _mm256_set1_ps(scale);
+    const __m256 voffset = _mm256_set1_ps(offset);
+    const __m256 low = _mm256_set1_ps(-126.0f);
+    const __m256 high = _mm256_set1_ps(126.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const std::size_t n = samples & ~std::size_t(7u);
+    for (std::size_t i=0;i<n;i+=8) {
+      __m256 y = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(x+i),vscale),
+                               voffset);
+      y = _mm256_min_ps(_mm256_max_ps(y,low),high);
+      const __m256 fl = _mm256_floor_ps(y);
+      const __m256 t = _mm256_sub_ps(y,fl);
+      __m256 p = _mm256_set1_ps(e5);
+      p = _mm256_add_ps(_mm256_set1_ps(e4),_mm256_mul_ps(t,p));
+      p = _mm256_add_ps(_mm256_set1_ps(e3),_mm256_mul_ps(t,p));
+      p = _mm256_add_ps(_mm256_set1_ps(e2),_mm256_mul_ps(t,p));
+      p = _mm256_add_ps(_mm256_set1_ps(e1),_mm256_mul_ps(t,p));
+      p = _mm256_add_ps(one,_mm256_mul_ps(t,p));
+      const __m256i bits =
+        _mm256_add_epi32(_mm256_castps_si256(p),
+                         _mm256_slli_epi32(_mm256_cvtps_epi32(fl),23));
+      _mm256_storeu_ps(x+i,_mm256_castsi256_ps(bits));
+    }
+    return n;
+#elif defined(__SSE2__)
+    const __m128 vscale = _mm_set1_ps(scale);
+    const __m128 voffset = _mm_set1_ps(offset);
+    const __m128 low = _mm_set1_ps(-126.0f);
+    const __m128 high = _mm_set1_ps(126.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const std::size_t n = samples & ~std::size_t(3u);
+    for (std::size_t i=0;i<n;i+=4) {
+      __m128 y = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x+i),vscale),voffset);
+      y = _mm_min_ps(_mm_max_ps(y,low),high);
+      // floor(), which SSE2 lacks: truncate, and step down the negatives
+      const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(y));
+      const __m128 fl = _mm_sub_ps(truncated,
+                                   _mm_and_ps(_mm_cmpgt_ps(truncated,y),one));
+      const __m128 t = _mm_sub_ps(y,fl);
+      __m128 p = _mm_set1_ps(e5);
+      p = _mm_add_ps(_mm_set1_ps(e4),_mm_mul_ps(t,p));
+      p = _mm_add_ps(_mm_set1_ps(e3),_mm_mul_ps(t,p));
+      p = _mm_add_ps(_mm_set1_ps(e2),_mm_mul_ps(t,p));
+      p = _mm_add_ps(_mm_set1_ps(e1),_mm_mul_ps(t,p));
+      p = _mm_add_ps(one,_mm_mul_ps(t,p));
+      const __m128i bits =
+        _mm_add_epi32(_mm_castps_si128(p),
+                      _mm_slli_epi32(_mm_cvtps_epi32(fl),23));
+      _mm_storeu_ps(x+i,_mm_castsi128_ps(bits));
+    }
+    return n;
+#else
+    (void)x; (void)scale; (void)offset; (void)samples;
+    return 0u;
+#endif
+  }
+
+  /**
+   * dst[i] = src[i]*g[i] with SIMD.  Returns the number of samples
+   * processed.
+   */
+  std::size_t apply_simd(float* dst,const float* src,const float* g,
+                         const std::size_t samples) {
+#if defined(__AVX2__)
+    const std::size_t n = samples & ~std::size_t(7u);
+    for (std::size_t i=0;i<n;i+=8) {
+      _mm256_storeu_ps(dst+i,_mm256_mul_ps(_mm256_loadu_ps(src+i),
+                                           _mm256_loadu_ps(g+i)));
+    }
+    return n;
+#elif defined(__SSE2__)
+    const std::size_t n = samples & ~std::size_t(3u);
+    for (std::size_t i=0;i<n;i+=4) {
+      _mm_storeu_ps(dst+i,_mm_mul_ps(_mm_loadu_ps(src+i),_mm_loadu_ps(g+i)));
+    }
+    return n;
+#else
+    (void)dst; (void)src; (void)g; (void)samples;
+    return 0u;
+#endif
+  }
+
+  /// One-pole coefficient of the given time constant
+  float pole(const float ms,const double sample_rate) {
+    return (ms > 0.0f) ?
+      float(std::exp(-1.0/(double(ms)*1e-3*sample_rate))) : 0.0f;
+  }
+}
+
+compressor::compressor()
+  : _slope(0.0f)
+  , _attack(0.0f)
+  , _release(0.0f)
+  , _rms(0.0f)
+  , _power(0.0f)
+  , _envelope(0.0f)
+  , _hold_length(0u)
+  , _hold(0u)
+  , _delay_pos(0u)
+  , _gain_reduction(0.0f) {
+}
+
+void compressor::configure(const settings& s,const double sample_rate) {
+  _settings = s;
+  _slope = std::isinf(s.ratio) ? 1.0f :
+    std::clamp(1.0f - 1.0f/std::max(s.ratio,1.0f),0.0f,1.0f);
+  _attack = pole(s.attack_ms,sample_rate);
+  _release = pole(s.release_ms,sample_rate);
+  // The averaging weight of the new power, not the pole
+  _rms = 1.0f - pole(std::max(s.rms_ms,0.0f),sample_rate);
+  _delay.assign(std::size_t(std::max(s.lookahead_ms,0.0f)*1e-3*
+                            sample_rate + 0.5),0.0f);
+  _hold_length = _delay.size();
+  reset();
+}
+
+void compressor::reset() {
+  _power = 0.0f;
+  _envelope = 0.0f;
+  _hold = 0u;
+  std::fill(_delay.begin(),_delay.end(),0.0f);
+  _delay_pos = 0u;
+  _gain_reduction.store(0.0f,std::memory_order_relaxed);
+}
+
+void compressor::process(const float* in,float* out,const std::size_t n) {
+  alignas(32) float level[chunk];
+  alignas(32) float g[chunk];
+  alignas(32) float delayed[chunk];
+
+  const bool rms = (_settings.mode == detector::Rms);
+  const float scale = rms ? power_db : amplitude_db;
+  const float threshold = _settings.threshold_db;
+  const float offset = _settings.makeup_db/amplitude_db;
+  float lowest = 0.0f;
+  
+  for (std::size_t i=0;i<n;i+=chunk) {
+    const std::size_t m = std::min(chunk,n - i);
+    const float* x = in + i;
+
+    // The RMS detector averages the power, one sample after the other
+    const float* detected = x;
+    if (rms) {
+      float power = _power;
+      for (std::size_t j=0;j<m;++j) {
+        power += _rms*(x[j]*x[j] - power);
+        power = (power < floor_level) ? 0.0f : power; // no denormals
+        level[j] = power;
+      }
+      _power = power;
+      detected = level;
+    }
+
+    // Gain reduction of the static curve, in dB
+    std::size_t j = curve_simd(detected,g,scale,threshold,_slope,m);
+    for (;j<m;++j) {
+      g[j] = curve(detected[j],scale,threshold,_slope);
+    }
+
+    // Attack while the reduction grows, hold it for the lookahead, and
+    // release it while it shrinks
+    float envelope = _envelope;
+    std::size_t hold = _hold;
+    for (j=0;j<m;++j) {
+      const float target = g[j];
+      if (target < envelope) {
+        envelope = target + _attack*(envelope - target);
+        hold = _hold_length;
+      } else if (hold > 0u) {
+        --hold;
+      } else {
+        envelope = target + _release*(envelope - target);
+      }
+      envelope = (envelope > -1e-6f) ? 0.0f : envelope;
+      g[j] = envelope;
+      lowest = std::min(lowest,envelope);
+    }
+    _envelope = envelope;
+    _hold = hold;
+
+    // Back to linear gains, with the makeup
+    for (j=gain_simd(g,1.0f/amplitude_db,offset,m);j<m;++j) {
+      g[j] = gain(g[j],1.0f/amplitude_db,offset);
+    }
+
+    // The lookahead delays the signal, but not its detection
+    if (!_delay.empty()) {
+      const std::size_t len = _delay.size();
+      for (j=0;j<m;++j) {
+        delayed[j] = _delay[_delay_pos];
+        _delay[_delay_pos] = x[j];
+        _delay_pos = (_delay_pos + 1u == len) ? 0u : _delay_pos + 1u;
+      }
+      x = delayed;
+    }
+
+    float* y = out + i;
+    for (j=apply_simd(y,x,g,m);j<m;++j) {
+      y[j] = x[j]*g[j];
+    }
+  }
+
+  _gain_reduction.store(-lowest,std::memory_order_relaxed);
+}
@@ -0,0 +1,135 @@
+/**
+ * compressor.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _COMPRESSOR_H
+#define _COMPRESSOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Feed-forward compressor and limiter of one channel.
+ *
+ * The level of the input is detected per sample, as its peak or as its
+ * RMS (a one-pole average of its power), and turned into decibels.  The
+ * static curve reduces the level above the threshold by the ratio, or
+ * clamps it to the threshold if the ratio is infinite (limiter).  The
+ * gain reduction is smoothed in decibels with the attack time while it
+ * grows and the release time while it shrinks.  With a lookahead, the
+ * signal goes through a delay line, so that the gain is already reduced
+ * when the peaks that caused it come out, and the reduction is held for
+ * as long before its release, so that it does not sag between the peaks
+ * of a steady tone.
+ *
+ * The logarithms and the exponentials are computed in blocks with
+ * polynomial approximations (errors below 1e-4 dB), eight or four at a
+ * time with AVX2 or SSE2, if the compiler targets them.  Only the
+ * detector and the smoothing are recursive, and run sample by sample.
+ *
+ * All memory is allocated by configure(), so process() can run in jack's
+ * process.
+ */
+class compressor {
+public:
+  /// How the level of the input is measured
+  enum class detector {
+    Peak, ///< absolute value of each sample
+    Rms   ///< moving average of the power
+  };
+
+  struct settings {
+    float threshold_db = -12.0f; ///< level where the compression starts
+    float ratio = 4.0f;          ///< input over output dB, or infinity
+    float attack_ms = 5.0f;
+    float release_ms = 100.0f;
+    float lookahead_ms = 0.0f;   ///< delay of the signal
+    float makeup_db = 0.0f;      ///< gain after the compression
+    detector mode = detector::Peak;
+    float rms_ms = 10.0f;        ///< time constant of the RMS detector
+  };
+
+  compressor();
+
+  /**
+   * Compute the coefficients for the sampling rate and allocate the
+   * delay line.  The state is reset.  Not for jack's process.
+   */
+  void configure(const settings& s,const double sample_rate);
+
+  /// Forget the signal seen so far
+  void reset();
+
+  /// Compress n samples.  out may be in.
+  void process(const float* in,float* out,const std::size_t n);
+
+  /// Largest gain reduction of the last call to process(), in dB (>= 0)
+  inline float gain_reduction_db() const {
+    return _gain_reduction.load(std::memory_order_relaxed);
+  }
+
+  /// Frames the signal is delayed by the lookahead
+  inline std::size_t latency() const {return _delay.size();}
+
+  inline const settings& get_settings() const {return _settings;}
+
+private:
+  settings _settings;
+
+  /// 1 - 1/ratio: dB of reduction per dB above the threshold
+  float _slope;
+  /// One-pole coefficients of the smoothing and of the RMS detector
+  float _attack;
+  float _release;
+  float _rms;
+
+  /// Power seen by the RMS detector
+  float _power;
+  /// Smoothed gain reduction in dB (<= 0)
+  float _envelope;
+  /// Samples the reduction is held after it last grew
+  std::size_t _hold_length;
+  std::size_t _hold;
+
+  /// Lookahead delay line
+  std::vector<float> _delay;
+  std::size_t _delay_pos;
+
+  std::atomic<float> _gain_reduction;
+};
+
+#endif
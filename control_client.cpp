@@ -0,0 +1,153 @@
+/**
+ * control_client.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file control_client.cpp
+ *
+ * @brief Command line client of the control socket of a running jack
+ * client (see control_commands.h for the commands).
+ *
+ * The command can be given as arguments, e.g.
+ *
+ *   tarea3-ctl play voice.wav
+ *
+ * or, without arguments, one per line in the standard input, which are
+ * all sent as a single batch.
+ */
+
+#include <cstdlib>
+#include <cstring>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+namespace po=boost::program_options;
+
+int main(int argc,char *argv[]) {
+
+  try {
+    std::string socket_path;
+    std::vector<std::string> words;
+    
+    po::options_description desc("Allowed options");
+
+    desc.add_options()
+      ("help,h","show usage information")
+      ("socket,s",
+       po::value<std::string>(&socket_path)->default_value("/tmp/tarea3.sock"),
+       "Control socket of the client (see its --control option)")
+      ("command",
+       po::value<std::vector<std::string> >(&words),
+       "Command to send.  Without it, commands are read from the standard "
+       "input, one per line");
+
+    po::positional_options_description positional;
+    positional.add("command",-1);
+    
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc,argv).
+              options(desc).positional(positional).run(),vm);
+    po::notify(vm);
+    
+    if (vm.count("help")) {
+      std::cout << "Usage: " << argv[0] << " [options] [command]\n"
+                << desc << std::endl;
+      return EXIT_SUCCESS;
+    }
+
+    // All commands, one per line
+    std::string batch;
+    if (words.empty()) {
+      for (std::string line; std::getline(std::cin,line);) {
+        batch += line + '\n';
+      }
+    } else {
+      for (const auto& w : words) {
+        batch += (batch.empty() ? "" : " ") + w;
+      }
+      batch += '\n';
+    }
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path,socket_path.c_str(),sizeof(addr.sun_path)-1);
+
+    const int fd = socket(AF_UNIX,SOCK_STREAM | SOCK_CLOEXEC,0);
+    if ((fd < 0) ||
+        (connect(fd,reinterpret_cast<sockaddr*>(&addr),sizeof(addr)) != 0)) {
+      std::cerr << "E> Unable to connect to '" << socket_path
+                << "'.  Is the client running with --control?" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    // Send the batch and tell the server there is nothing else
+    for (std::size_t sent = 0u; sent < batch.size();) {
+      const ssize_t n = send(fd,batch.data() + sent,batch.size() - sent,
+                             MSG_NOSIGNAL);
+      if (n <= 0) {
+        std::cerr << "E> Connection lost" << std::endl;
+        return EXIT_FAILURE;
+      }
+      sent += std::size_t(n);
+    }
+    shutdown(fd,SHUT_WR);
+
+    // Print the replies, failing if any of them is an error
+    std::string replies;
+    char buffer[4096];
+    for (ssize_t n; (n = read(fd,buffer,sizeof(buffer))) > 0;) {
+      replies.append(buffer,std::size_t(n));
+    }
+    close(fd);
+
+    std::cout << replies << std::flush;
+    
+    const bool failed = (replies.rfind("ERR",0u) == 0u) ||
+      (replies.find("\nERR") != std::string::npos);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+  catch (std::exception& exc) {
+    std::cerr << argv[0] << ": Error: " << exc.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}
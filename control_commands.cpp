@@ -0,0 +1,197 @@
+/**
+ * control_commands.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "control_commands.h"
+#include "parse_filter.tpp"
+
+#include <cmath>
+#include <sstream>
+#include <filesystem>
+
+namespace {
+  /// Rest of the line after the stream position, without leading spaces
+  std::string rest_of(std::istringstream& is) {
+    std::string rest;
+    std::getline(is >> std::ws,rest);
+    return rest;
+  }
+
+  inline float from_db(const float db) {
+    return std::pow(10.0f,db/20.0f);
+  }
+
+  inline std::string reply(const bool ok,const std::string& failure) {
+    return ok ? "OK" : "ERR " + failure;
+  }
+}
+
+control_commands::control_commands(jack::client& client,event_loop& loop)
+  : _client(client)
+  , _loop(loop) {
+}
+
+std::string control_commands::operator()(const std::string& line) {
+  std::istringstream is(line);
+  std::string cmd;
+  is >> cmd;
+
+  if (cmd == "play") {
+    const std::string file = rest_of(is);
+    return reply(!file.empty() && _client.add_file(file),
+                 "cannot play '" + file + "'");
+  }
+
+  if (cmd == "schedule") {
+    double ms;
+    if (!(is >> ms) || (ms < 0.0)) {
+      return "ERR usage: schedule MS FILE";
+    }
+    const std::string file = rest_of(is);
+    const jack_nframes_t start = _client.frame_time() +
+      jack_nframes_t(ms*1e-3*double(_client.sample_rate()));
+    if (file.empty() || !_client.schedule_file(file,start)) {
+      return "ERR cannot schedule '" + file + "'";
+    }
+    return "OK " + std::to_string(start);
+  }
+
+  if (cmd == "voice") {
+    float gain_db,pan;
+    double ms;
+    if (!(is >> gain_db >> pan >> ms)) {
+      return "ERR usage: voice GAIN_DB PAN MS FILE";
+    }
+    const std::string file = rest_of(is);
+    bool ok = !file.empty();
+    if (ok && (ms < 0.0)) {
+      ok = _client.add_voice(file,from_db(gain_db),pan);
+    } else if (ok) {
+      const jack_nframes_t start = _client.frame_time() +
+        jack_nframes_t(ms*1e-3*double(_client.sample_rate()));
+      ok = _client.schedule_voice(file,from_db(gain_db),pan,start);
+    }
+    return reply(ok,"cannot mix '" + file + "'");
+  }
+
+  if (cmd == "stop") {
+    return reply(_client.stop_files(),"cannot stop the files");
+  }
+
+  if (cmd == "seek") {
+    std::size_t frame;
+    if (!(is >> frame)) {
+      return "ERR usage: seek FRAME";
+    }
+    _client.seek_file(frame);
+    return "OK";
+  }
+
+  if (cmd == "loop") {
+    int repeats;
+    std::size_t start = 0u, end = 0u;
+    if (!(is >> repeats)) {
+      return "ERR usage: loop REPEATS [START END]";
+    }
+    is >> start >> end;
+    _client.set_file_loop(sndfile_thread::loop_region(start,end,repeats));
+    return "OK";
+  }
+
+  if (cmd == "coeffs") {
+    const std::string file = rest_of(is);
+    if (!std::filesystem::exists(file)) {
+      return "ERR no file '" + file + "'";
+    }
+    try {
+      const jack::filter_coefficients coefs =
+        parse_filter<jack::client::sample_t>(file);
+      if (!_client.set_coefficients(coefs)) {
+        return "ERR busy, try again";
+      }
+      return "OK " + std::to_string(coefs.size());
+    } catch (std::exception& exc) {
+      return std::string("ERR ") + exc.what();
+    }
+  }
+
+  if (cmd == "bypass") {
+    std::string state;
+    is >> state;
+    if ((state != "on") && (state != "off")) {
+      return "ERR usage: bypass on|off";
+    }
+    return reply(_client.set_bypass(state == "on"),"busy, try again");
+  }
+
+  if (cmd == "live-gain") {
+    std::string value;
+    is >> value;
+    if (value == "off") {
+      return reply(_client.set_live_gain(-1.0f),"busy, try again");
+    }
+    try {
+      return reply(_client.set_live_gain(from_db(std::stof(value))),
+                   "busy, try again");
+    } catch (std::exception&) {
+      return "ERR usage: live-gain DB|off";
+    }
+  }
+
+  if (cmd == "stats") {
+    std::ostringstream os;
+    _client.report_stats(os);
+    std::string stats = os.str();
+    if (stats.rfind("I> ",0u) == 0u) {
+      stats.erase(0u,3u);
+    }
+    while (!stats.empty() && (stats.back() == '\n')) {
+      stats.pop_back();
+    }
+    return "OK " + stats;
+  }
+
+  if (cmd == "ping") {
+    return "OK pong";
+  }
+
+  if (cmd == "quit") {
+    _loop.stop();
+    return "OK";
+  }
+
+  return "ERR unknown command '" + cmd + "'";
+}
@@ -0,0 +1,80 @@
+/**
+ * control_commands.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _CONTROL_COMMANDS_H
+#define _CONTROL_COMMANDS_H
+
+#include <string>
+
+#include "jack_client.h"
+#include "event_loop.h"
+
+/**
+ * Commands of the control socket (see control_server).
+ *
+ * Each line holds a command and its arguments, separated by spaces.
+ * File names are always the last argument, and may contain spaces.
+ *
+ *   play FILE                      append FILE to the playlist
+ *   schedule MS FILE               play FILE MS milliseconds from now
+ *   voice GAIN_DB PAN MS FILE      mix FILE in its own voice, MS < 0 now
+ *   stop                           stop all files
+ *   seek FRAME                     move the current file to FRAME
+ *   loop REPEATS [START END]       loop the current file (-1 forever)
+ *   coeffs FILE                    load filter coefficients
+ *   bypass on|off                  copy the input to the output
+ *   live-gain DB|off               mix the live input under the files
+ *   stats                          statistics of the client
+ *   ping                           check the connection
+ *   quit                           stop the client
+ *
+ * The reply is "OK" followed by optional information, or "ERR" followed
+ * by the reason of the failure.
+ */
+class control_commands {
+public:
+  control_commands(jack::client& client,event_loop& loop);
+
+  /// Execute the command line and return its reply
+  std::string operator()(const std::string& line);
+
+private:
+  jack::client& _client;
+  event_loop& _loop;
+};
+
+#endif
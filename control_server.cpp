@@ -0,0 +1,232 @@
+/**
+ * control_server.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "control_server.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include <iostream>
+
+control_server::control_server()
+  : _listen_fd(-1)
+  , _loop(nullptr) {
+}
+
+control_server::~control_server() {
+  close();
+}
+
+bool control_server::open(const std::filesystem::path& path,
+                          event_loop& loop,
+                          dispatcher dispatch) {
+  close();
+  
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.native().size() >= sizeof(addr.sun_path)) {
+    std::cerr << "E> Control socket path too long: " << path << std::endl;
+    return false;
+  }
+  std::strncpy(addr.sun_path,path.c_str(),sizeof(addr.sun_path)-1);
+
+  _listen_fd = socket(AF_UNIX,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+  if (_listen_fd < 0) {
+    std::cerr << "E> Unable to create the control socket" << std::endl;
+    return false;
+  }
+
+  // A socket left by a crashed run would make bind() fail
+  if (std::filesystem::is_socket(path)) {
+    std::filesystem::remove(path);
+  }
+  
+  if ((bind(_listen_fd,reinterpret_cast<sockaddr*>(&addr),sizeof(addr))!=0) ||
+      (listen(_listen_fd,16) != 0)) {
+    std::cerr << "E> Unable to listen on " << path << ": "
+              << std::strerror(errno) << std::endl;
+    ::close(_listen_fd);
+    _listen_fd = -1;
+    return false;
+  }
+
+  _path = path;
+  _loop = &loop;
+  _dispatch = std::move(dispatch);
+
+  if (!_loop->add(_listen_fd,[this](std::uint32_t) {accept_client();})) {
+    close();
+    return false;
+  }
+
+  std::cerr << "I> Control socket " << path << std::endl;
+  return true;
+}
+
+void control_server::close() {
+  while (!_clients.empty()) {
+    drop(_clients.begin()->first);
+  }
+  
+  if (_listen_fd >= 0) {
+    if (_loop != nullptr) {
+      _loop->remove(_listen_fd);
+    }
+    ::close(_listen_fd);
+    _listen_fd = -1;
+    std::error_code ec;
+    std::filesystem::remove(_path,ec);
+  }
+}
+
+void control_server::accept_client() {
+  int fd;
+  while ((fd = accept4(_listen_fd,nullptr,nullptr,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    connection& c = _clients[fd];
+    c = connection();
+    c.events = EPOLLIN | EPOLLRDHUP;
+    if (!_loop->add(fd,[this,fd](std::uint32_t events) {serve(fd,events);},
+                    c.events)) {
+      _clients.erase(fd);
+      ::close(fd);
+    }
+  }
+}
+
+void control_server::serve(const int fd,const std::uint32_t events) {
+  connection& c = _clients[fd];
+  std::string& pending = c.pending;
+  std::string& replies = c.unsent;
+  bool closed = (events & (EPOLLHUP | EPOLLERR)) != 0u;
+  
+  char buffer[4096];
+  while (!c.closing && !closed) {
+    const ssize_t n = recv(fd,buffer,sizeof(buffer),MSG_DONTWAIT);
+    if (n > 0) {
+      pending.append(buffer,std::size_t(n));
+      continue;
+    }
+    if (n == 0) {
+      c.closing = true; // the other end finished writing
+    } else if (errno == EINTR) {
+      continue;
+    } else if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+      closed = true;
+    }
+    break;
+  }
+  
+  // Execute all complete lines as one batch
+  std::size_t begin = 0u;
+  for (std::size_t end;
+       (end = pending.find('\n',begin)) != std::string::npos;
+       begin = end + 1u) {
+    std::string line = pending.substr(begin,end - begin);
+    if (!line.empty() && (line.back() == '\r')) {
+      line.pop_back();
+    }
+    if (!line.empty()) {
+      replies += _dispatch(line);
+      replies += '\n';
+    }
+  }
+  pending.erase(0u,begin);
+
+  if (pending.size() > max_line) {
+    replies += "ERR line too long\n";
+    pending.clear();
+    c.closing = true;
+  }
+  
+  // The replies are sent together.  What the socket does not take now
+  // is sent when it is writable again.
+  if (!closed && !flush(fd,c)) {
+    closed = true;
+  }
+  if (replies.size() > max_unsent) {
+    std::cerr << "E> Control client does not read its replies" << std::endl;
+    closed = true;
+  }
+
+  if (closed || (c.closing && replies.empty())) {
+    drop(fd);
+  } else {
+    watch(fd,c);
+  }
+}
+
+bool control_server::flush(const int fd,connection& c) {
+  std::size_t sent = 0u;
+  while (sent < c.unsent.size()) {
+    const ssize_t n = send(fd,c.unsent.data() + sent,c.unsent.size() - sent,
+                           MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n > 0) {
+      sent += std::size_t(n);
+    } else if ((n < 0) && (errno == EINTR)) {
+      continue;
+    } else if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+      break;
+    } else {
+      return false;
+    }
+  }
+  c.unsent.erase(0u,sent);
+  return true;
+}
+
+void control_server::watch(const int fd,connection& c) {
+  // A client that finished writing would keep the socket readable
+  std::uint32_t events = c.closing ? 0u : (EPOLLIN | EPOLLRDHUP);
+  if (!c.unsent.empty()) {
+    events |= EPOLLOUT;
+  }
+  if ((events != c.events) && _loop->modify(fd,events)) {
+    c.events = events;
+  }
+}
+
+void control_server::drop(const int fd) {
+  if (_loop != nullptr) {
+    _loop->remove(fd);
+  }
+  _clients.erase(fd);
+  ::close(fd);
+}
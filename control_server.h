@@ -0,0 +1,123 @@
+/**
+ * control_server.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _CONTROL_SERVER_H
+#define _CONTROL_SERVER_H
+
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <string>
+
+#include "event_loop.h"
+
+/**
+ * UNIX domain socket where other programs send text commands to the
+ * running client.
+ *
+ * The protocol is line based: each line is one command, and each
+ * command gets exactly one reply line, starting with "OK" or "ERR".
+ * All complete lines received at once are executed as a batch, and their
+ * replies are sent back together, so that scripts can pipeline many
+ * commands without waiting for each reply.
+ *
+ * The server runs in the event loop of the main thread (see
+ * event_loop), so commands are never executed concurrently.  Sockets
+ * never block it: replies that a client does not read yet wait in its
+ * connection, and a client that lets more than max_unsent bytes pile up
+ * is dropped.
+ */
+class control_server {
+public:
+  /// Execute a command line and return its reply, without newline
+  typedef std::function<std::string(const std::string&)> dispatcher;
+
+  control_server();
+  control_server(const control_server&) = delete; // not copyable
+  control_server& operator=(const control_server&) = delete; // not copyable
+
+  /// Closes all connections and removes the socket
+  ~control_server();
+
+  /**
+   * Listen on the socket at the given path, served by the event loop.
+   * A stale socket left by a previous run is replaced.
+   *
+   * Returns false if the socket cannot be created.
+   */
+  bool open(const std::filesystem::path& path,
+            event_loop& loop,
+            dispatcher dispatch);
+
+  /// Close all connections and remove the socket
+  void close();
+
+  /// Largest line accepted, longer ones drop the connection
+  static constexpr std::size_t max_line = 4096u;
+
+  /// Largest amount of replies waiting for a client to read them
+  static constexpr std::size_t max_unsent = 1024u*1024u;
+
+private:
+  /// State of one client
+  struct connection {
+    /// Incomplete line received
+    std::string pending;
+    /// Replies not sent yet, because the socket was full
+    std::string unsent;
+    /// The client finished writing; drop it once the replies are sent
+    bool closing = false;
+    /// Events watched in the event loop
+    std::uint32_t events = 0u;
+  };
+  
+  int _listen_fd;
+  std::filesystem::path _path;
+  event_loop* _loop;
+  dispatcher _dispatch;
+  std::map<int,connection> _clients;
+
+  void accept_client();
+  void serve(const int fd,const std::uint32_t events);
+  /// Send as many replies as the socket takes.  False on errors.
+  bool flush(const int fd,connection& c);
+  /// Watch the events the connection needs now
+  void watch(const int fd,connection& c);
+  void drop(const int fd);
+};
+
+#endif
@@ -0,0 +1,195 @@
+/**
+ * event_loop.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event_loop.h"
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <csignal>
+#include <cerrno>
+#include <cmath>
+
+#include <iostream>
+
+event_loop::event_loop()
+  : _epoll_fd(epoll_create1(EPOLL_CLOEXEC))
+  , _running(false) {
+  if (_epoll_fd < 0) {
+    std::cerr << "E> Unable to create the epoll instance" << std::endl;
+  }
+}
+
+event_loop::~event_loop() {
+  for (const int fd : _owned) {
+    close(fd);
+  }
+  if (_epoll_fd >= 0) {
+    close(_epoll_fd);
+  }
+}
+
+bool event_loop::add(const int fd,handler h,const std::uint32_t events) {
+  if (!valid() || (fd < 0)) {
+    return false;
+  }
+  
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(_epoll_fd,EPOLL_CTL_ADD,fd,&ev) != 0) {
+    std::cerr << "E> Unable to watch file descriptor " << fd << std::endl;
+    return false;
+  }
+
+  _handlers[fd] = std::move(h);
+  return true;
+}
+
+bool event_loop::modify(const int fd,const std::uint32_t events) {
+  if (_handlers.find(fd) == _handlers.end()) {
+    return false;
+  }
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.fd = fd;
+  return epoll_ctl(_epoll_fd,EPOLL_CTL_MOD,fd,&ev) == 0;
+}
+
+bool event_loop::remove(const int fd) {
+  if (_handlers.erase(fd) == 0u) {
+    return false;
+  }
+  return epoll_ctl(_epoll_fd,EPOLL_CTL_DEL,fd,nullptr) == 0;
+}
+
+bool event_loop::block_signals(std::initializer_list<int> signals) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  for (const int s : signals) {
+    sigaddset(&mask,s);
+  }
+  return pthread_sigmask(SIG_BLOCK,&mask,nullptr) == 0;
+}
+
+bool event_loop::add_signals(std::initializer_list<int> signals,
+                             std::function<void(int)> h) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  for (const int s : signals) {
+    sigaddset(&mask,s);
+  }
+
+  const int fd = signalfd(-1,&mask,SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd < 0) {
+    std::cerr << "E> Unable to create the signal descriptor" << std::endl;
+    return false;
+  }
+  _owned.push_back(fd);
+
+  return add(fd,[fd,h](std::uint32_t) {
+    signalfd_siginfo info;
+    while (read(fd,&info,sizeof(info)) == ssize_t(sizeof(info))) {
+      h(int(info.ssi_signo));
+    }
+  });
+}
+
+bool event_loop::add_timer(const double period,std::function<void()> h) {
+  const int fd = add_disarmed_timer(std::move(h));
+  return (fd >= 0) && set_timer(fd,std::max(period,1e-3));
+}
+
+int event_loop::add_disarmed_timer(std::function<void()> h) {
+  const int fd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0) {
+    std::cerr << "E> Unable to create the timer" << std::endl;
+    return -1;
+  }
+  _owned.push_back(fd);
+
+  const bool added = add(fd,[fd,h](std::uint32_t) {
+    std::uint64_t expirations;
+    if (read(fd,&expirations,sizeof(expirations)) ==
+        ssize_t(sizeof(expirations))) {
+      h();
+    }
+  });
+  return added ? fd : -1;
+}
+
+bool event_loop::set_timer(const int fd,const double period) {
+  // A zero period (and expiration) disarms the timer
+  double secs;
+  const double frac = std::modf(std::max(period,0.0),&secs);
+  itimerspec spec{};
+  spec.it_interval.tv_sec  = time_t(secs);
+  spec.it_interval.tv_nsec = long(frac*1e9);
+  spec.it_value = spec.it_interval;
+  if (timerfd_settime(fd,0,&spec,nullptr) != 0) {
+    std::cerr << "E> Unable to start the timer" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void event_loop::run() {
+  static constexpr int max_events = 16;
+  epoll_event events[max_events];
+  
+  _running = valid();
+  while (_running) {
+    const int n = epoll_wait(_epoll_fd,events,max_events,-1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "E> epoll_wait failed" << std::endl;
+      break;
+    }
+
+    for (int i=0;(i<n) && _running;++i) {
+      auto it = _handlers.find(events[i].data.fd);
+      if (it != _handlers.end()) {
+        // The handler may remove itself, so it is called on a copy
+        const handler h = it->second;
+        h(events[i].events);
+      }
+    }
+  }
+}
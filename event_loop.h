@@ -0,0 +1,135 @@
+/**
+ * event_loop.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _EVENT_LOOP_H
+#define _EVENT_LOOP_H
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <vector>
+
+#include <sys/epoll.h>
+
+/**
+ * Single-threaded event loop of the main thread, based on epoll.
+ *
+ * File descriptors are registered with a handler, which is called from
+ * run() whenever they are ready.  Signals are received through a
+ * signalfd and periodic timers through timerfds, so that no handler ever
+ * runs in signal context, and the thread sleeps until something happens.
+ */
+class event_loop {
+public:
+  /// Handler of a file descriptor, receiving the epoll events
+  typedef std::function<void(std::uint32_t)> handler;
+  
+  event_loop();
+  event_loop(const event_loop&) = delete; // not copyable
+  event_loop& operator=(const event_loop&) = delete; // not copyable
+  
+  /// Closes the epoll instance and all descriptors created by the loop
+  ~event_loop();
+
+  /// True if the epoll instance could be created
+  inline bool valid() const {return _epoll_fd >= 0;}
+  
+  /**
+   * Call the handler whenever fd is ready for the given epoll events.
+   *
+   * The descriptor is not owned by the loop.
+   */
+  bool add(const int fd,handler h,const std::uint32_t events = EPOLLIN);
+
+  /// Change the epoll events watched for the file descriptor
+  bool modify(const int fd,const std::uint32_t events);
+
+  /// Stop watching the file descriptor
+  bool remove(const int fd);
+
+  /**
+   * Block the given signals in the calling thread.  It must be called at
+   * the very beginning of main(), so that all threads inherit the mask
+   * and the signals are only received by the loop (see add_signals()).
+   */
+  static bool block_signals(std::initializer_list<int> signals);
+  
+  /**
+   * Call the handler with the signal number when one of the signals
+   * arrives.  The signals must have been blocked with block_signals().
+   */
+  bool add_signals(std::initializer_list<int> signals,
+                   std::function<void(int)> h);
+
+  /**
+   * Call the handler every period seconds.
+   */
+  bool add_timer(const double period,std::function<void()> h);
+
+  /**
+   * Create a timer for the handler that does not expire until it is
+   * armed with set_timer().
+   *
+   * Returns the descriptor of the timer, or -1 if it could not be created.
+   */
+  int add_disarmed_timer(std::function<void()> h);
+
+  /**
+   * Let the timer expire every period seconds, or disarm it if the period
+   * is zero, so that it does not wake up the loop anymore.
+   */
+  bool set_timer(const int fd,const double period);
+
+  /**
+   * Wait for events and dispatch them, until stop() is called by one of
+   * the handlers.
+   */
+  void run();
+
+  /// Let run() return after the current handler
+  inline void stop() {_running = false;}
+
+private:
+  int _epoll_fd;
+  bool _running;
+  std::map<int,handler> _handlers;
+  /// Descriptors created and closed by the loop
+  std::vector<int> _owned;
+};
+
+#endif
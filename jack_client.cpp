@@ -36,14 +36,26 @@
  */
 
 #include "jack_client.h"
+#include "audio_mix.h"
+#include "startup_profile.h"
+#include "tracer.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include <cstdio>
 #include <cerrno>
 #include <cstdlib>
+#include <cstring>
+#include <cmath>
 #include <stdexcept>
+#include <algorithm>
 
+#include <chrono>
 #include <mutex>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 
 std::ostream& operator<<(std::ostream& os,const JackStatus& s) {
   if (s & JackFailure) {
@@ -88,17 +100,163 @@ namespace jack {
 
   // Static member of class client
   jack_client_t* client::_client_ptr  = 0;
-  client_state   client::_state       = client_state::Idle;
+  std::atomic<client_state> client::_state(client_state::Idle);
 
   jack_nframes_t client::_buffer_size = 0;
   jack_nframes_t client::_sample_rate = 0;
 
   sndfile_thread client::_file_thread;
+  unsigned int   client::_arena_options = block_arena::Prefault;
+
+  std::vector<jack_default_audio_sample_t> client::_mix_buffer;
+  float          client::_live_gain = -1.0f;
+
+  spsc_ringbuffer<client::rt_command> client::_rt_commands(1024u);
+  spsc_ringbuffer<filter_coefficients*> client::_retired(1024u);
+  filter_coefficients* client::_coefficients = nullptr;
+  bool           client::_bypass = false;
+
+  double         client::_crossfade_ms = 5.0;
+  std::vector<jack_default_audio_sample_t> client::_fade_in;
+  std::vector<jack_default_audio_sample_t> client::_fade_out;
+  client::fade_state client::_fade = client::fade_state::Live;
+  std::size_t    client::_fade_pos = 0u;
+
+  shm_ring       client::_shm_source;
+  std::string    client::_shm_name;
+  std::size_t    client::_shm_capacity = 0u;
+
+  stream_writer  client::_output_stream;
+  std::filesystem::path client::_output_target;
+  pcm_format     client::_output_format;
+
+  stats_segment  client::_stats;
+  std::string    client::_stats_name;
+  std::atomic<std::size_t> client::_xruns(0u);
+
+  float          client::_silence_threshold = -1.0f;
+  compressor     client::_compressor;
+  compressor::settings client::_compressor_settings;
+  bool           client::_compress = false;
+  loudness_meter client::_meter;
+  bool           client::_metering = false;
+  std::atomic<std::uint64_t> client::_silent_cycles(0u);
+
+  std::string    client::_client_name = "dsp1";
+  port_connections client::_connections = port_connections::physical(2u);
+  int            client::_graph_fd = -1;
+
+  bool           client::_reconnect = true;
+  bool           client::_fast_start = false;
+  std::function<void()> client::_pending_setup;
+  int            client::_shutdown_fd = -1;
+  std::chrono::steady_clock::time_point client::_down_since;
+
+  load_watchdog  client::_watchdog;
+  load_watchdog::settings client::_watchdog_settings;
+  bool           client::_watchdog_enabled = false;
+  bool           client::_watchdog_bypass = false;
+  std::size_t    client::_quality = 0u;
+  bool           client::_shed_process = false;
+
+  session_recorder client::_recorder;
+  std::filesystem::path client::_record_file;
+  std::uint64_t  client::_cycle_index = 0u;
+  client::replay_sources client::_replay;
+
+  perf_counters  client::_counters;
+  bool           client::_count_perf = false;
+  perf_counters::totals client::_reported_counters{};
   
   jack_port_t*   client::_input_port  = nullptr;
   jack_port_t*   client::_output_port = nullptr;
 
   
+  typedef jack_default_audio_sample_t sample_t;
+
+  /*
+   * One cycle of the client, from the input to the output buffer.  It is
+   * called by jack's process, and by replays of recorded sessions.
+   */
+  static bool run_cycle(client* ptr,
+                        const jack_nframes_t nframes,
+                        const sample_t* in,
+                        sample_t *const out) {
+    stats_segment::stage_clock clock(ptr->stats_active() ||
+                                     ptr->watchdog_active());
+    if (tracer::enabled()) {
+      ptr->trace_period();
+    }
+    
+    const jack_nframes_t cycle = ptr->cycle_start();
+    ptr->begin_cycle(nframes,cycle,in);
+    
+    ptr->apply_commands();
+    ptr->apply_quality();
+    clock.mark(stats_segment::Commands);
+    
+    // Check if we have to replace the input by audio files' input
+    sndfile_thread::file_block* file_block_ptr =
+      ptr->next_file_block(cycle);
+    startup_profile::cycle(file_block_ptr != nullptr);
+    
+    // Otherwise, other processes may be feeding samples through
+    // shared memory, which are used in place
+    const sample_t* shm_ptr = nullptr;
+    
+    if (file_block_ptr != nullptr) {
+      // The samples before the start of a file, or after its end, come
+      // from the live input, with crossfades in between
+      ptr->mix_live(file_block_ptr,in,nframes);
+      ptr->crossfade(file_block_ptr,in,nframes);
+      in = &(file_block_ptr->front());
+    } else if (ptr->file_audible()) {
+      in = ptr->fade_to_live(in,nframes);
+    } else if ((shm_ptr = ptr->next_shm_block(nframes)) != nullptr) {
+      in = shm_ptr;
+    }
+    clock.mark(stats_segment::Input);
+
+    // Other files playing at the same time are mixed on top
+    in = ptr->mix_voices(in,nframes,cycle);
+    clock.mark(stats_segment::Voices);
+
+    bool ok = true;
+    if (ptr->bypassed()) {
+      memcpy(out,in,sizeof(sample_t)*nframes);
+    } else {
+      if (ptr->silent(in,nframes)) {
+        // A settled chain would only turn this silence into silence
+        memset(out,0,sizeof(sample_t)*nframes);
+      } else {
+        ptr->perf_begin();
+        ok = ptr->process(nframes,in,out);
+        ptr->perf_end();
+      }
+      // The dynamics catch the peaks added by the filters, too
+      ptr->compress(out,nframes);
+    }
+    clock.mark(stats_segment::Process);
+
+    if (file_block_ptr != nullptr) {
+      file_block_ptr->status = sndfile_thread::Status::Garbage;
+    }
+    if (shm_ptr != nullptr) {
+      ptr->release_shm_block(nframes);
+    }
+
+    ptr->measure(out,nframes);
+    ptr->stream_output(out,nframes);
+    clock.mark(stats_segment::Output);
+    clock.finish(cycle);
+    ptr->watch_load(nframes,clock.total());
+
+    ptr->end_cycle(out,nframes);
+    ptr->publish_cycle(nframes,clock,in,out);
+    
+    return ok;
+  }
+  
   /*
    * C level callback function.  
    *
@@ -109,8 +267,6 @@ namespace jack {
   static int process(jack_nframes_t nframes, void *arg) {
     client* ptr=static_cast<client*>(arg);
     
-    typedef jack_default_audio_sample_t sample_t;
-
     jack_port_t *const ip = ptr->input_port();
     jack_port_t *const op = ptr->output_port();
     
@@ -120,21 +276,7 @@ namespace jack {
     sample_t *const out
       = static_cast<sample_t*>(jack_port_get_buffer(op,nframes));
 
-    // Check if we have to replace the input by audio files' input
-    sndfile_thread::file_block* file_block_ptr =
-      ptr->next_file_block();
-    
-    if (file_block_ptr != nullptr) {
-      in = &(file_block_ptr->front());
-    }
-
-    bool ok = ptr->process(nframes,in,out);
-
-    if (file_block_ptr != nullptr) {
-      file_block_ptr->status = sndfile_thread::Status::Garbage;
-    }
-    
-    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    return run_cycle(ptr,nframes,in,out) ? EXIT_SUCCESS : EXIT_FAILURE;
   }
 
   // C level callback function, follows jack's C API.
@@ -156,13 +298,34 @@ namespace jack {
     ptr->set_buffer_size(nframes);
     return EXIT_SUCCESS;
   }
+
+  // Callback used to count xruns
+  static int xrun(void *arg) {
+    client* ptr=static_cast<client*>(arg);
+    ptr->xrun();
+    return EXIT_SUCCESS;
+  }
+
+  // Callback used when ports appear or disappear
+  static void port_registration(jack_port_id_t,int registered,void *arg) {
+    if (registered != 0) {
+      client* ptr=static_cast<client*>(arg);
+      ptr->port_registered();
+    }
+  }
+
+  // Called by jack's realtime thread before its first cycle
+  static void thread_init(void *arg) {
+    client* ptr=static_cast<client*>(arg);
+    ptr->init_thread();
+  }
   
 
   client::client() {
   }
 
   client::~client() {
-    if (_state != client_state::Idle) {
+    if ((_state != client_state::Idle) && (_client_ptr != nullptr)) {
       std::cout << "I> Deactivating and closing JACK client" << std::endl;
       jack_deactivate(_client_ptr);
       jack_client_close(_client_ptr);
@@ -190,11 +353,100 @@ namespace jack {
 
     std::cerr << "I> Initializing JACK" << std::endl;
 
-    static const char* client_name = "dsp1";
+    if (_shutdown_fd < 0) {
+      _shutdown_fd = eventfd(0u,EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+    if (_graph_fd < 0) {
+      _graph_fd = eventfd(0u,EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    {
+      startup_profile::phase phase("opening jack");
+      if (!open_jack(false)) {
+        return (_state = client_state::Error);
+      }
+    }
+
+    {
+      startup_profile::phase phase("setting up the client");
+    
+      // Live statistics for monitors, if requested
+      if (!_stats_name.empty()) {
+        if (_stats.create(_stats_name,_sample_rate,_buffer_size)) {
+          std::cerr << "I> Statistics published in '" << _stats_name << "'"
+                    << std::endl;
+          _file_thread.set_stats(&_stats);
+        }
+      }
+
+      // A fast start reads the first file meanwhile
+      if (_fast_start) {
+        _file_thread.init(_buffer_size,_sample_rate,10,_arena_options);
+        _file_thread.spawn();
+      }
+
+      // Shared memory ring for other processes, if requested
+      if (!_shm_name.empty()) {
+        if (_shm_source.create(_shm_name,_shm_capacity,_sample_rate)) {
+          std::cerr << "I> Shared memory input '" << _shm_name << "' with "
+                    << _shm_source.capacity() << " frames" << std::endl;
+        }
+      }
+
+      // Output stream for other programs, if requested
+      start_output_stream();
+
+      // Session log, starting with the current state of the client
+      if (!_record_file.empty()) {
+        start_recording();
+      }
+
+      // The watchdog is ready before the first cycle
+      if (_watchdog_enabled) {
+        start_watchdog();
+      }
+
+      prepare_mix();
+    }
+
+    if (_fast_start) {
+      if (_pending_setup) {
+        startup_profile::phase phase("joining the parallel setup");
+        _pending_setup();
+        _pending_setup = nullptr;
+      }
+      if (!_file_thread.idle()) {
+        startup_profile::phase phase("prefetching the first file");
+        if (!_file_thread.wait_primed(std::chrono::milliseconds(250))) {
+          std::cerr << "I> No file ready for the first cycle" << std::endl;
+        }
+      }
+    }
+    
+    {
+      startup_profile::phase phase("activating jack");
+      if ((_state = activate_jack()) != client_state::Running) {
+        return _state;
+      }
+    }
+
+    // Initialize and start the audio file reading thread
+    if (!_fast_start) {
+      startup_profile::phase phase("starting the file thread");
+      _file_thread.init(_buffer_size,_sample_rate,10,_arena_options);
+      _file_thread.spawn();
+    }
+    
+    return (_state);
+  }
+  
+  bool client::open_jack(const bool retry) {
+    const char* client_name = _client_name.c_str();
     static const char* server_name = nullptr;
 
     jack_status_t jack_status;
-    jack_options_t options = JackNullOption;
+    // While reconnecting, wait for the server instead of starting one
+    const jack_options_t options = retry ? JackNoStartServer : JackNullOption;
     
     // open a client connection to the JACK server
     _client_ptr = jack_client_open(client_name,
@@ -203,12 +455,15 @@ namespace jack {
                                    server_name);
 
     if (_client_ptr == nullptr) {
+      if (retry) {
+        return false;
+      }
       std::cerr << "E> jack_client_open() failed, " << jack_status << std::endl;
 
       if (jack_status & JackServerFailed) {
         std::cerr << "E> Unable to connect to JACK server" << std::endl;
       }
-      return (_state = client_state::Error);
+      return false;
     }
     
     if (jack_status & JackServerStarted) {
@@ -227,7 +482,7 @@ namespace jack {
                                   jack::process,
                                   this) != 0) {
       std::cerr << "E> Unable to set process callback" << std::endl;
-      return (_state = client_state::Error);
+      return false;
     }
 
     // call `jack::shutdown()' if jack ever shuts down, either
@@ -249,6 +504,23 @@ namespace jack {
       std::cerr << "E> Unable to set sample rate callback" << std::endl;
     }
 
+    if (jack_set_xrun_callback(_client_ptr,jack::xrun,this) != 0) {
+      std::cerr << "E> Unable to set xrun callback" << std::endl;
+    }
+
+    // New ports are connected following the rules
+    if (jack_set_port_registration_callback(_client_ptr,
+                                            jack::port_registration,
+                                            this) != 0) {
+      std::cerr << "E> Unable to set port registration callback" << std::endl;
+    }
+
+    if (jack_set_thread_init_callback(_client_ptr,
+                                      jack::thread_init,
+                                      this) != 0) {
+      std::cerr << "E> Unable to set thread init callback" << std::endl;
+    }
+
     // Get sample rate and buffer size
     _sample_rate = jack_get_sample_rate(_client_ptr);
     _buffer_size = jack_get_buffer_size(_client_ptr);
@@ -267,72 +539,33 @@ namespace jack {
 
     if ((_input_port == nullptr) || (_output_port == nullptr)) {
       std::cerr << "E> no more JACK ports available" << std::endl;
-      return (_state = client_state::Error);
+      return false;
     }
 
+    return true;
+  }
+
+  client_state client::activate_jack() {
     // Tell the JACK server that we are ready to roll.  Our process()
     // callback will start running now.
     if (jack_activate (_client_ptr)) {
       std::cerr << "E> cannot activate client" << std::endl;
-      return (_state = client_state::Error);
+      return client_state::Error;
     }
 
-    _state = client_state::Running;
-    
-    const char **ports = nullptr;
-    
     // Connect the ports.  You can't do this before the client is
     // activated, because we can't make connections to clients that
-    // aren't running.  Note the confusing (but necessary) orientation
-    // of the driver backend ports: playback ports are "input" to the
-    // backend, and capture ports are "output" from it.
-    ports = jack_get_ports(_client_ptr, nullptr, nullptr,
-                           JackPortIsPhysical|JackPortIsOutput);
-    
-    if (ports == nullptr) {
-      stop();
-      std::cerr << "E> no physical capture ports" << std::endl;
-      return (_state = client_state::Error);
-    }
-    
-    if (jack_connect(_client_ptr, ports[0], jack_port_name(_input_port))) {
-      fprintf (stderr, "cannot connect input ports\n");
-      _state = client_state::Error;
-    }
-    
-    free(ports);
-    ports=nullptr;
-    
-    ports = jack_get_ports (_client_ptr, nullptr, nullptr,
-                            JackPortIsPhysical|JackPortIsInput);
-    if (ports == nullptr) {
-      std::cerr << "E> no physical playback ports" << std::endl;
-      return (_state = client_state::Error);
-    }
-
-    // Left speaker
-    if (jack_connect (_client_ptr, jack_port_name(_output_port), ports[0])) {
-      std::cerr << "E> Cannot connect output ports" << std::endl;
-      _state = client_state::Error;
+    // aren't running.
+    if (_connections.empty()) {
+      std::cerr << "I> Ports left unconnected" << std::endl;
+    } else if (_connections.apply(_client_ptr,_input_port,
+                                  _output_port) == 0u) {
+      std::cerr << "I> No ports to connect yet" << std::endl;
     }
 
-    // Right speaker
-    if (jack_connect (_client_ptr, jack_port_name(_output_port), ports[1])) {
-      std::cerr << "E> Cannot connect output ports" << std::endl;
-      _state = client_state::Error;
-    }
-
-    
-    free(ports);
-    ports=nullptr;
-
-    // Initialize and start the audio file reading thread
-    _file_thread.init(_buffer_size,_sample_rate);
-    _file_thread.spawn();
-    
-    return (_state);
+    return client_state::Running;
   }
-  
+
   /*
    * JACK calls this shutdown_callback if the server ever shuts down or
    * decides to disconnect the client.
@@ -340,19 +573,223 @@ namespace jack {
   void client::shutdown() {
     _state = client_state::ShuttingDown;
     std::cerr << "I> Shutdown called" << std::endl;
+
+    // The supervisor reconnects from the main thread
+    const std::uint64_t one = 1u;
+    if ((_shutdown_fd >= 0) &&
+        (write(_shutdown_fd,&one,sizeof(one)) != ssize_t(sizeof(one)))) {
+      std::cerr << "E> Unable to notify the shutdown" << std::endl;
+    }
+  }
+
+  void client::set_client_name(const std::string& name) {
+    _client_name = name;
+  }
+
+  void client::set_connections(const port_connections& connections) {
+    _connections = connections;
+  }
+
+  int client::graph_fd() const {
+    return _graph_fd;
+  }
+
+  void client::port_registered() {
+    // jack must not be called from its callbacks: the main thread connects
+    const std::uint64_t one = 1u;
+    if ((_graph_fd >= 0) &&
+        (write(_graph_fd,&one,sizeof(one)) != ssize_t(sizeof(one)))) {
+      std::cerr << "E> Unable to notify a new port" << std::endl;
+    }
+  }
+
+  void client::connect_ports() {
+    std::uint64_t count = 0u;
+    if ((_graph_fd >= 0) &&
+        (read(_graph_fd,&count,sizeof(count)) != ssize_t(sizeof(count)))) {
+      count = 0u;
+    }
+    if ((_client_ptr == nullptr) || (_state != client_state::Running) ||
+        _connections.empty()) {
+      return;
+    }
+    const std::size_t n =
+      _connections.apply(_client_ptr,_input_port,_output_port);
+    if (n > 0u) {
+      std::cerr << "I> " << n << " new port connection(s)" << std::endl;
+    }
+  }
+
+  int client::shutdown_fd() const {
+    return _shutdown_fd;
+  }
+
+  void client::set_reconnect(const bool reconnect) {
+    _reconnect = reconnect;
+  }
+
+  void client::set_fast_start(std::function<void()> pending) {
+    _fast_start = true;
+    _pending_setup = std::move(pending);
+  }
+
+  bool client::supervise() {
+    std::uint64_t count = 0u;
+    if ((_shutdown_fd >= 0) &&
+        (read(_shutdown_fd,&count,sizeof(count)) != ssize_t(sizeof(count)))) {
+      count = 0u;
+    }
+
+    if (_state != client_state::ShuttingDown) {
+      return true;
+    }
+    if (!_reconnect) {
+      return false;
+    }
+    reconnect();
+    return true;
+  }
+
+  bool client::reconnect() {
+    const auto begin = std::chrono::steady_clock::now();
+
+    if (_client_ptr != nullptr) {
+      // The old connection is dead: it only has to be released
+      jack_client_close(_client_ptr);
+      _client_ptr = nullptr;
+      _input_port = nullptr;
+      _output_port = nullptr;
+      _down_since = begin;
+      std::cerr << "I> Waiting for the JACK server to come back" << std::endl;
+    }
+
+    const jack_nframes_t sample_rate = _sample_rate;
+    const jack_nframes_t buffer_size = _buffer_size;
+    
+    if (!open_jack(true)) {
+      if (_client_ptr != nullptr) {
+        jack_client_close(_client_ptr);
+        _client_ptr = nullptr;
+      }
+      return false;
+    }
+
+    // The new server may run with another format.  process() is not
+    // running yet, so everything that depends on it is rebuilt here: the
+    // file blocks must hold a whole period, and the fades and the time
+    // constants of the compressor and the meter depend on the rate
+    if ((_sample_rate != sample_rate) || (_buffer_size != buffer_size)) {
+      std::cerr << "I> The server now runs at " << _sample_rate << " Hz with "
+                << _buffer_size << " frames per period" << std::endl;
+      _stats.set_format(_sample_rate,_buffer_size);
+      if (_watchdog.active()) {
+        start_watchdog();
+      }
+      prepare_mix();
+
+      // The files being played go on from the frame heard last
+      _file_thread.suspend();
+      _file_thread.init(_buffer_size,_sample_rate,10,_arena_options);
+      _file_thread.spawn();
+    }
+
+    if (activate_jack() != client_state::Running) {
+      // The next tick of the supervisor tries again
+      jack_client_close(_client_ptr);
+      _client_ptr = nullptr;
+      _input_port = nullptr;
+      _output_port = nullptr;
+      return false;
+    }
+    _state = client_state::Running;
+
+    const auto end = std::chrono::steady_clock::now();
+    std::cerr << "I> Reconnected to JACK after "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   end - _down_since).count() << " ms ("
+              << std::chrono::duration_cast<std::chrono::microseconds>(
+                   end - begin).count() << " us to reconnect)" << std::endl;
+    return true;
   }
 
   void client::stop() {
-    jack_deactivate(_client_ptr);
+    _file_thread.stop();
+    if (_client_ptr != nullptr) {
+      jack_deactivate(_client_ptr);
+    }
+    _recorder.close();
+    _output_stream.stop();
+    if (_file_thread.late_starts() > 0u) {
+      std::cerr << "I> " << _file_thread.late_starts()
+                << " scheduled files started late" << std::endl;
+    }
+    if (_metering) {
+      report_loudness(std::cerr);
+    }
     _state = client_state::Stopped;
   }
 
+  int client::file_notify_fd() const {
+    return _file_thread.notify_fd();
+  }
+
+  std::size_t client::finished_files() {
+    return _file_thread.finished_files();
+  }
+
+  bool client::files_idle() {
+    return _file_thread.idle();
+  }
+
+  void client::report_stats(std::ostream& os) const {
+    if (_client_ptr != nullptr) {
+      os << "I> DSP load " << jack_cpu_load(_client_ptr) << "%";
+    } else {
+      os << "I> Waiting for the JACK server";
+    }
+    if (_xruns.load() > 0u) {
+      os << ", xruns " << _xruns.load();
+    }
+    if (_file_thread.prefetch_misses() > 0u) {
+      os << ", prefetch misses " << _file_thread.prefetch_misses();
+    }
+    if (_watchdog.active()) {
+      os << ", quality level " << _quality << "/"
+         << _watchdog.levels() - 1u;
+    }
+    if (_silent_cycles.load() > 0u) {
+      os << ", silent cycles skipped " << _silent_cycles.load();
+    }
+    if (_compress) {
+      os << ", gain reduction " << _compressor.gain_reduction_db() << " dB";
+    }
+    if (_metering) {
+      os << ", loudness " << _meter.short_term() << " LUFS";
+    }
+    if (_file_thread.late_starts() > 0u) {
+      os << ", late starts " << _file_thread.late_starts();
+    }
+    if (_output_stream.active()) {
+      os << ", output " << _output_stream.written() << " samples ("
+         << _output_stream.dropped() << " dropped)";
+    }
+    if (_counters.valid()) {
+      // Since the last report
+      const perf_counters::totals now = _counters.read_totals();
+      os << ", ";
+      perf_counters::report(os,now,_reported_counters,_counters);
+      _reported_counters = now;
+    }
+    os << std::endl;
+  }
+
   void client::set_sample_rate(const jack_nframes_t sample_rate) {
     
     std::cout << "I> Sample rate changed from " << _sample_rate
               << " to " << sample_rate << std::endl;
     
     _sample_rate = sample_rate;
+    _stats.set_format(_sample_rate,_buffer_size);
   }
   
   void client::set_buffer_size(const jack_nframes_t buffer_size) {
@@ -361,6 +798,7 @@ namespace jack {
               << " to " << buffer_size << std::endl;
 
     _buffer_size = buffer_size; 
+    _stats.set_format(_sample_rate,_buffer_size);
   }
 
   jack_port_t* client::input_port() const {
@@ -371,8 +809,116 @@ namespace jack {
     return _output_port;
   }
 
-  bool client::add_file(const std::filesystem::path& f) {
-    return _file_thread.append_file(f);
+  void client::set_arena_options(const unsigned int options) {
+    _arena_options = options;
+  }
+
+  bool client::add_file(const std::filesystem::path& f,
+                        const sndfile_thread::loop_region& loop) {
+    return _file_thread.append_file(f,loop);
+  }
+
+  void client::seek_file(const std::size_t frame) {
+    _file_thread.seek(frame);
+  }
+
+  void client::set_file_loop(const sndfile_thread::loop_region& loop) {
+    _file_thread.set_loop(loop);
+  }
+
+  void client::set_stream_format(const pcm_format& raw,
+                                 const double jitter_ms) {
+    _file_thread.set_stream_format(raw,jitter_ms);
+  }
+
+  bool client::add_voice(const std::filesystem::path& f,
+                         const float gain,
+                         const float pan,
+                         const sndfile_thread::loop_region& loop) {
+    return _file_thread.add_voice(f,gain,pan,false,0u,loop);
+  }
+
+  bool client::schedule_voice(const std::filesystem::path& f,
+                              const float gain,
+                              const float pan,
+                              const jack_nframes_t start,
+                              const sndfile_thread::loop_region& loop) {
+    return _file_thread.add_voice(f,gain,pan,true,start,loop);
+  }
+
+  bool client::post(const rt_command& cmd) {
+    if (_state != client_state::Running) {
+      // jack's process is not running: apply it right away
+      _rt_commands.push(cmd);
+      apply_commands();
+      collect_garbage();
+      return true;
+    }
+    return _rt_commands.push(cmd);
+  }
+  
+  bool client::set_live_gain(const float gain) {
+    rt_command cmd;
+    cmd.what = rt_command::type::LiveGain;
+    cmd.value = gain;
+    return post(cmd);
+  }
+
+  bool client::set_bypass(const bool bypass) {
+    rt_command cmd;
+    cmd.what = rt_command::type::Bypass;
+    cmd.value = bypass ? 1.0f : 0.0f;
+    return post(cmd);
+  }
+
+  bool client::set_coefficients(const filter_coefficients& coefficients) {
+    // Make sure there is room for the coefficients this one replaces
+    collect_garbage();
+    if (_retired.writable() <= _rt_commands.readable()) {
+      return false;
+    }
+    
+    rt_command cmd;
+    cmd.what = rt_command::type::Coefficients;
+    cmd.coefficients = new filter_coefficients(coefficients);
+    if (!post(cmd)) {
+      delete cmd.coefficients;
+      return false;
+    }
+    return true;
+  }
+
+  void client::collect_garbage() {
+    filter_coefficients* old = nullptr;
+    while (_retired.pop(old)) {
+      delete old;
+    }
+  }
+
+  void client::apply_commands() {
+    rt_command cmd;
+    while (_rt_commands.pop(cmd)) {
+      _recorder.command(std::uint32_t(cmd.what),cmd.value,cmd.coefficients);
+      switch (cmd.what) {
+      case rt_command::type::Bypass:
+        _bypass = (cmd.value != 0.0f);
+        break;
+      case rt_command::type::LiveGain:
+        _live_gain = cmd.value;
+        break;
+      case rt_command::type::Quality:
+        set_quality_level(std::size_t(cmd.value));
+        break;
+      case rt_command::type::Coefficients:
+        // Never delete here: the main thread does it
+        if ((_coefficients == nullptr) || _retired.push(_coefficients)) {
+          _coefficients = cmd.coefficients;
+        } else {
+          _retired.push(cmd.coefficients);
+        }
+        break;
+      }
+    }
   }
 
   bool client::stop_files() {
@@ -380,8 +926,735 @@ namespace jack {
   }
 
   
-  sndfile_thread::file_block* client::next_file_block() {
-    return _file_thread.next_block();
+  bool client::schedule_file(const std::filesystem::path& f,
+                             const jack_nframes_t start,
+                             const sndfile_thread::loop_region& loop) {
+    return _file_thread.schedule_file(f,start,loop);
+  }
+
+  jack_nframes_t client::frame_time() const {
+    return (_client_ptr != nullptr) ? jack_frame_time(_client_ptr) : 0u;
+  }
+
+  jack_nframes_t client::cycle_start() const {
+    return _replay.active ? _replay.frame_time
+                          : jack_last_frame_time(_client_ptr);
+  }
+  
+  sndfile_thread::file_block*
+  client::next_file_block(const jack_nframes_t cycle) {
+    return voice_block(0u,cycle);
+  }
+
+  sndfile_thread::file_block*
+  client::voice_block(const std::size_t voice,const jack_nframes_t cycle) {
+    if (_replay.active) {
+      sndfile_thread::file_block* block = _replay.blocks[voice];
+      _replay.blocks[voice] = nullptr;
+      return block;
+    }
+    
+    sndfile_thread::file_block* block = _file_thread.next_block(voice,cycle);
+    if (block != nullptr) {
+      _recorder.block(std::uint32_t(voice),*block);
+    }
+    return block;
+  }
+
+  void client::mix_live(sndfile_thread::file_block* block,
+                        const sample_t* in,
+                        const jack_nframes_t nframes) {
+    if ((_live_gain >= 0.0f) && (block->size() >= nframes)) {
+      mix_add(block->begin() + block->live,in + block->live,_live_gain,
+              nframes - block->live);
+    }
+  }
+
+  void client::set_crossfade(const double ms) {
+    _crossfade_ms = std::max(0.0,ms);
+  }
+
+  bool client::settled(const float) const {
+    return false;
+  }
+
+  std::size_t client::quality_levels() const {
+    return 1u;
+  }
+
+  void client::set_quality(const std::size_t) {
+  }
+
+  void client::set_silence_threshold(const float threshold) {
+    _silence_threshold = threshold;
+  }
+
+  void client::set_compressor(const compressor::settings& settings) {
+    _compressor_settings = settings;
+    _compress = true;
+  }
+
+  void client::set_loudness_meter(const bool enable) {
+    _metering = enable;
+  }
+
+  void client::report_loudness(std::ostream& os) const {
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1)
+         << "I> Loudness: momentary " << _meter.momentary()
+         << " LUFS, short-term " << _meter.short_term()
+         << " LUFS, integrated " << _meter.integrated()
+         << " LUFS, true peak " << _meter.true_peak() << " dBTP";
+    os << line.str() << std::endl;
+  }
+
+  bool client::silent(const sample_t* in,const jack_nframes_t nframes) {
+    if ((_silence_threshold < 0.0f) ||
+        !mix_silent(in,nframes,_silence_threshold) ||
+        !settled(_silence_threshold)) {
+      return false;
+    }
+    _silent_cycles.fetch_add(1u,std::memory_order_relaxed);
+    return true;
+  }
+  
+  void client::fade_to(const fade_state target) {
+    const std::size_t len = _fade_in.size();
+    
+    if (target == fade_state::FadingIn) {
+      if (_fade == fade_state::Live) {
+        _fade_pos = 0u;
+      } else if (_fade == fade_state::FadingOut) {
+        // Reverse at the same gains: the curves mirror each other
+        _fade_pos = len - std::min(_fade_pos,len);
+      } else {
+        return;
+      }
+    } else {
+      if (_fade == fade_state::File) {
+        _fade_pos = 0u;
+      } else if (_fade == fade_state::FadingIn) {
+        _fade_pos = len - std::min(_fade_pos,len);
+      } else {
+        return;
+      }
+    }
+    _fade = target;
+  }
+  
+  void client::crossfade(sample_t* file,
+                         const sample_t* live,
+                         std::size_t from,
+                         const std::size_t to) {
+    const std::size_t len = _fade_in.size();
+    
+    while (from < to) {
+      switch (_fade) {
+      case fade_state::Live: {
+        memcpy(file + from,live + from,sizeof(sample_t)*(to - from));
+        return;
+      }
+      case fade_state::File: {
+        return;
+      }
+      default: {
+        if (_fade_pos >= len) {
+          _fade = (_fade == fade_state::FadingIn) ? fade_state::File
+                                                  : fade_state::Live;
+          continue;
+        }
+        const std::size_t n = std::min(to - from,len - _fade_pos);
+        if (_fade == fade_state::FadingIn) {
+          mix_crossfade(file + from,
+                        file + from,_fade_in.data() + _fade_pos,
+                        live + from,_fade_out.data() + _fade_pos,n);
+        } else {
+          mix_crossfade(file + from,
+                        file + from,_fade_out.data() + _fade_pos,
+                        live + from,_fade_in.data() + _fade_pos,n);
+        }
+        _fade_pos += n;
+        from += n;
+      }
+      }
+    }
+  }
+
+  void client::crossfade(sndfile_thread::file_block* block,
+                         const sample_t* in,
+                         const jack_nframes_t nframes) {
+    sample_t *const file = block->begin();
+    const std::size_t n = std::min(std::size_t(nframes),block->size());
+    std::size_t i = 0u;
+
+    if (block->first) {
+      // The previous file ended without its fade (e.g. its length was
+      // unknown): its samples are silent now
+      fade_to(fade_state::FadingOut);
+      crossfade(file,in,0u,block->live);
+      i = block->live;
+      fade_to(fade_state::FadingIn);
+    } else if ((_fade == fade_state::Live) && (block->frames > 0u) &&
+               (block->fade_out != 0u)) {
+      // The file continues after its fade (e.g. after a seek)
+      fade_to(fade_state::FadingIn);
+    }
+
+    const std::size_t end = std::min(n,block->live + block->frames);
+    
+    if ((block->fade_out >= i) && (block->fade_out < end)) {
+      crossfade(file,in,i,block->fade_out);
+      i = block->fade_out;
+      fade_to(fade_state::FadingOut);
+    }
+
+    if (end < n) {
+      // End of the file: the padding is silent
+      crossfade(file,in,i,end);
+      i = end;
+      fade_to(fade_state::FadingOut);
+    }
+
+    crossfade(file,in,i,n);
+  }
+
+  const client::sample_t* client::fade_to_live(const sample_t* in,
+                                               const jack_nframes_t nframes) {
+    if (nframes > _mix_buffer.size()) {
+      _fade = fade_state::Live;
+      return in;
+    }
+    
+    // Without blocks the file is silent
+    fade_to(fade_state::FadingOut);
+    sample_t *const mix = _mix_buffer.data();
+    std::fill(mix,mix + nframes,0.0f);
+    crossfade(mix,in,0u,nframes);
+    
+    return mix;
+  }
+  
+  const client::sample_t* client::mix_voices(const sample_t* in,
+                                             const jack_nframes_t nframes,
+                                             const jack_nframes_t cycle) {
+    if (nframes > _mix_buffer.size()) {
+      return in; // the buffer size changed, voices are not mixed
+    }
+
+    sample_t *const mix = _mix_buffer.data();
+    const sample_t* result = in;
+    
+    for (std::size_t v=1;v<sndfile_thread::max_voices;++v) {
+      sndfile_thread::file_block* block = voice_block(v,cycle);
+      if (block == nullptr) {
+        continue;
+      }
+      if (block->size() >= nframes) {
+        if ((result == in) && (in != mix)) {
+          memcpy(mix,in,sizeof(sample_t)*nframes);
+        }
+        result = mix;
+        mix_add(mix,block->begin(),block->gain,nframes);
+      }
+      block->status = sndfile_thread::Status::Garbage;
+    }
+
+    return result;
+  }
+
+  void client::set_shm_source(const std::string& name,
+                              const std::size_t capacity) {
+    _shm_name = name;
+    _shm_capacity = capacity;
+  }
+
+  const client::sample_t*
+  client::next_shm_block(const jack_nframes_t nframes) {
+    if (_replay.active) {
+      const sample_t* samples = _replay.shm;
+      _replay.shm = nullptr;
+      return samples;
+    }
+    
+    const sample_t* samples =
+      _shm_source.valid() ? _shm_source.peek(nframes) : nullptr;
+    if (samples != nullptr) {
+      _recorder.shm(samples,nframes);
+    }
+    return samples;
+  }
+
+  void client::release_shm_block(const jack_nframes_t nframes) {
+    if (!_replay.active) {
+      _shm_source.consume(nframes);
+    }
+  }
+
+  void client::set_output_stream(const std::filesystem::path& target,
+                                 const pcm_format& fmt) {
+    _output_target = target;
+    _output_format = fmt;
+  }
+
+  void client::stream_output(const sample_t* out,
+                             const jack_nframes_t nframes) {
+    if (_output_stream.active()) {
+      if (_replay.active) {
+        _output_stream.push_wait(out,nframes); // nothing may be dropped
+      } else {
+        _output_stream.push(out,nframes);
+      }
+    }
+  }
+
+  void client::start_output_stream() {
+    // One second of audio is buffered for the writer thread
+    if (!_output_target.empty()) {
+      if (_output_stream.open(_output_target,_output_format,_sample_rate)) {
+        _output_stream.spawn();
+      } else {
+        std::cerr << "E> Unable to open output stream " << _output_target
+                  << std::endl;
+      }
+    }
+  }
+
+  void client::prepare_mix() {
+    // Equal-power crossfade curves between the live input and the files
+    const std::size_t len =
+      std::size_t(_crossfade_ms*1e-3*double(_sample_rate) + 0.5);
+    _fade_in.resize(len);
+    _fade_out.resize(len);
+    for (std::size_t i=0;i<len;++i) {
+      const double angle = M_PI_2*(double(i) + 0.5)/double(len);
+      _fade_in[i]  = sample_t(std::sin(angle));
+      _fade_out[i] = sample_t(std::cos(angle));
+    }
+    _fade = fade_state::Live;
+    _file_thread.set_fade_length(len);
+
+    _mix_buffer.assign(_buffer_size,0.0f);
+
+    // The time constants depend on the sampling rate
+    if (_compress) {
+      _compressor.configure(_compressor_settings,double(_sample_rate));
+      std::cerr << "I> Compressor at " << _compressor_settings.threshold_db
+                << " dBFS, ratio " << _compressor_settings.ratio << ", "
+                << _compressor.latency() << " frames of lookahead"
+                << std::endl;
+    }
+    if (_metering) {
+      _meter.configure(double(_sample_rate));
+    }
+  }
+  
+  void client::set_stats_segment(const std::string& name) {
+    _stats_name = name;
+  }
+
+  void client::publish_cycle(const jack_nframes_t nframes,
+                             const stats_segment::stage_clock& clock,
+                             const sample_t* in,
+                             const sample_t* out) {
+    stats_segment::loudness loudness{};
+    if (_metering && _stats.valid()) {
+      loudness.active = 1u;
+      loudness.momentary = _meter.momentary();
+      loudness.short_term = _meter.short_term();
+      loudness.integrated = _meter.integrated();
+      loudness.true_peak = _meter.true_peak();
+    }
+    _stats.publish_cycle(nframes,clock,in,out,_counters,
+                         _silent_cycles.load(std::memory_order_relaxed),
+                         _compress ? _compressor.gain_reduction_db() : -1.0f,
+                         _metering ? &loudness : nullptr);
+  }
+
+  void client::xrun() {
+    const std::size_t count = _xruns.fetch_add(1u,std::memory_order_relaxed);
+    _stats.count_xrun();
+    tracer::instant(tracer::Xrun,std::uint32_t(count + 1u));
+  }
+
+  void client::set_perf_counters(const bool enable) {
+    _count_perf = enable;
+  }
+
+  void client::init_thread() {
+    tracer::name_thread("jack process");
+    if (_count_perf) {
+      _counters.open();
+    }
+  }
+
+  void client::trace_period() const {
+    jack_nframes_t frames = 0u;
+    jack_time_t current_us = 0u, next_us = 0u;
+    float period_us = 0.0f;
+    if ((_client_ptr != nullptr) &&
+        (jack_get_cycle_times(_client_ptr,&frames,&current_us,&next_us,
+                              &period_us) == 0)) {
+      tracer::instant_at(tracer::Period,std::uint64_t(current_us)*1000u,
+                         frames);
+    } else {
+      tracer::instant(tracer::Period,cycle_start());
+    }
+  }
+  
+  void client::set_record_file(const std::filesystem::path& file) {
+    _record_file = file;
+  }
+
+  void client::start_recording() {
+    session_log::header hdr{};
+    hdr.sample_rate = _sample_rate;
+    hdr.buffer_size = _buffer_size;
+    hdr.crossfade_ms = _crossfade_ms;
+    if (!_recorder.open(_record_file,hdr)) {
+      return;
+    }
+
+    // The state set before jack's process started
+    _recorder.command(std::uint32_t(rt_command::type::Bypass),
+                      _bypass ? 1.0f : 0.0f,nullptr);
+    _recorder.command(std::uint32_t(rt_command::type::LiveGain),
+                      _live_gain,nullptr);
+    if (_coefficients != nullptr) {
+      _recorder.command(std::uint32_t(rt_command::type::Coefficients),
+                        0.0f,_coefficients);
+    }
+  }
+
+  void client::begin_cycle(const jack_nframes_t nframes,
+                           const jack_nframes_t cycle,
+                           const sample_t* in) {
+    if (_recorder.active()) {
+      _recorder.begin_cycle(_cycle_index,cycle,nframes,
+                            _sample_rate,_buffer_size,in);
+    }
+    ++_cycle_index;
+  }
+
+  void client::end_cycle(const sample_t* out,const jack_nframes_t nframes) {
+    if (_recorder.active()) {
+      _recorder.end_cycle(out,nframes);
+    }
+  }
+
+  bool client::replay(const std::filesystem::path& file) {
+    session_player log;
+    if (!log.open(file)) {
+      return false;
+    }
+
+    const session_log::header& hdr = log.header();
+    _crossfade_ms = hdr.crossfade_ms;
+    begin_offline(hdr.sample_rate,hdr.buffer_size);
+    start_output_stream();
+
+    std::cerr << "I> Replaying " << file << " at " << _sample_rate
+              << " Hz with " << _buffer_size << " frames" << std::endl;
+
+    // Samples of the cycle being replayed
+    std::vector<sample_t> input, shm, out;
+    std::array<std::vector<sample_t>,sndfile_thread::max_voices> samples;
+    std::array<sndfile_thread::file_block,sndfile_thread::max_voices> blocks;
+    voice_blocks cycle_blocks{};
+    const sample_t* cycle_shm = nullptr;
+    jack_nframes_t nframes = 0u;
+    jack_nframes_t frame_time = 0u;
+
+    std::uint64_t cycles = 0u, mismatches = 0u, first_mismatch = 0u;
+    bool ok = true;
+
+    auto floats = [](const std::vector<char>& payload,std::size_t offset,
+                     std::vector<sample_t>& dst) {
+      dst.resize((payload.size() - offset)/sizeof(sample_t));
+      memcpy(dst.data(),payload.data() + offset,
+             dst.size()*sizeof(sample_t));
+    };
+    
+    session_player::record r;
+
+    // Copy the fixed part of the record, if the payload holds it
+    auto fixed = [&r](void* dst,const std::size_t size) {
+      if (r.payload.size() < size) {
+        std::cerr << "E> Truncated record in the session log" << std::endl;
+        return false;
+      }
+      memcpy(dst,r.payload.data(),size);
+      return true;
+    };
+    
+    while (ok && log.next(r)) {
+      const char* payload = r.payload.data();
+      const std::size_t size = r.payload.size();
+      
+      switch (r.type) {
+      case session_log::record_type::Format: {
+        session_log::format_record fmt;
+        if (!fixed(&fmt,sizeof(fmt))) {
+          ok = false;
+          break;
+        }
+        if (fmt.sample_rate != _sample_rate) {
+          set_sample_rate(fmt.sample_rate);
+        }
+        if (fmt.buffer_size != _buffer_size) {
+          set_buffer_size(fmt.buffer_size);
+        }
+      } break;
+      case session_log::record_type::Cycle: {
+        session_log::cycle_record c;
+        if (!fixed(&c,sizeof(c))) {
+          ok = false;
+          break;
+        }
+        nframes = c.nframes;
+        _cycle_index = c.index;
+        frame_time = c.frame_time;
+      } break;
+      case session_log::record_type::Command: {
+        session_log::command_record c;
+        if (!fixed(&c,sizeof(c))) {
+          ok = false;
+          break;
+        }
+        rt_command cmd;
+        cmd.what = rt_command::type(c.what);
+        cmd.value = c.value;
+        if (cmd.what == rt_command::type::Coefficients) {
+          // Each row is its length and its values, all in the payload
+          std::size_t offset = sizeof(c);
+          ok = (c.rows <= (size - offset)/sizeof(std::uint32_t));
+          cmd.coefficients = new filter_coefficients(ok ? c.rows : 0u);
+          for (auto& row : *cmd.coefficients) {
+            std::uint32_t len;
+            if (size - offset < sizeof(len)) {
+              ok = false;
+              break;
+            }
+            memcpy(&len,payload + offset,sizeof(len));
+            offset += sizeof(len);
+            if (len > (size - offset)/sizeof(sample_t)) {
+              ok = false;
+              break;
+            }
+            row.resize(len);
+            memcpy(row.data(),payload + offset,len*sizeof(sample_t));
+            offset += len*sizeof(sample_t);
+          }
+          if (!ok) {
+            std::cerr << "E> Corrupt coefficients in the session log"
+                      << std::endl;
+            delete cmd.coefficients;
+            break;
+          }
+        }
+        // Applied at the beginning of the cycle, as when recorded
+        if (!_rt_commands.push(cmd)) {
+          delete cmd.coefficients;
+          ok = false;
+        }
+      } break;
+      case session_log::record_type::Input: {
+        floats(r.payload,0u,input);
+      } break;
+      case session_log::record_type::Block: {
+        session_log::block_record b;
+        if (!fixed(&b,sizeof(b))) {
+          ok = false;
+          break;
+        }
+        if (b.voice >= sndfile_thread::max_voices) {
+          std::cerr << "E> Block of an unknown voice in the session log"
+                    << std::endl;
+          ok = false;
+          break;
+        }
+        floats(r.payload,sizeof(b),samples[b.voice]);
+        sndfile_thread::file_block& block = blocks[b.voice];
+        block = sndfile_thread::file_block(samples[b.voice].data(),
+                                           samples[b.voice].size());
+        block.status   = sndfile_thread::Status::Playing;
+        block.gain     = b.gain;
+        block.live     = b.live;
+        block.frames   = b.frames;
+        block.first    = (b.first != 0u);
+        block.fade_out = (b.fade_out == 0xffffffffu) ?
+          sndfile_thread::file_block::no_fade : b.fade_out;
+        cycle_blocks[b.voice] = &block;
+      } break;
+      case session_log::record_type::Shm: {
+        floats(r.payload,0u,shm);
+        cycle_shm = shm.data();
+      } break;
+      case session_log::record_type::Output: {
+        session_log::output_record o;
+        if (!fixed(&o,sizeof(o))) {
+          ok = false;
+          break;
+        }
+        if (input.size() < nframes) {
+          std::cerr << "E> Cycle without its input in the session log"
+                    << std::endl;
+          ok = false;
+          break;
+        }
+        out.resize(nframes);
+        render_cycle(nframes,frame_time,input.data(),out.data(),
+                     cycle_blocks,cycle_shm);
+        if (_output_stream.active() && !_output_stream.alive()) {
+          std::cerr << "E> The output stream is gone: the replay stops"
+                    << std::endl;
+          ok = false;
+          break;
+        }
+        
+        if (session_log::hash(out.data(),nframes) != o.hash) {
+          if (mismatches++ == 0u) {
+            first_mismatch = _cycle_index - 1u;
+          }
+        }
+        ++cycles;
+        cycle_blocks.fill(nullptr);
+        cycle_shm = nullptr;
+      } break;
+      case session_log::record_type::Gap: {
+        session_log::gap_record g;
+        if (!fixed(&g,sizeof(g))) {
+          ok = false;
+          break;
+        }
+        std::cerr << "E> The recording lost " << g.cycles << " cycles "
+                  << "here: the replay stops" << std::endl;
+        ok = false;
+      } break;
+      default: {
+        std::cerr << "E> Unknown record in the session log" << std::endl;
+        ok = false;
+      }
+      }
+    }
+
+    end_offline();
+
+    std::cerr << "I> " << cycles << " cycles replayed";
+    if (mismatches > 0u) {
+      std::cerr << ", " << mismatches << " differ from the recording, "
+                << "first at cycle " << first_mismatch;
+    } else {
+      std::cerr << ", all outputs identical to the recording";
+    }
+    std::cerr << std::endl;
+    if (_metering) {
+      report_loudness(std::cerr);
+    }
+    
+    return ok && (mismatches == 0u);
+  }
+
+  void client::begin_offline(const jack_nframes_t sample_rate,
+                             const jack_nframes_t buffer_size) {
+    _sample_rate = sample_rate;
+    _buffer_size = buffer_size;
+    prepare_mix();
+
+    _replay = replay_sources();
+    _replay.active = true;
+  }
+
+  bool client::render_cycle(const jack_nframes_t nframes,
+                            const jack_nframes_t frame_time,
+                            const sample_t* in,
+                            sample_t* out,
+                            const voice_blocks& blocks,
+                            const sample_t* shm) {
+    _replay.frame_time = frame_time;
+    _replay.blocks = blocks;
+    _replay.shm = shm;
+
+    const bool ok = run_cycle(this,nframes,in,out);
+    collect_garbage();
+
+    _replay.blocks.fill(nullptr);
+    _replay.shm = nullptr;
+    return ok;
+  }
+
+  void client::end_offline() {
+    _replay.active = false;
+    _output_stream.stop();
+  }
+  
+  void client::set_watchdog(const load_watchdog::settings& settings,
+                            const bool may_bypass) {
+    _watchdog_settings = settings;
+    _watchdog_enabled = true;
+    _watchdog_bypass = may_bypass;
+  }
+
+  void client::start_watchdog() {
+    const std::size_t levels =
+      std::max<std::size_t>(quality_levels(),1u) + (_watchdog_bypass ? 1u : 0u);
+    if (levels < 2u) {
+      std::cerr << "E> The watchdog has nothing to degrade: process() has a "
+                << "single quality level, and may not be bypassed"
+                << std::endl;
+      return;
+    }
+    _watchdog.configure(_watchdog_settings,levels,
+                        double(_buffer_size)/double(_sample_rate));
+    std::cerr << "I> Watchdog: " << levels << " quality levels, degrading "
+              << "above " << 100.0f*_watchdog_settings.high << "% load and "
+              << "restoring below " << 100.0f*_watchdog_settings.low << "%"
+              << std::endl;
+  }
+  
+  void client::watch_load(const jack_nframes_t nframes,
+                          const std::uint64_t ns) {
+    if (!_watchdog.active() || (nframes == 0u)) {
+      return;
+    }
+    const double period_ns = 1e9*double(nframes)/double(_sample_rate);
+    _watchdog.update(float(double(ns)/period_ns));
+  }
+
+  void client::apply_quality() {
+    if (!_watchdog.active()) {
+      return;
+    }
+    const std::size_t level = _watchdog.level();
+    if (level != _quality) {
+      // Logged as a command, so that replays switch at the same cycle
+      _recorder.command(std::uint32_t(rt_command::type::Quality),
+                        float(level),nullptr);
+      set_quality_level(level);
+    }
+  }
+  
+  void client::set_quality_level(const std::size_t level) {
+    const std::size_t levels = std::max<std::size_t>(quality_levels(),1u);
+    _shed_process = (level >= levels);
+    set_quality(std::min(level,levels - 1u));
+    _quality = level;
+  }
+
+  void client::report_watchdog(std::ostream& os) {
+    const std::size_t levels = std::max<std::size_t>(quality_levels(),1u);
+    load_watchdog::transition t;
+    while (_watchdog.pop(t)) {
+      std::ostringstream line;
+      line << "I> Load " << std::fixed << std::setprecision(1)
+           << 100.0f*t.load << "% in cycle "
+           << t.cycle << ": quality "
+           << ((t.to > t.from) ? "degraded" : "restored")
+           << " from level " << t.from << " to " << t.to;
+      if (t.to >= levels) {
+        line << " (process() bypassed)";
+      }
+      os << line.str() << std::endl;
+    }
   }
   
 }
@@ -39,9 +39,24 @@
 #define _JACK_CLIENT_H
 
 #include <jack/jack.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <ostream>
+#include <vector>
 
+#include "compressor.h"
+#include "load_watchdog.h"
+#include "loudness_meter.h"
+#include "perf_counters.h"
+#include "port_connections.h"
+#include "session_log.h"
 #include "sndfile_thread.h"
+#include "shm_ring.h"
+#include "stream_writer.h"
+#include "spsc_ringbuffer.h"
+#include "stats_segment.h"
 
 
 namespace jack {
@@ -55,6 +70,10 @@ namespace jack {
     Error
   };
   
+  /// Second order sections of a filter, one row per section
+  typedef std::vector< std::vector<jack_default_audio_sample_t> >
+  filter_coefficients;
+
   /**
    * Jack client class
    *
@@ -68,17 +87,200 @@ namespace jack {
     
     /// Part of monostate 
     static jack_client_t* _client_ptr;
-    static client_state   _state;
+    /// Changed by jack's shutdown callback too
+    static std::atomic<client_state> _state;
 
     static jack_nframes_t _buffer_size;
     static jack_nframes_t _sample_rate;
 
     static sndfile_thread _file_thread;
+    static unsigned int   _arena_options;
+
+    /// Mix of the input and the file voices, allocated in init()
+    static std::vector<jack_default_audio_sample_t> _mix_buffer;
+    /// Gain of the live input under the playlist files, or < 0 to replace it
+    static float          _live_gain;
+
+    /// Source heard at the output, between the live input and the files
+    enum class fade_state {
+      Live,
+      FadingIn,  ///< from the live input to the files
+      File,
+      FadingOut  ///< from the files to the live input
+    };
+
+    /**
+     * Change of a parameter used by jack's process, sent from the other
+     * threads through a lock-free queue.
+     */
+    struct rt_command {
+      enum class type {
+        Bypass,
+        LiveGain,
+        Coefficients,
+        Quality         ///< set by the overload watchdog
+      } what = type::Bypass;
+      float value = 0.0f;
+      filter_coefficients* coefficients = nullptr;
+    };
+
+    /// Commands for jack's process, pushed only by the main thread
+    static spsc_ringbuffer<rt_command> _rt_commands;
+    /// Coefficients replaced in jack's process, deleted by the main thread
+    static spsc_ringbuffer<filter_coefficients*> _retired;
+    /// Coefficients used by jack's process
+    static filter_coefficients* _coefficients;
+    /// If true, jack's process copies the input to the output
+    static bool           _bypass;
+
+
+    /// Length of the crossfades in milliseconds
+    static double         _crossfade_ms;
+    /// Equal-power gain curves of the files, computed in init()
+    static std::vector<jack_default_audio_sample_t> _fade_in;
+    static std::vector<jack_default_audio_sample_t> _fade_out;
+    static fade_state     _fade;
+    /// Position in the curves of the current fade
+    static std::size_t    _fade_pos;
+
+    /// Start a fade in the given direction, continuing the current one
+    static void fade_to(const fade_state target);
+
+    /**
+     * Walk the fade state from sample from to sample to, mixing the file
+     * with the live input in place
+     */
+    static void crossfade(jack_default_audio_sample_t* file,
+                          const jack_default_audio_sample_t* live,
+                          std::size_t from,
+                          const std::size_t to);
+
+    static shm_ring       _shm_source;
+    static std::string    _shm_name;
+    static std::size_t    _shm_capacity;
+
+    static stream_writer  _output_stream;
+    static std::filesystem::path _output_target;
+    static pcm_format     _output_format;
+
+    /// Live statistics for other processes, if a name was given
+    static stats_segment  _stats;
+    static std::string    _stats_name;
+    /// xruns reported by jack
+    static std::atomic<std::size_t> _xruns;
+
+    /// Level below which process() may be skipped, or negative to never
+    static float          _silence_threshold;
+    /// Cycles whose process() was skipped
+    static std::atomic<std::uint64_t> _silent_cycles;
+
+    /// Dynamics of the output, if requested
+    static compressor     _compressor;
+    static compressor::settings _compressor_settings;
+    static bool           _compress;
+
+    /// Loudness of the output, if requested
+    static loudness_meter _meter;
+    static bool           _metering;
+
+    /// Name of the client in the jack graph
+    static std::string    _client_name;
+    /// How the ports are connected
+    static port_connections _connections;
+    /// eventfd signaled by jack when a port appears
+    static int            _graph_fd;
+
+    /// Reconnect after the server goes away, instead of giving up
+    static bool           _reconnect;
+
+    /// Spawn the file thread before activating jack (see set_fast_start())
+    static bool           _fast_start;
+    /// Work of other threads to be joined before the activation
+    static std::function<void()> _pending_setup;
+    /// eventfd signaled by jack's shutdown callback
+    static int            _shutdown_fd;
+    /// When the server went away
+    static std::chrono::steady_clock::time_point _down_since;
+
+    /// Overload watchdog, if requested
+    static load_watchdog  _watchdog;
+    static load_watchdog::settings _watchdog_settings;
+    static bool           _watchdog_enabled;
+    /// The watchdog may bypass process() as its last level
+    static bool           _watchdog_bypass;
+    /// Quality level in use
+    static std::size_t    _quality;
+    /// process() bypassed by the watchdog
+    static bool           _shed_process;
+
+    /// Log of the session for offline replays, if requested
+    static session_recorder _recorder;
+    static std::filesystem::path _record_file;
+    /// Cycles run so far
+    static std::uint64_t  _cycle_index;
+
+    /// Sources of the cycle being replayed, instead of jack and the files
+    struct replay_sources {
+      bool active = false;
+      jack_nframes_t frame_time = 0u;
+      std::array<sndfile_thread::file_block*,sndfile_thread::max_voices>
+      blocks{};
+      const jack_default_audio_sample_t* shm = nullptr;
+    };
+    static replay_sources _replay;
+
+    /// Open the session log and write the current state to it
+    void start_recording();
+
+    /// Open the output stream, if one was requested
+    void start_output_stream();
+
+    /// Compute the crossfade curves and allocate the mix buffer
+    void prepare_mix();
+
+    /**
+     * Open the jack client, set its callbacks and register its ports.
+     * When retrying, the server is not started and failures are silent.
+     */
+    bool open_jack(const bool retry);
+
+    /// Activate the client and connect its ports
+    client_state activate_jack();
+
+    /// Try to open the client again after a shutdown
+    bool reconnect();
+
+    /// Configure the watchdog with the quality levels of process()
+    void start_watchdog();
+
+    /// Use the given quality level, bypassing process() past its last one
+    void set_quality_level(const std::size_t level);
+
+    /**
+     * Get the next block of the given voice (0 for the playlist), from
+     * the file thread or from the replay, and log it if recording.
+     */
+    sndfile_thread::file_block* voice_block(const std::size_t voice,
+                                            const jack_nframes_t cycle);
+
+    /// Hardware counters of jack's thread around process(), if requested
+    static perf_counters  _counters;
+    static bool           _count_perf;
+    /// Totals at the last report_stats()
+    static perf_counters::totals _reported_counters;
     
   protected:
     
     static jack_port_t*   _input_port;
     static jack_port_t*   _output_port;
+
+    /**
+     * Filter coefficients to be used by process(), or nullptr if none
+     * were given.  They only change between two calls to process().
+     */
+    inline const filter_coefficients* coefficients() const {
+      return _coefficients;
+    }
     
   public:
     typedef jack_default_audio_sample_t sample_t;
@@ -100,7 +302,41 @@ namespace jack {
     virtual bool process(jack_nframes_t nframes,
                          const sample_t *const in,
                          sample_t *const out) = 0;
+
+    /**
+     * True if the state of process() has decayed below the given linear
+     * level, so that processing an input below that level would only
+     * produce silence (e.g. the tails of its filters have died out).
+     *
+     * While the input stays silent and this is true, jack's process
+     * writes zeros instead of calling process() (see
+     * set_silence_threshold()).  It is called from jack's realtime
+     * thread, so it must be cheap.  The default is false: a client that
+     * does not know its state is always processed.
+     */
+    virtual bool settled(const float threshold) const;
+
+    /**
+     * Number of quality levels of process(): 0 is the full quality, and
+     * each next level is cheaper (e.g. a shorter resampler, fewer FIR
+     * partitions, or optional stages bypassed).  The default is 1, a
+     * single level.
+     */
+    virtual std::size_t quality_levels() const;
+
+    /**
+     * Switch process() to the given quality level.  It is called by the
+     * overload watchdog from jack's realtime thread, between cycles, so
+     * it must not allocate nor block: the cheaper variants have to be
+     * ready beforehand.  The default does nothing.
+     */
+    virtual void set_quality(const std::size_t level);
     
+    /**
+     * Called by jack when the server shuts down or drops the client.  It
+     * marks the client as ShuttingDown and wakes up the supervisor (see
+     * shutdown_fd() and supervise()).
+     */
     virtual void shutdown();
 
     client& operator=(const client&) = delete; // not copyable
@@ -114,8 +350,98 @@ namespace jack {
     /**
      * Stop processing.  After calling this method, the application must
      * end, as no Jack client will be available anymore.
+     *
+     * The file thread is stopped first, then the client is deactivated
+     * and finally the output stream is flushed.
      */
     void stop();
+
+    /**
+     * File descriptor readable whenever a file finishes playing (see
+     * sndfile_thread::notify_fd())
+     */
+    int file_notify_fd() const;
+
+    /**
+     * Name of the client in the jack graph ("dsp1" by default).  jack may
+     * add a suffix if it is taken.  It has to be called before init().
+     */
+    void set_client_name(const std::string& name);
+
+    /**
+     * Connect the ports following these rules, instead of the default
+     * ones (see port_connections::physical()).  Without rules, nothing
+     * is connected.  It has to be called before init().
+     */
+    void set_connections(const port_connections& connections);
+
+    /**
+     * File descriptor readable when ports appear in the jack graph.  Then
+     * connect_ports() has to be called.
+     */
+    int graph_fd() const;
+
+    /**
+     * Apply the connection rules to the current jack graph.  Existing
+     * connections are kept.  It must not be called from jack's callbacks.
+     */
+    void connect_ports();
+
+    /// Called by jack when a port is registered
+    void port_registered();
+
+    /**
+     * File descriptor readable when jack shuts the client down.  Then
+     * supervise() has to be called.
+     */
+    int shutdown_fd() const;
+
+    /**
+     * Reconnect after the server restarts (see set_reconnect()).
+     *
+     * If jack shut the client down, the old connection is closed, and a
+     * new one is opened, with its ports registered and connected again,
+     * and the buffer size and sampling rate synchronized.  The file
+     * thread keeps its playlist and its prefetched blocks meanwhile, so
+     * the files resume at the frame where they stopped.  If the server
+     * is not back yet, it has to be called again later, e.g. from a
+     * timer.
+     *
+     * It must be called by the thread that called init().  Returns false
+     * if the client is down and will not reconnect.
+     */
+    bool supervise();
+
+    /**
+     * Let supervise() reconnect after a shutdown (the default), or give
+     * up.
+     */
+    void set_reconnect(const bool reconnect);
+
+    /**
+     * Start faster: init() spawns the file thread as soon as jack told
+     * the buffer size, so that the first file is opened and prefetched
+     * while the rest of the client is set up, and the first cycle already
+     * plays it.
+     *
+     * The given function is called by init() right before the
+     * activation, to join the work that the caller runs meanwhile in
+     * other threads (e.g. adding the files or loading the coefficients).
+     * Its exceptions leave init().  It must be called before init().
+     */
+    void set_fast_start(std::function<void()> pending);
+
+    /// Current state
+    inline client_state state() const {return _state;}
+
+    /// Number of files finished since the last call
+    std::size_t finished_files();
+
+    /// True if no file is playing nor waiting to be played
+    bool files_idle();
+
+    /// Print the current statistics of the client in one line
+    void report_stats(std::ostream& os) const;
     
     void set_sample_rate(const jack_nframes_t sample_rate);
     void set_buffer_size(const jack_nframes_t buffer_size);
@@ -135,9 +461,97 @@ namespace jack {
 
 
     /**
-     * Add file to playlist
+     * Set the block_arena options used to allocate the file blocks.
+     *
+     * It has to be called before init() to have any effect.
+     */
+    void set_arena_options(const unsigned int options);
+
+    /**
+     * Add file to playlist, optionally looping a region of it
+     */
+    bool add_file(const std::filesystem::path& file,
+                  const sndfile_thread::loop_region& loop =
+                  sndfile_thread::loop_region());
+
+    /**
+     * Play a file in its own voice, mixed with the input or the playlist
+     * files, with the given linear gain and stereo balance in [-1,1] (see
+     * sndfile_thread::add_voice()).
+     *
+     * Returns false if the file does not exist or all voices are busy.
+     */
+    bool add_voice(const std::filesystem::path& file,
+                   const float gain,
+                   const float pan,
+                   const sndfile_thread::loop_region& loop =
+                   sndfile_thread::loop_region());
+
+    /**
+     * Play a file in its own voice starting exactly at the given jack
+     * frame time.
+     */
+    bool schedule_voice(const std::filesystem::path& file,
+                        const float gain,
+                        const float pan,
+                        const jack_nframes_t start,
+                        const sndfile_thread::loop_region& loop =
+                        sndfile_thread::loop_region());
+
+    /**
+     * Mix the live input with the given linear gain under the playlist
+     * files, instead of replacing it.  A negative gain replaces it.
+     *
+     * While running, the change is sent to jack's process without locks.
+     * Returns false if the command queue is full.
+     */
+    bool set_live_gain(const float gain);
+
+    /**
+     * Copy the input to the output, without calling process().
+     * Returns false if the command queue is full.
+     */
+    bool set_bypass(const bool bypass);
+
+    /**
+     * Replace the filter coefficients used by process() (see
+     * coefficients()).  Returns false if the command queue is full.
+     */
+    bool set_coefficients(const filter_coefficients& coefficients);
+
+    /**
+     * Delete the coefficients that jack's process does not use anymore.
+     * It is called by the main thread.
+     */
+    void collect_garbage();
+
+    /**
+     * Apply the commands sent to jack's process.  It is called at the
+     * beginning of each cycle.
+     */
+    void apply_commands();
+
+  private:
+    /// Send a command to jack's process, or apply it if not running
+    bool post(const rt_command& cmd);
+
+  public:
+
+    /**
+     * Move the file being played to the given frame
      */
-    bool add_file(const std::filesystem::path& file);
+    void seek_file(const std::size_t frame);
+
+    /**
+     * Change the loop of the file being played
+     */
+    void set_file_loop(const sndfile_thread::loop_region& loop);
+
+    /**
+     * Set the format of streams without WAV header, and their jitter
+     * buffer in milliseconds
+     */
+    void set_stream_format(const pcm_format& raw,const double jitter_ms);
 
     /**
      * Stop playing files
@@ -145,9 +559,284 @@ namespace jack {
     bool stop_files();
     
     /**
-     * Get the next block from the current file
+     * Add file to the playlist, to start exactly at the given jack frame
+     * time (see frame_time())
+     */
+    bool schedule_file(const std::filesystem::path& file,
+                       const jack_nframes_t start,
+                       const sndfile_thread::loop_region& loop =
+                       sndfile_thread::loop_region());
+
+    /**
+     * Current estimate of jack's frame time.  Add an offset to it to
+     * schedule a file.
+     */
+    jack_nframes_t frame_time() const;
+
+    /**
+     * Frame time of the first frame of the current cycle.  It is only
+     * meaningful when called from process().
+     */
+    jack_nframes_t cycle_start() const;
+    
+    /**
+     * Get the next block from the current file, for the cycle starting at
+     * the given frame time
+     */
+    sndfile_thread::file_block* next_file_block(const jack_nframes_t cycle);
+
+    /**
+     * Add the live input to the playlist block, if set_live_gain() asked
+     * for it
+     */
+    void mix_live(sndfile_thread::file_block* block,
+                  const sample_t* in,
+                  const jack_nframes_t nframes);
+    
+    /**
+     * Set the length of the crossfades between the live input and the
+     * playlist files.  It has to be called before init().
+     */
+    void set_crossfade(const double ms);
+
+    /**
+     * Skip process() and write silence while no sample of its input
+     * exceeds the given linear level and settled() is true.  A negative
+     * level disables it.  It has to be called before init().
+     */
+    void set_silence_threshold(const float threshold);
+
+    /**
+     * True if process() can be skipped for this input, counting the
+     * skipped cycles.
+     */
+    bool silent(const sample_t* in,const jack_nframes_t nframes);
+
+    /**
+     * Compress (or limit) the output of process() in place, after
+     * set_compressor().  The lookahead delays the output.
+     */
+    void set_compressor(const compressor::settings& settings);
+
+    /// Apply the compressor to the output, if there is one
+    inline void compress(sample_t* out,const jack_nframes_t nframes) {
+      if (_compress) {
+        _compressor.process(out,out,nframes);
+      }
+    }
+
+    /**
+     * Measure the loudness of the output after EBU R128, shown in the
+     * statistics and at the end of replays.  It has to be called before
+     * init().
+     */
+    void set_loudness_meter(const bool enable);
+
+    /// Feed the output to the loudness meter, if there is one
+    inline void measure(const sample_t* out,const jack_nframes_t nframes) {
+      if (_metering) {
+        _meter.process(out,nframes);
+      }
+    }
+
+    /**
+     * Print the loudness measured so far: momentary, short-term and
+     * integrated loudness, and the true peak.
+     */
+    void report_loudness(std::ostream& os) const;
+
+    /**
+     * Crossfade the playlist block with the live input wherever a file
+     * starts or ends within it.
+     */
+    void crossfade(sndfile_thread::file_block* block,
+                   const sample_t* in,
+                   const jack_nframes_t nframes);
+
+    /// True if process() is skipped
+    inline bool bypassed() const {return _bypass || _shed_process;}
+
+    /// True while the output is not only the live input
+    inline bool file_audible() const {return _fade != fade_state::Live;}
+
+    /**
+     * Continue fading in the live input after the file ended, and return
+     * the faded input
+     */
+    const sample_t* fade_to_live(const sample_t* in,
+                                 const jack_nframes_t nframes);
+
+    /**
+     * Mix the blocks of all voices with this cycle's input, and return
+     * the mix, or the input itself if no voice is playing.
+     */
+    const sample_t* mix_voices(const sample_t* in,
+                               const jack_nframes_t nframes,
+                               const jack_nframes_t cycle);
+
+    /**
+     * Create a shared memory ring with the given name, where other
+     * processes can write audio to replace the input (see shm_ring).
+     *
+     * It has to be called before init(), since the ring is created with
+     * jack's sample rate.
+     */
+    void set_shm_source(const std::string& name,const std::size_t capacity);
+
+    /**
+     * Get nframes contiguous samples from the shared memory ring, or
+     * nullptr if not enough are available.  The samples are used in
+     * place, and must be released with release_shm_block().
+     */
+    const sample_t* next_shm_block(const jack_nframes_t nframes);
+
+    /// Release the samples obtained with next_shm_block()
+    void release_shm_block(const jack_nframes_t nframes);
+
+    /**
+     * Write the processed output as raw PCM with the given encoding to
+     * the target ("-" for the standard output, a named pipe or a file).
+     *
+     * It has to be called before init().
+     */
+    void set_output_stream(const std::filesystem::path& target,
+                           const pcm_format& fmt);
+
+    /// Queue the output samples for the output stream, if there is one
+    void stream_output(const sample_t* out,const jack_nframes_t nframes);
+
+    /**
+     * Publish live statistics in the shared memory segment with the given
+     * name (see stats_segment and tarea3-top).
+     *
+     * It has to be called before init().
+     */
+    void set_stats_segment(const std::string& name);
+
+    /// True if the stages of each cycle have to be timed
+    inline bool stats_active() const {return _stats.valid();}
+
+    /// True if the overload watchdog watches the load of each cycle
+    inline bool watchdog_active() const {return _watchdog.active();}
+
+    /**
+     * Publish the timings and levels of the current cycle.  It is called
+     * at the end of jack's process.
+     */
+    void publish_cycle(const jack_nframes_t nframes,
+                       const stats_segment::stage_clock& clock,
+                       const sample_t* in,
+                       const sample_t* out);
+
+    /// Count an xrun reported by jack
+    void xrun();
+
+    /**
+     * Degrade the quality of process() when the load of jack's process
+     * stays too high, and restore it when it drops (see load_watchdog).
+     * If may_bypass is true, process() is bypassed after its cheapest
+     * level.  It has to be called before init().
+     */
+    void set_watchdog(const load_watchdog::settings& settings,
+                      const bool may_bypass);
+
+    /// Report the loads of the last cycle to the watchdog
+    void watch_load(const jack_nframes_t nframes,const std::uint64_t ns);
+
+    /// Switch to the level chosen by the watchdog, at a cycle start
+    void apply_quality();
+
+    /// Print the quality switches of the watchdog since the last call
+    void report_watchdog(std::ostream& os);
+
+    /**
+     * Log everything reaching jack's process to the given file, to be
+     * replayed later with replay().  It has to be called before init().
+     */
+    void set_record_file(const std::filesystem::path& file);
+
+    /**
+     * Run the session recorded in the given file through this client,
+     * offline and at full speed, without jack.  The output goes to the
+     * output stream, if there is one (see set_output_stream()), and each
+     * cycle is compared with the recorded output.
+     *
+     * It has to be called instead of init().  Returns false if the log is
+     * invalid or incomplete, or if any output differs.
+     */
+    bool replay(const std::filesystem::path& file);
+
+    /// File blocks of each voice for render_cycle(), nullptr if none
+    typedef std::array<sndfile_thread::file_block*,sndfile_thread::max_voices>
+    voice_blocks;
+
+    /**
+     * Prepare the client to render cycles offline, as replay() does,
+     * without jack nor the file thread.  It is also used by the
+     * regression tests, to run the cycles of the shipped client.
+     */
+    void begin_offline(const jack_nframes_t sample_rate,
+                       const jack_nframes_t buffer_size);
+
+    /**
+     * Run one cycle offline, with the given input and the given sources
+     * instead of the file thread and the shared memory ring.  The blocks
+     * are marked as garbage when they have been used.
+     *
+     * Returns the result of process().
+     */
+    bool render_cycle(const jack_nframes_t nframes,
+                      const jack_nframes_t frame_time,
+                      const sample_t* in,
+                      sample_t* out,
+                      const voice_blocks& blocks,
+                      const sample_t* shm = nullptr);
+
+    /// Finish the offline rendering started with begin_offline()
+    void end_offline();
+
+    /// Start a cycle: log its input when recording
+    void begin_cycle(const jack_nframes_t nframes,
+                     const jack_nframes_t cycle,
+                     const sample_t* in);
+
+    /// End a cycle: log its output when recording
+    void end_cycle(const sample_t* out,const jack_nframes_t nframes);
+
+    /**
+     * Count cycles, instructions, cache and branch misses of jack's
+     * thread in process() (see perf_counters).  They are shown by
+     * report_stats() and published in the statistics segment.
+     *
+     * It has to be called before init().
+     */
+    void set_perf_counters(const bool enable);
+
+    /**
+     * Prepare jack's realtime thread: name it for the tracer and open its
+     * performance counters.  Called by jack before the first cycle.
+     */
+    void init_thread();
+
+    /// Start counting, right before process()
+    inline void perf_begin() {
+      if (_counters.valid()) {
+        _counters.begin();
+      }
+    }
+
+    /// Stop counting, right after process()
+    inline void perf_end() {
+      if (_counters.valid()) {
+        _counters.end();
+      }
+    }
+
+    /**
+     * Trace the start of the current period, as reported by jack.  It is
+     * called by jack's process while tracing (see tracer).
      */
-    sndfile_thread::file_block* next_file_block();
+    void trace_period() const;
     
   };
   
@@ -0,0 +1,110 @@
+/**
+ * load_watchdog.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "load_watchdog.h"
+
+#include <algorithm>
+#include <cmath>
+
+load_watchdog::load_watchdog()
+  : _levels(1u)
+  , _recover_cycles(1u)
+  , _cycle(0u)
+  , _above(0u)
+  , _below(0u)
+  , _level(0u)
+  , _transitions(64u)
+  , _lost(0u) {
+}
+
+void load_watchdog::configure(const settings& s,
+                              const std::size_t levels,
+                              const double period_s) {
+  _settings = s;
+  _settings.low = std::min(s.low,s.high);
+  _levels = std::max<std::size_t>(levels,1u);
+  _recover_cycles = (period_s > 0.0) ?
+    std::max<std::size_t>(std::size_t(std::ceil(s.recover_s/period_s)),1u) :
+    1u;
+  _cycle = 0u;
+  _above = 0u;
+  _below = 0u;
+  _level = 0u;
+}
+
+std::size_t load_watchdog::update(const float load) {
+  ++_cycle;
+  std::size_t level = _level.load(std::memory_order_relaxed);
+
+  if (load > _settings.high) {
+    _below = 0u;
+    if ((++_above >= _settings.hold_cycles) && (level + 1u < _levels)) {
+      move(++level,load);
+    }
+  } else if (load < _settings.low) {
+    _above = 0u;
+    if ((++_below >= _recover_cycles) && (level > 0u)) {
+      move(--level,load);
+    }
+  } else {
+    _above = 0u;
+    _below = 0u;
+  }
+  
+  return level;
+}
+
+void load_watchdog::move(const std::size_t to,const float load) {
+  transition t;
+  t.cycle = _cycle;
+  t.from = std::uint32_t(_level.load(std::memory_order_relaxed));
+  t.to = std::uint32_t(to);
+  t.load = load;
+  _level.store(to,std::memory_order_relaxed);
+  
+  // The new level gets its own time before the next switch
+  _above = 0u;
+  _below = 0u;
+
+  if (!_transitions.push(t)) {
+    _lost.fetch_add(1u,std::memory_order_relaxed);
+  }
+}
+
+bool load_watchdog::pop(transition& t) {
+  return _transitions.pop(t);
+}
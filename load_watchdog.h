@@ -0,0 +1,134 @@
+/**
+ * load_watchdog.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LOAD_WATCHDOG_H
+#define _LOAD_WATCHDOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "spsc_ringbuffer.h"
+
+/**
+ * Overload watchdog of jack's process.
+ *
+ * It receives the load of each cycle (its time over the period) and
+ * chooses a quality level: 0 is the full quality, and each next level is
+ * cheaper.  When the load stays above the high threshold for some
+ * cycles, it moves one level down; when it stays below the low
+ * threshold for longer, it moves one level back up.  The gap between
+ * both thresholds and the longer time to recover avoid oscillations.
+ *
+ * update() is called only by jack's thread and never allocates nor
+ * blocks.  Each switch is queued, to be logged by a normal thread with
+ * pop().
+ */
+class load_watchdog {
+public:
+  struct settings {
+    float high = 0.85f;           ///< load that degrades the quality
+    float low = 0.5f;             ///< load that restores it
+    std::size_t hold_cycles = 4u; ///< cycles above high before degrading
+    double recover_s = 2.0;       ///< seconds below low before restoring
+  };
+
+  /// A change of level
+  struct transition {
+    std::uint64_t cycle;  ///< cycles watched when it happened
+    std::uint32_t from;
+    std::uint32_t to;
+    float load;           ///< load of the cycle that caused it
+  };
+
+  load_watchdog();
+
+  load_watchdog(const load_watchdog&) = delete; // not copyable
+  load_watchdog& operator=(const load_watchdog&) = delete; // not copyable
+  
+  /**
+   * Watch with the given thresholds and number of levels, for cycles of
+   * the given period.  It must not be called while jack's thread
+   * updates the watchdog.
+   */
+  void configure(const settings& s,
+                 const std::size_t levels,
+                 const double period_s);
+
+  /// True once configured with more than one level
+  inline bool active() const {return _levels > 1u;}
+
+  /**
+   * Account the load of one cycle and return the level for the next
+   * one.  Wait-free.
+   */
+  std::size_t update(const float load);
+
+  /// Current level
+  inline std::size_t level() const {
+    return _level.load(std::memory_order_relaxed);
+  }
+
+  inline std::size_t levels() const {return _levels;}
+
+  /// Take the oldest switch not yet logged, if there is one
+  bool pop(transition& t);
+
+  /// Switches lost because nobody popped them
+  inline std::uint64_t lost() const {
+    return _lost.load(std::memory_order_relaxed);
+  }
+
+private:
+  settings _settings;
+  std::size_t _levels;
+  std::size_t _recover_cycles;
+
+  std::uint64_t _cycle;
+  /// Consecutive cycles above the high threshold
+  std::size_t _above;
+  /// Consecutive cycles below the low threshold
+  std::size_t _below;
+
+  std::atomic<std::size_t> _level;
+  spsc_ringbuffer<transition> _transitions;
+  std::atomic<std::uint64_t> _lost;
+
+  void move(const std::size_t to,const float load);
+};
+
+#endif
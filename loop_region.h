@@ -0,0 +1,85 @@
+/**
+ * loop_region.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LOOP_REGION_H
+#define _LOOP_REGION_H
+
+#include <algorithm>
+#include <cstddef>
+
+/**
+ * Region of a file played repeatedly.  All positions are frames in
+ * the sampling rate of the file.
+ */
+struct loop_region {
+  loop_region(const std::size_t first = 0u,
+              const std::size_t last = 0u,
+              const int times = 0)
+    : start(first), end(last), repeats(times) {}
+
+  std::size_t start; ///< first frame of the loop
+  std::size_t end;   ///< frame after the loop, 0 for the end of file
+  int repeats;       ///< repetitions after the first pass, -1 forever
+};
+
+/**
+ * Prepare the next read of at most wanted frames at position.
+ *
+ * If position reached loop_end and the loop still repeats, it wraps
+ * to the loop start and one repetition is consumed.  The returned
+ * number of frames never crosses loop_end while the loop repeats,
+ * whether the read starts inside the loop or before it, so that the
+ * wrap is sample accurate.
+ */
+inline std::size_t loop_step(std::size_t& position,
+                             loop_region& loop,
+                             const std::size_t loop_end,
+                             const std::size_t wanted) {
+  if ((loop.repeats != 0) && (position >= loop_end)) {
+    if (loop.repeats > 0) {
+      --loop.repeats;
+    }
+    position = loop.start;
+  }
+
+  if ((loop.repeats != 0) && (position < loop_end)) {
+    return std::min(wanted,loop_end - position);
+  }
+  return wanted;
+}
+
+#endif
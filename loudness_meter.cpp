@@ -0,0 +1,302 @@
+/**
+ * loudness_meter.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "loudness_meter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+namespace {
+  /// Samples oversampled at once, in a buffer on the stack
+  constexpr std::size_t chunk = 64u;
+
+  constexpr std::size_t history = loudness_meter::peak_taps - 1u;
+
+  constexpr float minus_infinity = -std::numeric_limits<float>::infinity();
+
+  /// Loudness in LUFS of the given mean square of K-weighted samples
+  inline float lufs(const double mean_square) {
+    return (mean_square > 0.0) ?
+      float(-0.691 + 10.0*std::log10(mean_square)) : minus_infinity;
+  }
+
+  /**
+   * Highest magnitude of the four interpolated phases of the samples
+   * buf[history] to buf[history + n - 1], and of the samples themselves.
+   */
+  float oversampled_peak(const float* buf,const std::size_t n,
+                         const float (*coefs)[loudness_meter::oversampling]) {
+#if defined(__SSE__)
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 vpeak = _mm_setzero_ps();
+    for (std::size_t i=0;i<n;++i) {
+      const float* newest = buf + history + i;
+      const __m128 x = _mm_set1_ps(newest[0]);
+      __m128 acc = _mm_mul_ps(_mm_load_ps(coefs[0]),x);
+      for (std::size_t k=1;k<loudness_meter::peak_taps;++k) {
+        const __m128 older = _mm_set1_ps(*(newest - k));
+        acc = _mm_add_ps(acc,_mm_mul_ps(_mm_load_ps(coefs[k]),older));
+      }
+      vpeak = _mm_max_ps(vpeak,_mm_andnot_ps(sign,acc));
+      vpeak = _mm_max_ps(vpeak,_mm_andnot_ps(sign,x));
+    }
+    alignas(16) float p[4];
+    _mm_store_ps(p,vpeak);
+    return std::max(std::max(p[0],p[1]),std::max(p[2],p[3]));
+#else
+    float peak = 0.0f;
+    for (std::size_t i=0;i<n;++i) {
+      const float* newest = buf + history + i;
+      peak = std::max(peak,std::fabs(newest[0]));
+      for (std::size_t p=0;p<loudness_meter::oversampling;++p) {
+        float acc = 0.0f;
+        for (std::size_t k=0;k<loudness_meter::peak_taps;++k) {
+          acc += coefs[k][p]*(*(newest - k));
+        }
+        peak = std::max(peak,std::fabs(acc));
+      }
+    }
+    return peak;
+#endif
+  }
+
+  /// One sample through a biquad in transposed direct form II
+  template<class B>
+  inline double filter(B& f,const double x) {
+    const double y = f.b0*x + f.z1;
+    f.z1 = f.b1*x - f.a1*y + f.z2;
+    f.z2 = f.b2*x - f.a2*y;
+    return y;
+  }
+
+  /// Clear the state of a filter that decayed into denormals
+  template<class B>
+  inline void flush(B& f) {
+    f.z1 = (std::fabs(f.z1) < 1e-30) ? 0.0 : f.z1;
+    f.z2 = (std::fabs(f.z2) < 1e-30) ? 0.0 : f.z2;
+  }
+}
+
+loudness_meter::loudness_meter()
+  : _shelf{}
+  , _highpass{}
+  , _hop_length(4800u)
+  , _hop_fill(0u)
+  , _hop_energy(0.0)
+  , _hops{}
+  , _hop_pos(0u)
+  , _hop_count(0u)
+  , _gate_count{}
+  , _gate_energy{}
+  , _peak_coefs{}
+  , _peak_tail{}
+  , _peak(0.0f)
+  , _momentary(minus_infinity)
+  , _short_term(minus_infinity)
+  , _integrated(minus_infinity)
+  , _true_peak_db(minus_infinity) {
+}
+
+void loudness_meter::configure(const double sample_rate) {
+  // K-weighting of BS.1770, derived for any sampling rate from the
+  // analog prototypes of its 48 kHz coefficients
+  {
+    const double f0 = 1681.974450955533;
+    const double gain_db = 3.999843853973347;
+    const double q = 0.7071752369554196;
+    const double k = std::tan(M_PI*f0/sample_rate);
+    const double vh = std::pow(10.0,gain_db/20.0);
+    const double vb = std::pow(vh,0.4996667741545416);
+    const double a0 = 1.0 + k/q + k*k;
+    _shelf.b0 = (vh + vb*k/q + k*k)/a0;
+    _shelf.b1 = 2.0*(k*k - vh)/a0;
+    _shelf.b2 = (vh - vb*k/q + k*k)/a0;
+    _shelf.a1 = 2.0*(k*k - 1.0)/a0;
+    _shelf.a2 = (1.0 - k/q + k*k)/a0;
+  }
+  {
+    const double f0 = 38.13547087602444;
+    const double q = 0.5003270373238773;
+    const double k = std::tan(M_PI*f0/sample_rate);
+    const double a0 = 1.0 + k/q + k*k;
+    _highpass.b0 = 1.0;
+    _highpass.b1 = -2.0;
+    _highpass.b2 = 1.0;
+    _highpass.a1 = 2.0*(k*k - 1.0)/a0;
+    _highpass.a2 = (1.0 - k/q + k*k)/a0;
+  }
+
+  _hop_length = std::max(std::size_t(1u),std::size_t(sample_rate/10.0 + 0.5));
+
+  // Blackman windowed sinc at 4 times the rate, cut at the original
+  // Nyquist frequency, and split in phases of unit gain
+  const std::size_t taps = peak_taps*oversampling;
+  const double center = 0.5*double(taps - 1u);
+  for (std::size_t p=0;p<oversampling;++p) {
+    double sum = 0.0;
+    for (std::size_t k=0;k<peak_taps;++k) {
+      const std::size_t j = k*oversampling + p;
+      const double t = (double(j) - center)/double(oversampling);
+      const double sinc = (t == 0.0) ? 1.0 : std::sin(M_PI*t)/(M_PI*t);
+      const double w = 2.0*M_PI*(double(j) + 0.5)/double(taps);
+      const double window = 0.42 - 0.5*std::cos(w) + 0.08*std::cos(2.0*w);
+      _peak_coefs[k][p] = float(sinc*window);
+      sum += sinc*window;
+    }
+    for (std::size_t k=0;k<peak_taps;++k) {
+      _peak_coefs[k][p] = float(double(_peak_coefs[k][p])/sum);
+    }
+  }
+
+  reset();
+}
+
+void loudness_meter::reset() {
+  _shelf.z1 = _shelf.z2 = 0.0;
+  _highpass.z1 = _highpass.z2 = 0.0;
+  _hop_fill = 0u;
+  _hop_energy = 0.0;
+  _hops.fill(0.0);
+  _hop_pos = 0u;
+  _hop_count = 0u;
+  _gate_count.fill(0u);
+  _gate_energy.fill(0.0);
+  _peak_tail.fill(0.0f);
+  _peak = 0.0f;
+  _momentary.store(minus_infinity,std::memory_order_relaxed);
+  _short_term.store(minus_infinity,std::memory_order_relaxed);
+  _integrated.store(minus_infinity,std::memory_order_relaxed);
+  _true_peak_db.store(minus_infinity,std::memory_order_relaxed);
+}
+
+void loudness_meter::process(const float* x,const std::size_t n) {
+  // K-weighted energy, closing a hop every 100 ms
+  for (std::size_t i=0;i<n;++i) {
+    const double y = filter(_highpass,filter(_shelf,double(x[i])));
+    _hop_energy += y*y;
+    if (++_hop_fill == _hop_length) {
+      end_hop();
+    }
+  }
+
+  // True peak, with the last samples of the previous chunk in front
+  alignas(16) float buf[history + chunk];
+  std::memcpy(buf,_peak_tail.data(),sizeof(float)*history);
+  for (std::size_t i=0;i<n;i+=chunk) {
+    const std::size_t m = std::min(chunk,n - i);
+    std::memcpy(buf + history,x + i,sizeof(float)*m);
+    _peak = std::max(_peak,oversampled_peak(buf,m,_peak_coefs));
+    std::memmove(buf,buf + m,sizeof(float)*history);
+  }
+  std::memcpy(_peak_tail.data(),buf,sizeof(float)*history);
+
+  _true_peak_db.store((_peak > 0.0f) ? 20.0f*std::log10(_peak) :
+                      minus_infinity,std::memory_order_relaxed);
+}
+
+void loudness_meter::end_hop() {
+  _hops[_hop_pos] = _hop_energy;
+  _hop_pos = (_hop_pos + 1u == short_term_hops) ? 0u : _hop_pos + 1u;
+  _hop_count++;
+  _hop_fill = 0u;
+  _hop_energy = 0.0;
+  flush(_shelf);
+  flush(_highpass);
+
+  // Sums of the windows ending with this hop, newest first
+  double sum = 0.0;
+  for (std::size_t h=1;h<=short_term_hops;++h) {
+    sum += _hops[(_hop_pos + short_term_hops - h) % short_term_hops];
+    
+    if ((h == momentary_hops) && (_hop_count >= momentary_hops)) {
+      const double block = sum/double(momentary_hops*_hop_length);
+      const float loudness = lufs(block);
+      _momentary.store(loudness,std::memory_order_relaxed);
+
+      // Each momentary block is a gating block
+      if (loudness > histogram_low) {
+        const std::size_t bin =
+          std::min(std::size_t((loudness - histogram_low)*
+                               float(histogram_bins)/
+                               (histogram_high - histogram_low)),
+                   histogram_bins - 1u);
+        _gate_count[bin]++;
+        _gate_energy[bin] += block;
+      }
+    }
+  }
+  
+  if (_hop_count >= short_term_hops) {
+    _short_term.store(lufs(sum/double(short_term_hops*_hop_length)),
+                      std::memory_order_relaxed);
+  }
+
+  _integrated.store(gated_loudness(),std::memory_order_relaxed);
+}
+
+float loudness_meter::gated_loudness() const {
+  // The blocks above the absolute gate give the relative gate
+  double energy = 0.0;
+  std::uint64_t count = 0u;
+  for (std::size_t i=0;i<histogram_bins;++i) {
+    energy += _gate_energy[i];
+    count += _gate_count[i];
+  }
+  if (count == 0u) {
+    return minus_infinity;
+  }
+  const double relative = double(lufs(energy/double(count))) - 10.0;
+
+  // Blocks in bins centered above the relative gate
+  const double width =
+    double(histogram_high - histogram_low)/double(histogram_bins);
+  energy = 0.0;
+  count = 0u;
+  for (std::size_t i=0;i<histogram_bins;++i) {
+    if (double(histogram_low) + (double(i) + 0.5)*width > relative) {
+      energy += _gate_energy[i];
+      count += _gate_count[i];
+    }
+  }
+  return (count > 0u) ? lufs(energy/double(count)) : minus_infinity;
+}
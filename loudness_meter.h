@@ -0,0 +1,153 @@
+/**
+ * loudness_meter.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LOUDNESS_METER_H
+#define _LOUDNESS_METER_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Loudness meter of one channel after EBU R128 (ITU-R BS.1770).
+ *
+ * The samples are K-weighted by a high shelf and a high pass biquad, and
+ * their energy is summed in hops of 100 ms.  The last 4 hops give the
+ * momentary loudness (400 ms) and the last 30 the short-term one (3 s).
+ * Each momentary block also enters a histogram of 0.1 LU bins, holding
+ * the count and the energy of the blocks above the absolute gate
+ * (-70 LUFS), from which the gated integrated loudness is computed at
+ * every hop, without storing the blocks.  The true peak is the highest
+ * magnitude of the signal oversampled 4 times by a polyphase FIR, four
+ * phases at a time with SSE.
+ *
+ * All memory is part of the object, so process() can run in jack's
+ * process.  The results can be read by any thread.
+ */
+class loudness_meter {
+public:
+  /// Hops of the short-term window
+  static constexpr std::size_t short_term_hops = 30u;
+  /// Hops of the momentary window, which are the gating blocks
+  static constexpr std::size_t momentary_hops = 4u;
+  
+  /// Range of the histogram of the gating blocks, in LUFS
+  static constexpr float histogram_low = -70.0f;
+  static constexpr float histogram_high = 10.0f;
+  static constexpr std::size_t histogram_bins = 800u;
+
+  /// Taps of each phase of the true peak interpolator
+  static constexpr std::size_t peak_taps = 12u;
+  static constexpr std::size_t oversampling = 4u;
+
+  loudness_meter();
+
+  /// Compute the filters for the sampling rate, and reset the meter
+  void configure(const double sample_rate);
+
+  /// Forget the signal measured so far
+  void reset();
+
+  /// Measure n more samples
+  void process(const float* x,const std::size_t n);
+
+  /// Loudness of the last 400 ms in LUFS, or -infinity before them
+  inline float momentary() const {
+    return _momentary.load(std::memory_order_relaxed);
+  }
+
+  /// Loudness of the last 3 s in LUFS, or -infinity before them
+  inline float short_term() const {
+    return _short_term.load(std::memory_order_relaxed);
+  }
+
+  /// Gated loudness since the start in LUFS, or -infinity if all silent
+  inline float integrated() const {
+    return _integrated.load(std::memory_order_relaxed);
+  }
+
+  /// Highest true peak since the start, in dBTP
+  inline float true_peak() const {
+    return _true_peak_db.load(std::memory_order_relaxed);
+  }
+
+private:
+  /// Biquad in transposed direct form II
+  struct biquad {
+    double b0, b1, b2, a1, a2;
+    double z1, z2;
+  };
+
+  biquad _shelf;
+  biquad _highpass;
+
+  /// Samples of each hop
+  std::size_t _hop_length;
+  /// Samples and K-weighted energy of the hop being measured
+  std::size_t _hop_fill;
+  double _hop_energy;
+
+  /// Energy of the last hops, as a ring
+  std::array<double,short_term_hops> _hops;
+  std::size_t _hop_pos;
+  /// Hops measured since the start
+  std::uint64_t _hop_count;
+
+  /// Gating blocks above the absolute gate, per 0.1 LU
+  std::array<std::uint64_t,histogram_bins> _gate_count;
+  std::array<double,histogram_bins> _gate_energy;
+
+  /// Polyphase interpolator: coefficient k of all phases together
+  alignas(16) float _peak_coefs[peak_taps][oversampling];
+  /// Last samples of the previous call
+  std::array<float,peak_taps - 1u> _peak_tail;
+  float _peak;
+
+  std::atomic<float> _momentary;
+  std::atomic<float> _short_term;
+  std::atomic<float> _integrated;
+  std::atomic<float> _true_peak_db;
+
+  /// Close the current hop and update the loudness
+  void end_hop();
+
+  /// Integrated loudness of the histogram, with both gates
+  float gated_loudness() const;
+};
+
+#endif
@@ -47,12 +47,26 @@
 #include <stdexcept>
 #include <filesystem>
 #include <vector>
+#include <limits>
+#include <future>
+#include <cmath>
+#include <string>
+#include <sstream>
 
 #include <csignal>
+#include <cstdint>
+
+#include <unistd.h>
 
 #include <boost/program_options.hpp>
 
 #include "waitkey.h"
+#include "event_loop.h"
+#include "control_server.h"
+#include "control_commands.h"
+#include "tracer.h"
+#include "startup_profile.h"
+#include "stream_writer.h"
 #include "passthrough_client.h"
 
 #include "parse_filter.tpp"
@@ -60,20 +74,97 @@
 namespace po=boost::program_options;
 
 /**
- * Handler for the SIGINT (interrupt signal)
+ * A file played in its own voice, given as file[,gain_dB[,pan[,delay_ms]]]
  */
-void signal_handler(int signal) {
-  if (signal == SIGINT) {
-    std::cout << "Ctrl-C caught, cleaning up and exiting" << std::endl;
+struct voice_spec {
+  std::filesystem::path file;
+  float gain_db = 0.0f;
+  float pan = 0.0f;
+  double delay_ms = -1.0; ///< negative to start right away
+};
+
+/**
+ * Parse a voice specification.  Throws std::runtime_error if invalid.
+ */
+voice_spec parse_voice(const std::string& spec) {
+  voice_spec v;
+  std::vector<std::string> fields;
+  std::size_t pos = 0u;
+  for (std::size_t comma;
+       (comma = spec.find(',',pos)) != std::string::npos;
+       pos = comma + 1u) {
+    fields.push_back(spec.substr(pos,comma - pos));
+  }
+  fields.push_back(spec.substr(pos));
 
-    // Let RAII do the clean-up
-    exit(EXIT_SUCCESS);
+  try {
+    v.file = fields[0];
+    if (fields.size() > 1u && !fields[1].empty()) {
+      v.gain_db = std::stof(fields[1]);
+    }
+    if (fields.size() > 2u && !fields[2].empty()) {
+      v.pan = std::stof(fields[2]);
+    }
+    if (fields.size() > 3u && !fields[3].empty()) {
+      v.delay_ms = std::stod(fields[3]);
+    }
+  } catch (std::exception&) {
+    throw std::runtime_error("Invalid voice '" + spec + "'");
   }
+
+  if (v.file.empty() || (fields.size() > 4u)) {
+    throw std::runtime_error("Invalid voice '" + spec + "'");
+  }
+
+  return v;
+}
+
+/**
+ * Parse a compressor given as THRESHOLD:RATIO[:ATTACK:RELEASE[:MAKEUP]],
+ * in dBFS, ms and dB, where the ratio may be 'inf'.  Throws
+ * std::runtime_error if invalid.
+ */
+compressor::settings parse_compressor(const std::string& spec) {
+  compressor::settings c;
+  std::vector<std::string> fields;
+  std::size_t pos = 0u;
+  for (std::size_t colon;
+       (colon = spec.find(':',pos)) != std::string::npos;
+       pos = colon + 1u) {
+    fields.push_back(spec.substr(pos,colon - pos));
+  }
+  fields.push_back(spec.substr(pos));
+
+  if ((fields.size() < 2u) || (fields.size() == 3u) || (fields.size() > 5u)) {
+    throw std::runtime_error("Invalid compressor '" + spec + "'");
+  }
+  
+  try {
+    c.threshold_db = std::stof(fields[0]);
+    c.ratio = std::stof(fields[1]);
+    if (fields.size() > 2u) {
+      c.attack_ms = std::stof(fields[2]);
+      c.release_ms = std::stof(fields[3]);
+    }
+    if (fields.size() > 4u) {
+      c.makeup_db = std::stof(fields[4]);
+    }
+  } catch (std::exception&) {
+    throw std::runtime_error("Invalid compressor '" + spec + "'");
+  }
+
+  if ((c.ratio < 1.0f) || (c.attack_ms < 0.0f) || (c.release_ms < 0.0f)) {
+    throw std::runtime_error("Invalid compressor '" + spec + "'");
+  }
+  
+  return c;
 }
 
 int main (int argc, char *argv[])
 {
-  std::signal(SIGINT,signal_handler);
+  // The signals are handled by the event loop, so they are blocked
+  // before any thread is created, to be inherited by all of them
+  event_loop::block_signals({SIGINT,SIGTERM});
 
   
   try {
@@ -81,6 +172,62 @@ int main (int argc, char *argv[])
 
     typedef jack::client::sample_t sample_t;
     
+    // Format of streamed audio without header
+    std::string raw_spec;
+    double jitter_ms = 50.0;
+
+    // Delay before the scheduled start of the files
+    double start_delay_ms = 0.0;
+
+    // Loop played in every file
+    sndfile_thread::loop_region loop;
+
+    // Files mixed in their own voices, and the live input under the files
+    std::vector<std::string> voice_specs;
+    float live_gain_db = 0.0f;
+    float silence_db = -90.0f;
+
+    // Name and connections in the jack graph
+    std::string client_name;
+    std::vector<std::string> connect_specs;
+    std::filesystem::path connections_file;
+    std::size_t fan_out = 2u;
+
+    // Overload watchdog, as HIGH:LOW[:SECONDS]
+    std::string watchdog_spec;
+
+    // Dynamics of the output
+    std::string compressor_spec;
+    float limiter_db = -1.0f;
+    float lookahead_ms = 0.0f;
+
+    // Crossfades between the live input and the playlist files
+    double crossfade_ms = 5.0;
+
+    // Seconds between statistics reports, or 0 for none
+    double stats_interval = 0.0;
+
+    // Control socket for other programs
+    std::filesystem::path control_path;
+
+    // Shared memory statistics for tarea3-top
+    std::string stats_name;
+
+    // Chrome trace of the realtime spans
+    std::filesystem::path trace_file;
+
+    // Session log to be written, or to be replayed
+    std::filesystem::path record_file;
+    std::filesystem::path replay_file;
+
+    // Shared memory input
+    std::string shm_name;
+    std::size_t shm_frames = 0u;
+
+    // Output stream
+    std::filesystem::path output_target;
+    std::string output_spec;
+    
     // Filter coefficients
     std::string filter_file;
     std::vector< std::vector< sample_t > > filter_coefs;
@@ -92,10 +239,140 @@ int main (int argc, char *argv[])
       ("help,h","show usage information")
       ("files,f",
        po::value<std::vector<std::filesystem::path> >()->multitoken(),
-       "List of audio files to be played")
+       "List of audio files to be played.  Named pipes and '-' (standard "
+       "input) are streamed")
+      ("start-delay",
+       po::value<double>(&start_delay_ms),
+       "Start playing the first file exactly this many milliseconds after "
+       "the client starts")
+      ("voice",
+       po::value<std::vector<std::string> >(&voice_specs)->multitoken(),
+       "Files mixed on top of the input or the playlist, each one as "
+       "file[,gain_dB[,pan[,delay_ms]]], with pan in [-1,1] balancing "
+       "stereo files.  Up to 7 voices play at once")
+      ("live-gain",
+       po::value<float>(&live_gain_db),
+       "Mix the live input with this gain in dB under the playlist files, "
+       "instead of replacing it")
+      ("control",
+       po::value<std::filesystem::path>(&control_path)->
+       implicit_value("/tmp/tarea3.sock"),
+       "Accept commands from other programs (e.g. tarea3-ctl) on this "
+       "UNIX socket")
+      ("stats",
+       po::value<double>(&stats_interval),
+       "Print the statistics of the client every given seconds")
+      ("stats-shm",
+       po::value<std::string>(&stats_name)->
+       implicit_value(stats_segment::default_name),
+       "Publish live statistics in this shared memory segment, to be "
+       "watched with tarea3-top")
+      ("trace",
+       po::value<std::filesystem::path>(&trace_file),
+       "Trace each cycle and the file reads to this Chrome trace file, "
+       "to be opened with chrome://tracing or ui.perfetto.dev")
+      ("record",
+       po::value<std::filesystem::path>(&record_file),
+       "Log the input, the file blocks and the commands of each cycle to "
+       "this file, to be replayed with --replay")
+      ("replay",
+       po::value<std::filesystem::path>(&replay_file),
+       "Run the session logged with --record offline, without jack, and "
+       "check that each cycle produces the same output.  Use --output to "
+       "keep the rendered audio")
+      ("skip-silence",
+       po::value<float>(&silence_db)->implicit_value(-90.0f),
+       "Write silence without processing while the input stays below "
+       "this level in dBFS and the processing has settled")
+      ("watchdog",
+       po::value<std::string>(&watchdog_spec)->implicit_value("85:50"),
+       "Lower the quality of process() when the load of the callback "
+       "stays above HIGH percent, and restore it after it stays below LOW "
+       "percent for SECONDS (2 by default), given as HIGH:LOW[:SECONDS]")
+      ("watchdog-bypass","let the watchdog bypass process() after its "
+       "cheapest quality level")
+      ("compressor",
+       po::value<std::string>(&compressor_spec),
+       "Compress the output above THRESHOLD dBFS by RATIO ('inf' to "
+       "limit), given as THRESHOLD:RATIO[:ATTACK_MS:RELEASE_MS[:MAKEUP_DB]]"
+       " (5 ms and 100 ms by default)")
+      ("limiter",
+       po::value<float>(&limiter_db)->implicit_value(-1.0f),
+       "Limit the output to this level in dBFS, with 1.5 ms of lookahead "
+       "unless --lookahead is given")
+      ("lookahead",
+       po::value<float>(&lookahead_ms),
+       "Delay the output of the compressor this many milliseconds, so that "
+       "it reduces the gain before the peaks")
+      ("loudness","measure the loudness of the output after EBU R128, "
+       "shown with --stats, in tarea3-top and at the end of replays")
+      ("rms-detector","let the compressor follow the RMS level of the "
+       "output (10 ms) instead of its peaks")
+      ("crossfade",
+       po::value<double>(&crossfade_ms)->default_value(5.0),
+       "Milliseconds of the equal-power crossfades between the live input "
+       "and the files, 0 to switch abruptly")
+      ("loop",
+       po::value<int>(&loop.repeats),
+       "Repeat the loop of each file this many times after the first "
+       "pass, or forever with -1")
+      ("loop-start",
+       po::value<std::size_t>(&loop.start),
+       "First frame of the loop (in the sampling rate of the file)")
+      ("loop-end",
+       po::value<std::size_t>(&loop.end),
+       "Frame after the loop, or the end of the file if omitted")
+      ("raw",
+       po::value<std::string>(&raw_spec),
+       "Format of streams without WAV header, as encoding:rate:channels "
+       "(e.g. s16:48000:2).  Encodings: u8, s16, s24, s32, f32, f64, with "
+       "optional 'be' suffix for big endian")
+      ("jitter",
+       po::value<double>(&jitter_ms)->default_value(50.0),
+       "Milliseconds of streamed audio buffered before playing")
+      ("shm",
+       po::value<std::string>(&shm_name),
+       "Create a shared memory ring with this name (e.g. /tarea3-in), "
+       "where other processes can write audio to replace the input")
+      ("shm-frames",
+       po::value<std::size_t>(&shm_frames)->default_value(65536u),
+       "Capacity of the shared memory ring in frames")
+      ("output,o",
+       po::value<std::filesystem::path>(&output_target),
+       "Write the processed audio as raw PCM to this file or named pipe, "
+       "or to the standard output with '-'")
+      ("output-format",
+       po::value<std::string>(&output_spec)->default_value("f32"),
+       "Encoding of the output stream: s16, s24, s32 or f32, with "
+       "optional 'be' suffix")
       ("coeffs,c",
        po::value<std::string>(&filter_file),
-       "File with filter coefficients (from GNU/Octave)");
+       "File with filter coefficients (from GNU/Octave)")
+      ("perf","count cycles, instructions and cache misses of process() "
+       "with the hardware performance counters, shown with --stats")
+      ("name",
+       po::value<std::string>(&client_name)->default_value("dsp1"),
+       "Name of the client in the JACK graph")
+      ("connect",
+       po::value<std::vector<std::string> >(&connect_specs)->multitoken(),
+       "Connect our ports as input=REGEX[,N] or output=REGEX[,N]: the "
+       "first N ports (or 'all') whose names match REGEX, instead of the "
+       "physical ports")
+      ("connections",
+       po::value<std::filesystem::path>(&connections_file),
+       "File with --connect rules, one per line")
+      ("fan-out",
+       po::value<std::size_t>(&fan_out)->default_value(2u),
+       "Physical playback ports fed by the output without --connect rules "
+       "(each one costs the server a mixdown)")
+      ("no-auto-connect","leave the ports unconnected")
+      ("fast-start","probe the files, read the coefficients and prefetch "
+       "the first file while the JACK client is set up, so that the first "
+       "cycle already plays it")
+      ("no-reconnect","exit when the JACK server goes away, instead of "
+       "waiting for it to come back")
+      ("mlock","lock the audio file blocks in RAM")
+      ("hugepages","try to use huge pages for the audio file blocks");
 
     po::variables_map vm;
     po::store(po::parse_command_line(argc,argv,desc),vm);
@@ -106,69 +383,397 @@ int main (int argc, char *argv[])
       return EXIT_SUCCESS;
     }
 
-    if (vm.count("files")) {
-      const std::vector< std::filesystem::path >&
-        audio_files = vm["files"].as< std::vector<std::filesystem::path> >();
+    // The log messages below must not end up in the audio
+    if (vm.count("output") && (output_target == "-") &&
+        !stream_writer::claim_stdout()) {
+      throw std::runtime_error("Unable to use the standard output");
+    }
+
+    startup_profile::mark("options parsed");
+
+    {
+      unsigned int arena_options = block_arena::Prefault;
+      if (vm.count("mlock")) {
+        arena_options |= block_arena::Lock;
+      }
+      if (vm.count("hugepages")) {
+        arena_options |= block_arena::HugePages;
+      }
+      client.set_arena_options(arena_options);
+    }
     
+    {
+      pcm_format raw;
+      raw.sample_rate = 48000u;
+      raw.channels = 1u;
+      if (vm.count("raw") && !parse_pcm_spec(raw_spec,raw)) {
+        throw std::runtime_error("Invalid raw format '" + raw_spec + "'");
+      }
+      client.set_stream_format(raw,jitter_ms);
+    }
+
+    client.set_crossfade(crossfade_ms);
+
+    if (vm.count("watchdog")) {
+      load_watchdog::settings settings;
+      std::istringstream is(watchdog_spec);
+      char colon = ':';
+      float high = 0.0f, low = 0.0f;
+      if (!(is >> high >> colon >> low) || (colon != ':') ||
+          (high <= 0.0f) || (low < 0.0f) || (low > high)) {
+        throw std::runtime_error("Invalid watchdog '" + watchdog_spec + "'");
+      }
+      if (is >> colon) {
+        if ((colon != ':') || !(is >> settings.recover_s)) {
+          throw std::runtime_error("Invalid watchdog '" + watchdog_spec +
+                                   "'");
+        }
+      }
+      settings.high = high/100.0f;
+      settings.low = low/100.0f;
+      client.set_watchdog(settings,vm.count("watchdog-bypass") != 0u);
+    }
+
+    if (vm.count("compressor") && vm.count("limiter")) {
+      throw std::runtime_error("Use either --compressor or --limiter");
+    }
+    if (vm.count("compressor") || vm.count("limiter")) {
+      compressor::settings settings;
+      if (vm.count("compressor")) {
+        settings = parse_compressor(compressor_spec);
+      } else {
+        settings.threshold_db = limiter_db;
+        settings.ratio = std::numeric_limits<float>::infinity();
+        settings.release_ms = 50.0f;
+        settings.lookahead_ms = 1.5f;
+      }
+      if (vm.count("lookahead")) {
+        settings.lookahead_ms = lookahead_ms;
+      }
+      if (vm.count("limiter")) {
+        // The reduction settles within the lookahead, before the peaks
+        settings.attack_ms = settings.lookahead_ms/3.0f;
+      }
+      if (vm.count("rms-detector")) {
+        settings.mode = compressor::detector::Rms;
+      }
+      client.set_compressor(settings);
+    }
+
+    client.set_loudness_meter(vm.count("loudness") != 0u);
+
+    if (vm.count("skip-silence")) {
+      client.set_silence_threshold(std::pow(10.0f,silence_db/20.0f));
+    }
+
+    if (vm.count("shm")) {
+      client.set_shm_source(shm_name,shm_frames);
+    }
+
+    if (vm.count("stats-shm")) {
+      client.set_stats_segment(stats_name);
+    }
+
+    client.set_perf_counters(vm.count("perf") != 0u);
+
+    // The tracer has to be ready before jack's and the file threads start
+    if (vm.count("trace")) {
+      tracer::start(trace_file);
+    }
+
+    if (vm.count("output")) {
+      pcm_format fmt;
+      fmt.channels = 1u;
+      if (!parse_pcm_spec(output_spec,fmt)) {
+        throw std::runtime_error("Invalid output format '" + output_spec +
+                                 "'");
+      }
+      client.set_output_stream(output_target,fmt);
+    }
+
+    // The keyboard cannot be used if the audio comes through stdin
+    bool stdin_stream = false;
+
+    // Scheduled files can only be added once jack's frame time runs
+    const bool scheduled = vm.count("start-delay") > 0;
+
+    std::vector< std::filesystem::path > audio_files;
+    if (vm.count("files")) {
+      audio_files = vm["files"].as< std::vector<std::filesystem::path> >();
       for (const auto& f : audio_files) {
-        bool ok =client.add_file(f);
+        stdin_stream = stdin_stream || (f == "-");
+      }
+    }
+
+    // Probing the files and parsing the coefficients take about as long
+    // as opening jack, so a fast start does them in parallel
+    auto add_files = [&]() {
+      startup_profile::phase phase("probing the files");
+      if (scheduled) {
+        return;
+      }
+      for (const auto& f : audio_files) {
+        bool ok =client.add_file(f,loop);
         std::cout << "Adding file '" << f.c_str() << "' "
                   << (ok ? "succedded" : "failed") << std::endl;
       }
-    }
+    };
 
-    if (vm.count("coeffs")) {
-      filter_coefs = parse_filter<sample_t>(filter_file);
+    auto read_coefficients = [&]() {
+      startup_profile::phase phase("reading the coefficients");
+      return parse_filter<sample_t>(filter_file);
+    };
+
+    auto set_coefficients = [&]() {
       std::cout << filter_coefs.size() << " 2nd order filter read from "
-                << filter_file;
+                << filter_file << std::endl;
+      client.set_coefficients(filter_coefs);
+    };
+
+    const bool fast_start =
+      (vm.count("fast-start") != 0u) && (vm.count("replay") == 0u);
+
+    if (fast_start) {
+      auto files_added = std::async(std::launch::async,add_files).share();
+      auto coefs_read = vm.count("coeffs") ?
+        std::async(std::launch::async,read_coefficients).share() :
+        std::shared_future< std::vector< std::vector<sample_t> > >();
+      client.set_fast_start([=,&filter_coefs]() {
+        files_added.get();
+        if (coefs_read.valid()) {
+          filter_coefs = coefs_read.get();
+          set_coefficients();
+        }
+      });
+    } else {
+      add_files();
+      if (vm.count("coeffs")) {
+        filter_coefs = read_coefficients();
+        set_coefficients();
+      }
+    }
+    
+    if (vm.count("replay")) {
+      return client.replay(replay_file) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (vm.count("record")) {
+      client.set_record_file(record_file);
+    }
+
+    client.set_reconnect(vm.count("no-reconnect") == 0u);
+
+    client.set_client_name(client_name);
+    if (vm.count("no-auto-connect")) {
+      client.set_connections(port_connections());
+    } else if (vm.count("connect") || vm.count("connections")) {
+      port_connections connections;
+      std::string error;
+      if (vm.count("connections") &&
+          !connections.load(connections_file,error)) {
+        throw std::runtime_error(error);
+      }
+      for (const auto& spec : connect_specs) {
+        if (!connections.add(spec,error)) {
+          throw std::runtime_error("Invalid connection '" + spec + "': " +
+                                   error);
+        }
+      }
+      client.set_connections(connections);
+    } else {
+      client.set_connections(port_connections::physical(fan_out));
     }
     
     if (client.init() != jack::client_state::Running) {
       throw std::runtime_error("Could not initialize the JACK client");
     }
+    startup_profile::mark("client running");
 
-    // keep running until stopped by the user
-    std::cout << "Press x key to exit" << std::endl;
-
-    int key = -1;
-    bool go_away=false;
-    while (!go_away) {
-      key = waitkey(100);
-      if (key>0) {
-        switch(key) {
-        case 'x': {
-          go_away=true;
-          std::cout << "Finishing..." << std::endl;
-        } break;
-        case 'r': {
-
-          if (vm.count("files")) {
-            const std::vector< std::filesystem::path >&
-              audio_files =
-              vm["files"].as< std::vector<std::filesystem::path> >();
-            
-            for (const auto& f : audio_files) {
-              bool ok =client.add_file(f);
-              std::cout << "  Re-adding file '" << f.c_str() << "' "
-                        << (ok ? "succedded" : "failed") << std::endl;
-            }
-          }
+    if (scheduled && vm.count("files")) {
+      const std::vector< std::filesystem::path >&
+        audio_files = vm["files"].as< std::vector<std::filesystem::path> >();
+
+      // The first file starts exactly at this frame, and the others
+      // follow it
+      const jack_nframes_t start = client.frame_time() +
+        jack_nframes_t(start_delay_ms*1e-3*double(client.sample_rate()));
+      
+      bool first = true;
+      for (const auto& f : audio_files) {
+        bool ok = first ?
+          client.schedule_file(f,start,loop) : client.add_file(f,loop);
+        std::cout << "Adding file '" << f.c_str() << "' "
+                  << (ok ? "succedded" : "failed");
+        if (first) {
+          std::cout << " to start at frame " << start;
+        }
+        std::cout << std::endl;
+        first = false;
+      }
+    }
+
+    if (vm.count("live-gain")) {
+      client.set_live_gain(std::pow(10.0f,live_gain_db/20.0f));
+    }
+    
+    // The voices start after the client runs, since their delays are
+    // given relative to jack's frame time
+    {
+      const jack_nframes_t now = client.frame_time();
+      for (const auto& spec : voice_specs) {
+        const voice_spec v = parse_voice(spec);
+        const float gain = std::pow(10.0f,v.gain_db/20.0f);
+        bool ok = false;
+        if (v.delay_ms < 0.0) {
+          ok = client.add_voice(v.file,gain,v.pan,loop);
+        } else {
+          const jack_nframes_t start = now +
+            jack_nframes_t(v.delay_ms*1e-3*double(client.sample_rate()));
+          ok = client.schedule_voice(v.file,gain,v.pan,start,loop);
+        }
+        std::cout << "Adding voice '" << v.file.c_str() << "' at "
+                  << v.gain_db << " dB "
+                  << (ok ? "succedded" : "failed") << std::endl;
+      }
+    }
+    
+    // The main thread sleeps until a key, a signal, the statistics timer
+    // or a finished file wakes it up
+    event_loop events;
+
+    events.add_signals({SIGINT,SIGTERM},[&](int signal) {
+      std::cout << (signal == SIGINT ? "Ctrl-C" : "SIGTERM")
+                << " caught, cleaning up and exiting" << std::endl;
+      events.stop();
+    });
+
+    // If the server goes away, the client reconnects when it comes back.
+    // The retry timer only runs while the client is disconnected, so it
+    // does not wake up this thread otherwise
+    int retry_timer = -1;
+    auto supervise = [&]() {
+      if (!client.supervise()) {
+        std::cerr << "E> The JACK server went away" << std::endl;
+        events.stop();
+        return;
+      }
+      const bool down = (client.state() != jack::client_state::Running);
+      if (retry_timer >= 0) {
+        events.set_timer(retry_timer,down ? 0.05 : 0.0);
+      }
+    };
+    retry_timer = events.add_disarmed_timer(supervise);
+    events.add(client.shutdown_fd(),[&](std::uint32_t) {
+      supervise();
+    });
+
+    // The first cycles are logged when they happen
+    events.add(startup_profile::notify_fd(),[&](std::uint32_t) {
+      if (startup_profile::report(std::cout)) {
+        events.remove(startup_profile::notify_fd());
+      }
+    });
+
+    // New ports are connected as soon as they appear
+    events.add(client.graph_fd(),[&](std::uint32_t) {
+      client.connect_ports();
+    });
+
+    // Quality switches of the watchdog are logged by this thread
+    if (client.watchdog_active()) {
+      events.add_timer(0.1,[&]() {
+        client.report_watchdog(std::cout);
+      });
+    }
+
+    if (stats_interval > 0.0) {
+      events.add_timer(stats_interval,[&]() {
+        client.report_stats(std::cout);
+      });
+    }
+
+    events.add(client.file_notify_fd(),[&](std::uint32_t) {
+      const std::size_t finished = client.finished_files();
+      std::cout << finished << " file(s) finished" << std::endl;
+      if (client.files_idle()) {
+        std::cout << "All files played" << std::endl;
+      }
+    });
+
+    // Commands from other programs, executed by this thread
+    control_commands commands(client,events);
+    control_server control;
+    if (vm.count("control")) {
+      control.open(control_path,events,[&](const std::string& line) {
+        const std::string reply = commands(line);
+        client.collect_garbage();
+        return reply;
+      });
+    }
+
+    auto handle_key = [&](const int key) {
+      switch(key) {
+      case 'x': {
+        events.stop();
+        std::cout << "Finishing..." << std::endl;
+      } break;
+      case 'r': {
+
+        if (vm.count("files")) {
+          const std::vector< std::filesystem::path >&
+            audio_files =
+            vm["files"].as< std::vector<std::filesystem::path> >();
           
-          std::cout << "Repeat playing files" << std::endl;
-        } break;
-        default: {
-          if (key>32) {
-            std::cout << "Key " << char(key) << " pressed" << std::endl;
-          } else {
-            std::cout << "Key " << key << " pressed" << std::endl;
+          for (const auto& f : audio_files) {
+            bool ok =client.add_file(f,loop);
+            std::cout << "  Re-adding file '" << f.c_str() << "' "
+                      << (ok ? "succedded" : "failed") << std::endl;
           }
-          key=-1;
         }
-        } // switch key
-      } // if (key>0)
-    } // end while
+        
+        std::cout << "Repeat playing files" << std::endl;
+      } break;
+      case 'b': {
+        client.seek_file(0u);
+        std::cout << "Back to the beginning of the file" << std::endl;
+      } break;
+      case 'l': {
+        // Keep the region but stop repeating it
+        sndfile_thread::loop_region last = loop;
+        last.repeats = 0;
+        client.set_file_loop(last);
+        std::cout << "Leaving the loop" << std::endl;
+      } break;
+      default: {
+        if (key>32) {
+          std::cout << "Key " << char(key) << " pressed" << std::endl;
+        } else {
+          std::cout << "Key " << key << " pressed" << std::endl;
+        }
+      }
+      } // switch key
+    };
+    
+    // keep running until stopped by the user
+    if (stdin_stream || !isatty(STDIN_FILENO)) {
+      std::cout << "Press Ctrl-C to exit" << std::endl;
+    } else {
+      std::cout << "Press x key to exit, b to restart the current file, "
+                << "l to leave its loop" << std::endl;
+
+      prepare_terminal();
+      events.add(STDIN_FILENO,[&](std::uint32_t) {
+        for (int key = readkey(); key > 0; key = readkey()) {
+          handle_key(key);
+        }
+      });
+    }
+
+    events.run();
 
+    // Orderly shutdown: files, jack and then the output stream
     client.stop();
+    tracer::stop();
   }
   catch (std::exception& exc) {
     std::cout << argv[0] << ": Error: " << exc.what() << std::endl;
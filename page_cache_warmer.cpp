@@ -0,0 +1,166 @@
+/**
+ * page_cache_warmer.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "page_cache_warmer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <system_error>
+
+namespace {
+  /// Smallest region worth a system call
+  constexpr std::size_t min_advise = 1024u*1024u;
+  /// Played region kept in the cache behind the play position
+  constexpr std::size_t keep_behind = 16u*1024u*1024u;
+}
+
+page_cache_warmer::page_cache_warmer(const double horizon,
+                                     const std::size_t huge_file,
+                                     const double byte_rate)
+  : _horizon(horizon)
+  , _huge_file(huge_file)
+  , _byte_rate(byte_rate) {
+}
+
+void page_cache_warmer::set_byte_rate(const std::filesystem::path& file,
+                                      const double duration) {
+  const entry* e = find(file);
+  if ((e != nullptr) && (e->bytes > 0u) && (duration > 0.0)) {
+    _byte_rate = double(e->bytes)/duration;
+  }
+}
+
+bool page_cache_warmer::advise(const std::filesystem::path& file,
+                               const std::size_t offset,
+                               const std::size_t len,
+                               const int advice) {
+  const int fd = ::open(file.c_str(),O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  
+  // The advice applies to the cached pages of the file, which survive
+  // closing this descriptor
+  const bool ok = (posix_fadvise(fd,off_t(offset),off_t(len),advice) == 0);
+  ::close(fd);
+  return ok;
+}
+
+page_cache_warmer::entry*
+page_cache_warmer::find(const std::filesystem::path& file) {
+  for (auto& e : _entries) {
+    if (e.file == file) {
+      return &e;
+    }
+  }
+
+  entry e;
+  e.file = file;
+
+  std::error_code ec;
+  e.bytes = std::filesystem::file_size(file,ec);
+  if (ec) {
+    return nullptr;
+  }
+
+  _entries.push_back(e);
+  return &_entries.back();
+}
+
+void page_cache_warmer::warm(const std::vector<std::filesystem::path>& queued,
+                             double remaining) {
+
+  double start = std::max(0.0,remaining);
+  
+  for (const auto& file : queued) {
+    if (start >= _horizon) {
+      break;
+    }
+    
+    entry* e = find(file);
+    if (e == nullptr) {
+      continue; // it will fail to open anyway
+    }
+
+    // Load the part of the file played from now to the horizon
+    const double duration = double(e->bytes)/_byte_rate;
+    std::size_t target = e->bytes;
+    if (duration > 0.0) {
+      const double fraction = (_horizon - start)/duration;
+      if (fraction < 1.0) {
+        target = std::size_t(fraction*double(e->bytes));
+      }
+    }
+    target = std::min(e->bytes,std::max(target,min_advise));
+
+    if ((target > e->warmed) &&
+        ((target - e->warmed >= min_advise) || (target == e->bytes))) {
+      if (advise(file,e->warmed,target-e->warmed,POSIX_FADV_WILLNEED)) {
+        e->warmed = target;
+      }
+    }
+    
+    start += duration;
+  }
+}
+
+void page_cache_warmer::release_behind(const std::filesystem::path& file,
+                                       const double played) {
+  entry* e = find(file);
+  if ((e == nullptr) || (e->bytes < _huge_file)) {
+    return;
+  }
+
+  const std::size_t pos = std::size_t(std::clamp(played,0.0,1.0) *
+                                      double(e->bytes));
+  if (pos <= keep_behind) {
+    return;
+  }
+  
+  const std::size_t until = pos - keep_behind;
+  if ((until > e->released) && (until - e->released >= min_advise)) {
+    if (advise(file,e->released,until-e->released,POSIX_FADV_DONTNEED)) {
+      e->released = until;
+    }
+  }
+}
+
+void page_cache_warmer::forget(const std::filesystem::path& file) {
+  _entries.remove_if([&file](const entry& e) {return e.file == file;});
+}
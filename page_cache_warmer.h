@@ -0,0 +1,137 @@
+/**
+ * page_cache_warmer.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PAGE_CACHE_WARMER_H
+#define _PAGE_CACHE_WARMER_H
+
+#include <cstddef>
+#include <filesystem>
+#include <list>
+#include <vector>
+
+/**
+ * Kernel hints to have the audio files in the page cache before they
+ * are needed.
+ *
+ * The files waiting in the playlist are usually cold.  This class
+ * estimates when each of them will start playing, and asks the kernel
+ * with posix_fadvise(POSIX_FADV_WILLNEED) to load the beginning of the
+ * files that will start within the readahead horizon: the closer the
+ * start, the larger the loaded region.  The data stays in the page
+ * cache, and not in the memory of this process.
+ *
+ * The queued files are not opened to read their headers, which would
+ * stall on a cold disk just like reading their samples: their durations
+ * are estimated from their sizes, at the byte rate of the file being
+ * played.
+ *
+ * For huge files, the pages already played are dropped with
+ * POSIX_FADV_DONTNEED, so that they do not push other data out of the
+ * cache.
+ *
+ * All methods must be called from the same (non-realtime) thread.
+ */
+class page_cache_warmer {
+public:
+  /**
+   * @param horizon time in seconds before its start at which a file
+   *                begins to be loaded
+   * @param huge_file files with at least this number of bytes are
+   *                  released behind the play position
+   * @param byte_rate bytes per second assumed until a file is played,
+   *                  by default 16 bit stereo at 48 kHz
+   */
+  page_cache_warmer(const double horizon = 10.0,
+                    const std::size_t huge_file = 256u*1024u*1024u,
+                    const double byte_rate = 192000.0);
+
+  /**
+   * Estimate the durations of the queued files with the byte rate of
+   * the file being played.
+   *
+   * @param duration seconds of audio of the file
+   */
+  void set_byte_rate(const std::filesystem::path& file,
+                     const double duration);
+
+  /**
+   * Issue the hints for the queued files, in playing order.
+   *
+   * @param queued files waiting in the playlist
+   * @param remaining seconds until the current file ends
+   */
+  void warm(const std::vector<std::filesystem::path>& queued,
+            double remaining);
+
+  /**
+   * Drop the pages of the given file already played, if it is huge.
+   *
+   * @param played fraction of the file already read, between 0 and 1
+   */
+  void release_behind(const std::filesystem::path& file,
+                      const double played);
+
+  /// Forget everything known about the given file
+  void forget(const std::filesystem::path& file);
+
+private:
+  struct entry {
+    std::filesystem::path file;
+    std::size_t bytes = 0u;     ///< file size
+    std::size_t warmed = 0u;    ///< bytes already requested to the kernel
+    std::size_t released = 0u;  ///< bytes already dropped from the cache
+  };
+  
+  double _horizon;
+  std::size_t _huge_file;
+  /// Bytes per second of the files
+  double _byte_rate;
+
+  /// Files seen so far
+  std::list<entry> _entries;
+
+  /// Find the entry of the file, taking its size if not known yet
+  entry* find(const std::filesystem::path& file);
+
+  /// Issue a hint for a region of the file
+  static bool advise(const std::filesystem::path& file,
+                     const std::size_t offset,
+                     const std::size_t len,
+                     const int advice);
+};
+
+#endif
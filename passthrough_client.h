@@ -63,6 +63,11 @@ public:
   virtual bool process(jack_nframes_t nframes,
                        const sample_t *const in,
                        sample_t *const out) override;
+
+  /**
+   * Copying has no state: silence in is always silence out
+   */
+  virtual bool settled(const float threshold) const override;
 };
 
 
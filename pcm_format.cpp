@@ -0,0 +1,475 @@
+/**
+ * pcm_format.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pcm_format.h"
+
+#include <cstring>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+  
+  inline std::uint16_t le16(const unsigned char* p) {
+    return std::uint16_t(p[0]) | (std::uint16_t(p[1])<<8);
+  }
+  
+  inline std::uint32_t le32(const unsigned char* p) {
+    return std::uint32_t(p[0])      | (std::uint32_t(p[1])<<8) |
+          (std::uint32_t(p[2])<<16) | (std::uint32_t(p[3])<<24);
+  }
+
+  inline std::uint16_t be16(const unsigned char* p) {
+    return std::uint16_t(p[1]) | (std::uint16_t(p[0])<<8);
+  }
+  
+  inline std::uint32_t be32(const unsigned char* p) {
+    return std::uint32_t(p[3])      | (std::uint32_t(p[2])<<8) |
+          (std::uint32_t(p[1])<<16) | (std::uint32_t(p[0])<<24);
+  }
+
+  inline bool tag(const unsigned char* p,const char* t) {
+    return std::memcmp(p,t,4)==0;
+  }
+
+  /// Convert the 80-bit IEEE 754 extended float used by AIFF
+  double extended_to_double(const unsigned char* p) {
+    const int expon = ((p[0] & 0x7f) << 8) | p[1];
+    const std::uint32_t hi = be32(p+2);
+    const std::uint32_t lo = be32(p+6);
+
+    if ((expon == 0) && (hi == 0) && (lo == 0)) {
+      return 0.0;
+    }
+
+    double f = std::ldexp(double(hi),expon-16383-31) +
+               std::ldexp(double(lo),expon-16383-63);
+    return (p[0] & 0x80) ? -f : f;
+  }
+
+  pcm_format::encoding int_encoding(const unsigned int bits) {
+    switch(bits) {
+    case 8:  return pcm_format::encoding::U8;
+    case 16: return pcm_format::encoding::S16;
+    case 24: return pcm_format::encoding::S24;
+    case 32: return pcm_format::encoding::S32;
+    default: return pcm_format::encoding::Unknown;
+    }
+  }
+
+  pcm_format::encoding float_encoding(const unsigned int bits) {
+    switch(bits) {
+    case 32: return pcm_format::encoding::F32;
+    case 64: return pcm_format::encoding::F64;
+    default: return pcm_format::encoding::Unknown;
+    }
+  }
+  
+  inline void store(unsigned char* p,std::uint64_t v,
+                    const std::size_t bytes,const bool be) {
+    for (std::size_t i=0;i<bytes;++i) {
+      p[be ? bytes-1u-i : i] = static_cast<unsigned char>(v >> (8u*i));
+    }
+  }
+
+  /**
+   * Saturated conversion of a float to an integer with the given scale.
+   * It rounds to nearest even, as the SIMD conversion does, and clamps
+   * after rounding so that 1.0 gives max and does not wrap around.
+   */
+  inline std::int32_t quantize(const float v,const float scale,
+                               const float max) {
+    return static_cast<std::int32_t>(std::clamp(std::nearbyint(v*scale),
+                                                -scale,max));
+  }
+
+  /**
+   * Convert floats to 32 bit integers scaled to the given number of
+   * bits, four samples at a time if SSE2 is available.
+   *
+   * Returns the number of samples converted with SIMD.
+   */
+  std::size_t quantize_simd(const float* src,const std::size_t samples,
+                            const unsigned int bits,std::int32_t* dst) {
+#if defined(__SSE2__)
+    const float scale = float(1u << (bits-1u));
+    const __m128 vscale = _mm_set1_ps(scale);
+    const __m128 vmax = _mm_set1_ps(scale - 1.0f);
+    const __m128 vmin = _mm_set1_ps(-scale);
+    const std::size_t n = samples & ~std::size_t(3u);
+    for (std::size_t i=0;i<n;i+=4) {
+      __m128 v = _mm_mul_ps(_mm_loadu_ps(src+i),vscale);
+      v = _mm_min_ps(_mm_max_ps(v,vmin),vmax);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i),
+                       _mm_cvtps_epi32(v)); // round to nearest
+    }
+    return n;
+#else
+    (void)src; (void)samples; (void)bits; (void)dst;
+    return 0u;
+#endif
+  }
+  
+  template<typename Fetch,typename Conv>
+  inline void decode_loop(const unsigned char* src,
+                          const std::size_t samples,
+                          const std::size_t bytes,
+                          float* dst,
+                          Fetch fetch,
+                          Conv conv) {
+    const unsigned char *const end = src + samples*bytes;
+    for (;src!=end;src+=bytes,++dst) {
+      *dst = conv(fetch(src));
+    }
+  }
+}
+
+std::size_t pcm_format::sample_bytes() const {
+  switch(enc) {
+  case encoding::U8:  return 1u;
+  case encoding::S16: return 2u;
+  case encoding::S24: return 3u;
+  case encoding::S32: return 4u;
+  case encoding::F32: return 4u;
+  case encoding::F64: return 8u;
+  default: return 0u;
+  }
+}
+
+bool parse_wav_header(const unsigned char* buf,
+                      const std::size_t size,
+                      pcm_format& fmt) {
+  
+  if ((size < 12) || !tag(buf,"RIFF") || !tag(buf+8,"WAVE")) {
+    return false;
+  }
+
+  pcm_format f;
+  bool has_fmt = false;
+  std::size_t pos = 12u;
+  
+  while (pos + 8u <= size) {
+    const unsigned char* chunk = buf+pos;
+    const std::size_t chunk_size = le32(chunk+4);
+    
+    if (tag(chunk,"fmt ")) {
+      if ((chunk_size < 16u) || (pos + 8u + 16u > size)) {
+        return false;
+      }
+      
+      unsigned int format_tag = le16(chunk+8);
+      f.channels    = le16(chunk+10);
+      f.sample_rate = le32(chunk+12);
+      const unsigned int bits = le16(chunk+22);
+
+      if ((format_tag == 0xfffe) && (chunk_size >= 40u) &&
+          (pos + 8u + 26u <= size)) {
+        // WAVE_FORMAT_EXTENSIBLE: the format is at the start of the GUID
+        format_tag = le16(chunk+8+24);
+      }
+
+      if (format_tag == 1) {
+        f.enc = int_encoding(bits);
+      } else if (format_tag == 3) {
+        f.enc = float_encoding(bits);
+      } else {
+        return false; // compressed formats are left to libsndfile
+      }
+      has_fmt = true;
+    } else if (tag(chunk,"data")) {
+      if (!has_fmt) {
+        return false;
+      }
+      f.data_offset = pos + 8u;
+      f.data_bytes  = chunk_size;
+      f.big_endian  = false;
+      
+      if (f.valid()) {
+        fmt = f;
+        return true;
+      }
+      return false;
+    }
+
+    // chunks are padded to an even size
+    pos += 8u + chunk_size + (chunk_size & 1u);
+  }
+
+  return false;
+}
+
+bool parse_aiff_header(const unsigned char* buf,
+                       const std::size_t size,
+                       pcm_format& fmt) {
+  
+  if ((size < 12) || !tag(buf,"FORM") || !tag(buf+8,"AIFF")) {
+    return false;
+  }
+
+  pcm_format f;
+  bool has_comm = false;
+  std::size_t pos = 12u;
+  
+  while (pos + 8u <= size) {
+    const unsigned char* chunk = buf+pos;
+    const std::size_t chunk_size = be32(chunk+4);
+    
+    if (tag(chunk,"COMM")) {
+      if ((chunk_size < 18u) || (pos + 8u + 18u > size)) {
+        return false;
+      }
+      f.channels    = be16(chunk+8);
+      f.enc         = int_encoding(be16(chunk+14));
+      f.sample_rate = std::size_t(extended_to_double(chunk+16) + 0.5);
+      
+      if (f.enc == pcm_format::encoding::U8) {
+        return false; // AIFF 8-bit data is signed, not supported here
+      }
+      has_comm = true;
+    } else if (tag(chunk,"SSND")) {
+      if (!has_comm || (pos + 16u > size) || (chunk_size < 8u)) {
+        return false;
+      }
+      const std::size_t offset = be32(chunk+8);
+      f.data_offset = pos + 16u + offset;
+      f.data_bytes  = chunk_size - 8u - offset;
+      f.big_endian  = true;
+      
+      if (f.valid()) {
+        fmt = f;
+        return true;
+      }
+      return false;
+    }
+
+    pos += 8u + chunk_size + (chunk_size & 1u);
+  }
+
+  return false;
+}
+
+bool parse_pcm_header(const unsigned char* buf,
+                      const std::size_t size,
+                      pcm_format& fmt) {
+  return parse_wav_header(buf,size,fmt) || parse_aiff_header(buf,size,fmt);
+}
+
+bool parse_pcm_spec(const std::string& spec,pcm_format& fmt) {
+  std::istringstream is(spec);
+  std::string field;
+  pcm_format f = fmt;
+  
+  if (!std::getline(is,field,':')) {
+    return false;
+  }
+  
+  f.big_endian = false;
+  if ((field.size() > 2) && (field.compare(field.size()-2,2,"be") == 0)) {
+    f.big_endian = true;
+    field.resize(field.size()-2);
+  } else if ((field.size() > 2) &&
+             (field.compare(field.size()-2,2,"le") == 0)) {
+    field.resize(field.size()-2);
+  }
+
+  if      (field == "u8")  f.enc = pcm_format::encoding::U8;
+  else if (field == "s16") f.enc = pcm_format::encoding::S16;
+  else if (field == "s24") f.enc = pcm_format::encoding::S24;
+  else if (field == "s32") f.enc = pcm_format::encoding::S32;
+  else if (field == "f32") f.enc = pcm_format::encoding::F32;
+  else if (field == "f64") f.enc = pcm_format::encoding::F64;
+  else return false;
+
+  try {
+    if (std::getline(is,field,':')) {
+      f.sample_rate = std::stoul(field);
+    }
+    if (std::getline(is,field,':')) {
+      f.channels = std::stoul(field);
+    }
+  } catch (std::exception&) {
+    return false;
+  }
+
+  fmt = f;
+  return true;
+}
+
+void decode_pcm(const unsigned char* src,
+                const std::size_t frames,
+                const pcm_format& fmt,
+                float* dst) {
+  
+  const std::size_t samples = frames*fmt.channels;
+  const bool be = fmt.big_endian;
+  
+  switch(fmt.enc) {
+  case pcm_format::encoding::U8: {
+    decode_loop(src,samples,1u,dst,
+                [](const unsigned char* p) {return int(p[0]);},
+                [](int v) {return float(v-128)*(1.0f/128.0f);});
+  } break;
+  case pcm_format::encoding::S16: {
+    decode_loop(src,samples,2u,dst,
+                [be](const unsigned char* p) {
+                  return std::int16_t(be ? be16(p) : le16(p));
+                },
+                [](std::int16_t v) {return float(v)*(1.0f/32768.0f);});
+  } break;
+  case pcm_format::encoding::S24: {
+    decode_loop(src,samples,3u,dst,
+                [be](const unsigned char* p) {
+                  const std::uint32_t u = be ?
+                    (std::uint32_t(p[0])<<24) | (std::uint32_t(p[1])<<16) |
+                    (std::uint32_t(p[2])<<8) :
+                    (std::uint32_t(p[2])<<24) | (std::uint32_t(p[1])<<16) |
+                    (std::uint32_t(p[0])<<8);
+                  return std::int32_t(u);
+                },
+                [](std::int32_t v) {return float(v)*(1.0f/2147483648.0f);});
+  } break;
+  case pcm_format::encoding::S32: {
+    decode_loop(src,samples,4u,dst,
+                [be](const unsigned char* p) {
+                  return std::int32_t(be ? be32(p) : le32(p));
+                },
+                [](std::int32_t v) {return float(v)*(1.0f/2147483648.0f);});
+  } break;
+  case pcm_format::encoding::F32: {
+    decode_loop(src,samples,4u,dst,
+                [be](const unsigned char* p) {
+                  const std::uint32_t u = be ? be32(p) : le32(p);
+                  float v;
+                  std::memcpy(&v,&u,sizeof(v));
+                  return v;
+                },
+                [](float v) {return v;});
+  } break;
+  case pcm_format::encoding::F64: {
+    decode_loop(src,samples,8u,dst,
+                [be](const unsigned char* p) {
+                  const std::uint64_t u = be ?
+                    (std::uint64_t(be32(p))<<32) | be32(p+4) :
+                    (std::uint64_t(le32(p+4))<<32) | le32(p);
+                  double v;
+                  std::memcpy(&v,&u,sizeof(v));
+                  return v;
+                },
+                [](double v) {return float(v);});
+  } break;
+  default: {
+    std::memset(dst,0,samples*sizeof(float));
+  }
+  }
+}
+
+void encode_pcm(const float* src,
+                const std::size_t samples,
+                const pcm_format& fmt,
+                unsigned char* dst) {
+
+  const bool be = fmt.big_endian;
+  const std::size_t bytes = fmt.sample_bytes();
+  
+  switch(fmt.enc) {
+  case pcm_format::encoding::F32: {
+    if (!be) {
+      std::memcpy(dst,src,samples*sizeof(float));
+    } else {
+      for (std::size_t i=0;i<samples;++i,dst+=4) {
+        std::uint32_t u;
+        std::memcpy(&u,src+i,sizeof(u));
+        store(dst,u,4u,true);
+      }
+    }
+  } break;
+  case pcm_format::encoding::F64: {
+    for (std::size_t i=0;i<samples;++i,dst+=8) {
+      const double d = src[i];
+      std::uint64_t u;
+      std::memcpy(&u,&d,sizeof(u));
+      store(dst,u,8u,be);
+    }
+  } break;
+  case pcm_format::encoding::U8: {
+    for (std::size_t i=0;i<samples;++i) {
+      dst[i] = static_cast<unsigned char>(quantize(src[i],128.0f,127.0f)+128);
+    }
+  } break;
+  case pcm_format::encoding::S16:
+  case pcm_format::encoding::S24:
+  case pcm_format::encoding::S32: {
+    const unsigned int bits = unsigned(bytes*8u);
+    const float scale = float(1u << (bits-1u));
+    // Largest integer, or the largest float below 2^31 that a 32 bit
+    // integer can hold
+    const float max = (bits < 32u) ? scale - 1.0f :
+      std::nextafter(scale,0.0f);
+    
+    // Convert blocks of samples into integers with SIMD, and then pack
+    // them with the required number of bytes
+    constexpr std::size_t block = 256u;
+    alignas(16) std::int32_t tmp[block];
+    
+    for (std::size_t i=0;i<samples;i+=block) {
+      const std::size_t n = std::min(block,samples-i);
+      std::size_t k = (bits < 32u) ? quantize_simd(src+i,n,bits,tmp) : 0u;
+      for (;k<n;++k) {
+        tmp[k] = quantize(src[i+k],scale,max);
+      }
+
+      if ((bits == 16u) && !be) {
+        for (k=0;k<n;++k,dst+=2) {
+          const std::int16_t v = static_cast<std::int16_t>(tmp[k]);
+          std::memcpy(dst,&v,2u);
+        }
+      } else {
+        for (k=0;k<n;++k,dst+=bytes) {
+          store(dst,std::uint32_t(tmp[k]),bytes,be);
+        }
+      }
+    }
+  } break;
+  default:
+    break;
+  }
+}
@@ -0,0 +1,152 @@
+/**
+ * pcm_format.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PCM_FORMAT_H
+#define _PCM_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Description of uncompressed PCM audio stored in a file or a stream.
+ *
+ * This is the minimal information required to decode raw samples
+ * without libsndfile: the sample encoding, the byte order, the
+ * number of channels and where the samples are located.
+ */
+struct pcm_format {
+  /// Encoding of each sample
+  enum class encoding {
+    Unknown,
+    U8,
+    S16,
+    S24,
+    S32,
+    F32,
+    F64
+  };
+
+  encoding    enc = encoding::Unknown;
+  bool        big_endian = false;
+  std::size_t channels = 0u;
+  std::size_t sample_rate = 0u;
+  
+  /// Offset in bytes of the first sample from the beginning of the file
+  std::size_t data_offset = 0u;
+  /// Number of bytes of sample data, or 0 if unknown (e.g. streams)
+  std::size_t data_bytes = 0u;
+
+  /// Bytes used by one sample of one channel
+  std::size_t sample_bytes() const;
+  /// Bytes used by one frame (one sample of all channels)
+  inline std::size_t frame_bytes() const {return sample_bytes()*channels;}
+  /// True if the format can be decoded
+  inline bool valid() const {
+    return (enc != encoding::Unknown) && (channels>0u) && (sample_rate>0u);
+  }
+};
+
+/**
+ * Parse the header of a RIFF/WAVE file.
+ *
+ * The given buffer must contain the beginning of the file, at least up
+ * to the header of the "data" chunk.  Only PCM and IEEE float formats
+ * are accepted (also in the WAVE_FORMAT_EXTENSIBLE container).
+ *
+ * Returns false if the header is not a supported WAV header.
+ */
+bool parse_wav_header(const unsigned char* buf,
+                      const std::size_t size,
+                      pcm_format& fmt);
+
+/**
+ * Parse the header of an AIFF file (AIFF-C is not supported).
+ *
+ * The given buffer must contain the beginning of the file, at least up
+ * to the header of the "SSND" chunk.
+ *
+ * Returns false if the header is not a supported AIFF header.
+ */
+bool parse_aiff_header(const unsigned char* buf,
+                       const std::size_t size,
+                       pcm_format& fmt);
+
+/**
+ * Parse either a WAV or an AIFF header
+ */
+bool parse_pcm_header(const unsigned char* buf,
+                      const std::size_t size,
+                      pcm_format& fmt);
+
+/**
+ * Parse a textual description of raw PCM data, with the form
+ * "encoding[:rate[:channels]]", for instance "s16:48000:2".
+ *
+ * The encoding is one of u8, s16, s24, s32, f32 or f64, optionally
+ * followed by "be" for big endian data (e.g. "s24be").  Fields not
+ * given keep their value in fmt.
+ *
+ * Returns false if the description is not valid.
+ */
+bool parse_pcm_spec(const std::string& spec,pcm_format& fmt);
+
+/**
+ * Convert the given number of interleaved frames from the raw bytes
+ * in src, into interleaved floats in the range [-1,1) in dst.
+ *
+ * dst must have room for frames*fmt.channels floats.
+ */
+void decode_pcm(const unsigned char* src,
+                const std::size_t frames,
+                const pcm_format& fmt,
+                float* dst);
+
+/**
+ * Convert the given number of samples from floats in src into raw bytes
+ * in dst, with the encoding and byte order of fmt.  For the integer
+ * encodings, samples out of the range [-1,1) are saturated.
+ *
+ * dst must have room for samples*fmt.sample_bytes() bytes.  The
+ * little-endian integer encodings use SIMD instructions if available.
+ */
+void encode_pcm(const float* src,
+                const std::size_t samples,
+                const pcm_format& fmt,
+                unsigned char* dst);
+
+#endif
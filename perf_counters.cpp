@@ -0,0 +1,279 @@
+/**
+ * perf_counters.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "perf_counters.h"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+namespace {
+  /// Event of each counter
+  struct event_config {
+    std::uint32_t type;
+    std::uint64_t config;
+  };
+
+  const event_config configs[perf_counters::Counters] = {
+    {PERF_TYPE_HARDWARE,PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE,PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE,PERF_COUNT_HW_CACHE_L1D |
+                        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE,PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE,PERF_COUNT_HW_BRANCH_MISSES}
+  };
+
+  const char* counter_names[perf_counters::Counters] = {
+    "cycles","instructions","L1d misses","LLC misses","branch misses"
+  };
+
+  int perf_event_open(perf_event_attr* attr,const int group) {
+    return int(syscall(SYS_perf_event_open,attr,0,-1,group,
+                       PERF_FLAG_FD_CLOEXEC));
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  inline std::uint64_t rdpmc(const std::uint32_t counter) {
+    std::uint32_t lo, hi;
+    __asm__ volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(counter));
+    return std::uint64_t(lo) | (std::uint64_t(hi) << 32);
+  }
+#endif
+}
+
+perf_counters::perf_counters()
+  : _group_size(0)
+  , _rdpmc(false)
+  , _intervals(0u) {
+  for (std::size_t c=0;c<Counters;++c) {
+    _fd[c] = -1;
+    _page[c] = nullptr;
+    _group_index[c] = -1;
+    _start[c] = 0u;
+    _totals[c] = 0u;
+  }
+}
+
+perf_counters::~perf_counters() {
+  close();
+}
+
+bool perf_counters::open() {
+  close();
+
+  const std::size_t page_size = std::size_t(sysconf(_SC_PAGESIZE));
+
+  for (std::size_t c=0;c<Counters;++c) {
+    perf_event_attr attr;
+    std::memset(&attr,0,sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = configs[c].type;
+    attr.config = configs[c].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    if (c == Cycles) {
+      // The whole group is started at once, and kept on the PMU
+      attr.disabled = 1;
+      attr.pinned = 1;
+    }
+
+    _fd[c] = perf_event_open(&attr,(c == Cycles) ? -1 : _fd[Cycles]);
+    if (_fd[c] < 0) {
+      if (c == Cycles) {
+        std::cerr << "E> Unable to open performance counters: "
+                  << std::strerror(errno) << " (see "
+                  << "/proc/sys/kernel/perf_event_paranoid)" << std::endl;
+        return false;
+      }
+      std::cerr << "I> No " << counter_names[c] << " counter" << std::endl;
+      continue;
+    }
+    _group_index[c] = _group_size++;
+
+    void* page = mmap(nullptr,page_size,PROT_READ,MAP_SHARED,_fd[c],0);
+    _page[c] = (page != MAP_FAILED) ?
+      static_cast<perf_event_mmap_page*>(page) : nullptr;
+  }
+
+  ioctl(_fd[Cycles],PERF_EVENT_IOC_RESET,PERF_IOC_FLAG_GROUP);
+  ioctl(_fd[Cycles],PERF_EVENT_IOC_ENABLE,PERF_IOC_FLAG_GROUP);
+
+  // rdpmc needs the pages of all counters, and the kernel's permission
+#if defined(__x86_64__) || defined(__i386__)
+  _rdpmc = true;
+  for (std::size_t c=0;c<Counters;++c) {
+    if (_fd[c] >= 0) {
+      _rdpmc = _rdpmc && (_page[c] != nullptr) && _page[c]->cap_user_rdpmc;
+    }
+  }
+#endif
+
+  std::cerr << "I> Performance counters read with "
+            << (_rdpmc ? "rdpmc" : "read(2)") << std::endl;
+  return true;
+}
+
+void perf_counters::close() {
+  const std::size_t page_size = std::size_t(sysconf(_SC_PAGESIZE));
+  for (std::size_t c=0;c<Counters;++c) {
+    if (_page[c] != nullptr) {
+      munmap(_page[c],page_size);
+      _page[c] = nullptr;
+    }
+  }
+  // Members after the leader, which closes the group
+  for (std::size_t c=Counters;c-- > 0u;) {
+    if (_fd[c] >= 0) {
+      ::close(_fd[c]);
+      _fd[c] = -1;
+    }
+    _group_index[c] = -1;
+  }
+  _group_size = 0;
+  _rdpmc = false;
+}
+
+bool perf_counters::read(std::uint64_t* values) const {
+#if defined(__x86_64__) || defined(__i386__)
+  if (_rdpmc) {
+    bool ok = true;
+    for (std::size_t c=0;(c<Counters) && ok;++c) {
+      if (_fd[c] < 0) {
+        continue;
+      }
+      // The kernel changes the page when the counter is rescheduled
+      const volatile perf_event_mmap_page* pc = _page[c];
+      std::uint32_t seq;
+      do {
+        seq = pc->lock;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        const std::uint32_t idx = pc->index;
+        if (idx == 0u) {
+          ok = false; // not on the PMU right now
+          break;
+        }
+        const std::uint32_t shift = 64u - pc->pmc_width;
+        const std::int64_t raw = std::int64_t(rdpmc(idx - 1u) << shift);
+        values[c] = std::uint64_t(pc->offset + (raw >> shift));
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+      } while (pc->lock != seq);
+    }
+    if (ok) {
+      return true;
+    }
+  }
+#endif
+
+  std::uint64_t group[1 + Counters];
+  const ssize_t bytes = sizeof(std::uint64_t)*std::size_t(1 + _group_size);
+  if (::read(_fd[Cycles],group,std::size_t(bytes)) != bytes) {
+    return false;
+  }
+  for (std::size_t c=0;c<Counters;++c) {
+    if (_group_index[c] >= 0) {
+      values[c] = group[1 + _group_index[c]];
+    }
+  }
+  return true;
+}
+
+void perf_counters::begin() {
+  if (valid() && !read(_start)) {
+    std::fill(_start,_start + Counters,std::uint64_t(0u));
+  }
+}
+
+void perf_counters::end() {
+  std::uint64_t now[Counters];
+  if (!valid() || !read(now)) {
+    return;
+  }
+  // Only this thread writes the totals
+  for (std::size_t c=0;c<Counters;++c) {
+    if (_fd[c] >= 0) {
+      _totals[c].store(_totals[c].load(std::memory_order_relaxed) +
+                       (now[c] - _start[c]),std::memory_order_relaxed);
+    }
+  }
+  _intervals.store(_intervals.load(std::memory_order_relaxed) + 1u,
+                   std::memory_order_release);
+}
+
+perf_counters::totals perf_counters::read_totals() const {
+  totals t;
+  t.intervals = _intervals.load(std::memory_order_acquire);
+  for (std::size_t c=0;c<Counters;++c) {
+    t.value[c] = _totals[c].load(std::memory_order_relaxed);
+  }
+  return t;
+}
+
+void perf_counters::report(std::ostream& os,
+                           const totals& now,
+                           const totals& before,
+                           const perf_counters& which) {
+  const double cycles = double(now.value[Cycles] - before.value[Cycles]);
+  const double instructions =
+    double(now.value[Instructions] - before.value[Instructions]);
+  
+  os << std::fixed << std::setprecision(2);
+  if (which.available(Instructions) && (cycles > 0.0)) {
+    os << "IPC " << instructions/cycles;
+  } else {
+    os << "cycles " << cycles;
+  }
+  if (which.available(Instructions) && (instructions > 0.0)) {
+    for (std::size_t c=L1DMisses;c<Counters;++c) {
+      if (which.available(counter(c))) {
+        os << ", " << counter_names[c] << " "
+           << 1e3*double(now.value[c] - before.value[c])/instructions
+           << "/kinstr";
+      }
+    }
+  }
+  os << std::defaultfloat;
+}
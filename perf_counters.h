@@ -0,0 +1,138 @@
+/**
+ * perf_counters.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PERF_COUNTERS_H
+#define _PERF_COUNTERS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+struct perf_event_mmap_page;
+
+/**
+ * Hardware performance counters of the calling thread, read around a
+ * piece of code (e.g. the user's process()) to explain why it got
+ * slower: instructions per cycle, cache and branch misses.
+ *
+ * The counters are opened as one group with perf_event_open(2), only
+ * counting user space.  If the kernel allows it, they are read with the
+ * rdpmc instruction through the mapped page of each counter, which
+ * takes a few nanoseconds and no system call.  Otherwise the whole
+ * group is read with one read(2).
+ *
+ * open() must be called by the thread to be measured, and begin() and
+ * end() only by that thread.  The totals can be read by any thread.
+ */
+class perf_counters {
+public:
+  enum counter {
+    Cycles,
+    Instructions,
+    L1DMisses,     ///< L1 data cache read misses
+    LLCMisses,     ///< last level cache misses
+    BranchMisses,
+    Counters
+  };
+
+  /// Sums of the counters over all measured intervals
+  struct totals {
+    std::uint64_t intervals;
+    std::uint64_t value[Counters];
+  };
+
+  perf_counters();
+  ~perf_counters();
+
+  perf_counters(const perf_counters&) = delete; // not copyable
+  perf_counters& operator=(const perf_counters&) = delete; // not copyable
+
+  /**
+   * Open the counters for the calling thread.  Counters not supported by
+   * the processor are left out.  Returns false if not even cycles can be
+   * counted (e.g. without a PMU, or with a restrictive
+   * /proc/sys/kernel/perf_event_paranoid).
+   */
+  bool open();
+
+  /// Close the counters
+  void close();
+
+  inline bool valid() const {return _fd[Cycles] >= 0;}
+
+  /// True if the counter could be opened
+  inline bool available(const counter c) const {return _fd[c] >= 0;}
+
+  /// True if the counters are read with rdpmc
+  inline bool uses_rdpmc() const {return _rdpmc;}
+
+  /// Start an interval.  Wait-free with rdpmc.
+  void begin();
+
+  /// End the interval and add it to the totals
+  void end();
+
+  /// Current totals.  Counters are consistent only approximately.
+  totals read_totals() const;
+
+  /**
+   * Print instructions per cycle and misses per thousand instructions of
+   * the difference between two totals.
+   */
+  static void report(std::ostream& os,
+                     const totals& now,
+                     const totals& before,
+                     const perf_counters& which);
+
+private:
+  int _fd[Counters];
+  perf_event_mmap_page* _page[Counters];
+  /// Position of each counter in the group read, or -1
+  int _group_index[Counters];
+  int _group_size;
+  bool _rdpmc;
+
+  std::uint64_t _start[Counters];
+  std::atomic<std::uint64_t> _intervals;
+  std::atomic<std::uint64_t> _totals[Counters];
+
+  /// Read the current values of all counters
+  bool read(std::uint64_t* values) const;
+};
+
+#endif
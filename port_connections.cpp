@@ -0,0 +1,187 @@
+/**
+ * port_connections.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "port_connections.h"
+
+#include <cctype>
+#include <cerrno>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+port_connections::port_connections() {
+}
+
+port_connections port_connections::physical(const std::size_t fan_out) {
+  port_connections c;
+  c._rules.push_back({channel::Input,"",std::regex(""),1u,true});
+  if (fan_out > 0u) {
+    c._rules.push_back({channel::Output,"",std::regex(""),fan_out,true});
+  }
+  return c;
+}
+
+bool port_connections::add(const std::string& spec,std::string& error) {
+  const std::size_t eq = spec.find('=');
+  if (eq == std::string::npos) {
+    error = "expected input=REGEX or output=REGEX";
+    return false;
+  }
+
+  rule r;
+  const std::string local = spec.substr(0u,eq);
+  if (local == "input") {
+    r.local = channel::Input;
+  } else if (local == "output") {
+    r.local = channel::Output;
+  } else {
+    error = "unknown port '" + local + "'";
+    return false;
+  }
+
+  r.pattern = spec.substr(eq + 1u);
+  r.count = 1u;
+  r.physical = false;
+  
+  // Only a trailing ",N" or ",all" is a count: commas inside the regex,
+  // as in "a{1,2}", belong to the pattern
+  static const std::regex count_suffix(",([0-9]+|all)$");
+  std::smatch m;
+  if (std::regex_search(r.pattern,m,count_suffix)) {
+    const std::string count = m[1].str();
+    if (count == "all") {
+      r.count = std::numeric_limits<std::size_t>::max();
+    } else {
+      try {
+        r.count = std::stoul(count);
+      } catch (std::exception&) {
+        error = "invalid count '" + count + "'";
+        return false;
+      }
+    }
+    r.pattern.erase(std::size_t(m.position(0)));
+  }
+
+  try {
+    r.regex = std::regex(r.pattern);
+  } catch (std::regex_error& exc) {
+    error = "invalid regular expression '" + r.pattern + "': " + exc.what();
+    return false;
+  }
+
+  _rules.push_back(std::move(r));
+  return true;
+}
+
+bool port_connections::load(const std::filesystem::path& file,
+                            std::string& error) {
+  std::ifstream is(file);
+  if (!is) {
+    error = "unable to read " + file.string();
+    return false;
+  }
+  
+  std::string line;
+  for (std::size_t n=1u;std::getline(is,line);++n) {
+    // Trailing blanks and carriage returns are not part of the regex
+    while (!line.empty() &&
+           std::isspace(static_cast<unsigned char>(line.back()))) {
+      line.pop_back();
+    }
+    if (line.empty() || (line[0] == '#')) {
+      continue;
+    }
+    if (!add(line,error)) {
+      error = file.string() + ":" + std::to_string(n) + ": " + error;
+      return false;
+    }
+  }
+  return true;
+}
+
+std::size_t port_connections::apply(jack_client_t* client,
+                                    jack_port_t* input,
+                                    jack_port_t* output) const {
+  std::size_t connected = 0u;
+  
+  for (const rule& r : _rules) {
+    const bool in = (r.local == channel::Input);
+    jack_port_t* ours = in ? input : output;
+    if (ours == nullptr) {
+      continue;
+    }
+    
+    // Our input is fed by outputs, and our output feeds inputs
+    unsigned long flags = in ? JackPortIsOutput : JackPortIsInput;
+    if (r.physical) {
+      flags |= JackPortIsPhysical;
+    }
+    const char** ports =
+      jack_get_ports(client,nullptr,JACK_DEFAULT_AUDIO_TYPE,flags);
+    if (ports == nullptr) {
+      continue;
+    }
+
+    std::size_t matched = 0u;
+    for (const char** p=ports;(*p != nullptr) && (matched < r.count);++p) {
+      if (!std::regex_search(*p,r.regex)) {
+        continue;
+      }
+      jack_port_t* other = jack_port_by_name(client,*p);
+      if ((other != nullptr) && jack_port_is_mine(client,other)) {
+        continue;
+      }
+      ++matched;
+      
+      if (jack_port_connected_to(ours,*p)) {
+        continue;
+      }
+      const char* src = in ? *p : jack_port_name(ours);
+      const char* dst = in ? jack_port_name(ours) : *p;
+      const int err = jack_connect(client,src,dst);
+      if (err == 0) {
+        ++connected;
+      } else if (err != EEXIST) {
+        std::cerr << "E> Cannot connect " << src << " to " << dst
+                  << std::endl;
+      }
+    }
+    jack_free(ports);
+  }
+
+  return connected;
+}
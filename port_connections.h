@@ -0,0 +1,120 @@
+/**
+ * port_connections.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PORT_CONNECTIONS_H
+#define _PORT_CONNECTIONS_H
+
+#include <jack/jack.h>
+
+#include <cstddef>
+#include <filesystem>
+#include <regex>
+#include <string>
+#include <vector>
+
+/**
+ * Connections of the ports of the client to the rest of the jack graph,
+ * given as rules, one per channel and direction:
+ *
+ *   input=REGEX[,N]    feed our input from the outputs matching REGEX
+ *   output=REGEX[,N]   feed the inputs matching REGEX from our output
+ *
+ * REGEX is searched in the full port names (e.g. "system:playback_1"),
+ * and at most N matching ports are connected, in jack's order: 1 by
+ * default, or all of them with "all".  Only a trailing ",N" or ",all"
+ * is a count, so REGEX may contain commas, as in "_[0-9]{1,2}$".  Each
+ * extra connection of the output (a fan-out) costs the server a mixdown.
+ *
+ * Rules are applied in a single batch, after the client is activated,
+ * and again whenever a port appears; existing connections are kept.
+ */
+class port_connections {
+public:
+  /// Our port of a rule
+  enum class channel {
+    Input,
+    Output
+  };
+
+  struct rule {
+    channel local;
+    std::string pattern;
+    std::regex regex;
+    /// Most ports connected
+    std::size_t count;
+    /// Only hardware ports (the default rules)
+    bool physical;
+  };
+
+  /// Without rules: nothing is connected
+  port_connections();
+
+  /**
+   * Connect the first physical capture port to our input, and our
+   * output to the first fan_out physical playback ports.
+   */
+  static port_connections physical(const std::size_t fan_out);
+
+  /**
+   * Add a rule as "input=REGEX[,N]" or "output=REGEX[,N]".  Returns false
+   * with the reason in error if it is invalid.
+   */
+  bool add(const std::string& spec,std::string& error);
+
+  /**
+   * Add the rules of a file, one per line.  Empty lines and lines
+   * starting with '#' are ignored.
+   */
+  bool load(const std::filesystem::path& file,std::string& error);
+
+  inline bool empty() const {return _rules.empty();}
+  inline const std::vector<rule>& rules() const {return _rules;}
+
+  /**
+   * Connect the given ports of the client following the rules.  It
+   * calls the jack server, so it must not be called from jack's
+   * callbacks.  Returns the number of new connections.
+   */
+  std::size_t apply(jack_client_t* client,
+                    jack_port_t* input,
+                    jack_port_t* output) const;
+
+private:
+  std::vector<rule> _rules;
+};
+
+#endif
@@ -0,0 +1,826 @@
+/**
+ * regression_test.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file regression_test.cpp
+ *
+ * @brief Regression tests of the signal processing of the client, run by
+ * meson test.
+ *
+ * Reference stimuli (an impulse, a logarithmic sweep and white noise)
+ * are rendered through each processing mode, in blocks of several sizes,
+ * as jack's process would do with different periods.  Three checks are
+ * available:
+ *
+ * - --golden DIR compares the outputs with the ones stored in DIR, with
+ *   tolerances in ULPs and in signal to noise ratio.  With --update the
+ *   stored outputs are replaced instead.
+ * - --invariance checks that the modes that do not depend on the block
+ *   size give the same output with every block size.
+ * - --benchmark FILE measures the nanoseconds per sample of each mode,
+ *   and fails if it is worse than the one stored in FILE for this machine
+ *   by more than --threshold.  The first run on a machine stores it.
+ */
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "audio_mix.h"
+#include "compressor.h"
+#include "loudness_meter.h"
+#include "passthrough_client.h"
+
+namespace po=boost::program_options;
+
+namespace {
+  constexpr double sample_rate = 48000.0;
+
+  /// Samples of each stimulus
+  const std::size_t stimulus_length = 4800u;
+
+  /// Block sizes of the renders, like jack periods plus odd sizes
+  const std::size_t block_sizes[] = {1u,7u,32u,64u,256u,1024u};
+
+  /// Block size of the golden outputs and of the benchmark
+  const std::size_t reference_block = 64u;
+
+  // -------------------------------------------------------------------------
+  // Stimuli
+  // -------------------------------------------------------------------------
+  
+  struct stimulus {
+    const char* name;
+    std::vector<float> samples;
+  };
+
+  std::vector<float> impulse(const std::size_t n) {
+    std::vector<float> s(n,0.0f);
+    s[100u] = 1.0f;
+    return s;
+  }
+
+  /// Logarithmic sweep from 20 Hz to 20 kHz, at -6 dBFS
+  std::vector<float> sweep(const std::size_t n) {
+    std::vector<float> s(n);
+    const double f0 = 20.0, f1 = 20000.0;
+    const double t1 = double(n)/sample_rate;
+    const double k = std::log(f1/f0);
+    for (std::size_t i=0;i<n;++i) {
+      const double t = double(i)/sample_rate;
+      const double phase = 2.0*M_PI*f0*t1/k*(std::exp(t/t1*k) - 1.0);
+      s[i] = float(0.5*std::sin(phase));
+    }
+    return s;
+  }
+
+  /// Uniform white noise in [-0.5,0.5), the same on every run
+  std::vector<float> noise(const std::size_t n) {
+    std::vector<float> s(n);
+    std::uint32_t x = 0x2545f491u;
+    for (auto& v : s) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      v = float(double(x)/4294967296.0 - 0.5);
+    }
+    return s;
+  }
+
+  std::vector<stimulus> stimuli(const std::size_t n) {
+    return {{"impulse",impulse(n)},{"sweep",sweep(n)},{"noise",noise(n)}};
+  }
+
+  /// Sine wave, used as the file voices
+  std::vector<float> tone(const std::size_t n,const double freq,
+                          const double amplitude) {
+    std::vector<float> s(n);
+    for (std::size_t i=0;i<n;++i) {
+      s[i] = float(amplitude*std::sin(2.0*M_PI*freq*double(i)/sample_rate));
+    }
+    return s;
+  }
+  
+  // -------------------------------------------------------------------------
+  // Processing modes
+  // -------------------------------------------------------------------------
+
+  /**
+   * One processing mode, fed block after block.  The output of a render
+   * are the processed samples, followed by what finish() appends (e.g.
+   * measurements).
+   */
+  class processor {
+  public:
+    virtual ~processor() = default;
+    
+    /// Process the n samples of the block starting at frame
+    virtual void process(const std::size_t frame,
+                         const float* in,float* out,
+                         const std::size_t n) = 0;
+
+    /// Append the results of the whole render
+    virtual void finish(std::vector<float>&) {}
+  };
+
+  /// Live gain (see jack::client::set_live_gain())
+  class gain_mode : public processor {
+  public:
+    virtual void process(const std::size_t,const float* in,float* out,
+                         const std::size_t n) override {
+      mix_scale(out,in,0.5f,n);
+    }
+  };
+
+  /**
+   * Cycles of the shipped client, a passthrough_client, rendered offline
+   * through its run_cycle() as replay() does.  Each block is one cycle.
+   * The client is a monostate, so only one render may use it at a time.
+   */
+  class client_mode : public processor {
+  public:
+    /**
+     * @param silence threshold of the silence detection, negative to
+     *                disable it (see jack::client::set_silence_threshold())
+     */
+    client_mode(const float silence = -1.0f)
+      : _silence(silence) {}
+
+    virtual ~client_mode() {
+      if (_started) {
+        shipped_client().end_offline();
+      }
+    }
+
+    virtual void process(const std::size_t frame,const float* in,float* out,
+                         const std::size_t n) override {
+      passthrough_client& client = shipped_client();
+      if (!_started) {
+        // The first block is the longest one
+        client.set_crossfade(crossfade_ms);
+        client.set_silence_threshold(_silence);
+        client.begin_offline(jack_nframes_t(sample_rate),jack_nframes_t(n));
+        _started = true;
+      }
+
+      jack::client::voice_blocks blocks{};
+      for (std::size_t v=0;v<sndfile_thread::max_voices;++v) {
+        _samples[v].assign(n,0.0f);
+        _blocks[v] = sndfile_thread::file_block(_samples[v].data(),n);
+        if (block(v,frame,_blocks[v])) {
+          _blocks[v].status = sndfile_thread::Status::Playing;
+          blocks[v] = &_blocks[v];
+        }
+      }
+      client.render_cycle(jack_nframes_t(n),jack_nframes_t(frame),in,out,
+                          blocks);
+    }
+
+  protected:
+    /// Length of the crossfades between the input and the files
+    static constexpr double crossfade_ms = 5.0;
+
+    /**
+     * Fill the file block of voice v for the cycle starting at frame, as
+     * the file thread would, or return false if the voice has none.
+     */
+    virtual bool block(const std::size_t,const std::size_t,
+                       sndfile_thread::file_block&) {
+      return false;
+    }
+
+  private:
+    static passthrough_client& shipped_client() {
+      static passthrough_client client;
+      return client;
+    }
+    
+    float _silence;
+    bool _started = false;
+    std::array<std::vector<float>,sndfile_thread::max_voices> _samples;
+    std::array<sndfile_thread::file_block,sndfile_thread::max_voices> _blocks;
+  };
+
+  /// passthrough_client::process() alone
+  class passthrough_mode : public client_mode {
+  };
+
+  /// Two file voices mixed on top of the input
+  class voices_mode : public client_mode {
+  public:
+    voices_mode(const std::size_t length)
+      : _a(tone(length,440.0,0.25)), _b(tone(length,1250.0,0.5)) {}
+
+  protected:
+    virtual bool block(const std::size_t v,const std::size_t frame,
+                       sndfile_thread::file_block& b) override {
+      if ((v != 1u) && (v != 2u)) {
+        return false;
+      }
+      const std::vector<float>& file = (v == 1u) ? _a : _b;
+      std::copy(file.begin() + frame,file.begin() + frame + b.size(),
+                b.begin());
+      b.gain = (v == 1u) ? 0.7f : -0.3f;
+      b.frames = b.size();
+      return true;
+    }
+  private:
+    std::vector<float> _a, _b;
+  };
+
+  /**
+   * A file replacing the input with equal-power crossfades: it starts at
+   * frame 500, its fade out ends with its last sample at frame 3000, and
+   * both fades may span several blocks.
+   */
+  class crossfade_mode : public client_mode {
+  public:
+    crossfade_mode(const std::size_t length)
+      : _file(tone(length,1000.0,0.5)) {}
+
+  protected:
+    virtual bool block(const std::size_t v,const std::size_t frame,
+                       sndfile_thread::file_block& b) override {
+      const std::size_t n = b.size();
+      if ((v != 0u) || (frame + n <= file_start) || (frame >= file_end)) {
+        return false;
+      }
+
+      // The file starts within the first block, after the live samples
+      const std::size_t first = std::max(frame,file_start);
+      const std::size_t last = std::min(frame + n,file_end);
+      std::copy(_file.begin() + first,_file.begin() + last,
+                b.begin() + (first - frame));
+      b.first = (frame <= file_start);
+      b.live = first - frame;
+      b.frames = last - first;
+
+      const std::size_t fade = file_end - fade_length;
+      if ((fade >= frame) && (fade < frame + n)) {
+        b.fade_out = fade - frame;
+      }
+      return true;
+    }
+  private:
+    static constexpr std::size_t file_start = 500u;
+    static constexpr std::size_t file_end = 3000u;
+    static constexpr std::size_t fade_length =
+      std::size_t(crossfade_ms*1e-3*sample_rate + 0.5);
+    
+    std::vector<float> _file;
+  };
+
+  /// Peak and RMS meters of the statistics, over the whole render
+  class levels_mode : public processor {
+  public:
+    virtual void process(const std::size_t,const float* in,float* out,
+                         const std::size_t n) override {
+      float peak = 0.0f, energy = 0.0f;
+      mix_levels(in,n,peak,energy);
+      _peak = std::max(_peak,peak);
+      _energy += energy;
+      _samples += n;
+      memcpy(out,in,sizeof(float)*n);
+    }
+
+    virtual void finish(std::vector<float>& out) override {
+      out.push_back(_peak);
+      out.push_back(float(std::sqrt(_energy/double(std::max<std::size_t>(
+        _samples,1u)))));
+    }
+  private:
+    float _peak = 0.0f;
+    double _energy = 0.0;
+    std::size_t _samples = 0u;
+  };
+  
+  /**
+   * Blocks below -60 dBFS are replaced by silence, as the client does
+   * when process() has settled.  The decision is taken per block, so the
+   * output depends on the block size.
+   */
+  class silence_mode : public client_mode {
+  public:
+    silence_mode() : client_mode(1e-3f) {}
+  };
+  
+  /**
+   * Compressor of the output (see jack::client::set_compressor()), with
+   * its largest gain reduction appended.  The recursive parts run sample
+   * by sample, so the output does not depend on the block size.
+   */
+  class compressor_mode : public processor {
+  public:
+    compressor_mode(const compressor::settings& settings) {
+      _compressor.configure(settings,sample_rate);
+    }
+    
+    virtual void process(const std::size_t,const float* in,float* out,
+                         const std::size_t n) override {
+      _compressor.process(in,out,n);
+      _reduction = std::max(_reduction,_compressor.gain_reduction_db());
+    }
+
+    virtual void finish(std::vector<float>& out) override {
+      out.push_back(_reduction);
+    }
+  private:
+    compressor _compressor;
+    float _reduction = 0.0f;
+  };
+
+  /// RMS compressor at -20 dBFS, 4:1, with makeup
+  compressor::settings rms_compressor() {
+    compressor::settings s;
+    s.threshold_db = -20.0f;
+    s.ratio = 4.0f;
+    s.attack_ms = 2.0f;
+    s.release_ms = 30.0f;
+    s.makeup_db = 3.0f;
+    s.mode = compressor::detector::Rms;
+    return s;
+  }
+
+  /// Peak limiter at -12 dBFS with 1 ms of lookahead
+  compressor::settings peak_limiter() {
+    compressor::settings s;
+    s.threshold_db = -12.0f;
+    s.ratio = std::numeric_limits<float>::infinity();
+    s.attack_ms = 0.5f;
+    s.release_ms = 20.0f;
+    s.lookahead_ms = 1.0f;
+    return s;
+  }
+  
+  /**
+   * EBU R128 meter of the output.  The stimuli are shorter than the
+   * windows, so after the render they are measured 40 more times (4 s)
+   * before the momentary, short-term and integrated loudness and the
+   * true peak are appended.
+   */
+  class loudness_mode : public processor {
+  public:
+    loudness_mode() {
+      _meter.configure(sample_rate);
+    }
+    
+    virtual void process(const std::size_t,const float* in,float* out,
+                         const std::size_t n) override {
+      _meter.process(in,n);
+      _input.insert(_input.end(),in,in + n);
+      memcpy(out,in,sizeof(float)*n);
+    }
+
+    virtual void finish(std::vector<float>& out) override {
+      for (int i=0;i<40;++i) {
+        _meter.process(_input.data(),_input.size());
+      }
+      out.push_back(_meter.momentary());
+      out.push_back(_meter.short_term());
+      out.push_back(_meter.integrated());
+      out.push_back(_meter.true_peak());
+    }
+  private:
+    loudness_meter _meter;
+    std::vector<float> _input;
+  };
+  
+  /**
+   * A mode, and how close its renders must be to the golden outputs and
+   * to each other.  Two outputs match if their largest difference is
+   * within ulps, or if the error is below the signal by snr_db.
+   */
+  struct mode {
+    const char* name;
+    std::function<std::unique_ptr<processor>(std::size_t length)> create;
+    /// Whether the output must not depend on the block size
+    bool block_invariant;
+    std::uint32_t ulps;
+    double snr_db;
+  };
+
+  const std::vector<mode>& modes() {
+    static const std::vector<mode> all = {
+      {"gain",
+       [](std::size_t) {return std::make_unique<gain_mode>();},
+       true,0u,200.0},
+      {"passthrough",
+       [](std::size_t) {return std::make_unique<passthrough_mode>();},
+       true,0u,200.0},
+      {"voices",
+       [](std::size_t n) {return std::make_unique<voices_mode>(n);},
+       true,2u,120.0},
+      {"crossfade",
+       [](std::size_t n) {return std::make_unique<crossfade_mode>(n);},
+       true,2u,120.0},
+      {"levels",
+       [](std::size_t) {return std::make_unique<levels_mode>();},
+       true,16u,100.0},
+      {"silence",
+       [](std::size_t) {return std::make_unique<silence_mode>();},
+       false,0u,200.0},
+      {"compressor",
+       [](std::size_t) {
+         return std::make_unique<compressor_mode>(rms_compressor());},
+       true,16u,100.0},
+      {"limiter",
+       [](std::size_t) {
+         return std::make_unique<compressor_mode>(peak_limiter());},
+       true,16u,100.0},
+      {"loudness",
+       [](std::size_t) {return std::make_unique<loudness_mode>();},
+       true,16u,100.0}
+    };
+    return all;
+  }
+
+  /// Process the whole input in blocks of the given size
+  std::vector<float> render(const mode& m,const std::vector<float>& in,
+                            const std::size_t block) {
+    std::unique_ptr<processor> p = m.create(in.size());
+    std::vector<float> out(in.size());
+    for (std::size_t frame=0;frame<in.size();frame+=block) {
+      const std::size_t n = std::min(block,in.size() - frame);
+      p->process(frame,in.data() + frame,out.data() + frame,n);
+    }
+    p->finish(out);
+    return out;
+  }
+
+  // -------------------------------------------------------------------------
+  // Comparisons
+  // -------------------------------------------------------------------------
+
+  /// Floats mapped to integers in the same order, to count ULPs
+  std::int64_t ordered(const float x) {
+    std::int32_t i;
+    memcpy(&i,&x,sizeof(i));
+    return (i < 0) ? std::int64_t(std::numeric_limits<std::int32_t>::min())
+      - std::int64_t(i) : std::int64_t(i);
+  }
+
+  struct difference {
+    std::uint64_t max_ulps = 0u;
+    std::size_t worst = 0u;  ///< sample with the largest difference
+    double snr_db = std::numeric_limits<double>::infinity();
+    bool same_size = true;
+  };
+
+  difference compare(const std::vector<float>& ref,
+                     const std::vector<float>& out) {
+    difference d;
+    if (ref.size() != out.size()) {
+      d.same_size = false;
+      return d;
+    }
+    double signal = 0.0, error = 0.0;
+    for (std::size_t i=0;i<ref.size();++i) {
+      const std::uint64_t ulps =
+        std::uint64_t(std::abs(ordered(ref[i]) - ordered(out[i])));
+      if (ulps > d.max_ulps) {
+        d.max_ulps = ulps;
+        d.worst = i;
+      }
+      const double e = double(out[i]) - double(ref[i]);
+      signal += double(ref[i])*double(ref[i]);
+      error += e*e;
+    }
+    if (error > 0.0) {
+      d.snr_db = (signal > 0.0) ? 10.0*std::log10(signal/error) : 0.0;
+    }
+    return d;
+  }
+
+  /// Check and report a comparison
+  bool check(const mode& m,const std::string& what,const difference& d) {
+    const bool ok = d.same_size &&
+      ((d.max_ulps <= m.ulps) || (d.snr_db >= m.snr_db));
+    std::cout << (ok ? "ok   " : "FAIL ") << m.name << " " << what;
+    if (!d.same_size) {
+      std::cout << ": different length";
+    } else if (d.max_ulps > 0u) {
+      std::cout << ": " << d.max_ulps << " ulps at sample " << d.worst
+                << ", SNR " << std::fixed << std::setprecision(1)
+                << d.snr_db << " dB";
+    }
+    std::cout << std::endl;
+    return ok;
+  }
+  
+  // -------------------------------------------------------------------------
+  // Golden outputs
+  // -------------------------------------------------------------------------
+
+  /// Golden outputs are raw native floats, one file per mode and stimulus
+  std::filesystem::path golden_file(const std::filesystem::path& dir,
+                                    const mode& m,const stimulus& s) {
+    return dir / (std::string(m.name) + "-" + s.name + ".f32");
+  }
+
+  bool read_golden(const std::filesystem::path& file,std::vector<float>& v) {
+    std::ifstream is(file,std::ios::binary | std::ios::ate);
+    if (!is) {
+      return false;
+    }
+    v.resize(std::size_t(is.tellg())/sizeof(float));
+    is.seekg(0);
+    return bool(is.read(reinterpret_cast<char*>(v.data()),
+                        std::streamsize(v.size()*sizeof(float))));
+  }
+
+  bool write_golden(const std::filesystem::path& file,
+                    const std::vector<float>& v) {
+    std::ofstream os(file,std::ios::binary | std::ios::trunc);
+    os.write(reinterpret_cast<const char*>(v.data()),
+             std::streamsize(v.size()*sizeof(float)));
+    return bool(os);
+  }
+  
+  bool golden(const std::vector<const mode*>& selected,
+              const std::filesystem::path& dir,
+              const bool update) {
+    bool ok = true;
+    if (update) {
+      std::filesystem::create_directories(dir);
+    }
+    for (const stimulus& s : stimuli(stimulus_length)) {
+      for (const mode* m : selected) {
+        const std::vector<float> out = render(*m,s.samples,reference_block);
+        const std::filesystem::path file = golden_file(dir,*m,s);
+        if (update) {
+          if (!write_golden(file,out)) {
+            std::cerr << "E> Unable to write " << file << std::endl;
+            ok = false;
+          }
+          continue;
+        }
+        std::vector<float> ref;
+        if (!read_golden(file,ref)) {
+          std::cout << "FAIL " << m->name << " " << s.name
+                    << ": missing " << file << std::endl;
+          ok = false;
+          continue;
+        }
+        ok = check(*m,std::string(s.name) + " vs golden",
+                   compare(ref,out)) && ok;
+      }
+    }
+    return ok;
+  }
+
+  bool invariance(const std::vector<const mode*>& selected) {
+    bool ok = true;
+    for (const stimulus& s : stimuli(stimulus_length)) {
+      for (const mode* m : selected) {
+        if (!m->block_invariant) {
+          continue;
+        }
+        const std::vector<float> ref = render(*m,s.samples,reference_block);
+        for (const std::size_t block : block_sizes) {
+          if (block == reference_block) {
+            continue;
+          }
+          ok = check(*m,std::string(s.name) + " in blocks of " +
+                     std::to_string(block) + " vs " +
+                     std::to_string(reference_block),
+                     compare(ref,render(*m,s.samples,block))) && ok;
+        }
+      }
+    }
+    return ok;
+  }
+
+  // -------------------------------------------------------------------------
+  // Performance
+  // -------------------------------------------------------------------------
+
+  /**
+   * Nanoseconds per sample of the mode, the best of several renders of a
+   * second of noise, to leave out interruptions of the process.
+   */
+  double ns_per_sample(const mode& m,const std::size_t repeats) {
+    const std::vector<float> in = noise(std::size_t(sample_rate));
+    std::unique_ptr<processor> p = m.create(in.size());
+    std::vector<float> out(in.size());
+    
+    double best = std::numeric_limits<double>::max();
+    for (std::size_t r=0;r<repeats;++r) {
+      const auto start = std::chrono::steady_clock::now();
+      for (std::size_t frame=0;frame<in.size();frame+=reference_block) {
+        const std::size_t n = std::min(reference_block,in.size() - frame);
+        p->process(frame,in.data() + frame,out.data() + frame,n);
+      }
+      const std::chrono::duration<double,std::nano> t =
+        std::chrono::steady_clock::now() - start;
+      best = std::min(best,t.count()/double(in.size()));
+    }
+    return best;
+  }
+
+  std::string host_name() {
+    char name[256] = {};
+    if (gethostname(name,sizeof(name) - 1u) != 0) {
+      return "unknown";
+    }
+    return name;
+  }
+  
+  /**
+   * The baseline file has one line per machine and mode:
+   * "host mode ns_per_sample".
+   */
+  typedef std::map<std::pair<std::string,std::string>,double> baseline_map;
+
+  baseline_map read_baseline(const std::filesystem::path& file) {
+    baseline_map baseline;
+    std::ifstream is(file);
+    std::string line;
+    while (std::getline(is,line)) {
+      std::istringstream ls(line);
+      std::string host, name;
+      double ns;
+      if ((line.empty()) || (line[0] == '#') || !(ls >> host >> name >> ns)) {
+        continue;
+      }
+      baseline[{host,name}] = ns;
+    }
+    return baseline;
+  }
+
+  bool write_baseline(const std::filesystem::path& file,
+                      const baseline_map& baseline) {
+    std::ofstream os(file,std::ios::trunc);
+    os << "# host mode ns_per_sample, written by tarea3-regression\n";
+    for (const auto& [key,ns] : baseline) {
+      os << key.first << " " << key.second << " " << ns << "\n";
+    }
+    return bool(os);
+  }
+  
+  bool benchmark(const std::vector<const mode*>& selected,
+                 const std::filesystem::path& file,
+                 const double threshold,
+                 const std::size_t repeats,
+                 const bool update) {
+    baseline_map baseline = read_baseline(file);
+    const std::string host = host_name();
+    bool ok = true, changed = false;
+
+    for (const mode* m : selected) {
+      const double ns = ns_per_sample(*m,repeats);
+      auto it = baseline.find({host,m->name});
+
+      std::cout << std::fixed << std::setprecision(3);
+      if ((it == baseline.end()) || update) {
+        std::cout << "ok   " << m->name << ": " << ns
+                  << " ns/sample, stored as baseline" << std::endl;
+        baseline[{host,m->name}] = ns;
+        changed = true;
+        continue;
+      }
+      const double limit = it->second*(1.0 + threshold);
+      const bool fast = (ns <= limit);
+      std::cout << (fast ? "ok   " : "FAIL ") << m->name << ": " << ns
+                << " ns/sample, baseline " << it->second
+                << ", limit " << limit << std::endl;
+      ok = ok && fast;
+    }
+
+    if (changed && !write_baseline(file,baseline)) {
+      std::cerr << "E> Unable to write " << file << std::endl;
+      ok = false;
+    }
+    return ok;
+  }
+}
+
+int main(int argc,char *argv[]) {
+
+  try {
+    std::filesystem::path golden_dir;
+    std::filesystem::path baseline_file;
+    std::vector<std::string> names;
+    double threshold = 0.25;
+    std::size_t repeats = 20u;
+    
+    po::options_description desc("Allowed options");
+
+    desc.add_options()
+      ("help,h","show usage information")
+      ("golden",
+       po::value<std::filesystem::path>(&golden_dir),
+       "Compare the outputs with the golden ones in this directory")
+      ("update","write the golden outputs or the baseline instead of "
+       "checking them")
+      ("invariance","check that the outputs do not depend on the block size")
+      ("benchmark",
+       po::value<std::filesystem::path>(&baseline_file),
+       "Compare the nanoseconds per sample with the baseline of this "
+       "machine in this file")
+      ("threshold",
+       po::value<double>(&threshold)->default_value(0.25),
+       "Largest slowdown allowed by --benchmark, as a fraction")
+      ("repeats",
+       po::value<std::size_t>(&repeats)->default_value(20u),
+       "Renders measured by --benchmark, keeping the fastest")
+      ("mode,m",
+       po::value<std::vector<std::string> >(&names)->multitoken(),
+       "Check only these modes");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc,argv,desc),vm);
+    po::notify(vm);
+    
+    if (vm.count("help")) {
+      std::cout << desc << std::endl;
+      std::cout << "Modes:";
+      for (const mode& m : modes()) {
+        std::cout << " " << m.name;
+      }
+      std::cout << std::endl;
+      return EXIT_SUCCESS;
+    }
+
+    std::vector<const mode*> selected;
+    for (const mode& m : modes()) {
+      if (names.empty() ||
+          (std::find(names.begin(),names.end(),m.name) != names.end())) {
+        selected.push_back(&m);
+      }
+    }
+    if (selected.empty()) {
+      std::cerr << "E> No such mode" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    const bool update = vm.count("update") != 0u;
+    bool ok = true;
+    if (vm.count("golden")) {
+      ok = golden(selected,golden_dir,update) && ok;
+    }
+    if (vm.count("invariance")) {
+      ok = invariance(selected) && ok;
+    }
+    if (vm.count("benchmark")) {
+      ok = benchmark(selected,baseline_file,threshold,repeats,update) && ok;
+    }
+    
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  catch (std::exception& exc) {
+    std::cerr << exc.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}
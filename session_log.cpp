@@ -0,0 +1,297 @@
+/**
+ * session_log.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "session_log.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace session_log {
+  std::uint64_t hash(const float* samples,const std::size_t n) {
+    // FNV-1a over the bit patterns, one sample at a time
+    std::uint64_t h = 0xcbf29ce484222325u;
+    for (std::size_t i=0;i<n;++i) {
+      std::uint32_t bits;
+      std::memcpy(&bits,samples + i,sizeof(bits));
+      h = (h ^ bits)*0x100000001b3u;
+    }
+    return h;
+  }
+}
+
+using session_log::record_type;
+
+session_recorder::session_recorder()
+  : _active(false)
+  , _used(0u)
+  , _overflow(false)
+  , _sample_rate(0u)
+  , _buffer_size(0u)
+  , _cycle_rate(0u)
+  , _cycle_buffer(0u)
+  , _lost(0u)
+  , _lost_total(0u)
+  , _running(false) {
+}
+
+session_recorder::~session_recorder() {
+  close();
+}
+
+bool session_recorder::open(const std::filesystem::path& file,
+                            const session_log::header& hdr,
+                            const std::size_t capacity,
+                            const std::size_t max_frames) {
+  close();
+
+  _file.open(file,std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!_file) {
+    std::cerr << "E> Unable to create the session log " << file << std::endl;
+    return false;
+  }
+  session_log::header h = hdr;
+  h.magic = session_log::magic;
+  h.version = session_log::version;
+  _file.write(reinterpret_cast<const char*>(&h),sizeof(h));
+
+  _sample_rate = _cycle_rate = h.sample_rate;
+  _buffer_size = _cycle_buffer = h.buffer_size;
+
+  // Input, all voices, shared memory and output, plus room for commands
+  _staging.assign((sndfile_thread::max_voices + 3u)*
+                  (max_frames*sizeof(float) + 64u) + 65536u,0);
+  _used = 0u;
+  _overflow = false;
+  _lost = 0u;
+  _lost_total = 0u;
+
+  _ring.allocate(capacity);
+  _running = true;
+  _thread = std::thread(&session_recorder::run,this);
+  _active = true;
+
+  std::cerr << "I> Recording the session to " << file << std::endl;
+  return true;
+}
+
+void session_recorder::close() {
+  if (!_active) {
+    return;
+  }
+  _active = false;
+  _running = false;
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+  drain();
+  _file.close();
+  
+  if (_lost_total.load() > 0u) {
+    std::cerr << "I> Session log lost " << _lost_total.load()
+              << " cycles: it can only be replayed up to the first gap"
+              << std::endl;
+  }
+}
+
+void session_recorder::put(const void* data,const std::size_t bytes) {
+  if (_used + bytes > _staging.size()) {
+    _overflow = true;
+    return;
+  }
+  std::memcpy(_staging.data() + _used,data,bytes);
+  _used += bytes;
+}
+
+void session_recorder::append(const record_type type,
+                              const void* head,const std::size_t head_bytes,
+                              const float* samples,const std::size_t n) {
+  const std::uint32_t prefix[2] = {
+    std::uint32_t(type),std::uint32_t(head_bytes + n*sizeof(float))
+  };
+  put(prefix,sizeof(prefix));
+  put(head,head_bytes);
+  if (n > 0u) {
+    put(samples,n*sizeof(float));
+  }
+}
+
+void session_recorder::command(const std::uint32_t what,
+                               const float value,
+                               const std::vector<std::vector<float> >* c) {
+  if (!_active) {
+    return;
+  }
+  
+  session_log::command_record rec{what,value,0u};
+  std::size_t bytes = sizeof(rec);
+  if (c != nullptr) {
+    rec.rows = std::uint32_t(c->size());
+    for (const auto& row : *c) {
+      bytes += sizeof(std::uint32_t) + row.size()*sizeof(float);
+    }
+  }
+
+  const std::uint32_t prefix[2] = {
+    std::uint32_t(record_type::Command),std::uint32_t(bytes)
+  };
+  put(prefix,sizeof(prefix));
+  put(&rec,sizeof(rec));
+  if (c != nullptr) {
+    for (const auto& row : *c) {
+      const std::uint32_t len = std::uint32_t(row.size());
+      put(&len,sizeof(len));
+      put(row.data(),row.size()*sizeof(float));
+    }
+  }
+}
+
+void session_recorder::begin_cycle(const std::uint64_t index,
+                                   const std::uint32_t frame_time,
+                                   const std::uint32_t nframes,
+                                   const std::uint32_t sample_rate,
+                                   const std::uint32_t buffer_size,
+                                   const float* in) {
+  if (!_active) {
+    return;
+  }
+
+  // The initial state, logged before the first cycle
+  if (_used > 0u) {
+    flush_cycle();
+  }
+
+  if (_lost > 0u) {
+    const session_log::gap_record gap{_lost};
+    append(record_type::Gap,&gap,sizeof(gap));
+  }
+  if ((sample_rate != _sample_rate) || (buffer_size != _buffer_size)) {
+    const session_log::format_record fmt{sample_rate,buffer_size};
+    append(record_type::Format,&fmt,sizeof(fmt));
+  }
+  _cycle_rate = sample_rate;
+  _cycle_buffer = buffer_size;
+  
+  const session_log::cycle_record cycle{index,frame_time,nframes};
+  append(record_type::Cycle,&cycle,sizeof(cycle));
+  append(record_type::Input,nullptr,0u,in,nframes);
+}
+
+void session_recorder::block(const std::uint32_t voice,
+                             const sndfile_thread::file_block& b) {
+  if (!_active) {
+    return;
+  }
+  const session_log::block_record rec{
+    voice,std::uint32_t(b.size()),std::uint32_t(b.live),
+    std::uint32_t(b.frames),b.first ? 1u : 0u,
+    (b.fade_out == sndfile_thread::file_block::no_fade) ?
+      0xffffffffu : std::uint32_t(b.fade_out),
+    b.gain
+  };
+  append(record_type::Block,&rec,sizeof(rec),b.begin(),b.size());
+}
+
+void session_recorder::shm(const float* samples,const std::size_t n) {
+  if (_active) {
+    append(record_type::Shm,nullptr,0u,samples,n);
+  }
+}
+
+void session_recorder::end_cycle(const float* out,const std::size_t n) {
+  if (!_active) {
+    return;
+  }
+  const session_log::output_record rec{session_log::hash(out,n)};
+  append(record_type::Output,&rec,sizeof(rec));
+  flush_cycle();
+}
+
+void session_recorder::flush_cycle() {
+  if (!_overflow && (_ring.writable() >= _used)) {
+    _ring.push(_staging.data(),_used);
+    // The log knows the format of this cycle from now on
+    _sample_rate = _cycle_rate;
+    _buffer_size = _cycle_buffer;
+    _lost = 0u;
+  } else {
+    ++_lost;
+    _lost_total.fetch_add(1u,std::memory_order_relaxed);
+  }
+  _used = 0u;
+  _overflow = false;
+}
+
+void session_recorder::drain() {
+  char chunk[65536];
+  for (std::size_t n; (n = _ring.pop(chunk,sizeof(chunk))) > 0u;) {
+    _file.write(chunk,std::streamsize(n));
+  }
+}
+
+void session_recorder::run() {
+  while (_running) {
+    drain();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Player
+// ---------------------------------------------------------------------------
+
+bool session_player::open(const std::filesystem::path& file) {
+  _file.open(file,std::ios::in | std::ios::binary);
+  if (!_file.read(reinterpret_cast<char*>(&_header),sizeof(_header)) ||
+      (_header.magic != session_log::magic) ||
+      (_header.version != session_log::version)) {
+    std::cerr << "E> " << file << " is not a session log of this version"
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool session_player::next(record& r) {
+  std::uint32_t prefix[2];
+  if (!_file.read(reinterpret_cast<char*>(prefix),sizeof(prefix))) {
+    return false;
+  }
+  r.type = record_type(prefix[0]);
+  r.payload.resize(prefix[1]);
+  return bool(_file.read(r.payload.data(),std::streamsize(prefix[1])));
+}
@@ -0,0 +1,261 @@
+/**
+ * session_log.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SESSION_LOG_H
+#define _SESSION_LOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include "sndfile_thread.h"
+#include "spsc_ringbuffer.h"
+
+/**
+ * Binary log of everything that reaches jack's process, to replay a
+ * realtime session offline and bit-exactly (see jack::client::replay()).
+ *
+ * The log starts with a header, followed by records, all in the byte
+ * order of the host:
+ *
+ *   record:  uint32 type, uint32 bytes of payload, payload
+ *
+ * Each cycle starts with a Cycle record and ends with an Output record
+ * holding a hash of the output samples, which replays compare against.
+ * In between come the commands applied in the cycle, the live input,
+ * the file blocks taken by each voice and the shared memory block, in
+ * this order.  Format records precede the cycles where the sample rate
+ * or the buffer size changed.  Commands before the first cycle are the
+ * state of the client when the recording started.
+ *
+ * The samples of the file blocks are logged, not their file positions,
+ * so the files are not needed to replay the session.
+ */
+namespace session_log {
+  constexpr std::uint32_t magic = 0x4c523354u; // "T3RL"
+  constexpr std::uint32_t version = 1u;
+
+  enum class record_type : std::uint32_t {
+    Format = 1u, ///< format_record
+    Cycle,       ///< cycle_record
+    Command,     ///< command_record, then rows of coefficients
+    Input,       ///< samples of the live input
+    Block,       ///< block_record, then its samples
+    Shm,         ///< samples of the shared memory input
+    Output,      ///< output_record
+    Gap          ///< gap_record: cycles lost by the recorder
+  };
+
+  struct header {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t sample_rate;
+    std::uint32_t buffer_size;
+    double crossfade_ms;
+  };
+
+  struct format_record {
+    std::uint32_t sample_rate;
+    std::uint32_t buffer_size;
+  };
+
+  struct cycle_record {
+    std::uint64_t index;
+    std::uint32_t frame_time;
+    std::uint32_t nframes;
+  };
+
+  /**
+   * Followed by rows times: uint32 length, and length floats
+   */
+  struct command_record {
+    std::uint32_t what;
+    float value;
+    std::uint32_t rows;
+  };
+
+  /// Followed by size floats
+  struct block_record {
+    std::uint32_t voice;
+    std::uint32_t size;
+    std::uint32_t live;
+    std::uint32_t frames;
+    std::uint32_t first;
+    std::uint32_t fade_out;  ///< 0xffffffff without fade
+    float gain;
+  };
+
+  struct output_record {
+    std::uint64_t hash;
+  };
+
+  struct gap_record {
+    std::uint64_t cycles;
+  };
+
+  /// Hash of the output samples, compared bit by bit
+  std::uint64_t hash(const float* samples,const std::size_t n);
+}
+
+/**
+ * Writer of session logs.
+ *
+ * jack's process assembles each cycle in a preallocated buffer, and
+ * pushes it as a whole into a lock-free ring at the end of the cycle.  A
+ * normal thread writes the ring to the file.  If the ring is full, the
+ * cycle is lost and a Gap record tells the replay where the log stops
+ * being exact.
+ */
+class session_recorder {
+public:
+  session_recorder();
+  ~session_recorder();
+
+  session_recorder(const session_recorder&) = delete; // not copyable
+  session_recorder& operator=(const session_recorder&) = delete;
+
+  /**
+   * Create the log and start the writer thread.  The ring holds capacity
+   * bytes, and cycles up to max_frames frames can be logged.
+   */
+  bool open(const std::filesystem::path& file,
+            const session_log::header& hdr,
+            const std::size_t capacity = 16u*1024u*1024u,
+            const std::size_t max_frames = 8192u);
+
+  /// Write what is still buffered and close the log
+  void close();
+
+  /// True while recording
+  inline bool active() const {return _active;}
+
+  /// Cycles lost because the writer could not keep up
+  inline std::uint64_t lost_cycles() const {return _lost_total.load();}
+
+  /**
+   * Log a command.  Before the first cycle, it is part of the initial
+   * state.
+   */
+  void command(const std::uint32_t what,
+               const float value,
+               const std::vector<std::vector<float> >* coefficients);
+
+  /// Start logging a cycle with its live input
+  void begin_cycle(const std::uint64_t index,
+                   const std::uint32_t frame_time,
+                   const std::uint32_t nframes,
+                   const std::uint32_t sample_rate,
+                   const std::uint32_t buffer_size,
+                   const float* in);
+
+  /// Log the file block taken by a voice
+  void block(const std::uint32_t voice,
+             const sndfile_thread::file_block& b);
+
+  /// Log the samples taken from shared memory
+  void shm(const float* samples,const std::size_t n);
+
+  /// Log the hash of the output, and send the cycle to the writer
+  void end_cycle(const float* out,const std::size_t n);
+
+private:
+  std::ofstream _file;
+  bool _active;
+
+  /// Records of the current cycle
+  std::vector<char> _staging;
+  std::size_t _used;
+  /// The current cycle did not fit in _staging
+  bool _overflow;
+  /// Format of the last cycle logged, and of the current one
+  std::uint32_t _sample_rate;
+  std::uint32_t _buffer_size;
+  std::uint32_t _cycle_rate;
+  std::uint32_t _cycle_buffer;
+  /// Cycles lost since the last one logged
+  std::uint64_t _lost;
+  std::atomic<std::uint64_t> _lost_total;
+
+  spsc_ringbuffer<char> _ring;
+  std::atomic<bool> _running;
+  std::thread _thread;
+
+  /// Append a record to the cycle
+  void append(const session_log::record_type type,
+              const void* head,const std::size_t head_bytes,
+              const float* samples = nullptr,const std::size_t n = 0u);
+
+  /// Append raw bytes to the current record
+  void put(const void* data,const std::size_t bytes);
+
+  /// Push the cycle into the ring, or count it as lost
+  void flush_cycle();
+
+  /// The writer thread
+  void run();
+  /// Write everything in the ring to the file
+  void drain();
+};
+
+/**
+ * Reader of session logs, for replays.
+ */
+class session_player {
+public:
+  struct record {
+    session_log::record_type type;
+    std::vector<char> payload;
+  };
+
+  /// Open the log and check its header
+  bool open(const std::filesystem::path& file);
+
+  inline const session_log::header& header() const {return _header;}
+
+  /// Read the next record.  Returns false at the end of the log.
+  bool next(record& r);
+
+private:
+  std::ifstream _file;
+  session_log::header _header{};
+};
+
+#endif
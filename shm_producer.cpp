@@ -0,0 +1,159 @@
+/** @file shm_producer.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file shm_producer.cpp
+ *
+ * @brief Test tool that generates synthetic stimuli and writes them into
+ * the shared memory ring of a running jack client (see shm_ring.h).
+ */
+
+#include <cstdlib>
+#include <cmath>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "shm_ring.h"
+
+namespace po=boost::program_options;
+
+int main(int argc,char *argv[]) {
+
+  try {
+    std::string name;
+    std::string signal;
+    double freq;
+    double amplitude;
+    double seconds;
+    std::size_t block;
+    
+    po::options_description desc("Allowed options");
+
+    desc.add_options()
+      ("help,h","show usage information")
+      ("name,n",
+       po::value<std::string>(&name)->default_value("/tarea3-in"),
+       "Name of the shared memory segment")
+      ("signal,s",
+       po::value<std::string>(&signal)->default_value("sine"),
+       "Stimulus: sine, noise or impulse")
+      ("freq",
+       po::value<double>(&freq)->default_value(1000.0),
+       "Frequency of the sine, or of the impulses, in Hz")
+      ("amplitude,a",
+       po::value<double>(&amplitude)->default_value(0.5),
+       "Peak amplitude")
+      ("seconds,t",
+       po::value<double>(&seconds)->default_value(5.0),
+       "Duration of the stimulus")
+      ("block,b",
+       po::value<std::size_t>(&block)->default_value(256u),
+       "Frames written at once");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc,argv,desc),vm);
+    po::notify(vm);
+    
+    if (vm.count("help")) {
+      std::cout << desc << std::endl;
+      return EXIT_SUCCESS;
+    }
+
+    shm_ring ring;
+    if (!ring.attach(name)) {
+      std::cerr << "E> Unable to attach to '" << name
+                << "'.  Is the client running with --shm?" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    const double rate = double(ring.sample_rate());
+    const std::size_t total = std::size_t(seconds*rate);
+    block = std::min(block,ring.capacity());
+    
+    std::cout << "I> Writing " << total << " frames at " << rate
+              << " Hz into '" << name << "'" << std::endl;
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dist(-1.0f,1.0f);
+    const std::size_t impulse_period =
+      std::max(std::size_t(1u),std::size_t(rate/freq));
+    
+    auto next = std::chrono::steady_clock::now();
+    const auto block_time =
+      std::chrono::duration<double>(double(block)/rate);
+    
+    std::size_t written = 0u;
+    while (written < total) {
+      const std::size_t n = std::min(block,total-written);
+      
+      // Wait for room in the ring, at the pace of the client
+      float* dst = ring.reserve(n);
+      if (dst == nullptr) {
+        next += std::chrono::duration_cast<std::chrono::steady_clock::duration>
+          (block_time);
+        std::this_thread::sleep_until(next);
+        continue;
+      }
+
+      for (std::size_t i=0;i<n;++i) {
+        const std::size_t k = written + i;
+        if (signal == "noise") {
+          dst[i] = float(amplitude)*dist(gen);
+        } else if (signal == "impulse") {
+          dst[i] = (k % impulse_period == 0u) ? float(amplitude) : 0.0f;
+        } else {
+          dst[i] = float(amplitude*std::sin(2.0*M_PI*freq*double(k)/rate));
+        }
+      }
+      ring.commit(n);
+      written += n;
+    }
+
+    std::cout << "I> Done" << std::endl;
+  }
+  catch (std::exception& exc) {
+    std::cout << argv[0] << ": Error: " << exc.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
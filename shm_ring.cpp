@@ -0,0 +1,244 @@
+/**
+ * shm_ring.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "shm_ring.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+namespace {
+  /// Bytes reserved for the header, in front of the data
+  constexpr std::size_t header_bytes = 4096u;
+}
+
+shm_ring::shm_ring()
+  : _name()
+  , _owner(false)
+  , _fd(-1)
+  , _header(nullptr)
+  , _data(nullptr)
+  , _capacity(0u)
+  , _mapped_bytes(0u) {
+}
+
+shm_ring::~shm_ring() {
+  close();
+}
+
+bool shm_ring::map(const std::size_t capacity) {
+  const std::size_t data_bytes = capacity*sizeof(float);
+  _mapped_bytes = header_bytes + 2u*data_bytes;
+
+  // Reserve the address space for the header and two copies of the data
+  char* base = static_cast<char*>(mmap(nullptr,_mapped_bytes,PROT_NONE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS,-1,0));
+  if (base == MAP_FAILED) {
+    _mapped_bytes = 0u;
+    return false;
+  }
+
+  if ((mmap(base,header_bytes + data_bytes,PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_FIXED,_fd,0) == MAP_FAILED) ||
+      (mmap(base + header_bytes + data_bytes,data_bytes,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_FIXED,_fd,header_bytes) == MAP_FAILED)) {
+    munmap(base,_mapped_bytes);
+    _mapped_bytes = 0u;
+    return false;
+  }
+
+  _header = reinterpret_cast<header*>(base);
+  _data = reinterpret_cast<float*>(base + header_bytes);
+  _capacity = capacity;
+  
+  return true;
+}
+
+bool shm_ring::create(const std::string& name,
+                      const std::size_t capacity,
+                      const std::size_t sample_rate) {
+  close();
+
+  // The mirror needs the data region to be a multiple of the page size
+  const std::size_t cap = std::bit_ceil(std::max(capacity,
+                                                 header_bytes/sizeof(float)));
+
+  shm_unlink(name.c_str()); // remove stale segments of crashed instances
+  _fd = shm_open(name.c_str(),O_CREAT | O_EXCL | O_RDWR,0600);
+  if (_fd < 0) {
+    std::cerr << "E> Unable to create shared memory '" << name << "': "
+              << std::strerror(errno) << std::endl;
+    return false;
+  }
+  _name = name;
+  _owner = true;
+
+  if ((ftruncate(_fd,off_t(header_bytes + cap*sizeof(float))) != 0) ||
+      !map(cap)) {
+    std::cerr << "E> Unable to map shared memory '" << name << "'"
+              << std::endl;
+    close();
+    return false;
+  }
+
+  // The new file is zero filled.  Set the header, and the magic at last
+  new (&_header->write_index) std::atomic<std::uint64_t>(0u);
+  new (&_header->read_index) std::atomic<std::uint64_t>(0u);
+  _header->version = version;
+  _header->channels = 1u;
+  _header->sample_rate = std::uint32_t(sample_rate);
+  _header->capacity = cap;
+  _header->dropped = 0u;
+  std::atomic_thread_fence(std::memory_order_release);
+  _header->magic = magic;
+  
+  return true;
+}
+
+bool shm_ring::attach(const std::string& name) {
+  close();
+
+  _fd = shm_open(name.c_str(),O_RDWR,0);
+  if (_fd < 0) {
+    return false;
+  }
+  _name = name;
+  _owner = false;
+
+  // Read the header first, to know the size of the segment
+  void* hdr = mmap(nullptr,header_bytes,PROT_READ,MAP_SHARED,_fd,0);
+  if (hdr == MAP_FAILED) {
+    close();
+    return false;
+  }
+  
+  const header* h = static_cast<const header*>(hdr);
+  const bool ok = (h->magic == magic) && (h->version == version) &&
+                  (h->channels == 1u) && std::has_single_bit(h->capacity);
+  const std::size_t cap = h->capacity;
+  munmap(hdr,header_bytes);
+  
+  if (!ok || !map(cap)) {
+    close();
+    return false;
+  }
+  
+  return true;
+}
+
+void shm_ring::close() {
+  if (_header != nullptr) {
+    munmap(_header,_mapped_bytes);
+  }
+  if (_fd >= 0) {
+    ::close(_fd);
+  }
+  if (_owner) {
+    shm_unlink(_name.c_str());
+  }
+  
+  _name.clear();
+  _owner = false;
+  _fd = -1;
+  _header = nullptr;
+  _data = nullptr;
+  _capacity = 0u;
+  _mapped_bytes = 0u;
+}
+
+std::size_t shm_ring::readable() const {
+  if (_header == nullptr) {
+    return 0u;
+  }
+  const std::uint64_t w = _header->write_index.load(std::memory_order_acquire);
+  const std::uint64_t r = _header->read_index.load(std::memory_order_relaxed);
+  return std::size_t(std::min<std::uint64_t>(w - r,_capacity));
+}
+
+const float* shm_ring::peek(const std::size_t n) const {
+  if ((n > _capacity) || (readable() < n)) {
+    return nullptr;
+  }
+  const std::uint64_t r = _header->read_index.load(std::memory_order_relaxed);
+  return _data + (r & (_capacity-1u));
+}
+
+void shm_ring::consume(const std::size_t n) {
+  const std::uint64_t r = _header->read_index.load(std::memory_order_relaxed);
+  _header->read_index.store(r + n,std::memory_order_release);
+}
+
+std::size_t shm_ring::writable() const {
+  if (_header == nullptr) {
+    return 0u;
+  }
+  const std::uint64_t w = _header->write_index.load(std::memory_order_relaxed);
+  const std::uint64_t r = _header->read_index.load(std::memory_order_acquire);
+  return _capacity - std::size_t(std::min<std::uint64_t>(w - r,_capacity));
+}
+
+float* shm_ring::reserve(const std::size_t n) {
+  if ((n > _capacity) || (writable() < n)) {
+    return nullptr;
+  }
+  const std::uint64_t w = _header->write_index.load(std::memory_order_relaxed);
+  return _data + (w & (_capacity-1u));
+}
+
+void shm_ring::commit(const std::size_t n) {
+  const std::uint64_t w = _header->write_index.load(std::memory_order_relaxed);
+  _header->write_index.store(w + n,std::memory_order_release);
+}
+
+std::size_t shm_ring::write(const float* src,const std::size_t n) {
+  const std::size_t m = std::min(n,writable());
+  if (m > 0u) {
+    std::memcpy(reserve(m),src,m*sizeof(float));
+    commit(m);
+  }
+  if (m < n) {
+    _header->dropped += n - m;
+  }
+  return m;
+}
@@ -0,0 +1,175 @@
+/**
+ * shm_ring.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SHM_RING_H
+#define _SHM_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Single-producer single-consumer ring of audio samples in POSIX shared
+ * memory, used to feed audio from other local processes into the jack
+ * client without files and without copies.
+ *
+ * The client creates the segment (create()), and one external producer
+ * attaches to it by name (attach()).  The layout of the segment, for
+ * producers not using this class, is:
+ *
+ * | offset | type      | content                                      |
+ * |--------|-----------|----------------------------------------------|
+ * |      0 | uint32    | magic number 0x4d485354 ("TSHM")             |
+ * |      4 | uint32    | layout version (1)                           |
+ * |      8 | uint32    | channels (always 1)                          |
+ * |     12 | uint32    | sample rate, equal to jack's                 |
+ * |     16 | uint64    | capacity in frames, a power of two           |
+ * |     24 | uint64    | frames dropped by the producer (statistics)  |
+ * |     64 | uint64    | write index: total frames written            |
+ * |    128 | uint64    | read index: total frames read                |
+ * |   4096 | float32[] | capacity frames of data                      |
+ *
+ * All numbers are in the byte order of the host.  Frame i of the
+ * stream is stored at data[i % capacity].  The producer writes samples
+ * and then publishes them by storing the new write index with release
+ * semantics; the consumer does the same with the read index.  The
+ * producer must never write more than capacity - (write - read) frames.
+ *
+ * Both sides map the data region twice, one copy right after the other,
+ * so that any run of up to capacity frames is contiguous in memory even
+ * if it wraps around the end of the ring.  That lets jack's process use
+ * the samples in place.
+ */
+class shm_ring {
+public:
+  static constexpr std::uint32_t magic = 0x4d485354u;
+  static constexpr std::uint32_t version = 1u;
+  
+  /// Layout of the first page of the segment
+  struct header {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t channels;
+    std::uint32_t sample_rate;
+    std::uint64_t capacity;
+    std::uint64_t dropped;
+    alignas(64) std::atomic<std::uint64_t> write_index;
+    alignas(64) std::atomic<std::uint64_t> read_index;
+  };
+  
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+                "shared memory counters must be lock free");
+  
+  shm_ring();
+  ~shm_ring();
+
+  shm_ring(const shm_ring&) = delete; // not copyable
+  shm_ring& operator=(const shm_ring&) = delete; // not copyable
+
+  /**
+   * Create (or replace) the named segment, as its consumer.
+   *
+   * The capacity is rounded up to a power of two of at least one page.
+   * The segment is removed from the system when this object is closed.
+   */
+  bool create(const std::string& name,
+              const std::size_t capacity,
+              const std::size_t sample_rate);
+
+  /// Attach to an existing segment, as its producer
+  bool attach(const std::string& name);
+
+  /// Unmap the segment (and remove it, if this object created it)
+  void close();
+
+  inline bool valid() const {return _header != nullptr;}
+  inline std::size_t capacity() const {return _capacity;}
+  inline std::size_t sample_rate() const {
+    return (_header != nullptr) ? _header->sample_rate : 0u;
+  }
+
+  /**
+   * Consumer: number of frames ready to be read
+   */
+  std::size_t readable() const;
+
+  /**
+   * Consumer: pointer to the next n contiguous frames, or nullptr if
+   * there are less than n frames available.
+   *
+   * This is wait-free and can be called from jack's process.
+   */
+  const float* peek(const std::size_t n) const;
+
+  /// Consumer: release n frames read with peek()
+  void consume(const std::size_t n);
+
+  /// Producer: number of frames that can be written
+  std::size_t writable() const;
+
+  /**
+   * Producer: pointer where the next n frames can be written in place,
+   * or nullptr if there is not enough room.  Publish them with commit().
+   */
+  float* reserve(const std::size_t n);
+
+  /// Producer: publish n frames written in the reserved region
+  void commit(const std::size_t n);
+
+  /**
+   * Producer: copy up to n frames into the ring, and publish them.
+   *
+   * Returns the number of frames written.  Frames not written are
+   * counted as dropped.
+   */
+  std::size_t write(const float* src,const std::size_t n);
+  
+private:
+  std::string _name;
+  bool _owner;
+  int _fd;
+  header* _header;
+  float* _data;
+  std::size_t _capacity;
+  std::size_t _mapped_bytes;
+
+  /// Map the segment with the data region mirrored
+  bool map(const std::size_t capacity);
+};
+
+#endif
@@ -36,13 +36,20 @@
  */
 
 #include "sndfile_thread.h"
+#include "tracer.h"
 
 #include <sndfile.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include <cassert>
 #include <chrono>
+#include <stdexcept>
+#include <limits>
 #include <iostream>
+#include <cstring>
 #include <algorithm>
+#include <cmath>
 
 
 
@@ -52,81 +59,106 @@
 
 sndfile_thread::file_block::file_block()
   : status(Status::Garbage)
+  , scheduled(false)
+  , start(0u)
+  , gain(1.0f)
+  , live(0u)
+  , frames(0u)
+  , first(false)
+  , fade_out(no_fade)
+  , _data(nullptr)
   , _end(nullptr) {}
 
 sndfile_thread::file_block::~file_block() {
-  status = Status::Garbage;
-  _data.reset();
-  _end=nullptr;
 }
 
-sndfile_thread::file_block::file_block(std::size_t size)
+sndfile_thread::file_block::file_block(float* data,std::size_t size)
   : status(Status::Garbage)
-  , _data(new float[size])
-  , _end(_data.get()+size) {
+  , scheduled(false)
+  , start(0u)
+  , gain(1.0f)
+  , live(0u)
+  , frames(0u)
+  , first(false)
+  , fade_out(no_fade)
+  , _data(data)
+  , _end(data+size) {
   
-  if (size==0) {
-    _data.reset();
+  if ((size==0) || (data==nullptr)) {
+    _data=nullptr;
     _end=nullptr;
   }
   
 }
 
-sndfile_thread::file_block::file_block(const file_block& other) {
-  this->operator=(other);
+sndfile_thread::file_block::file_block(const file_block& other)
+  : status(other.status.load())
+  , scheduled(other.scheduled)
+  , start(other.start)
+  , gain(other.gain)
+  , live(other.live)
+  , frames(other.frames)
+  , first(other.first)
+  , fade_out(other.fade_out)
+  , _data(other._data)
+  , _end(other._end) {
 }
 
 sndfile_thread::file_block&
 sndfile_thread::file_block::operator=(const file_block& other) {
-  
-  if (this == &other) {
-    return *this;
-  }
-  
-  status = other.status;
-  if (other.empty()) {
-    _data.reset();
-    _end=nullptr;
-  } else {
-    _data.reset(new float[other.size()]);
-    _end=_data.get()+other.size();
-    std::copy(other.begin(),other.end(),this->begin());
-  }
+  status    = other.status.load();
+  scheduled = other.scheduled;
+  start     = other.start;
+  gain      = other.gain;
+  live      = other.live;
+  frames    = other.frames;
+  first     = other.first;
+  fade_out  = other.fade_out;
+  _data     = other._data;
+  _end      = other._end;
   return *this;
 }
 
-sndfile_thread::file_block::file_block(file_block&& other) {
-  this->operator=(other);
+sndfile_thread::file_block::file_block(file_block&& other) noexcept
+  : status(other.status.load())
+  , scheduled(other.scheduled)
+  , start(other.start)
+  , gain(other.gain)
+  , live(other.live)
+  , frames(other.frames)
+  , first(other.first)
+  , fade_out(other.fade_out)
+  , _data(other._data)
+  , _end(other._end) {
+  other.status = Status::Garbage;
+  other._data  = nullptr;
+  other._end   = nullptr;
 }
 
 sndfile_thread::file_block&
-sndfile_thread::file_block::operator=(file_block&& other) {
+sndfile_thread::file_block::operator=(file_block&& other) noexcept {
   if (this == &other) {
     return *this;
   }
 
-  status = other.status;
-  other.status = Status::Garbage;
+  status    = other.status.load();
+  scheduled = other.scheduled;
+  start     = other.start;
+  gain      = other.gain;
+  live      = other.live;
+  frames    = other.frames;
+  first     = other.first;
+  fade_out  = other.fade_out;
+  _data     = other._data;
+  _end      = other._end;
   
-  if (other.empty()) {
-    _data.reset();
-    _end=nullptr;
-  } else {
-    _data = std::move(other._data);
-    _end=other._end;
-    other._end=nullptr;
-  }
+  other.status = Status::Garbage;
+  other._data  = nullptr;
+  other._end   = nullptr;
 
   return *this;
 }
 
-
-void sndfile_thread::file_block::resize(size_t size) {
-  status = Status::Garbage;
-  _data.reset(new float[size]);
-  _end=_data.get()+size;
-}
-
 /******************************
  * sndfile_thread
  ******************************/
@@ -135,45 +167,169 @@ void sndfile_thread::file_block::resize(size_t size) {
 sndfile_thread::sndfile_thread()
   : _block_size(0u)
   , _ringbuffer_size(0u)
-  , _buffer()
   , _sampling_rate(0u)
   , _running(false)
-  , _file_handler(nullptr)
-  , _playing_file(false) {
+  , _notify_fd(eventfd(0u,EFD_NONBLOCK | EFD_CLOEXEC))
+  , _warm_period(1u)
+  , _warm_countdown(0u)
+  , _cycle_start(0u)
+  , _cycle_known(false)
+  , _late_starts(0u)
+  , _prefetch_misses(0u)
+  , _rounds(0u) {
 }
 
-                               
+
 
 sndfile_thread::sndfile_thread(const std::size_t block_size,
                                const std::size_t sampling_rate,
-                               const std::size_t buffer_size)
+                               const std::size_t buffer_size,
+                               const unsigned int arena_options)
   : _block_size(block_size)
   , _ringbuffer_size(buffer_size)
-  , _buffer(buffer_size,file_block(block_size))
   , _sampling_rate(sampling_rate)
   , _running(false)
-  , _file_handler(nullptr)
-  , _playing_file(false) {
+  , _notify_fd(eventfd(0u,EFD_NONBLOCK | EFD_CLOEXEC))
+  , _warm_period(1u)
+  , _warm_countdown(0u)
+  , _cycle_start(0u)
+  , _cycle_known(false)
+  , _late_starts(0u)
+  , _prefetch_misses(0u)
+  , _rounds(0u) {
+  allocate_blocks(arena_options);
 }
 
 sndfile_thread::~sndfile_thread() {
+  stop();
+  if (_notify_fd >= 0) {
+    close(_notify_fd);
+  }
+}
+
+void sndfile_thread::stop() {
   _running=false;
   if (_thread.joinable()) {
     _thread.join();
   }
+  // The readers may still have requests in the ring
+  for (auto& v : _voices) {
+    v.reader.reset();
+    v.playing = false;
+    discard_ready_blocks(v);
+  }
+}
+
+void sndfile_thread::suspend() {
+  _running=false;
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+
+  std::lock_guard<std::mutex> lock(_playlist_mutex);
+
+  // Backwards, so that the voices keep their order in the requests
+  for (std::size_t i=max_voices;i-- > 0u;) {
+    voice& v = _voices[i];
+    if (!v.playing) {
+      continue;
+    }
+
+    playlist_entry entry{v.file,false,0u,v.loop,v.gain,v.pan};
+
+    if (!stream_reader::is_stream(v.file) && !v.start_pending) {
+      // The blocks read but not played yet are read again
+      std::size_t unplayed = 0u;
+      for (std::size_t b=0;b<v.buffer.size();++b) {
+        const file_block& block = v.buffer[b];
+        if (block.status.load() == Status::ReadyToPlay) {
+          unplayed += block.frames;
+        }
+      }
+      const std::size_t back = unplayed*v.sample_rate/_sampling_rate;
+
+      // unless the reader wrapped around the loop meanwhile
+      const bool may_wrap = (v.loop.repeats != 0) || v.loop_cache_ready;
+      entry.position = v.position;
+      if ((back <= v.position) &&
+          (!may_wrap || (v.position < v.loop.start) ||
+           (v.position - back >= v.loop.start))) {
+        entry.position -= back;
+      }
+    }
+
+    if (i == 0u) {
+      _playlist.push_front(entry);
+    } else {
+      _voice_requests.push_front(entry);
+    }
+  }
+
+  stop();
+}
+
+void sndfile_thread::notify_finished() {
+  ++_finished;
+  const std::uint64_t one = 1u;
+  if ((_notify_fd >= 0) &&
+      (write(_notify_fd,&one,sizeof(one)) != ssize_t(sizeof(one)))) {
+    std::cerr << "E> Unable to notify a finished file" << std::endl;
+  }
+}
+
+std::size_t sndfile_thread::finished_files() {
+  std::uint64_t count = 0u;
+  if ((_notify_fd >= 0) &&
+      (read(_notify_fd,&count,sizeof(count)) != ssize_t(sizeof(count)))) {
+    count = 0u;
+  }
+  return std::size_t(count);
+}
+
+bool sndfile_thread::idle() {
+  std::lock_guard<std::mutex> lock(_playlist_mutex);
+  if (!_playlist.empty() || !_voice_requests.empty()) {
+    return false;
+  }
+  for (const auto& v : _voices) {
+    if (v.playing.load()) {
+      return false;
+    }
+  }
+  return true;
 }
 
 void sndfile_thread::init(const std::size_t block_size,
                           const std::size_t sampling_rate,
-                          const std::size_t buffer_size) {
-  if (!_playing_file) {
+                          const std::size_t buffer_size,
+                          const unsigned int arena_options) {
+  if (!_running) {
     _block_size = block_size;
     _ringbuffer_size = buffer_size;
-    _buffer.allocate(buffer_size,file_block(block_size));
+    allocate_blocks(arena_options);
     _sampling_rate = sampling_rate;
-    _running = false;
-    _file_handler = nullptr;
-    _playing_file = false;
+    for (auto& v : _voices) {
+      v.reader.reset();
+      v.playing = false;
+    }
+  }
+}
+
+void sndfile_thread::allocate_blocks(const unsigned int arena_options) {
+  // One slab for the blocks of all voices
+  if (!_arena.allocate(max_voices*_ringbuffer_size*
+                       block_arena::padded(_block_size),
+                       arena_options)) {
+    throw std::runtime_error("Could not allocate memory for audio blocks");
+  }
+
+  // The blocks are views, so the ring buffers are first filled with empty
+  // ones, which then get their own region of the slab.
+  for (auto& v : _voices) {
+    v.buffer.allocate(_ringbuffer_size,file_block());
+    for (std::size_t i=0;i<_ringbuffer_size;++i) {
+      v.buffer[i] = file_block(_arena.carve(_block_size),_block_size);
+    }
   }
 }
 
@@ -184,168 +340,697 @@ void sndfile_thread::init(const std::size_t block_size,
  * be marked as Garbage, to signalize it can be reused.
  *
  * Return nullptr if no valid block available
- */  
-sndfile_thread::file_block* sndfile_thread::next_block() {
-  
-  for (std::size_t i=0;i<_buffer.size(); ++i) {
-    file_block& block = _buffer[i];
-    if (block.status == Status::ReadyToPlay) {
-      block.status = Status::Playing;
-      return &block;
+ */
+sndfile_thread::file_block*
+sndfile_thread::next_block(const std::uint32_t cycle_start) {
+  return next_block(0u,cycle_start);
+}
+
+sndfile_thread::file_block*
+sndfile_thread::next_block(const std::size_t voice_idx,
+                           const std::uint32_t cycle_start) {
+
+  _cycle_start.store(cycle_start,std::memory_order_relaxed);
+  _cycle_known.store(true,std::memory_order_release);
+
+  voice& v = _voices[voice_idx];
+  prealloc_ringbuffer<file_block>& buffer = v.buffer;
+
+  for (std::size_t i=0;i<buffer.size(); ++i) {
+    file_block& block = buffer[i];
+    if (block.status.load(std::memory_order_acquire) == Status::ReadyToPlay) {
+      if (block.scheduled) {
+        // Frame times wrap around, so compare their difference
+        const std::int32_t ahead = std::int32_t(block.start - cycle_start);
+        if (ahead > 0) {
+          return nullptr; // not yet
+        }
+        if (ahead < 0) {
+          // The cycle phase changed (e.g. after an xrun): play it right
+          // away
+          _late_starts.fetch_add(1u,std::memory_order_relaxed);
+        }
+      }
+      // The reader may have discarded the block in the meantime
+      Status expected = Status::ReadyToPlay;
+      if (block.status.compare_exchange_strong(expected,Status::Playing)) {
+        v.delivering.store(true,std::memory_order_relaxed);
+        return &block;
+      }
     }
   }
 
+  // The voice is still reading its file, but fell behind
+  if (v.playing.load(std::memory_order_relaxed) &&
+      v.delivering.load(std::memory_order_relaxed)) {
+    _prefetch_misses.fetch_add(1u,std::memory_order_relaxed);
+  }
+
   return nullptr;
 }
 
-bool sndfile_thread::append_file(const std::filesystem::path& file) {
-  if (std::filesystem::exists(file)) {
+bool sndfile_thread::append_file(const std::filesystem::path& file,
+                                 const loop_region& loop) {
+  if (stream_reader::is_stream(file) || std::filesystem::exists(file)) {
 
     std::lock_guard<std::mutex> lock(_playlist_mutex);
-    _playlist.push_back(file);
-    
+    _playlist.push_back(playlist_entry{file,false,0u,loop});
+
+    return true;
+  }
+  return false;
+
+}
+
+bool sndfile_thread::schedule_file(const std::filesystem::path& file,
+                                   const std::uint32_t start,
+                                   const loop_region& loop) {
+  if (stream_reader::is_stream(file) || std::filesystem::exists(file)) {
+
+    std::lock_guard<std::mutex> lock(_playlist_mutex);
+    _playlist.push_back(playlist_entry{file,true,start,loop});
+
     return true;
   }
   return false;
-    
+}
+
+bool sndfile_thread::add_voice(const std::filesystem::path& file,
+                               const float gain,
+                               const float pan,
+                               const bool scheduled,
+                               const std::uint32_t start,
+                               const loop_region& loop) {
+  if (!stream_reader::is_stream(file) && !std::filesystem::exists(file)) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(_playlist_mutex);
+
+  std::size_t busy = _voice_requests.size();
+  for (std::size_t i=1;i<max_voices;++i) {
+    if (_voices[i].playing.load()) {
+      ++busy;
+    }
+  }
+  if (busy >= max_voices-1) {
+    return false;
+  }
+
+  _voice_requests.push_back(playlist_entry{file,scheduled,start,loop,
+                                           gain,std::clamp(pan,-1.0f,1.0f)});
+  return true;
+}
+
+void sndfile_thread::set_fade_length(const std::size_t samples) {
+  _fade_length = samples;
+}
+
+void sndfile_thread::seek(const std::size_t frame) {
+  std::lock_guard<std::mutex> lock(_playlist_mutex);
+  _pending_seek = frame;
+}
+
+void sndfile_thread::set_loop(const loop_region& loop) {
+  std::lock_guard<std::mutex> lock(_playlist_mutex);
+  _pending_loop = loop;
+}
+
+void sndfile_thread::set_stream_format(const pcm_format& raw,
+                                       const double jitter_ms) {
+  std::lock_guard<std::mutex> lock(_playlist_mutex);
+  _stream_format = raw;
+  _stream_jitter_ms = jitter_ms;
 }
 
 bool sndfile_thread::stop_files() {
   std::lock_guard<std::mutex> lock(_playlist_mutex);
-  _playing_file=false;
   _playlist.clear();
+  _voice_requests.clear();
+
+  // The voices are closed by the reader thread
+  _pending_stop = true;
 
-  // Clear the ringbuffer
-  while (!_buffer.empty()) {
-    _buffer.pop_front();
-  }
-  
   return true;
 }
 
 
 
 void sndfile_thread::spawn() {
-  if (!_running) {
+  if (!_running.exchange(true)) {
     _thread = std::thread(&sndfile_thread::run,this);
   }
 }
 
+bool sndfile_thread::wait_primed(const std::chrono::milliseconds timeout) {
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  
+  // The round running now may have missed the last playlist entries
+  const std::size_t primed = _rounds.load(std::memory_order_acquire) + 2u;
+  while (_running &&
+         (_rounds.load(std::memory_order_acquire) < primed) &&
+         (std::chrono::steady_clock::now() < deadline)) {
+    std::this_thread::sleep_for(std::chrono::microseconds(250));
+  }
+
+  const voice& main = _voices[0];
+  for (std::size_t i=0;i<main.buffer.size();++i) {
+    if (main.buffer[i].status.load(std::memory_order_acquire) ==
+        Status::ReadyToPlay) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void sndfile_thread::check_files() {
-  while (!_playing_file) {
+  tracer::scope span(tracer::CheckFiles);
+  
+  // The playlist, one file after the other
+  voice& main = _voices[0];
+  while (!main.playing) {
     std::unique_lock<std::mutex> lock(_playlist_mutex);
     if (_playlist.empty()) {
-      return;
+      break;
     }
-    else {
-      std::filesystem::path file=_playlist.front();
-      _playlist.pop_front();
-      lock.unlock();
-      
-      // Try to open the file
-      SF_INFO info;
-      info.format = 0; // this has to be set to zero before calling sf_open
-      _file_handler = sf_open(file.c_str(),SFM_READ,&info);
-      
-      if (_file_handler == 0) { // not zero if error
-        std::cout << "Error opening file: '" << file << "'" << std::endl;
-        continue;
+    const playlist_entry entry=_playlist.front();
+    _playlist.pop_front();
+    lock.unlock();
+
+    open_voice(main,entry);
+  }
+
+  // New voices, on any free slot
+  for (std::size_t i=1;i<max_voices;++i) {
+    voice& v = _voices[i];
+    while (!v.playing) {
+      std::unique_lock<std::mutex> lock(_playlist_mutex);
+      if (_voice_requests.empty()) {
+        return;
       }
-      
-      _current_file_sample_rate = info.samplerate;
-      _current_file_channels    = info.channels;
-
-      _cache_size = (_block_size * _current_file_sample_rate +
-                     _sampling_rate - 1)/_sampling_rate;
-      
-      _file_cache.resize(_current_file_channels * _cache_size);
-      
-      // File seems to work
-      _playing_file=true;
+      const playlist_entry entry=_voice_requests.front();
+      _voice_requests.pop_front();
+      lock.unlock();
+
+      open_voice(v,entry);
+    }
+  }
+}
+
+bool sndfile_thread::open_voice(voice& v,const playlist_entry& entry) {
+  const std::filesystem::path& file=entry.file;
+
+  // Try to open the file
+  v.reader = open_reader(file);
+
+  if (!v.reader) {
+    std::cout << "Error opening file: '" << file << "'" << std::endl;
+    notify_finished();
+    return false;
+  }
+
+  v.file            = file;
+  v.frames          = v.reader->frames();
+  v.position        = entry.position;
+  v.reader_position = 0u;
+  v.gain            = entry.gain;
+  v.pan             = entry.pan;
+  v.first_block     = true;
+  v.fade_marked     = false;
+  v.start_pending   = entry.scheduled;
+  v.scheduled_start = entry.start;
+
+  prepare_format(v);
+
+  start_loop(v,entry.loop);
+
+  // File seems to work.  Its first blocks are not there yet, which is
+  // not a miss.
+  v.delivering = false;
+  v.playing = true;
+  return true;
+}
+
+void sndfile_thread::prepare_format(voice& v) {
+  v.sample_rate     = v.reader->sample_rate();
+  v.channels        = v.reader->channels();
+
+  // Equal-power balance of stereo files.  The weights also average all
+  // channels, and are all 1/channels at the center.
+  v.weights.assign(v.channels,1.0f/float(std::max(v.channels,std::size_t(1u))));
+  if (v.channels == 2u) {
+    const float angle = float(M_PI/4.0)*(v.pan + 1.0f);
+    v.weights[0] = float(M_SQRT1_2)*std::cos(angle);
+    v.weights[1] = float(M_SQRT1_2)*std::sin(angle);
+  }
+
+  v.cache_size = (_block_size * v.sample_rate +
+                  _sampling_rate - 1)/_sampling_rate;
+
+  v.file_cache.resize(v.channels * v.cache_size);
+}
+
+void sndfile_thread::close_voice(voice& v) {
+  v.reader.reset();
+  v.playing = false;
+  discard_ready_blocks(v);
+}
+
+std::unique_ptr<audio_reader>
+sndfile_thread::open_reader(const std::filesystem::path& file) {
+  std::unique_ptr<audio_reader> reader;
+
+  if (stream_reader::is_stream(file)) {
+    pcm_format raw;
+    double jitter_ms;
+    {
+      std::lock_guard<std::mutex> lock(_playlist_mutex);
+      raw = _stream_format;
+      jitter_ms = _stream_jitter_ms;
+    }
+    reader = std::make_unique<stream_reader>(raw,jitter_ms);
+    return reader->open(file) ? std::move(reader) : nullptr;
+  }
+
+#ifdef HAVE_LIBURING
+  if (_uring && _uring->valid()) {
+    reader = std::make_unique<uring_reader>(*_uring);
+    if (reader->open(file)) {
+      return reader;
     }
   }
+#endif
+
+  reader = std::make_unique<sndfile_reader>();
+  if (reader->open(file)) {
+    return reader;
+  }
+
+  return nullptr;
 }
 
 void sndfile_thread::read_buffers() {
-  if (_playing_file) {
-    // Garbage collect
-    while(!_buffer.empty() && (_buffer.front().status == Status::Garbage)) {
-      _buffer.pop_front();
+  // Garbage collect
+  for (auto& v : _voices) {
+    while(!v.buffer.empty() && (v.buffer.front().status == Status::Garbage)) {
+      v.buffer.pop_front();
     }
+  }
 
-    // Read as many new blocks as possible
-    while(_playing_file && !_buffer.full()) {
-      _buffer.push_back();
-      read_block(_buffer.back());
+  // Read as many new blocks as possible, without waiting for the disk,
+  // one block per voice in turns
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    for (auto& v : _voices) {
+      progress = read_voice(v) || progress;
     }
-  }  
+  }
 }
 
-void sndfile_thread::read_block(file_block& block) {
-  assert(_playing_file);
+bool sndfile_thread::read_voice(voice& v) {
+  if (!v.playing || v.buffer.full() || !v.reader->ready(v.cache_size)) {
+    return false;
+  }
 
-  if (_file_handler != nullptr) {
-    float* mem = &_file_cache.front();
-    
-    // this reads the buffer from the file, and returns the read "frames"
-    sf_count_t cnt = sf_readf_float(_file_handler,mem,_cache_size);
-
-    if (std::size_t(cnt)<_cache_size) {
-      // EOF reached?
-      if (_file_handler != nullptr) {
-        sf_close(_file_handler);
-        _file_handler=nullptr;
-        _playing_file=false;
+  // Streams are opened before their header arrives, and are ready
+  // without channels if it cannot be decoded
+  if (v.reader->channels() == 0u) {
+    std::cout << "Error decoding stream: '" << v.file << "'" << std::endl;
+    close_voice(v);
+    notify_finished();
+    return false;
+  }
+  if (v.channels != v.reader->channels()) {
+    prepare_format(v);
+    if (!v.reader->ready(v.cache_size)) {
+      return false;
+    }
+  }
+
+  // A scheduled file can only be placed once the phase of jack's
+  // cycles is known
+  if (v.start_pending &&
+      !_cycle_known.load(std::memory_order_acquire)) {
+    return false;
+  }
+
+  v.buffer.push_back();
+  file_block& block = v.buffer.back();
+
+  if (v.start_pending) {
+    // All cycles start at the same phase modulo the block size, so
+    // the first sample falls at this offset within its cycle
+    const std::uint32_t cycle = _cycle_start.load();
+    const std::int32_t ahead = std::int32_t(v.scheduled_start - cycle);
+    const std::size_t offset =
+      (ahead > 0) ? std::size_t(ahead) % _block_size : 0u;
+
+    if (ahead < 0) {
+      _late_starts.fetch_add(1u,std::memory_order_relaxed);
+    }
+
+    read_block(v,block,offset,(ahead > 0),
+               v.scheduled_start - std::uint32_t(offset));
+    v.start_pending = false;
+  } else {
+    read_block(v,block);
+  }
+
+  return true;
+}
+
+void sndfile_thread::start_loop(voice& v,const loop_region& loop) {
+  v.loop = loop;
+  v.loop_cache.clear();
+  v.loop_cache_filling = false;
+  v.loop_cache_ready = false;
+
+  v.loop_end = (v.loop.end > 0u) ? v.loop.end :
+    ((v.frames > 0u) ? v.frames : std::numeric_limits<std::size_t>::max());
+  if (v.frames > 0u) {
+    v.loop_end = std::min(v.loop_end,v.frames);
+  }
+
+  if (v.loop_end <= v.loop.start) {
+    v.loop.repeats = 0; // empty loop
+  }
+}
+
+void sndfile_thread::discard_ready_blocks(voice& v) {
+  for (std::size_t i=0;i<v.buffer.size();++i) {
+    Status expected = Status::ReadyToPlay;
+    v.buffer[i].status.compare_exchange_strong(expected,Status::Garbage);
+  }
+}
+
+void sndfile_thread::handle_commands() {
+  std::optional<std::size_t> seek;
+  std::optional<loop_region> loop;
+  bool stop = false;
+  {
+    std::lock_guard<std::mutex> lock(_playlist_mutex);
+    seek.swap(_pending_seek);
+    loop.swap(_pending_loop);
+    std::swap(stop,_pending_stop);
+  }
+
+  if (stop) {
+    for (auto& v : _voices) {
+      if (v.playing) {
+        _warmer.forget(v.file);
+        close_voice(v);
+      }
+    }
+    return;
+  }
+
+  voice& v = _voices[0];
+
+  if (!v.playing) {
+    return;
+  }
+
+  if (loop) {
+    start_loop(v,*loop);
+    v.fade_marked = false;
+  }
+
+  if (seek) {
+    v.position = *seek;
+    v.fade_marked = false;
+    if (v.loop_cache_filling) {
+      v.loop_cache.clear();
+      v.loop_cache_filling = false;
+    }
+    discard_ready_blocks(v);
+  }
+}
+
+std::size_t sndfile_thread::read_frames(voice& v,
+                                        float* dst,
+                                        const std::size_t frames) {
+  const std::size_t ch = v.channels;
+  std::size_t done = 0u;
+
+  while (done < frames) {
+    // Wraps around at the loop end; the rest of this block continues at
+    // the loop start
+    const std::size_t n = loop_step(v.position,v.loop,v.loop_end,
+                                    frames - done);
+    const bool looping = (v.loop.repeats != 0);
+    const bool in_loop = looping &&
+      (v.position >= v.loop.start) && (v.position < v.loop_end);
+
+    float *const out = dst + done*ch;
+    std::size_t got = 0u;
+
+    if (in_loop && v.loop_cache_ready) {
+      // Short loops are played from memory after the first pass
+      const float* src = v.loop_cache.data() + (v.position - v.loop.start)*ch;
+      std::copy(src,src + n*ch,out);
+      got = n;
+    } else {
+      if (v.reader_position != v.position) {
+        if (!v.reader->seek(v.position)) {
+          return done; // streams cannot seek
+        }
+        v.reader_position = v.position;
+      }
+
+      if (looping && !v.loop_cache_ready && (v.position == v.loop.start) &&
+          (v.loop_end - v.loop.start <= max_loop_cache/ch)) {
+        v.loop_cache.clear();
+        v.loop_cache_filling = true;
+      }
+
+      got = v.reader->read(out,n);
+      v.reader_position += got;
+
+      if (v.loop_cache_filling) {
+        v.loop_cache.insert(v.loop_cache.end(),out,out + got*ch);
+        if (v.position + got >= v.loop_end) {
+          v.loop_cache_filling = false;
+          v.loop_cache_ready = true;
+        }
+      }
+    }
+
+    v.position += got;
+    done += got;
+
+    if (got < n) {
+      // End of file.  If the loop should end beyond it, end it here
+      if (looping && (v.position > v.loop.start) &&
+          (v.position < v.loop_end)) {
+        v.loop_end = v.position;
+        if (v.loop_cache_filling) {
+          v.loop_cache_filling = false;
+          v.loop_cache_ready = true;
+        }
+        continue;
+      }
+      break;
+    }
+  }
+
+  return done;
+}
+
+void sndfile_thread::warm_files() {
+  if (_warm_countdown > 0u) {
+    --_warm_countdown;
+    return;
+  }
+  _warm_countdown = _warm_period;
+
+  static constexpr std::size_t max_queued = 8u;
+
+  _queued.clear();
+  {
+    std::lock_guard<std::mutex> lock(_playlist_mutex);
+    for (const auto& e : _playlist) {
+      if (_queued.size() >= max_queued) {
+        break;
       }
+      _queued.push_back(e.file);
     }
-    
-    const float fstep=float(_current_file_sample_rate)/float(_sampling_rate);
-    
+  }
+
+  const voice& v = _voices[0];
+
+  double remaining = 0.0;
+  if (v.playing && (v.sample_rate > 0u) && (v.frames > v.position)) {
+    remaining = double(v.frames - v.position) / double(v.sample_rate);
+    _warmer.set_byte_rate(v.file,double(v.frames) / double(v.sample_rate));
+  }
+
+  _warmer.warm(_queued,remaining);
+
+  if (v.playing && (v.frames > 0u)) {
+    _warmer.release_behind(v.file,double(v.position) / double(v.frames));
+  }
+}
+
+void sndfile_thread::read_block(voice& v,
+                                file_block& block,
+                                const std::size_t skip,
+                                const bool scheduled,
+                                const std::uint32_t start) {
+  tracer::scope span(tracer::ReadBlock,std::uint32_t(&v - _voices.data()));
+
+  assert(v.playing);
+
+  block.scheduled = scheduled;
+  block.start = start;
+  block.live = skip;
+  block.gain = v.gain;
+  block.frames = 0u;
+  block.first = v.first_block;
+  block.fade_out = file_block::no_fade;
+  v.first_block = false;
+
+  // Once the loops are over, the end of a file of known length can be
+  // anticipated, so that its fade ends with the last sample
+  if (!v.fade_marked && (_fade_length > 0u) && (v.frames > 0u) &&
+      (v.loop.repeats == 0) && (v.position <= v.frames)) {
+    const std::size_t end = skip +
+      (v.frames - v.position)*_sampling_rate/v.sample_rate;
+    if (end < block.size() + _fade_length) {
+      block.fade_out = (end > _fade_length + skip) ? end - _fade_length : skip;
+      v.fade_marked = true;
+    }
+  }
+
+  if (v.reader) {
+    float* mem = v.file_cache.data();
+
+    // file frames needed to fill the block after the skipped samples
+    const std::size_t frames = (skip == 0u) ? v.cache_size :
+      ((_block_size - skip) * v.sample_rate +
+       _sampling_rate - 1)/_sampling_rate;
+
+    // this reads the buffer from the file, and returns the read "frames"
+    const std::size_t cnt = read_frames(v,mem,frames);
+
+    if (cnt<frames) {
+      // EOF reached
+      v.reader.reset();
+      v.playing=false;
+      _warmer.forget(v.file);
+      notify_finished();
+    }
+
+    const float fstep=float(v.sample_rate)/float(_sampling_rate);
+
+    // Silence before the first sample.  jack's process replaces it with
+    // the live input in the playlist voice.
+    std::fill(block.begin(),block.begin()+skip,0.0f);
+
     // how many of "our" samples does cnt equate to?
     std::size_t jack_samples =
-      std::min(block.size(),cnt*_sampling_rate/_current_file_sample_rate);
-    auto it = block.begin();
+      std::min(block.size()-skip, cnt*_sampling_rate/v.sample_rate);
+    block.frames = jack_samples;
+    auto it = block.begin()+skip;
     const auto eit = it+jack_samples;
-    
+
+    const float *const w = v.weights.data();
+    const std::size_t channels = v.channels;
+
     // now, we want to fill with the data available
     for (float fidx=0.0f;it!=eit;++it,fidx+=fstep) {
-      const auto idx=static_cast<std::size_t>(fidx)*_current_file_channels;
+      const auto idx=static_cast<std::size_t>(fidx)*channels;
       const float* r=mem+idx;
-      const float *const re=r+_current_file_channels;
-      float acc=*r;
-      for (++r;r!=re;++r) {
-        acc+=*r; // add up all channels
-      }; 
-      *it=acc/_current_file_channels;
+      float acc=0.0f;
+      for (std::size_t c=0;c<channels;++c) {
+        acc+=w[c]*r[c]; // mix down all channels
+      }
+      *it=acc;
     }
 
     for (;it!=block.end();++it) {
       *it=0.0f;
     }
-    
+
   }
 
   block.status = Status::ReadyToPlay;
 }
 
 void sndfile_thread::run() {
-  /// Only one thread should be doing this
-  if (_running) return;
-
   std::cout << "sndfile_thread running" << std::endl;
-  
-  _running = true;
+  tracer::name_thread("sndfile_thread");
+
+#ifdef HAVE_LIBURING
+  // The ring is created by the thread that uses it
+  _uring = std::make_unique<uring_context>();
+  if (!_uring->valid()) {
+    std::cout << "io_uring not available, using libsndfile only" << std::endl;
+    _uring.reset();
+  }
+#endif
 
   double us = 1e6*double(_block_size)/double(_sampling_rate);
   auto sleep_time = std::chrono::duration<double,std::micro>(us);
-  
+
+  // The kernel hints are given every 100 ms
+  _warm_period = std::max(std::size_t(1u),std::size_t(1e5/us));
+  _warm_countdown = 0u;
+  _queued.reserve(8u);
+
   while(_running) {
+    handle_commands();
     check_files();
     read_buffers();
+    warm_files();
+    publish_stats();
+    _rounds.fetch_add(1u,std::memory_order_release);
 
     std::this_thread::sleep_for(sleep_time);
   }
 
   std::cout << "sndfile_thread stopped" << std::endl;
+
+}
+
+void sndfile_thread::publish_stats() {
+  static_assert(max_voices <= stats_segment::max_voices,
+                "the statistics segment must hold all voices");
+  if ((_stats == nullptr) || !_stats->valid()) {
+    return;
+  }
+
+  std::size_t queued = 0u;
+  {
+    std::lock_guard<std::mutex> lock(_playlist_mutex);
+    queued = _playlist.size() + _voice_requests.size();
+  }
   
+  stats_segment::files_section& f = _stats->begin_files();
+  f.rounds++;
+  f.queued = std::uint32_t(queued);
+  f.finished = std::uint32_t(_finished);
+  f.prefetch_misses = _prefetch_misses.load(std::memory_order_relaxed);
+  for (std::size_t i=0;i<max_voices;++i) {
+    const voice& v = _voices[i];
+    stats_segment::voice_state& s = f.voices[i];
+    std::uint32_t ready = 0u;
+    for (std::size_t b=0;b<v.buffer.size();++b) {
+      ready += (v.buffer[b].status.load(std::memory_order_relaxed) ==
+                Status::ReadyToPlay) ? 1u : 0u;
+    }
+    s.playing = v.playing.load(std::memory_order_relaxed) ? 1u : 0u;
+    s.ready_blocks = ready;
+    s.capacity = std::uint32_t(_ringbuffer_size);
+    s.sample_rate = std::uint32_t(v.sample_rate);
+    s.position = v.position;
+    s.frames = v.frames;
+  }
+  const char* name = _voices[0].file.c_str();
+  if (const char* slash = std::strrchr(name,'/')) {
+    name = slash + 1;
+  }
+  std::strncpy(f.file,name,sizeof(f.file) - 1u);
+  f.file[sizeof(f.file) - 1u] = '\0';
+  _stats->end_files();
 }
@@ -38,17 +38,32 @@
 #ifndef _SNDFILE_THREAD_H
 #define _SNDFILE_THREAD_H
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <thread>
 #include <filesystem>
 #include <mutex>
 #include <list>
 #include <optional>
+#include <vector>
 
 #include <sndfile.h>
 
 
 #include "prealloc_ringbuffer.h"
+#include "block_arena.h"
+#include "audio_reader.h"
+#include "loop_region.h"
+#include "stream_reader.h"
+#include "page_cache_warmer.h"
+#include "stats_segment.h"
+
+#ifdef HAVE_LIBURING
+#include "uring_reader.h"
+#endif
 
 /**
  * This is a worker class in the middle, to read audio files and
@@ -61,6 +76,12 @@
  * the data.  If no blocks are yet available, then a nullptr is
  * returned.  The main thread can add as many files as it wants with
  * the "add_file()" method.
+ *
+ * Several files can be played at the same time, each one in its own
+ * voice with its own ringbuffer.  Voice 0 plays the playlist, and the
+ * other voices play the files added with add_voice(), to be mixed by
+ * jack's process.  The thread reads one block per voice in turns, so
+ * that all voices are served fairly.
  */
 class sndfile_thread {
 public:
@@ -72,44 +93,79 @@ public:
   };
 
   /**
-   * A file_block holds a status indicator and the proper data
+   * A file_block holds a status indicator and a view to the proper data
    *
-   * It manages the data, and exposes them so that the sndfile library
-   * can access it directly.  
+   * It does not own the data: all blocks are carved from a single
+   * aligned slab (see block_arena), so that copying or moving a block
+   * never allocates memory.  It exposes the data so that the sndfile
+   * library can access it directly.
    */
   class file_block {
   public:
     /// Constructs an empty block, with "Garbage" status
     file_block();
-    /// Releases all allocated memory
+    /// Nothing to release: the memory belongs to the arena
     ~file_block();
 
-    /// Creates a block, holding a data array with size 
-    file_block(std::size_t size);
-    /// Construct a new instance with a copy of the other block
+    /// Creates a view to size floats starting at data
+    file_block(float* data,std::size_t size);
+    /// Construct a new view to the same data of the other block
     file_block(const file_block& other);
-    /// Moves the content of the other instance to this one
-    file_block(file_block&& other);
-    /// Copies the other content into this instance
+    /// Moves the view of the other instance to this one
+    file_block(file_block&& other) noexcept;
+    /// Makes this instance a view to the data of the other block
     file_block& operator=(const file_block& other);
-    /// Move assignment
-    file_block& operator=(file_block&& other);
+    /// Move assignment.  The other block is left empty
+    file_block& operator=(file_block&& other) noexcept;
+    
+    /**
+     * Changed by the reader thread and by jack's process, so it is
+     * atomic: a block can be discarded safely while jack may take it.
+     */
+    std::atomic<Status> status;
+
+    /**
+     * If true, this block must not start playing before the jack cycle
+     * beginning at frame time start.
+     */
+    bool scheduled;
+    /// jack frame time of the first sample of a scheduled block
+    std::uint32_t start;
+    /// Linear gain of the voice this block belongs to
+    float gain;
+    /**
+     * Number of samples at the beginning of the block that belong to the
+     * live input, and not to the file.  They are filled in by jack's
+     * process, so that the file starts at the exact frame.
+     */
+    std::size_t live;
+    /**
+     * Samples of the file after the live ones.  The rest of the block is
+     * past the end of the file.
+     */
+    std::size_t frames;
+    /// True if this is the first block of a file, which fades in at live
+    bool first;
+    /**
+     * Sample where the file starts fading out, so that the fade ends with
+     * the file, or no_fade.
+     */
+    std::size_t fade_out;
+    
+    static constexpr std::size_t no_fade = std::size_t(-1);
     
-    Status status;
-    inline float& front() {return *_data.get();}
-    inline const float& front() const {return *_data.get();}
-    inline size_t size() const {return _end-_data.get();}
-    inline float* begin() {return &front();}
-    inline const float* begin() const {return &front();}
+    inline float& front() {return *_data;}
+    inline const float& front() const {return *_data;}
+    inline size_t size() const {return _end-_data;}
+    inline float* begin() {return _data;}
+    inline const float* begin() const {return _data;}
     inline float* end() {return _end;}
     inline const float* end() const {return _end;}
     inline bool empty() const {return _end==nullptr;}
 
-    void resize(size_t size);
-    
   private:
     
-    std::unique_ptr<float[]> _data;
+    float* _data;
     float* _end;
   };
 
@@ -124,37 +180,143 @@ public:
    */
   sndfile_thread(const std::size_t block_size,
                  const std::size_t sampling_rate,
-                 const std::size_t buffer_size=10);
+                 const std::size_t buffer_size=10,
+                 const unsigned int arena_options=block_arena::Prefault);
 
   ~sndfile_thread();
 
   /**
    * Initialize the thread.
    *
-   * This must be called once, before the thread is running
+   * This must be called once, before the thread is running.
+   *
+   * All blocks of the ring buffer are carved from one slab, allocated
+   * with the given block_arena options.
    */
   void init(const std::size_t block_size,
             const std::size_t sampling_rate,
-            const std::size_t buffer_size=10);
+            const std::size_t buffer_size=10,
+            const unsigned int arena_options=block_arena::Prefault);
 
   
   /**
    * Get the next valid block.
    *
+   * @param cycle_start jack frame time of the first frame of the current
+   *                    cycle.  Scheduled blocks wait until their cycle.
+   *
    * Return nullptr if no valid block available
    */  
-  file_block* next_block();
+  file_block* next_block(const std::uint32_t cycle_start);
+
+  /**
+   * Get the next valid block of the given voice, or nullptr if there is
+   * none.  Voice 0 is the playlist (see next_block(cycle_start)).
+   */
+  file_block* next_block(const std::size_t voice,
+                         const std::uint32_t cycle_start);
+
+  /// Maximum number of voices played at once, including the playlist
+  static constexpr std::size_t max_voices = 8u;
+
+  /**
+   * Length in samples of the fades at the end of the playlist files.
+   * The blocks where the fades have to start are marked with fade_out.
+   */
+  void set_fade_length(const std::size_t samples);
 
+  /**
+   * Region of a file played repeatedly.
+   */
+  using loop_region = ::loop_region;
+  
   /**
    * Add a file to the playlist if it exists.
    *
+   * The file can also be a named pipe, or "-" for the standard input,
+   * streaming WAV or raw PCM data (see set_stream_format()).
+   *
+   * Optionally, a region of the file can be looped.  The loop is
+   * seamless: the reader crosses the loop end within the same block.
+   *
    * Returns true if the file exists and was added to the playlist or
    * false otherwise.
    */
-  bool append_file(const std::filesystem::path& file);
+  bool append_file(const std::filesystem::path& file,
+                   const loop_region& loop = loop_region());
+
+  /**
+   * Add a file to the playlist, to start playing exactly at the given
+   * jack frame time.
+   *
+   * The file is opened and buffered as soon as it reaches the front of
+   * the playlist, and its first sample is played at the given frame.  If
+   * the file reaches the front of the playlist too late, it starts as
+   * soon as possible.
+   *
+   * Returns true if the file exists and was added to the playlist or
+   * false otherwise.
+   */
+  bool schedule_file(const std::filesystem::path& file,
+                     const std::uint32_t start,
+                     const loop_region& loop = loop_region());
+
+  /**
+   * Play a file in a voice of its own, mixed with the playlist.
+   *
+   * The voice is scaled by the linear gain, and the pan in [-1,1]
+   * balances the left and right channels of stereo files with an
+   * equal-power law before they are mixed down.  If scheduled, the first
+   * sample plays at the jack frame time start.
+   *
+   * Returns false if the file does not exist or all voices are busy.
+   */
+  bool add_voice(const std::filesystem::path& file,
+                 const float gain,
+                 const float pan,
+                 const bool scheduled = false,
+                 const std::uint32_t start = 0u,
+                 const loop_region& loop = loop_region());
+
+  /**
+   * Move the file being played to the given frame (in the sampling rate
+   * of the file).  The blocks already buffered are discarded.
+   */
+  void seek(const std::size_t frame);
+
+  /**
+   * Change the loop of the file being played.  Use a loop without
+   * repeats to leave the current loop at its end.
+   */
+  void set_loop(const loop_region& loop);
+
+  /// Number of scheduled files that could not start at their frame
+  inline std::size_t late_starts() const {return _late_starts.load();}
+
+  /**
+   * Number of times jack's process found no block ready in a voice still
+   * reading its file, i.e. the prefetch fell behind.
+   */
+  inline std::size_t prefetch_misses() const {
+    return _prefetch_misses.load();
+  }
 
   /**
-   * Stop all files from playing
+   * Publish the state of the voices in the given statistics segment,
+   * after each round of reads.  It must be called before spawn().
+   */
+  inline void set_stats(stats_segment* stats) {_stats = stats;}
+
+  /**
+   * Set the format of streams without a WAV header, and the milliseconds
+   * of audio buffered from the streams before playing them.
+   *
+   * It must be called before adding the streams to the playlist.
+   */
+  void set_stream_format(const pcm_format& raw,const double jitter_ms);
+
+  /**
+   * Stop all files from playing, in all voices
    */
   bool stop_files();
   
@@ -165,63 +327,300 @@ public:
    */
   void spawn();
 
+  /**
+   * Wait until the thread went twice through its loop, so that the
+   * first file of the playlist is opened and its first blocks are read,
+   * but no longer than the timeout.  Returns true if the playlist has a
+   * block ready to play.
+   *
+   * It lets a client spawn the thread before activating jack, and start
+   * playing the file in its first cycle.
+   */
+  bool wait_primed(const std::chrono::milliseconds timeout);
+
   inline std::thread& thread() {return _thread;}
 
+  /**
+   * Stop the thread and close all files.  Jack's process can still ask
+   * for blocks, but there will be none.
+   */
+  void stop();
+
+  /**
+   * Stop the thread like stop(), but put the files being played back at
+   * the front of the playlist and of the voice requests, with their
+   * loops, gains and pans.  Once init() and spawn() are called again,
+   * e.g. for another block size, they go on from the frame where they
+   * were heard last.  Streams cannot seek, and go on from where their
+   * producer is.
+   */
+  void suspend();
+
+  /**
+   * File descriptor that becomes readable whenever a file finishes
+   * playing or cannot be opened, to be watched with poll or epoll.
+   */
+  inline int notify_fd() const {return _notify_fd;}
+
+  /// Frames of each block
+  inline std::size_t block_size() const {return _block_size;}
+
+  /**
+   * Number of files finished since the last call.  It clears the
+   * readiness of notify_fd().
+   */
+  std::size_t finished_files();
+
+  /// True if no file is playing nor waiting to be played
+  bool idle();
+
  
 private:
 
   
   std::size_t _block_size = 0u;
   std::size_t _ringbuffer_size = 0u;
-  prealloc_ringbuffer<file_block> _buffer;
+  block_arena _arena;
   std::size_t _sampling_rate = 0u;
-  bool _running = false;
+  std::atomic<bool> _running = false;
+
+  /// eventfd signaled whenever a file finishes
+  int _notify_fd = -1;
 
   /// Object running run()
   std::thread _thread;
 
+  /// Entry of the playlist, or a request of a new voice
+  struct playlist_entry {
+    std::filesystem::path file;
+    bool scheduled = false;
+    std::uint32_t start = 0u; ///< jack frame time of the first sample
+    loop_region loop;
+    float gain = 1.0f;
+    float pan = 0.0f;
+    std::size_t position = 0u; ///< first frame of the file to be played
+  };
+  
   /// List of remaining files to be played
-  std::list<std::filesystem::path> _playlist;
+  std::list<playlist_entry> _playlist;
+  /// Files waiting for a free voice
+  std::list<playlist_entry> _voice_requests;
   std::mutex _playlist_mutex;
 
-  /// Handler to file being played
-  SNDFILE* _file_handler;
-  bool _playing_file;
-  std::size_t _current_file_sample_rate;
-  std::size_t _current_file_channels;
+  /// Format of raw streams
+  pcm_format _stream_format;
+  /// Jitter buffer of streams, in milliseconds
+  double _stream_jitter_ms = 50.0;
+
+#ifdef HAVE_LIBURING
+  /// Asynchronous I/O ring shared by all readers
+  std::unique_ptr<uring_context> _uring;
+#endif
+
+  /**
+   * A file being played, with its own ringbuffer of blocks.
+   *
+   * All members but the blocks are only touched by the reader thread.
+   */
+  struct voice {
+    prealloc_ringbuffer<file_block> buffer;
+
+    /// Reader of the file being played
+    std::unique_ptr<audio_reader> reader;
+
+    /// Set by the reader thread, read by add_voice() to count free voices
+    std::atomic<bool> playing = false;
+    /// Set by jack's process once it got the first block of the file
+    std::atomic<bool> delivering = false;
+    std::size_t sample_rate = 0u;
+    std::size_t channels = 0u;
+    std::filesystem::path file;
+    std::size_t frames = 0u;
+    /// Next frame of the file to be delivered
+    std::size_t position = 0u;
+    /// Frame where the reader is, which differs from position after seeks
+    std::size_t reader_position = 0u;
+
+    /// Gain given to the blocks of this voice
+    float gain = 1.0f;
+    /// Balance of stereo files, from -1 (left) to 1 (right)
+    float pan = 0.0f;
+    /// Weights of each channel when mixing them down
+    std::vector<float> weights;
+    
+    /// Loop of the file
+    loop_region loop;
+    /// Frame after the loop, resolved with the length of the file
+    std::size_t loop_end = 0u;
+    /**
+     * Decoded samples of the loop.  After the first pass, short loops
+     * are played from memory, without seeking nor decoding again.
+     */
+    std::vector<float> loop_cache;
+    bool loop_cache_filling = false;
+    bool loop_cache_ready = false;
+
+    /// The next block read is the first one of the file
+    bool first_block = false;
+    /// A block was already marked to fade out the file
+    bool fade_marked = false;
+    
+    /// The next block read is the first one of a scheduled file
+    bool start_pending = false;
+    /// jack frame time where the scheduled file starts
+    std::uint32_t scheduled_start = 0u;
+
+    /**
+     * Size of the file cache.
+     *
+     * This considers the ratio between file and jack sampling rates and
+     * Jack's block size.
+     */
+    std::size_t cache_size = 0u;
+
+    /**
+     * The file might hold a different number of channels and sampling
+     * rate than currently used by Jack.  Hence, we need to load the data
+     * first in this cache buffer, to resample and mix down all channels.
+     *
+     * It is only touched by the reader thread, so it is not part of the
+     * arena.
+     */
+    std::vector<float> file_cache;
+  };
+
+  /// All voices.  Voice 0 plays the playlist.
+  std::array<voice,max_voices> _voices;
+  
+  /// Samples of the fade at the end of the playlist files
+  std::size_t _fade_length = 0u;
+  
+  /// Floats of the biggest loop kept in memory (16 MiB)
+  static constexpr std::size_t max_loop_cache = 4u*1024u*1024u;
+
+  /// Commands for the playlist voice, protected by _playlist_mutex
+  std::optional<std::size_t> _pending_seek;
+  std::optional<loop_region> _pending_loop;
+  bool _pending_stop = false;
+
+  /// Hints to the kernel about the files to be played soon
+  page_cache_warmer _warmer;
+  /// Files in the playlist considered by the warmer
+  std::vector<std::filesystem::path> _queued;
+  /// Iterations of run() between two calls to the warmer
+  std::size_t _warm_period;
+  std::size_t _warm_countdown;
   
   
   /// The real worker thread
   void run();
 
-  /// Check if there are audio file to be opened
+  /// Check if there are audio files to be opened, for all voices
   void check_files();
+
+  /**
+   * Open the file of the entry in the given voice.
+   *
+   * Returns false if the file cannot be read.
+   */
+  bool open_voice(voice& v,const playlist_entry& entry);
+
+  /**
+   * Take the number of channels and the sampling rate of the reader of
+   * the voice, which streams only know once their header arrived.
+   */
+  void prepare_format(voice& v);
+
+  /// Close the file of the voice and discard its pending blocks
+  void close_voice(voice& v);
+
+  /// Tell the main thread that a file finished
+  void notify_finished();
+
+  /// Files finished since the start
+  std::size_t _finished = 0u;
+
+  /// Segment where the state of the voices is published, or nullptr
+  stats_segment* _stats = nullptr;
+
+  /// Publish the state of the voices in _stats
+  void publish_stats();
+  
+  /**
+   * Open the file with the fastest backend able to read it.
+   *
+   * Streams are read with stream_reader.  Uncompressed WAV and AIFF
+   * files are read asynchronously with io_uring, if available.  All
+   * other files are read with libsndfile.
+   *
+   * Returns nullptr if the file cannot be read.
+   */
+  std::unique_ptr<audio_reader> open_reader(const std::filesystem::path& f);
   
-  /// Fill all available spaces with file information
+  /**
+   * Fill all available spaces with file information.  The voices are
+   * served in turns, one block each.
+   */
   void read_buffers();
 
   /**
-   * Read a single block and leave it on the given block.
-   *
-   * If the block could be successfully read, then the block will be
-   * in a status of ReadyToPlay
+   * Read the next block of the voice if there is space for it and its
+   * reader has the data.  Returns true if a block was read.
    */
-  void read_block(file_block& block);
+  bool read_voice(voice& v);
+
+  /// Apply the seek, loop and stop commands
+  void handle_commands();
+
+  /// Set the loop of the voice and reset its cache
+  void start_loop(voice& v,const loop_region& loop);
+
+  /// Mark all blocks of the voice ready to play as garbage
+  void discard_ready_blocks(voice& v);
 
   /**
-   * Size of the file cache.
+   * Read interleaved frames of the voice file, following its loop.
    *
-   * This considers the ratio between file and jack sampling rates and
-   * Jack's block size.
+   * Returns less frames than requested only at the end of the file.
    */
-  std::size_t _cache_size;
+  std::size_t read_frames(voice& v,float* dst,const std::size_t frames);
 
   /**
-   * The file might hold a different number of channels and sampling rate than
-   * currently used by Jack.  Hence, we need to load the data first in this 
-   * cache buffer, to resample and average all channels per sample.
+   * Ask the kernel to load the beginning of the queued files into the
+   * page cache, according to their expected start time, and to drop the
+   * played region of huge files.
    */
-  file_block _file_cache;
+  void warm_files();
+
+  /**
+   * Read a single block of the voice and leave it on the given block.
+   *
+   * The first skip samples of the block are left for the live input.
+   * A scheduled block is played from the jack frame time start on.
+   *
+   * If the block could be successfully read, then the block will be
+   * in a status of ReadyToPlay.  The status is written last, so that
+   * jack's thread sees all other fields of the block.
+   */
+  void read_block(voice& v,
+                  file_block& block,
+                  const std::size_t skip = 0u,
+                  const bool scheduled = false,
+                  const std::uint32_t start = 0u);
+
+  /// jack frame time of the last cycle, updated by next_block()
+  std::atomic<std::uint32_t> _cycle_start;
+  /// True once jack's process reported its first cycle
+  std::atomic<bool> _cycle_known;
+  /// Scheduled blocks that started after their frame
+  std::atomic<std::size_t> _late_starts;
+  /// Cycles where a playing voice had no block ready
+  std::atomic<std::size_t> _prefetch_misses;
+  /// Rounds of the loop of the thread
+  std::atomic<std::size_t> _rounds;
+
+  /// Carve all blocks of the ring buffers from the arena
+  void allocate_blocks(const unsigned int arena_options);
  
 };
 
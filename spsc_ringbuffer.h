@@ -0,0 +1,110 @@
+/**
+ * spsc_ringbuffer.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SPSC_RINGBUFFER_H
+#define _SPSC_RINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Lock-free ring buffer for exactly one producer thread and one consumer
+ * thread.
+ *
+ * All memory is allocated in allocate(), before the threads start using
+ * the buffer, so that pushing and popping never allocate nor block.  It
+ * is meant to pass data between jack's realtime thread and the normal
+ * threads of the application.
+ */
+template<class T>
+class spsc_ringbuffer {
+public:
+  typedef T value_type;
+  typedef typename std::vector<T>::size_type size_type;
+
+  /// Create an empty ringbuffer, without capacity
+  spsc_ringbuffer();
+
+  /// Create an empty ringbuffer with room for at least size elements
+  explicit spsc_ringbuffer(size_type size);
+
+  spsc_ringbuffer(const spsc_ringbuffer&) = delete; // not copyable
+  spsc_ringbuffer& operator=(const spsc_ringbuffer&) = delete;
+  
+  /**
+   * Discard current data and reserve room for at least size elements.
+   *
+   * The capacity is rounded up to a power of two.  It must not be called
+   * while other threads use the buffer.
+   */
+  void allocate(size_type size);
+
+  /// Producer: add one element, if there is room for it
+  bool push(const value_type& value);
+
+  /// Producer: add up to n elements, returning how many were added
+  size_type push(const value_type* src,size_type n);
+
+  /// Consumer: take the oldest element, if there is one
+  bool pop(value_type& value);
+  
+  /// Consumer: take up to n elements, returning how many were taken
+  size_type pop(value_type* dst,size_type n);
+
+  /// Elements ready to be popped
+  size_type readable() const;
+
+  /// Elements that can be pushed
+  size_type writable() const;
+
+  inline size_type capacity() const {return _data.size();}
+  inline bool empty() const {return readable()==0u;}
+  
+protected:
+  std::vector<T> _data;
+  size_type _mask;
+
+  /// Total elements written (only changed by the producer)
+  alignas(64) std::atomic<size_type> _write;
+  /// Total elements read (only changed by the consumer)
+  alignas(64) std::atomic<size_type> _read;
+};
+
+#include "spsc_ringbuffer.tpp"
+
+#endif
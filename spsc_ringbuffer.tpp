@@ -0,0 +1,141 @@
+/**
+ * spsc_ringbuffer.tpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SPSC_RINGBUFFER_TPP
+#define _SPSC_RINGBUFFER_TPP
+
+#include <algorithm>
+#include <bit>
+
+template<class T>
+spsc_ringbuffer<T>::spsc_ringbuffer()
+  : _data()
+  , _mask(0u)
+  , _write(0u)
+  , _read(0u) {
+}
+
+template<class T>
+spsc_ringbuffer<T>::spsc_ringbuffer(size_type size)
+  : spsc_ringbuffer() {
+  allocate(size);
+}
+
+template<class T>
+void spsc_ringbuffer<T>::allocate(size_type size) {
+  const size_type cap = (size > 0u) ? std::bit_ceil(size) : 0u;
+  _data.assign(cap,value_type());
+  _mask = (cap > 0u) ? cap - 1u : 0u;
+  _write.store(0u,std::memory_order_relaxed);
+  _read.store(0u,std::memory_order_relaxed);
+}
+
+template<class T>
+typename spsc_ringbuffer<T>::size_type
+spsc_ringbuffer<T>::readable() const {
+  return _write.load(std::memory_order_acquire) -
+         _read.load(std::memory_order_relaxed);
+}
+
+template<class T>
+typename spsc_ringbuffer<T>::size_type
+spsc_ringbuffer<T>::writable() const {
+  return _data.size() - (_write.load(std::memory_order_relaxed) -
+                         _read.load(std::memory_order_acquire));
+}
+
+template<class T>
+bool spsc_ringbuffer<T>::push(const value_type& value) {
+  if (writable() == 0u) {
+    return false;
+  }
+  const size_type w = _write.load(std::memory_order_relaxed);
+  _data[w & _mask] = value;
+  _write.store(w + 1u,std::memory_order_release);
+  return true;
+}
+
+template<class T>
+typename spsc_ringbuffer<T>::size_type
+spsc_ringbuffer<T>::push(const value_type* src,size_type n) {
+  n = std::min(n,writable());
+  if (n == 0u) {
+    return 0u;
+  }
+  
+  const size_type w = _write.load(std::memory_order_relaxed);
+  const size_type start = w & _mask;
+  const size_type first = std::min(n,_data.size() - start);
+  
+  std::copy(src,src+first,_data.begin()+start);
+  std::copy(src+first,src+n,_data.begin());
+  
+  _write.store(w + n,std::memory_order_release);
+  return n;
+}
+
+template<class T>
+bool spsc_ringbuffer<T>::pop(value_type& value) {
+  if (readable() == 0u) {
+    return false;
+  }
+  const size_type r = _read.load(std::memory_order_relaxed);
+  value = _data[r & _mask];
+  _read.store(r + 1u,std::memory_order_release);
+  return true;
+}
+
+template<class T>
+typename spsc_ringbuffer<T>::size_type
+spsc_ringbuffer<T>::pop(value_type* dst,size_type n) {
+  n = std::min(n,readable());
+  if (n == 0u) {
+    return 0u;
+  }
+
+  const size_type r = _read.load(std::memory_order_relaxed);
+  const size_type start = r & _mask;
+  const size_type first = std::min(n,_data.size() - start);
+
+  std::copy(_data.begin()+start,_data.begin()+start+first,dst);
+  std::copy(_data.begin(),_data.begin()+(n-first),dst+first);
+
+  _read.store(r + n,std::memory_order_release);
+  return n;
+}
+
+#endif
@@ -0,0 +1,148 @@
+/**
+ * startup_profile.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "startup_profile.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+namespace {
+  /// Initialized with the static objects, before main() runs
+  const std::chrono::steady_clock::time_point program_start =
+    std::chrono::steady_clock::now();
+
+  /// Phases of different threads log whole lines
+  std::mutex log_lock;
+
+  double ms_since_start(const std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double,std::milli>(t - program_start).
+      count();
+  }
+
+  double ms_since_start(const std::int64_t ticks) {
+    return ms_since_start(std::chrono::steady_clock::time_point(
+                            std::chrono::steady_clock::duration(ticks)));
+  }
+}
+
+std::atomic<std::int64_t> startup_profile::_first_cycle{0};
+std::atomic<std::int64_t> startup_profile::_first_audio{0};
+bool startup_profile::_cycle_reported = false;
+bool startup_profile::_audio_reported = false;
+// Created before main(), so that the first cycle always finds it
+int startup_profile::_notify_fd = eventfd(0u,EFD_NONBLOCK | EFD_CLOEXEC);
+
+startup_profile::phase::phase(const char* name)
+  : _name(name),
+    _start(std::chrono::steady_clock::now()) {
+}
+
+startup_profile::phase::~phase() {
+  const auto end = std::chrono::steady_clock::now();
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(1)
+     << "I> Startup: " << _name << " took "
+     << std::chrono::duration<double,std::milli>(end - _start).count()
+     << " ms (done at " << ms_since_start(end) << " ms)";
+
+  std::lock_guard<std::mutex> lock(log_lock);
+  std::cerr << os.str() << std::endl;
+}
+
+double startup_profile::elapsed_ms() {
+  return ms_since_start(std::chrono::steady_clock::now());
+}
+
+void startup_profile::mark(const char* event) {
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(1)
+     << "I> Startup: " << event << " at " << elapsed_ms() << " ms";
+
+  std::lock_guard<std::mutex> lock(log_lock);
+  std::cerr << os.str() << std::endl;
+}
+
+int startup_profile::notify_fd() {
+  return _notify_fd;
+}
+
+void startup_profile::notify() {
+  // Only twice in the whole run, so the realtime thread can afford it
+  const std::uint64_t one = 1u;
+  if ((_notify_fd >= 0) &&
+      (write(_notify_fd,&one,sizeof(one)) != ssize_t(sizeof(one)))) {
+    return; // the reader is woken up anyway
+  }
+}
+
+bool startup_profile::report(std::ostream& os) {
+  std::uint64_t count = 0u;
+  if ((_notify_fd >= 0) &&
+      (read(_notify_fd,&count,sizeof(count)) != ssize_t(sizeof(count)))) {
+    count = 0u;
+  }
+
+  if (_audio_reported) {
+    return true;
+  }
+  
+  std::ostringstream line;
+  line << std::fixed << std::setprecision(1);
+
+  const std::int64_t first_cycle = _first_cycle.load();
+  if (!_cycle_reported && (first_cycle != 0)) {
+    line << "I> Startup: first cycle at " << ms_since_start(first_cycle)
+         << " ms\n";
+    _cycle_reported = true;
+  }
+
+  const std::int64_t first_audio = _first_audio.load();
+  if (first_audio != 0) {
+    line << "I> Startup: first file block played at "
+         << ms_since_start(first_audio) << " ms\n";
+    _audio_reported = true;
+  }
+
+  std::lock_guard<std::mutex> lock(log_lock);
+  os << line.str() << std::flush;
+  return _audio_reported;
+}
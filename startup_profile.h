@@ -0,0 +1,133 @@
+/**
+ * startup_profile.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _STARTUP_PROFILE_H
+#define _STARTUP_PROFILE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+/**
+ * Time line of the start of the program, from its loading to the first
+ * cycles of jack's process.
+ *
+ * Each phase of the start (parsing the options, opening jack, probing the
+ * files, ...) is measured with a phase object, which logs its duration
+ * and the moment it ended, relative to the loading of the program.
+ * Phases may run in parallel in several threads.
+ *
+ * The realtime thread only stores the time of its first cycle, and of the
+ * first cycle that played a file block, and signals each one once through
+ * notify_fd(); report() logs them later from a normal thread.
+ *
+ * It follows the monostate pattern, like the tracer.
+ */
+class startup_profile {
+public:
+  /// Measures one phase, from its construction to its destruction
+  class phase {
+  public:
+    explicit phase(const char* name);
+    ~phase();
+
+    phase(const phase&) = delete; // not copyable
+    phase& operator=(const phase&) = delete;
+
+  private:
+    const char* _name;
+    std::chrono::steady_clock::time_point _start;
+  };
+
+  /// Milliseconds since the program was loaded
+  static double elapsed_ms();
+
+  /// Log that something happened now
+  static void mark(const char* event);
+
+  /**
+   * Called by each cycle of jack's process.  Only the first calls store
+   * anything, so it is safe and cheap in the realtime thread: after the
+   * first cycle, only a cycle with file audio reads the clock, until the
+   * first one did.
+   */
+  static inline void cycle(const bool file_audio) {
+    if ((_first_audio.load(std::memory_order_relaxed) != 0) ||
+        (!file_audio && (_first_cycle.load(std::memory_order_relaxed) != 0))) {
+      return;
+    }
+    const std::int64_t now = std::chrono::steady_clock::now().
+      time_since_epoch().count();
+    std::int64_t expected = 0;
+    if (_first_cycle.compare_exchange_strong(expected,now,
+                                             std::memory_order_relaxed)) {
+      notify();
+    }
+    if (file_audio) {
+      _first_audio.store(now,std::memory_order_relaxed);
+      notify();
+    }
+  }
+
+  /**
+   * Event descriptor readable when the first cycle or the first cycle
+   * with file audio happened, so that report() is called then.
+   */
+  static int notify_fd();
+
+  /**
+   * Log the first cycle and the first cycle with file audio, each one
+   * once, as soon as they happened.
+   *
+   * Returns true when both were logged, and notify_fd() is not needed
+   * anymore.
+   */
+  static bool report(std::ostream& os);
+
+private:
+  /// Wake up the thread waiting on notify_fd()
+  static void notify();
+
+  static int _notify_fd;
+  static std::atomic<std::int64_t> _first_cycle;
+  static std::atomic<std::int64_t> _first_audio;
+  static bool _cycle_reported;
+  static bool _audio_reported;
+};
+
+#endif
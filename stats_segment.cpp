@@ -0,0 +1,265 @@
+/**
+ * stats_segment.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stats_segment.h"
+#include "audio_mix.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <iostream>
+#include <new>
+
+namespace {
+  /// The layout rounded up to whole pages
+  std::size_t segment_bytes() {
+    const std::size_t page = std::size_t(sysconf(_SC_PAGESIZE));
+    return (sizeof(stats_segment::layout) + page - 1u)/page*page;
+  }
+}
+
+stats_segment::stats_segment()
+  : _name()
+  , _owner(false)
+  , _fd(-1)
+  , _layout(nullptr)
+  , _mapped_bytes(0u)
+  , _frame_ns(0.0) {
+}
+
+stats_segment::~stats_segment() {
+  close();
+}
+
+bool stats_segment::create(const std::string& name,
+                           const std::uint32_t sample_rate,
+                           const std::uint32_t buffer_size) {
+  close();
+
+  shm_unlink(name.c_str()); // remove stale segments of crashed instances
+  _fd = shm_open(name.c_str(),O_CREAT | O_EXCL | O_RDWR,0644);
+  if (_fd < 0) {
+    std::cerr << "E> Unable to create shared memory '" << name << "': "
+              << std::strerror(errno) << std::endl;
+    return false;
+  }
+  _name = name;
+  _owner = true;
+
+  const std::size_t bytes = segment_bytes();
+  void* base = MAP_FAILED;
+  if (ftruncate(_fd,off_t(bytes)) == 0) {
+    base = mmap(nullptr,bytes,PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE,_fd,0);
+  }
+  if (base == MAP_FAILED) {
+    std::cerr << "E> Unable to map shared memory '" << name << "'"
+              << std::endl;
+    close();
+    return false;
+  }
+  mlock(base,bytes); // best effort: jack's process must not fault
+  _mapped_bytes = bytes;
+  _layout = static_cast<layout*>(base);
+
+  // The new file is zero filled.  Set the header, and the magic at last
+  new (&_layout->xruns) std::atomic<std::uint64_t>(0u);
+  new (&_layout->cycle.sequence) std::atomic<std::uint32_t>(0u);
+  new (&_layout->files.sequence) std::atomic<std::uint32_t>(0u);
+  _layout->version = version;
+  _layout->size = std::uint32_t(sizeof(layout));
+  _layout->pid = std::uint32_t(getpid());
+  set_format(sample_rate,buffer_size);
+  std::atomic_thread_fence(std::memory_order_release);
+  _layout->magic = magic;
+
+  return true;
+}
+
+bool stats_segment::attach(const std::string& name) {
+  close();
+
+  _fd = shm_open(name.c_str(),O_RDONLY,0);
+  if (_fd < 0) {
+    return false;
+  }
+  _name = name;
+  _owner = false;
+
+  const std::size_t bytes = segment_bytes();
+  void* base = mmap(nullptr,bytes,PROT_READ,MAP_SHARED,_fd,0);
+  if (base == MAP_FAILED) {
+    close();
+    return false;
+  }
+  _mapped_bytes = bytes;
+  _layout = static_cast<layout*>(base);
+
+  if ((_layout->magic != magic) || (_layout->version != version) ||
+      (_layout->size != sizeof(layout))) {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+void stats_segment::close() {
+  if (_layout != nullptr) {
+    munmap(_layout,_mapped_bytes);
+  }
+  if (_fd >= 0) {
+    ::close(_fd);
+  }
+  if (_owner) {
+    shm_unlink(_name.c_str());
+  }
+
+  _name.clear();
+  _owner = false;
+  _fd = -1;
+  _layout = nullptr;
+  _mapped_bytes = 0u;
+}
+
+void stats_segment::set_format(const std::uint32_t sample_rate,
+                               const std::uint32_t buffer_size) {
+  if (_layout != nullptr) {
+    _layout->sample_rate = sample_rate;
+    _layout->buffer_size = buffer_size;
+  }
+  _frame_ns.store((sample_rate > 0u) ? 1e9/double(sample_rate) : 0.0,
+                  std::memory_order_relaxed);
+}
+
+// ---------------------------------------------------------------------------
+// Writers
+// ---------------------------------------------------------------------------
+
+void stats_segment::write_begin(std::atomic<std::uint32_t>& sequence) {
+  const std::uint32_t s = sequence.load(std::memory_order_relaxed);
+  sequence.store(s + 1u,std::memory_order_relaxed);
+  // The data must not be written before the sequence is odd
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void stats_segment::write_end(std::atomic<std::uint32_t>& sequence) {
+  const std::uint32_t s = sequence.load(std::memory_order_relaxed);
+  sequence.store(s + 1u,std::memory_order_release);
+}
+
+void stats_segment::publish_cycle(const std::uint32_t nframes,
+                                  const stage_clock& clock,
+                                  const float* in,
+                                  const float* out,
+                                  const perf_counters& counters,
+                                  const std::uint64_t silent_cycles,
+                                  const float gain_reduction_db,
+                                  const loudness* output_loudness) {
+  if ((_layout == nullptr) || !clock.active() || (nframes == 0u)) {
+    return;
+  }
+
+  // The levels are computed before entering the critical section, to
+  // keep it as short as possible
+  float in_peak = 0.0f, in_energy = 0.0f;
+  float out_peak = 0.0f, out_energy = 0.0f;
+  mix_levels(in,nframes,in_peak,in_energy);
+  mix_levels(out,nframes,out_peak,out_energy);
+
+  const double frame_ns = _frame_ns.load(std::memory_order_relaxed);
+  const float load = (frame_ns > 0.0) ?
+    float(double(clock.total())/(frame_ns*double(nframes))) : 0.0f;
+  const std::size_t bin =
+    std::min(std::size_t(std::max(0.0f,load)*20.0f),load_bins - 1u);
+
+  std::uint32_t available = 0u;
+  perf_counters::totals totals{};
+  if (counters.valid()) {
+    totals = counters.read_totals();
+    for (std::size_t i=0;i<perf_counters::Counters;++i) {
+      available |= counters.available(perf_counters::counter(i)) ?
+        (1u << i) : 0u;
+    }
+  }
+
+  cycle_section& c = _layout->cycle.data;
+  write_begin(_layout->cycle.sequence);
+  c.cycles++;
+  c.nframes = nframes;
+  c.load = load;
+  c.max_load = std::max(c.max_load,load);
+  c.histogram[bin]++;
+  for (std::size_t s=0;s<Stages;++s) {
+    c.stage_ns[s] = clock.ns[s];
+    c.stage_total_ns[s] += clock.ns[s];
+  }
+  c.input_peak = in_peak;
+  c.input_rms = std::sqrt(in_energy/float(nframes));
+  c.output_peak = out_peak;
+  c.output_rms = std::sqrt(out_energy/float(nframes));
+  c.perf_available = available;
+  c.perf_intervals = totals.intervals;
+  std::memcpy(c.perf,totals.value,sizeof(c.perf));
+  c.silent_cycles = silent_cycles;
+  c.gain_reduction_db = gain_reduction_db;
+  c.max_gain_reduction_db = std::max(c.max_gain_reduction_db,
+                                     gain_reduction_db);
+  if (output_loudness != nullptr) {
+    c.output_loudness = *output_loudness;
+  }
+  write_end(_layout->cycle.sequence);
+}
+
+void stats_segment::count_xrun() {
+  if (_layout != nullptr) {
+    _layout->xruns.fetch_add(1u,std::memory_order_relaxed);
+  }
+}
+
+stats_segment::files_section& stats_segment::begin_files() {
+  write_begin(_layout->files.sequence);
+  return _layout->files.data;
+}
+
+void stats_segment::end_files() {
+  write_end(_layout->files.sequence);
+}
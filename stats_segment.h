@@ -0,0 +1,330 @@
+/**
+ * stats_segment.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _STATS_SEGMENT_H
+#define _STATS_SEGMENT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <time.h>
+
+#include "perf_counters.h"
+#include "tracer.h"
+
+/**
+ * Live statistics of the client, published in POSIX shared memory for
+ * monitors in other processes (see tarea3-top).
+ *
+ * The segment holds one header and one section per writer thread:
+ * jack's process writes the cycle section, and the file thread writes
+ * the files section.  Each section is protected by its own seqlock, so
+ * writers never wait: they make the sequence number odd, write the
+ * section and make it even again.  Readers copy the section and retry
+ * if the sequence number was odd or changed in the meantime.  A reader
+ * can neither block nor slow down the writers, and it only needs read
+ * access to the segment.
+ *
+ * Readers must check magic and version before trusting the layout.  The
+ * version changes whenever the layout does.
+ */
+class stats_segment {
+public:
+  static constexpr std::uint32_t magic = 0x41545354u; // "TSTA"
+  static constexpr std::uint32_t version = 5u;
+
+  /// Default name of the segment
+  static constexpr const char* default_name = "/tarea3-stats";
+
+  /// Stages of jack's process, timed separately, in the order of tracer
+  enum stage {
+    Commands, ///< commands sent to jack's process
+    Input,    ///< playlist, live input, crossfades and shared memory
+    Voices,   ///< mix of the file voices
+    Process,  ///< client::process(), or the bypass
+    Output,   ///< output stream
+    Stages
+  };
+
+  static_assert(int(tracer::Output) - int(tracer::Commands) + 1 ==
+                int(Stages),"the stages must be traced in the same order");
+
+  /// Bins of the load histogram, of 5% each.  The last one is overload.
+  static constexpr std::size_t load_bins = 21u;
+
+  /// Longest file name published, including the terminating zero
+  static constexpr std::size_t name_length = 128u;
+
+  /// Loudness of the output after EBU R128
+  struct loudness {
+    std::uint32_t active;        ///< 0 without a meter
+    float momentary;             ///< LUFS of the last 400 ms, or -inf
+    float short_term;            ///< LUFS of the last 3 s, or -inf
+    float integrated;            ///< gated LUFS since the start, or -inf
+    float true_peak;             ///< highest dBTP since the start
+  };
+
+  /// Section written by jack's process once per cycle
+  struct cycle_section {
+    std::uint64_t cycles;        ///< cycles measured
+    std::uint32_t nframes;       ///< frames of the last cycle
+    float load;                  ///< last cycle time over its period
+    float max_load;              ///< highest load since the start
+    std::uint64_t histogram[load_bins];
+    std::uint32_t stage_ns[Stages];       ///< last cycle, per stage
+    std::uint64_t stage_total_ns[Stages]; ///< all cycles, per stage
+    float input_peak;            ///< linear peak of process' input
+    float input_rms;
+    float output_peak;
+    float output_rms;
+    /// Counters available, a bit per perf_counters::counter, or 0
+    std::uint32_t perf_available;
+    /// Sums of the performance counters around client::process()
+    std::uint64_t perf_intervals;
+    std::uint64_t perf[perf_counters::Counters];
+    /// Cycles that skipped process() on silent input
+    std::uint64_t silent_cycles;
+    /// dB of gain reduction of the compressor, or negative without one
+    float gain_reduction_db;
+    float max_gain_reduction_db;
+    loudness output_loudness;
+  };
+
+  /// State of one voice of the file thread
+  struct voice_state {
+    std::uint32_t playing;
+    std::uint32_t ready_blocks;  ///< prefetched blocks
+    std::uint32_t capacity;      ///< blocks in its ring
+    std::uint32_t sample_rate;   ///< of the file
+    std::uint64_t position;      ///< frames of the file delivered
+    std::uint64_t frames;        ///< length of the file, 0 if unknown
+  };
+
+  static constexpr std::size_t max_voices = 8u;
+
+  /// Section written by the file thread after each round of reads
+  struct files_section {
+    std::uint64_t rounds;          ///< rounds of the file thread
+    std::uint32_t queued;          ///< files waiting in the playlist
+    std::uint32_t finished;        ///< files played since the start
+    std::uint64_t prefetch_misses; ///< cycles a playing voice had no block
+    voice_state voices[max_voices];
+    char file[name_length];        ///< file of voice 0
+  };
+
+  /// A section with its sequence number
+  template<class T>
+  struct seqlock {
+    alignas(64) std::atomic<std::uint32_t> sequence;
+    T data;
+  };
+
+  /// Layout of the segment
+  struct layout {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t size;          ///< bytes of the layout
+    std::uint32_t pid;           ///< of the writer
+    std::uint32_t sample_rate;
+    std::uint32_t buffer_size;
+    /// Written by jack's xrun callback
+    alignas(64) std::atomic<std::uint64_t> xruns;
+    seqlock<cycle_section> cycle;
+    seqlock<files_section> files;
+  };
+
+  static_assert(std::atomic<std::uint32_t>::is_always_lock_free &&
+                std::atomic<std::uint64_t>::is_always_lock_free,
+                "shared memory counters must be lock free");
+
+  /**
+   * Times the stages of one cycle of jack's process with the monotonic
+   * clock, which is read in user space (vDSO) without system calls.
+   * Nothing is measured if it is inactive and the tracer is disabled.
+   * While tracing, each stage is also recorded as a span (see tracer).
+   */
+  class stage_clock {
+  public:
+    inline explicit stage_clock(const bool active)
+      : _trace(tracer::enabled()), _active(active || _trace),
+        _start(_active ? now() : 0u), _last(_start), ns{} {}
+
+    /// End the given stage, which started where the previous one ended
+    inline void mark(const stage s) {
+      if (_active) {
+        const std::uint64_t t = now();
+        ns[s] += std::uint32_t(t - _last);
+        if (_trace) {
+          const int e = int(tracer::Commands) + int(s);
+          tracer::complete(tracer::event(e),_last,t);
+        }
+        _last = t;
+      }
+    }
+
+    /// Trace the whole cycle, after its last stage
+    inline void finish(const std::uint32_t arg) {
+      if (_trace) {
+        tracer::complete(tracer::Cycle,_start,_last,arg);
+      }
+    }
+
+    /// Nanoseconds since the clock was created
+    inline std::uint64_t total() const {return _last - _start;}
+
+    inline bool active() const {return _active;}
+
+    /// Current time of the monotonic clock in nanoseconds
+    static inline std::uint64_t now() {
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC,&ts);
+      return std::uint64_t(ts.tv_sec)*1000000000u + std::uint64_t(ts.tv_nsec);
+    }
+
+  private:
+    bool _trace;
+    bool _active;
+    std::uint64_t _start;
+    std::uint64_t _last;
+
+  public:
+    /// Nanoseconds spent in each stage
+    std::uint32_t ns[Stages];
+  };
+
+  stats_segment();
+  ~stats_segment();
+
+  stats_segment(const stats_segment&) = delete; // not copyable
+  stats_segment& operator=(const stats_segment&) = delete; // not copyable
+
+  /**
+   * Create (or replace) the named segment as its writer.  The pages are
+   * populated and locked, so that writing them never faults.  The
+   * segment is removed when this object is closed.
+   */
+  bool create(const std::string& name,
+              const std::uint32_t sample_rate,
+              const std::uint32_t buffer_size);
+
+  /// Attach read-only to the segment of a running client
+  bool attach(const std::string& name);
+
+  /// Unmap the segment (and remove it, if this object created it)
+  void close();
+
+  inline bool valid() const {return _layout != nullptr;}
+
+  /// The mapped segment, or nullptr
+  inline const layout* get() const {return _layout;}
+
+  /// Writer: update the period, after jack changed it
+  void set_format(const std::uint32_t sample_rate,
+                  const std::uint32_t buffer_size);
+
+  /**
+   * Writer (jack's process): publish the timings and levels of one
+   * cycle, the performance counters if they are valid, the total of
+   * cycles skipped on silence, the gain reduction of the compressor
+   * (negative without one) and the loudness of the output (nullptr
+   * without a meter).  Wait-free.
+   */
+  void publish_cycle(const std::uint32_t nframes,
+                     const stage_clock& clock,
+                     const float* in,
+                     const float* out,
+                     const perf_counters& counters,
+                     const std::uint64_t silent_cycles,
+                     const float gain_reduction_db,
+                     const loudness* output_loudness);
+
+  /// Writer (jack's xrun callback): count an xrun
+  void count_xrun();
+
+  /**
+   * Writer (file thread): begin the update of the files section, and
+   * return it to be filled in.  It must be followed by end_files().
+   */
+  files_section& begin_files();
+
+  /// Writer (file thread): publish the files section
+  void end_files();
+
+  /**
+   * Reader: copy a consistent snapshot of the section.  Returns false if
+   * the writer kept changing it after some attempts.
+   */
+  template<class T>
+  static bool read(const seqlock<T>& section,T& copy);
+
+private:
+  std::string _name;
+  bool _owner;
+  int _fd;
+  layout* _layout;
+  std::size_t _mapped_bytes;
+  /**
+   * Nanoseconds of one frame, to compute the load of each cycle.  It is
+   * set from jack's callbacks while jack's process reads it.
+   */
+  std::atomic<double> _frame_ns;
+
+  /// Start or end the update of a section
+  static void write_begin(std::atomic<std::uint32_t>& sequence);
+  static void write_end(std::atomic<std::uint32_t>& sequence);
+};
+
+template<class T>
+bool stats_segment::read(const seqlock<T>& section,T& copy) {
+  for (int attempt=0;attempt<100;++attempt) {
+    const std::uint32_t before =
+      section.sequence.load(std::memory_order_acquire);
+    if ((before & 1u) != 0u) {
+      continue; // being written
+    }
+    std::memcpy(&copy,&section.data,sizeof(T));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (section.sequence.load(std::memory_order_relaxed) == before) {
+      return true;
+    }
+  }
+  return false;
+}
+
+#endif
@@ -0,0 +1,300 @@
+/**
+ * stats_top.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file stats_top.cpp
+ *
+ * @brief Monitor of the live statistics of a running jack client (see
+ * its --stats-shm option and stats_segment.h).
+ *
+ * It attaches read-only to the shared memory segment and redraws the
+ * statistics periodically.  The client never waits for it.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <csignal>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <boost/program_options.hpp>
+
+#include "stats_segment.h"
+
+namespace po=boost::program_options;
+
+namespace {
+  const char* stage_names[stats_segment::Stages] = {
+    "commands","input","voices","process","output"
+  };
+
+  /// Level in dBFS, or -inf
+  std::string dbfs(const float level) {
+    if (level <= 1e-10f) {
+      return "-inf";
+    }
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(1) << 20.0*std::log10(level);
+    return os.str();
+  }
+
+  /// Time of the given frames as mm:ss.s
+  std::string clock_time(const std::uint64_t frames,const std::uint32_t rate) {
+    const double s = (rate > 0u) ? double(frames)/double(rate) : 0.0;
+    std::ostringstream os;
+    os << std::setfill('0') << std::setw(2) << int(s/60.0) << ':'
+       << std::fixed << std::setprecision(1) << std::setw(4)
+       << std::fmod(s,60.0);
+    return os.str();
+  }
+
+  /// Bar of the given fraction of width characters
+  std::string bar(const double fraction,const int width) {
+    const int n = std::clamp(int(fraction*width + 0.5),0,width);
+    return std::string(std::size_t(n),'#') +
+      std::string(std::size_t(width - n),' ');
+  }
+
+  /**
+   * Print the statistics.  The averages are taken since the previous
+   * cycle snapshot.
+   */
+  void render(std::ostream& os,
+              const stats_segment::layout& seg,
+              const stats_segment::cycle_section& cycle,
+              const stats_segment::cycle_section& previous,
+              const stats_segment::files_section& files) {
+    const double period_ms = (seg.sample_rate > 0u) ?
+      1e3*double(seg.buffer_size)/double(seg.sample_rate) : 0.0;
+    const std::uint64_t cycles = cycle.cycles - previous.cycles;
+
+    os << "tarea3-top   pid " << seg.pid << "   " << seg.sample_rate
+       << " Hz   " << seg.buffer_size << " frames ("
+       << std::fixed << std::setprecision(2) << period_ms << " ms)\n"
+       << "cycles " << cycle.cycles
+       << "   xruns " << seg.xruns.load(std::memory_order_relaxed)
+       << "   prefetch misses " << files.prefetch_misses;
+    if (cycle.silent_cycles > 0u) {
+      os << "   silent " << cycle.silent_cycles;
+    }
+    os << "\n\n";
+
+    os << std::setprecision(1)
+       << "load   now " << std::setw(5) << 100.0*cycle.load << "%"
+       << "   max " << std::setw(5) << 100.0*cycle.max_load << "%\n\n";
+
+    if (cycle.output_loudness.active != 0u) {
+      const stats_segment::loudness& l = cycle.output_loudness;
+      os << "loudness   M " << std::setw(5) << l.momentary
+         << "   S " << std::setw(5) << l.short_term
+         << "   I " << std::setw(5) << l.integrated << " LUFS"
+         << "   true peak " << std::setw(5) << l.true_peak << " dBTP\n\n";
+    }
+
+    if (cycle.gain_reduction_db >= 0.0f) {
+      os << "gain reduction " << std::setw(5) << cycle.gain_reduction_db
+         << " dB   max " << std::setw(5) << cycle.max_gain_reduction_db
+         << " dB\n\n";
+    }
+
+    // Stages, averaged over the cycles since the last redraw
+    os << "stage       last us    avg us\n";
+    for (std::size_t s=0;s<stats_segment::Stages;++s) {
+      const double avg = (cycles > 0u) ?
+        1e-3*double(cycle.stage_total_ns[s] - previous.stage_total_ns[s])/
+        double(cycles) : 0.0;
+      os << std::left << std::setw(10) << stage_names[s] << std::right
+         << std::setw(9) << 1e-3*cycle.stage_ns[s]
+         << std::setw(10) << avg << "\n";
+    }
+
+    // Distribution of the load since the start
+    std::uint64_t total = 0u;
+    for (auto h : cycle.histogram) {
+      total += h;
+    }
+    os << "\nload histogram\n";
+    for (std::size_t b=0;b<stats_segment::load_bins;++b) {
+      if (cycle.histogram[b] == 0u) {
+        continue;
+      }
+      const double fraction = double(cycle.histogram[b])/double(total);
+      std::ostringstream range;
+      if (b + 1u < stats_segment::load_bins) {
+        range << 5u*b << "-" << 5u*(b + 1u) << "%";
+      } else {
+        range << ">100%";
+      }
+      os << "  " << std::left << std::setw(9) << range.str() << std::right
+         << "|" << bar(fraction,40) << "| " << std::setw(5)
+         << 100.0*fraction << "%\n";
+    }
+
+    // Hardware counters around process(), since the last redraw
+    if (cycle.perf_available != 0u) {
+      const std::uint64_t intervals =
+        cycle.perf_intervals - previous.perf_intervals;
+      auto delta = [&](const perf_counters::counter c) {
+        return double(cycle.perf[c] - previous.perf[c]);
+      };
+      os << "\nprocess() ";
+      if (intervals > 0u) {
+        os << std::setprecision(0) << delta(perf_counters::Cycles)/
+          double(intervals) << " cycles/call";
+      }
+      const double instructions = delta(perf_counters::Instructions);
+      if ((cycle.perf_available & (1u << perf_counters::Instructions)) &&
+          (instructions > 0.0)) {
+        const char* names[perf_counters::Counters] = {
+          "","","L1d","LLC","branch"
+        };
+        os << std::setprecision(2) << "   IPC "
+           << instructions/delta(perf_counters::Cycles) << "\n"
+           << "misses/kinstr";
+        for (std::size_t c=perf_counters::L1DMisses;
+             c<perf_counters::Counters;++c) {
+          if (cycle.perf_available & (1u << c)) {
+            os << "   " << names[c] << " "
+               << 1e3*delta(perf_counters::counter(c))/instructions;
+          }
+        }
+      }
+      os << "\n" << std::setprecision(1);
+    }
+
+    os << "\nlevel      peak dBFS   rms dBFS\n"
+       << "input    " << std::setw(11) << dbfs(cycle.input_peak)
+       << std::setw(11) << dbfs(cycle.input_rms) << "\n"
+       << "output   " << std::setw(11) << dbfs(cycle.output_peak)
+       << std::setw(11) << dbfs(cycle.output_rms) << "\n";
+
+    os << "\nvoice   ready   position / length\n";
+    for (std::size_t v=0;v<stats_segment::max_voices;++v) {
+      const stats_segment::voice_state& s = files.voices[v];
+      if ((s.playing == 0u) && (s.ready_blocks == 0u)) {
+        continue;
+      }
+      os << std::setw(5) << v << std::setw(5) << s.ready_blocks << "/"
+         << std::left << std::setw(3) << s.capacity << std::right
+         << clock_time(s.position,s.sample_rate) << " / "
+         << ((s.frames > 0u) ? clock_time(s.frames,s.sample_rate) : "--")
+         << ((v == 0u) ? "   " + std::string(files.file) : "") << "\n";
+    }
+    os << "files queued " << files.queued << ", finished "
+       << files.finished << std::endl;
+  }
+}
+
+int main(int argc,char *argv[]) {
+
+  try {
+    std::string name;
+    double interval = 0.5;
+    
+    po::options_description desc("Allowed options");
+
+    desc.add_options()
+      ("help,h","show usage information")
+      ("name,n",
+       po::value<std::string>(&name)->
+       default_value(stats_segment::default_name),
+       "Statistics segment of the client (see its --stats-shm option)")
+      ("interval,i",
+       po::value<double>(&interval)->default_value(0.5),
+       "Seconds between redraws")
+      ("once","print the statistics once, without clearing the screen");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc,argv,desc),vm);
+    po::notify(vm);
+    
+    if (vm.count("help")) {
+      std::cout << desc << std::endl;
+      return EXIT_SUCCESS;
+    }
+
+    stats_segment segment;
+    if (!segment.attach(name)) {
+      std::cerr << "E> Unable to attach to '" << name << "'.  Is the client "
+                << "running with --stats-shm, with the same version?"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    const stats_segment::layout& seg = *segment.get();
+
+    const bool once = vm.count("once") != 0u;
+    const auto period = std::chrono::duration<double>(std::max(0.05,interval));
+
+    stats_segment::cycle_section cycle{}, previous{};
+    stats_segment::files_section files{};
+    
+    // A first snapshot, for the averages of the first redraw
+    stats_segment::read(seg.cycle,previous);
+    if (once) {
+      std::this_thread::sleep_for(period);
+    }
+    
+    do {
+      // The segment outlives the client while it is mapped
+      if (kill(pid_t(seg.pid),0) != 0) {
+        std::cerr << "I> Client " << seg.pid << " finished" << std::endl;
+        return EXIT_SUCCESS;
+      }
+      if (stats_segment::read(seg.cycle,cycle) &&
+          stats_segment::read(seg.files,files)) {
+        std::ostringstream os;
+        render(os,seg,cycle,previous,files);
+        std::cout << (once ? "" : "\033[H\033[2J") << os.str() << std::flush;
+        previous = cycle;
+      }
+      if (!once) {
+        std::this_thread::sleep_for(period);
+      }
+    } while (!once);
+
+    return EXIT_SUCCESS;
+  }
+  catch (std::exception& exc) {
+    std::cerr << argv[0] << ": Error: " << exc.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}
@@ -0,0 +1,292 @@
+/**
+ * stream_reader.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream_reader.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+namespace {
+  /// Bytes of the stream inspected to find a WAV header
+  constexpr std::size_t header_bytes = 4096u;
+}
+
+stream_reader::stream_reader(const pcm_format& raw,const double jitter_ms)
+  : audio_reader()
+  , _raw(raw)
+  , _format()
+  , _jitter_ms(jitter_ms)
+  , _jitter_bytes(0u)
+  , _fd(-1)
+  , _eof(false)
+  , _primed(false)
+  , _connected(false)
+  , _awaiting_header(false)
+  , _buffer()
+  , _begin(0u)
+  , _end(0u) {
+}
+
+stream_reader::~stream_reader() {
+  close();
+}
+
+bool stream_reader::is_stream(const std::filesystem::path& file) {
+  if (file == "-") {
+    return true;
+  }
+  std::error_code ec;
+  return std::filesystem::is_fifo(file,ec);
+}
+
+bool stream_reader::open(const std::filesystem::path& file) {
+  close();
+
+  // A named pipe opened without O_NONBLOCK would block until a producer
+  // opens it, and with it the whole file thread
+  if (file == "-") {
+    _fd = ::dup(STDIN_FILENO);
+  } else if (is_stream(file)) {
+    _fd = ::open(file.c_str(),O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  }
+  
+  if (_fd < 0) {
+    return false;
+  }
+  
+  const int flags = fcntl(_fd,F_GETFL,0);
+  fcntl(_fd,F_SETFL,flags | O_NONBLOCK);
+
+  _eof = false;
+  _primed = false;
+  // Until a producer opens the pipe, reading it gives 0 bytes as at its
+  // end.  The standard input has its producer already.
+  _connected = (file == "-");
+  _awaiting_header = true;
+  _begin = _end = 0u;
+  _buffer.resize(std::max(_buffer.size(),header_bytes));
+
+  _format      = pcm_format();
+  _channels    = 0u; // known with the header
+  _sample_rate = 0u;
+  _frames      = 0u; // unknown for streams
+  
+  return true;
+}
+
+bool stream_reader::detect_format() {
+  const bool riff = (buffered() >= 4u) &&
+    (std::memcmp(_buffer.data()+_begin,"RIFF",4) == 0);
+
+  if (riff) {
+    // A WAV header: the header of the data chunk may still be on its way
+    if (parse_wav_header(_buffer.data()+_begin,buffered(),_format)) {
+      // The size in the header of a stream is meaningless
+      _begin += _format.data_offset;
+      _format.data_bytes = 0u;
+    } else if (!_eof && (buffered() < header_bytes)) {
+      return false;
+    } else {
+      std::cerr << "E> Unsupported WAV header in stream" << std::endl;
+      _format = pcm_format();
+    }
+  } else if ((buffered() < 4u) && !_eof) {
+    return false;
+  } else {
+    _format = _raw;
+    if (!_format.valid()) {
+      std::cerr << "E> Stream without header and without raw format"
+                << std::endl;
+    }
+  }
+
+  _awaiting_header = false;
+
+  if (!_format.valid()) {
+    // Nothing else will be read
+    _format = pcm_format();
+    _eof = true;
+    return true;
+  }
+
+  _channels    = _format.channels;
+  _sample_rate = _format.sample_rate;
+  
+  const std::size_t fb = _format.frame_bytes();
+  _jitter_bytes = fb*std::size_t(_jitter_ms*1e-3*double(_sample_rate));
+
+  // Room for the jitter buffer plus some chunks more
+  const std::size_t capacity = std::max(_jitter_bytes + 4u*chunk_bytes,
+                                        std::size_t(1024u*1024u));
+  if (_buffer.size() < capacity) {
+    // keep what was read with the header
+    _buffer.resize(capacity);
+  }
+  
+  return true;
+}
+
+void stream_reader::fill() {
+  if ((_fd < 0) || _eof) {
+    return;
+  }
+
+  // Move the pending bytes to the front, to make room for more
+  if ((_begin > 0u) && (_begin >= _buffer.size()/2u)) {
+    std::memmove(_buffer.data(),_buffer.data()+_begin,buffered());
+    _end -= _begin;
+    _begin = 0u;
+  }
+
+  while (_end < _buffer.size()) {
+    const std::size_t n = std::min(chunk_bytes,_buffer.size()-_end);
+    const ssize_t r = ::read(_fd,_buffer.data()+_end,n);
+    if (r > 0) {
+      _end += std::size_t(r);
+      _connected = true;
+    } else if (r == 0) {
+      // The producer closed the stream, unless it did not open it yet.
+      // Linux reports a hang-up only if a producer came and went.
+      if (!_connected) {
+        pollfd pfd;
+        pfd.fd = _fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        _connected = (poll(&pfd,1,0) > 0) && (pfd.revents & POLLHUP);
+      }
+      _eof = _connected;
+      break;
+    } else if (errno == EINTR) {
+      continue;
+    } else {
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+        _eof = true;
+      }
+      break;
+    }
+  }
+}
+
+void stream_reader::wait_for(const std::size_t bytes) {
+  fill();
+  // Without a producer the pipe would be always ready
+  while (_connected && !_eof && (buffered() < bytes) &&
+         (_end < _buffer.size())) {
+    pollfd pfd;
+    pfd.fd = _fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    const int r = poll(&pfd,1,-1);
+    if ((r < 0) && (errno != EINTR)) {
+      return;
+    }
+    fill();
+  }
+}
+
+bool stream_reader::ready(const std::size_t frames) {
+  fill();
+
+  if (_awaiting_header && !detect_format()) {
+    return false;
+  }
+
+  if (_eof) {
+    return true;
+  }
+
+  const std::size_t needed = frames*_format.frame_bytes();
+
+  if (!_primed) {
+    // Wait for the jitter buffer to fill before starting
+    _primed = buffered() >= std::max(_jitter_bytes,needed);
+    return _primed;
+  }
+
+  if (buffered() < needed) {
+    // Underrun: fill the jitter buffer again before continuing
+    _primed = false;
+    return false;
+  }
+  
+  return true;
+}
+
+std::size_t stream_reader::read(float* dst,const std::size_t frames) {
+  if ((_fd < 0) || _awaiting_header || !_format.valid()) {
+    return 0u;
+  }
+  
+  const std::size_t fb = _format.frame_bytes();
+  std::size_t done = 0u;
+  
+  while (done < frames) {
+    if (buffered() < fb) {
+      if (_eof) {
+        break;
+      }
+      wait_for((frames-done)*fb);
+      continue;
+    }
+    
+    const std::size_t n = std::min(frames-done,buffered()/fb);
+    decode_pcm(_buffer.data()+_begin,n,_format,dst+done*_channels);
+    _begin += n*fb;
+    done += n;
+  }
+
+  if (_begin == _end) {
+    _begin = _end = 0u;
+  }
+  
+  return done;
+}
+
+void stream_reader::close() {
+  if (_fd >= 0) {
+    ::close(_fd);
+    _fd = -1;
+  }
+  _begin = _end = 0u;
+}
@@ -0,0 +1,116 @@
+/**
+ * stream_reader.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _STREAM_READER_H
+#define _STREAM_READER_H
+
+#include <cstddef>
+#include <vector>
+
+#include "audio_reader.h"
+#include "pcm_format.h"
+
+/**
+ * Reader of audio streamed through the standard input ("-") or a named
+ * pipe.
+ *
+ * The stream may start with a WAV header; otherwise it is interpreted
+ * as raw interleaved PCM with the format given in the constructor.  The
+ * data is read in large non-blocking chunks, so that the thread is
+ * never blocked by a slow producer.
+ *
+ * Opening never blocks, not even for a named pipe without a producer
+ * yet: the header is detected by ready() as the first bytes arrive, and
+ * until then the number of channels and the sampling rate are zero.  If
+ * the stream cannot be decoded they stay zero and ready() returns true.
+ *
+ * Before the first frames are delivered, and after running out of data,
+ * the reader waits until the jitter buffer is full.  The stream ends
+ * when the producer closes it.
+ */
+class stream_reader : public audio_reader {
+public:
+  /**
+   * @param raw format of the stream if it has no WAV header
+   * @param jitter_ms milliseconds of audio buffered before playing
+   */
+  stream_reader(const pcm_format& raw,const double jitter_ms);
+  virtual ~stream_reader();
+
+  /// True if the given name refers to a stream and not to a regular file
+  static bool is_stream(const std::filesystem::path& file);
+
+  virtual bool open(const std::filesystem::path& file) override;
+  virtual std::size_t read(float* dst,const std::size_t frames) override;
+  virtual bool ready(const std::size_t frames) override;
+  virtual void close() override;
+
+private:
+  /// Bytes read in each system call, at most
+  static constexpr std::size_t chunk_bytes = 64u*1024u;
+  
+  pcm_format _raw;
+  pcm_format _format;
+  double _jitter_ms;
+  std::size_t _jitter_bytes;
+  
+  int _fd;
+  bool _eof;
+  bool _primed;
+  /// Some producer has written to the stream, so it ends when it closes
+  bool _connected;
+  /// The format is not known until the first bytes arrive
+  bool _awaiting_header;
+
+  std::vector<unsigned char> _buffer;
+  std::size_t _begin;
+  std::size_t _end;
+
+  inline std::size_t buffered() const {return _end-_begin;}
+
+  /// Read all data available without blocking
+  void fill();
+  /// Block until there are at least the given bytes or the stream ends
+  void wait_for(const std::size_t bytes);
+  /**
+   * Detect the WAV header, or use the raw format, with the bytes read so
+   * far.  Returns false if more bytes are needed to decide.
+   */
+  bool detect_format();
+};
+
+#endif
@@ -0,0 +1,280 @@
+/**
+ * stream_writer.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "stream_writer.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <chrono>
+#include <iostream>
+
+stream_writer::stream_writer()
+  : _target()
+  , _format()
+  , _fd(-1)
+  , _active(false)
+  , _ring()
+  , _running(false)
+  , _alive(false)
+  , _waiting(false)
+  , _wake_fd(eventfd(0u,EFD_NONBLOCK | EFD_CLOEXEC))
+  , _written(0u)
+  , _dropped(0u) {
+}
+
+stream_writer::~stream_writer() {
+  stop();
+  if (_wake_fd >= 0) {
+    ::close(_wake_fd);
+  }
+}
+
+int stream_writer::_stdout_fd = -1;
+
+bool stream_writer::claim_stdout() {
+  if (_stdout_fd >= 0) {
+    return true;
+  }
+
+  // Keep the real stdout for the audio, and send the log messages
+  // written to std::cout to stderr instead
+  std::cout.flush();
+  const int fd = ::dup(STDOUT_FILENO);
+  if (fd < 0) {
+    return false;
+  }
+  if (::dup2(STDERR_FILENO,STDOUT_FILENO) < 0) {
+    ::close(fd);
+    return false;
+  }
+  _stdout_fd = fd;
+  return true;
+}
+
+bool stream_writer::open(const std::filesystem::path& target,
+                         const pcm_format& fmt,
+                         const std::size_t capacity) {
+  if (_active || (fmt.sample_bytes() == 0u)) {
+    return false;
+  }
+  
+  _target = target;
+  _format = fmt;
+
+  if (target == "-") {
+    if (!claim_stdout()) {
+      return false;
+    }
+    _fd = ::dup(_stdout_fd);
+    if (_fd < 0) {
+      return false;
+    }
+  }
+
+  // A consumer that goes away must not kill the process
+  std::signal(SIGPIPE,SIG_IGN);
+  
+  _ring.allocate(capacity);
+  _samples.resize(chunk);
+  _bytes.resize(chunk*_format.sample_bytes());
+  _written = 0u;
+  _dropped = 0u;
+  _active = true;
+  
+  return true;
+}
+
+void stream_writer::spawn() {
+  if (_active && !_running) {
+    _running = true;
+    _alive = true;
+    _thread = std::thread(&stream_writer::run,this);
+  }
+}
+
+void stream_writer::stop() {
+  _running = false;
+  wake();
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+  if (_fd >= 0) {
+    ::close(_fd);
+    _fd = -1;
+  }
+  if (_active) {
+    std::cerr << "I> Output stream: " << _written << " samples written, "
+              << _dropped << " dropped" << std::endl;
+  }
+  _active = false;
+}
+
+void stream_writer::push(const float* samples,const std::size_t n) {
+  const std::size_t m = _ring.push(samples,n);
+  if (m < n) {
+    _dropped.fetch_add(n - m,std::memory_order_relaxed);
+  }
+  notify_writer();
+}
+
+bool stream_writer::push_wait(const float* samples,std::size_t n) {
+  while (n > 0u) {
+    if (!_alive.load()) {
+      return false; // nobody empties the ring anymore
+    }
+    const std::size_t m = _ring.push(samples,n);
+    notify_writer();
+    samples += m;
+    n -= m;
+    if (n > 0u) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  return true;
+}
+
+void stream_writer::notify_writer() {
+  // Only a sleeping writer costs a system call.  The fence pairs with
+  // the one in run(), so that either the writer sees the new samples or
+  // this sees it waiting.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (_waiting.load(std::memory_order_relaxed) &&
+      _waiting.exchange(false,std::memory_order_relaxed)) {
+    wake();
+  }
+}
+
+void stream_writer::wake() {
+  const std::uint64_t one = 1u;
+  if ((_wake_fd >= 0) &&
+      (::write(_wake_fd,&one,sizeof(one)) != ssize_t(sizeof(one)))) {
+    return; // the counter is already set, so the writer wakes up anyway
+  }
+}
+
+void stream_writer::sleep(const int timeout_ms) {
+  pollfd pfd;
+  pfd.fd = _wake_fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  if (poll(&pfd,1,timeout_ms) > 0) {
+    std::uint64_t count;
+    if (::read(_wake_fd,&count,sizeof(count)) != ssize_t(sizeof(count))) {
+      count = 0u;
+    }
+  }
+}
+
+bool stream_writer::write_all(const unsigned char* data,std::size_t size) {
+  while (size > 0u) {
+    const ssize_t r = ::write(_fd,data,size);
+    if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "E> Output stream closed: " << std::strerror(errno)
+                << std::endl;
+      return false;
+    }
+    data += r;
+    size -= std::size_t(r);
+  }
+  return true;
+}
+
+bool stream_writer::open_target() {
+  // Without O_NONBLOCK, opening a named pipe blocks until a reader opens
+  // it, and stop() could not end this thread.  With it, it fails with
+  // ENXIO meanwhile.
+  while (_running) {
+    _fd = ::open(_target.c_str(),
+                 O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK | O_CLOEXEC,0644);
+    if (_fd >= 0) {
+      // Writes block normally once the reader is there
+      const int flags = fcntl(_fd,F_GETFL,0);
+      fcntl(_fd,F_SETFL,flags & ~O_NONBLOCK);
+      return true;
+    }
+    if (errno == ENXIO) {
+      sleep(100);
+      continue;
+    }
+    if (errno != EINTR) {
+      std::cerr << "E> Unable to open output stream " << _target << ": "
+                << std::strerror(errno) << std::endl;
+      return false;
+    }
+  }
+  return false;
+}
+
+void stream_writer::run() {
+  if ((_fd < 0) && !open_target()) {
+    _alive = false;
+    return;
+  }
+
+  bool ok = true;
+  
+  // Keep going until stopped, and then write what is left in the ring
+  while (ok && (_running || !_ring.empty())) {
+    const std::size_t n = _ring.pop(_samples.data(),_samples.size());
+    if (n == 0u) {
+      // Sleep until push() or stop() wake this thread up
+      _waiting.store(true,std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (_running && _ring.empty()) {
+        sleep(-1);
+      }
+      _waiting.store(false,std::memory_order_relaxed);
+      continue;
+    }
+
+    encode_pcm(_samples.data(),n,_format,_bytes.data());
+    ok = write_all(_bytes.data(),n*_format.sample_bytes());
+    if (ok) {
+      _written.fetch_add(n,std::memory_order_relaxed);
+    }
+  }
+  _alive = false;
+}
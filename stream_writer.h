@@ -0,0 +1,163 @@
+/**
+ * stream_writer.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _STREAM_WRITER_H
+#define _STREAM_WRITER_H
+
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+#include "pcm_format.h"
+#include "spsc_ringbuffer.h"
+
+/**
+ * Writer of the processed audio as raw PCM into the standard output
+ * ("-"), a named pipe or a file, for downstream tools.
+ *
+ * jack's process pushes its output into a lock-free ring with push(),
+ * and a normal thread drains the ring, converts the samples to the
+ * requested encoding and writes them in large chunks.  If the consumer
+ * is too slow and the ring overflows, the samples that do not fit are
+ * dropped and counted.
+ */
+class stream_writer {
+public:
+  stream_writer();
+  ~stream_writer();
+
+  stream_writer(const stream_writer&) = delete; // not copyable
+  stream_writer& operator=(const stream_writer&) = delete; // not copyable
+
+  /**
+   * Keep the standard output for the audio, and send everything
+   * written to std::cout to the standard error from then on.  It must
+   * be called before anything is printed, so that no log message ends
+   * up in the stream.  Calling it again does nothing.
+   */
+  static bool claim_stdout();
+
+  /**
+   * Prepare the output.
+   *
+   * If the target is "-", the standard output is used for the audio,
+   * claimed with claim_stdout() if that was not done yet.  Named pipes
+   * are opened by the writer thread, which waits there until a reader
+   * appears, or until stop() is called.
+   *
+   * @param target where to write the samples
+   * @param fmt encoding and byte order of the samples
+   * @param capacity frames buffered between jack and the writer thread
+   */
+  bool open(const std::filesystem::path& target,
+            const pcm_format& fmt,
+            const std::size_t capacity);
+
+  /// Start the writer thread
+  void spawn();
+
+  /// Write what is still buffered, and stop the writer thread
+  void stop();
+
+  /**
+   * Queue samples to be written.  It never blocks, so it can be called
+   * from jack's process.
+   */
+  void push(const float* samples,const std::size_t n);
+
+  /**
+   * Queue samples, waiting for room in the ring.  It is meant for
+   * offline rendering, and must not be called from jack's process.
+   * Returns false if the writer thread is gone, because the target
+   * could not be opened or its reader went away.
+   */
+  bool push_wait(const float* samples,std::size_t n);
+
+  /// True if the output was opened
+  inline bool active() const {return _active;}
+
+  /// True while the writer thread is able to write
+  inline bool alive() const {return _alive.load();}
+  
+  /// Samples written so far
+  inline std::size_t written() const {return _written.load();}
+  /// Samples lost because the ring was full
+  inline std::size_t dropped() const {return _dropped.load();}
+
+private:
+  /// Samples converted and written in each system call, at most
+  static constexpr std::size_t chunk = 16384u;
+  
+  std::filesystem::path _target;
+  pcm_format _format;
+  int _fd;
+  bool _active;
+
+  /// The real standard output, once claimed
+  static int _stdout_fd;
+  
+  spsc_ringbuffer<float> _ring;
+  std::atomic<bool> _running;
+  /// Cleared by the writer thread when it ends
+  std::atomic<bool> _alive;
+  /// The writer thread sleeps on _wake_fd until there are samples
+  std::atomic<bool> _waiting;
+  int _wake_fd;
+  std::atomic<std::size_t> _written;
+  std::atomic<std::size_t> _dropped;
+  std::thread _thread;
+
+  std::vector<float> _samples;
+  std::vector<unsigned char> _bytes;
+
+  /// The real worker thread
+  void run();
+  /// Open the target, waiting for the reader of a named pipe
+  bool open_target();
+  /// Wake up the writer thread if it sleeps waiting for samples
+  void notify_writer();
+  /// Wake up the writer thread
+  void wake();
+  /// Sleep until wake() is called, or timeout_ms pass (-1 for no limit)
+  void sleep(const int timeout_ms);
+  /// Write all given bytes, returns false if the consumer is gone
+  bool write_all(const unsigned char* data,std::size_t size);
+};
+
+#endif
@@ -0,0 +1,191 @@
+#!/bin/bash
+#
+# Stress test of tarea3 with tiny jack periods, on the dummy backend of
+# a private jackd, so that it runs on machines without sound card.
+#
+# While the client plays a playlist and mixes voices, the control socket
+# is flooded with commands, including filter coefficient swaps.  At the
+# end the xruns, the prefetch misses and the distribution of the load of
+# the callback are reported (see tarea3-top).
+#
+# Usage: ./stress.sh [-b builddir] [-p period] [-r rate] [-d seconds]
+#                    [-i interval] [-x max_xruns] [-R] [files...]
+#
+#   -b  directory with tarea3, tarea3-ctl and tarea3-top (builddir)
+#   -p  frames per period (16)
+#   -r  sampling rate (48000)
+#   -d  seconds of the test (30)
+#   -i  seconds between command batches (0.01)
+#   -x  fail if there are more xruns than these (no limit)
+#   -R  run jackd with realtime scheduling
+#
+# Without files, some seconds of noise are generated for the playlist.
+
+build=builddir
+period=16
+rate=48000
+duration=30
+interval=0.01
+max_xruns=
+realtime=--no-realtime
+
+while getopts "b:p:r:d:i:x:Rh" opt; do
+  case $opt in
+    b) build=$OPTARG ;;
+    p) period=$OPTARG ;;
+    r) rate=$OPTARG ;;
+    d) duration=$OPTARG ;;
+    i) interval=$OPTARG ;;
+    x) max_xruns=$OPTARG ;;
+    R) realtime=--realtime ;;
+    *) sed -n '2,/^$/s/^# \{0,1\}//p' "$0"; exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+for tool in jackd "$build/tarea3" "$build/tarea3-ctl" "$build/tarea3-top"; do
+  if ! command -v "$tool" > /dev/null; then
+    echo "E> $tool not found" >&2
+    exit 1
+  fi
+done
+
+# Everything of this run lives in its own directory, server and segment
+work=$(mktemp -d /tmp/tarea3-stress.XXXXXX)
+server=tarea3-stress-$$
+socket=$work/control.sock
+segment=/tarea3-stress-$$
+export JACK_DEFAULT_SERVER=$server
+
+jack_pid=
+client_pid=
+flood_pid=
+
+cleanup() {
+  [ -n "$flood_pid" ] && kill "$flood_pid" 2> /dev/null
+  [ -n "$client_pid" ] && kill "$client_pid" 2> /dev/null
+  [ -n "$jack_pid" ] && kill "$jack_pid" 2> /dev/null
+  wait 2> /dev/null
+  rm -rf "$work"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# Little endian integers for the WAV headers
+le16() { printf '\\x%02x\\x%02x' $(($1 & 255)) $((($1 >> 8) & 255)); }
+le32() { le16 $(($1 & 65535)); le16 $((($1 >> 16) & 65535)); }
+
+# Mono 16 bit WAV file of noise: make_wav file seconds
+make_wav() {
+  local bytes=$(($2 * rate * 2))
+  {
+    printf "RIFF$(le32 $((36 + bytes)))WAVEfmt "
+    printf "$(le32 16)$(le16 1)$(le16 1)$(le32 $rate)$(le32 $((rate * 2)))"
+    printf "$(le16 2)$(le16 16)data$(le32 $bytes)"
+    head -c $bytes /dev/urandom
+  } > "$1"
+}
+
+# Two sets of second order sections, swapped by the flood
+make_coefficients() {
+  printf "1 0 0 1 0 0\n" > "$work/flat.txt"
+  printf "0.2929 0.5858 0.2929 1 0 0.1716\n0.5 0.5 0 1 0 0\n" \
+         > "$work/lowpass.txt"
+}
+
+files=("$@")
+if [ ${#files[@]} -eq 0 ]; then
+  for i in 1 2 3; do
+    make_wav "$work/noise$i.wav" $((i + 1))
+    files+=("$work/noise$i.wav")
+  done
+fi
+make_coefficients
+
+echo "I> jackd $server: dummy backend, $period frames at $rate Hz"
+jackd -n "$server" $realtime -d dummy -r "$rate" -p "$period" \
+      > "$work/jackd.log" 2>&1 &
+jack_pid=$!
+
+# The server is ready when a client can connect (or after a while,
+# without jack_lsp)
+for i in $(seq 50); do
+  if command -v jack_lsp > /dev/null; then
+    jack_lsp > /dev/null 2>&1 && break
+  elif [ $i -gt 10 ]; then
+    break
+  fi
+  if ! kill -0 $jack_pid 2> /dev/null; then
+    echo "E> jackd failed:" >&2
+    cat "$work/jackd.log" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+"$build/tarea3" --control "$socket" --stats-shm "$segment" \
+                --coeffs "$work/flat.txt" --crossfade 2 \
+                -f "${files[@]}" < /dev/null > "$work/tarea3.log" 2>&1 &
+client_pid=$!
+
+for i in $(seq 50); do
+  [ -S "$socket" ] && break
+  sleep 0.1
+done
+if ! "$build/tarea3-ctl" -s "$socket" ping > /dev/null; then
+  echo "E> tarea3 did not start:" >&2
+  cat "$work/tarea3.log" >&2
+  exit 1
+fi
+
+# Batches of commands as fast as the interval allows, each batch through
+# one connection
+flood() {
+  local n=0
+  while true; do
+    local file=${files[$((n % ${#files[@]}))]}
+    {
+      echo "play $file"
+      echo "voice -12 $(( (n % 3) - 1 )) -1 $file"
+      echo "coeffs $work/$( ((n % 2)) && echo lowpass || echo flat ).txt"
+      echo "live-gain $( ((n % 4)) && echo -20 || echo off )"
+      echo "bypass $( ((n % 5)) && echo off || echo on )"
+      echo "seek $(( (n * 4801) % (rate * 2) ))"
+      echo "loop $(( n % 3 )) 0 $rate"
+      ((n % 7)) || echo "stop"
+      echo "stats"
+    } | "$build/tarea3-ctl" -s "$socket" > /dev/null 2>&1
+    n=$((n + 1))
+    sleep "$interval"
+  done
+}
+flood &
+flood_pid=$!
+
+echo "I> Stressing tarea3 for $duration s"
+sleep "$duration"
+
+kill $flood_pid 2> /dev/null
+wait $flood_pid 2> /dev/null
+flood_pid=
+
+status=0
+if ! kill -0 $client_pid 2> /dev/null; then
+  echo "E> tarea3 died during the test:" >&2
+  tail -20 "$work/tarea3.log" >&2
+  exit 1
+fi
+
+"$build/tarea3-top" -n "$segment" --once -i 1 | tee "$work/top.txt"
+"$build/tarea3-ctl" -s "$socket" stats
+"$build/tarea3-ctl" -s "$socket" quit > /dev/null
+wait $client_pid || status=1
+client_pid=
+
+xruns=$(sed -n 's/.*xruns \([0-9]*\).*/\1/p' "$work/top.txt" | head -1)
+if [ -n "$max_xruns" ] && [ "${xruns:-0}" -gt "$max_xruns" ]; then
+  echo "E> $xruns xruns, more than $max_xruns" >&2
+  status=1
+fi
+
+exit $status
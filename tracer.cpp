@@ -0,0 +1,230 @@
+/**
+ * tracer.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tracer.h"
+
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace {
+  const char* event_names[tracer::Events] = {
+    "cycle","period","commands","input","voices","process","output",
+    "read_block","check_files","xrun"
+  };
+
+  std::uint64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return std::uint64_t(ts.tv_sec)*1000000000u + std::uint64_t(ts.tv_nsec);
+  }
+}
+
+// Static members of class tracer
+std::atomic<bool> tracer::_enabled(false);
+std::array<tracer::thread_ring,tracer::max_threads> tracer::_rings;
+std::atomic<std::size_t> tracer::_threads(0u);
+
+std::ofstream tracer::_file;
+std::thread tracer::_flusher;
+std::atomic<bool> tracer::_flushing(false);
+std::uint64_t tracer::_origin = 0u;
+bool tracer::_first = true;
+
+bool tracer::start(const std::filesystem::path& file,
+                   const std::size_t records) {
+  if (enabled()) {
+    return true;
+  }
+
+  _file.open(file,std::ios::out | std::ios::trunc);
+  if (!_file) {
+    std::cerr << "E> Unable to write the trace " << file << std::endl;
+    return false;
+  }
+  _file << "{\"traceEvents\":[\n";
+  _first = true;
+
+  // All memory is taken now: the traced threads only claim their ring
+  for (auto& r : _rings) {
+    r.records.allocate(records);
+    r.dropped = 0u;
+  }
+  
+  _origin = monotonic_ns();
+  _flushing = true;
+  _flusher = std::thread(&tracer::run);
+  _enabled.store(true,std::memory_order_release);
+
+  std::cerr << "I> Tracing to " << file << std::endl;
+  return true;
+}
+
+void tracer::stop() {
+  if (!_enabled.exchange(false)) {
+    return;
+  }
+  _flushing = false;
+  if (_flusher.joinable()) {
+    _flusher.join();
+  }
+  flush();
+
+  // Thread names, and the records lost
+  std::size_t dropped = 0u;
+  const std::size_t threads = std::min(_threads.load(),max_threads);
+  for (std::size_t t=0;t<threads;++t) {
+    const thread_ring& r = _rings[t];
+    _file << (_first ? "" : ",\n")
+          << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << getpid()
+          << ",\"tid\":" << t << ",\"args\":{\"name\":\""
+          << ((r.name[0] != '\0') ? r.name : "thread") << "\"}}";
+    _first = false;
+    dropped += r.dropped.load();
+  }
+  _file << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":"
+        << dropped << "}}\n";
+  _file.close();
+
+  if (dropped > 0u) {
+    std::cerr << "I> " << dropped << " trace records dropped" << std::endl;
+  }
+}
+
+tracer::thread_ring* tracer::ring() {
+  thread_local int slot = -1;
+  if (slot == -1) {
+    const std::size_t idx = _threads.fetch_add(1u);
+    slot = (idx < max_threads) ? int(idx) : -2;
+  }
+  return (slot >= 0) ? &_rings[std::size_t(slot)] : nullptr;
+}
+
+void tracer::name_thread(const char* name) {
+  thread_ring* r = ring();
+  if (r != nullptr) {
+    std::strncpy(r->name,name,sizeof(r->name) - 1u);
+  }
+}
+
+void tracer::push(const record& rec) {
+  thread_ring* r = ring();
+  if ((r != nullptr) && !r->records.push(rec)) {
+    r->dropped.fetch_add(1u,std::memory_order_relaxed);
+  }
+}
+
+void tracer::begin(const event e,const std::uint32_t arg) {
+  if (enabled()) {
+    push(record{monotonic_ns(),0u,arg,e,'B'});
+  }
+}
+
+void tracer::end(const event e,const std::uint32_t arg) {
+  if (enabled()) {
+    push(record{monotonic_ns(),0u,arg,e,'E'});
+  }
+}
+
+void tracer::complete(const event e,
+                      const std::uint64_t start_ns,
+                      const std::uint64_t end_ns,
+                      const std::uint32_t arg) {
+  if (enabled()) {
+    push(record{start_ns,end_ns - start_ns,arg,e,'X'});
+  }
+}
+
+void tracer::instant(const event e,const std::uint32_t arg) {
+  instant_at(e,monotonic_ns(),arg);
+}
+
+void tracer::instant_at(const event e,
+                        const std::uint64_t ns,
+                        const std::uint32_t arg) {
+  if (enabled()) {
+    push(record{ns,0u,arg,e,'i'});
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Background thread
+// ---------------------------------------------------------------------------
+
+void tracer::flush() {
+  const long pid = long(getpid());
+  const std::size_t threads = std::min(_threads.load(),max_threads);
+  char line[256];
+  
+  for (std::size_t t=0;t<threads;++t) {
+    record r;
+    while (_rings[t].records.pop(r)) {
+      // Chrome traces are in microseconds, relative to the start
+      const double ts = 1e-3*double(std::int64_t(r.ns - _origin));
+      int n = std::snprintf(line,sizeof(line),
+                            "%s{\"name\":\"%s\",\"cat\":\"tarea3\","
+                            "\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%ld,"
+                            "\"tid\":%zu",
+                            _first ? "" : ",\n",
+                            event_names[r.what],r.phase,ts,pid,t);
+      if (r.phase == 'X') {
+        n += std::snprintf(line + n,sizeof(line) - std::size_t(n),
+                           ",\"dur\":%.3f",1e-3*double(r.duration_ns));
+      } else if (r.phase == 'i') {
+        // Period boundaries and xruns are drawn across all threads
+        n += std::snprintf(line + n,sizeof(line) - std::size_t(n),
+                           ",\"s\":\"p\"");
+      }
+      n += std::snprintf(line + n,sizeof(line) - std::size_t(n),
+                         ",\"args\":{\"arg\":%u}}",r.arg);
+      _file.write(line,n);
+      _first = false;
+    }
+  }
+}
+
+void tracer::run() {
+  while (_flushing) {
+    flush();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+}
@@ -0,0 +1,190 @@
+/**
+ * tracer.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TRACER_H
+#define _TRACER_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#include "spsc_ringbuffer.h"
+
+/**
+ * Opt-in tracer of the realtime spans of the client, exported as a
+ * Chrome trace (JSON), which can be opened with chrome://tracing or
+ * https://ui.perfetto.dev.
+ *
+ * Each thread writes its records (timestamp, event, argument) to its own
+ * preallocated ring, without locks nor allocations, so it can be used in
+ * jack's process.  A background thread moves the records to the file.
+ * If a ring fills up, the newest records are dropped and counted.
+ *
+ * Timestamps come from the monotonic clock, which is the clock of jack's
+ * cycle times on Linux, so the period boundaries reported by jack can be
+ * placed on the same time line as the spans.
+ *
+ * It follows the monostate pattern, like jack::client: all threads trace
+ * to the same file.
+ */
+class tracer {
+public:
+  /// Traced events.  The stages follow the order of stats_segment::stage.
+  enum event : std::uint16_t {
+    Cycle,      ///< jack's process
+    Period,     ///< start of jack's period
+    Commands,
+    Input,
+    Voices,
+    Process,
+    Output,
+    ReadBlock,  ///< sndfile_thread::read_block(), argument is the voice
+    CheckFiles, ///< sndfile_thread::check_files()
+    Xrun,       ///< xrun reported by jack
+    Events
+  };
+
+  /// Threads traced at most.  Records of other threads are ignored.
+  static constexpr std::size_t max_threads = 16u;
+
+  /**
+   * Start tracing to the given file, with rings of the given number of
+   * records per thread.  It has to be called before the traced threads
+   * start.
+   */
+  static bool start(const std::filesystem::path& file,
+                    const std::size_t records = 32768u);
+
+  /// Write the remaining records and close the file
+  static void stop();
+
+  /// True while tracing
+  static inline bool enabled() {
+    return _enabled.load(std::memory_order_relaxed);
+  }
+
+  /// Name of the calling thread in the trace
+  static void name_thread(const char* name);
+
+  /// Start a span in the calling thread
+  static void begin(const event e,const std::uint32_t arg = 0u);
+
+  /// End the last span started in the calling thread
+  static void end(const event e,const std::uint32_t arg = 0u);
+
+  /// A span already measured, with monotonic times in nanoseconds
+  static void complete(const event e,
+                       const std::uint64_t start_ns,
+                       const std::uint64_t end_ns,
+                       const std::uint32_t arg = 0u);
+
+  /**
+   * A point in time seen by all threads (e.g. a period boundary), now or
+   * at the given monotonic time in nanoseconds
+   */
+  static void instant(const event e,const std::uint32_t arg = 0u);
+  static void instant_at(const event e,
+                         const std::uint64_t ns,
+                         const std::uint32_t arg = 0u);
+
+  /// Span of the enclosing scope
+  class scope {
+  public:
+    inline explicit scope(const event e,const std::uint32_t arg = 0u)
+      : _event(e), _active(enabled()) {
+      if (_active) {
+        begin(e,arg);
+      }
+    }
+    inline ~scope() {
+      if (_active) {
+        end(_event);
+      }
+    }
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+  private:
+    event _event;
+    bool _active;
+  };
+
+private:
+  struct record {
+    std::uint64_t ns;
+    std::uint64_t duration_ns;
+    std::uint32_t arg;
+    event what;
+    char phase; ///< as in the Chrome trace format: B, E, X or i
+  };
+
+  /// Records of one thread
+  struct thread_ring {
+    spsc_ringbuffer<record> records;
+    char name[32] = {};
+    std::atomic<std::size_t> dropped = 0u;
+  };
+
+  static std::atomic<bool> _enabled;
+  static std::array<thread_ring,max_threads> _rings;
+  /// Slots of _rings taken by threads
+  static std::atomic<std::size_t> _threads;
+
+  static std::ofstream _file;
+  static std::thread _flusher;
+  static std::atomic<bool> _flushing;
+  /// Monotonic time of the start, the origin of the trace
+  static std::uint64_t _origin;
+  /// No record was written yet
+  static bool _first;
+
+  /// Ring of the calling thread, or nullptr if there are too many threads
+  static thread_ring* ring();
+
+  static void push(const record& r);
+
+  /// Move all pending records to the file
+  static void flush();
+
+  /// Loop of the background thread
+  static void run();
+};
+
+#endif
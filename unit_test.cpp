@@ -0,0 +1,212 @@
+/**
+ * unit_test.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file unit_test.cpp
+ *
+ * @brief Unit tests of small parts of the client that are not covered by
+ * the signal processing regression tests, run by meson test.
+ *
+ * Each test prints "ok" or "FAIL" followed by its name and what was
+ * checked.  The names given in the command line select the tests to
+ * run; without them all are run.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "loop_region.h"
+#include "pcm_format.h"
+
+namespace {
+
+  bool report(const bool ok,const std::string& name,const std::string& what) {
+    std::cout << (ok ? "ok   " : "FAIL ") << name << " " << what << std::endl;
+    return ok;
+  }
+
+  /**
+   * Frame indices produced by reading blocks of the given size, with
+   * the same stepping as sndfile_thread::read_frames, from a file whose
+   * samples are their frame index.
+   */
+  std::vector<std::size_t> play_loop(const std::size_t file_frames,
+                                     loop_region loop,
+                                     const std::size_t block) {
+    std::vector<std::size_t> played;
+    std::size_t position = 0u;
+    const std::size_t loop_end = loop.end;
+
+    while (position < file_frames) {
+      std::size_t done = 0u;
+      while ((done < block) && (position < file_frames)) {
+        const std::size_t n =
+          std::min(loop_step(position,loop,loop_end,block - done),
+                   file_frames - position);
+        for (std::size_t i=0;i<n;++i) {
+          played.push_back(position + i);
+        }
+        position += n;
+        done += n;
+      }
+    }
+    return played;
+  }
+
+  /**
+   * Blocks that start before a short loop must wrap exactly at its end,
+   * whatever the block size is.
+   */
+  bool loop_wrap() {
+    static constexpr std::size_t file_frames = 300u;
+    static constexpr std::size_t start = 100u;
+    static constexpr std::size_t end = 110u;
+    static constexpr int repeats = 3;
+
+    std::vector<std::size_t> expected(end);
+    std::iota(expected.begin(),expected.end(),0u);
+    for (int r=0;r<repeats;++r) {
+      for (std::size_t i=start;i<end;++i) {
+        expected.push_back(i);
+      }
+    }
+    for (std::size_t i=end;i<file_frames;++i) {
+      expected.push_back(i);
+    }
+
+    bool ok = true;
+    for (const std::size_t block : {1u,7u,64u,105u,128u,512u}) {
+      const auto played =
+        play_loop(file_frames,loop_region(start,end,repeats),block);
+      ok = report(played == expected,"loop",
+                  "block of " + std::to_string(block)) && ok;
+    }
+    return ok;
+  }
+
+  /// Signed integer stored in the given bytes
+  std::int32_t load(const unsigned char* p,const std::size_t bytes,
+                    const bool be) {
+    std::uint32_t u = 0u;
+    for (std::size_t i=0;i<bytes;++i) {
+      u |= std::uint32_t(p[be ? bytes-1u-i : i]) << (8u*i);
+    }
+    const unsigned int shift = unsigned(32u - 8u*bytes);
+    return static_cast<std::int32_t>(u << shift) >> shift;
+  }
+
+  /**
+   * Full scale samples must saturate instead of wrapping around, and
+   * halfway values must round the same way, both in the SIMD part of
+   * encode_pcm and in its scalar tail.
+   */
+  bool pcm_full_scale() {
+    bool ok = true;
+    for (const char* spec : {"s16","s16be","s24","s24be"}) {
+      pcm_format fmt;
+      parse_pcm_spec(spec,fmt);
+      const std::size_t bytes = fmt.sample_bytes();
+      const std::int32_t top = (1 << (8u*bytes - 1u)) - 1;
+      const float half = 2.5f/float(top + 1);
+
+      // Lengths up to 7 leave tails of 1 to 3 samples after SIMD
+      for (std::size_t n=1u;n<=7u;++n) {
+        const std::pair<float,std::int32_t> cases[] = {
+          {1.0f,top},{2.0f,top},{-1.0f,-top - 1},{half,2},{-half,-2}
+        };
+        for (const auto& [value,expected] : cases) {
+          const std::vector<float> src(n,value);
+          std::vector<unsigned char> dst(n*bytes);
+          encode_pcm(src.data(),n,fmt,dst.data());
+
+          bool same = true;
+          for (std::size_t i=0;i<n;++i) {
+            same = same &&
+              (load(dst.data() + i*bytes,bytes,fmt.big_endian) == expected);
+          }
+          if (!same) {
+            ok = report(false,"pcm",std::string(spec) + " " +
+                        std::to_string(value) + " with " +
+                        std::to_string(n) + " samples");
+          }
+        }
+      }
+      ok = report(ok,"pcm",std::string(spec) + " full scale and rounding")
+        && ok;
+    }
+    return ok;
+  }
+
+  struct unit {
+    std::string name;
+    std::function<bool()> run;
+  };
+
+  const std::vector<unit>& units() {
+    static const std::vector<unit> all = {
+      {"loop",loop_wrap},
+      {"pcm",pcm_full_scale},
+    };
+    return all;
+  }
+
+} // namespace
+
+int main(int argc,char *argv[]) {
+  const std::vector<std::string> names(argv + 1,argv + argc);
+
+  bool ok = true;
+  bool any = false;
+  for (const unit& u : units()) {
+    if (names.empty() ||
+        (std::find(names.begin(),names.end(),u.name) != names.end())) {
+      any = true;
+      ok = u.run() && ok;
+    }
+  }
+  if (!any) {
+    std::cerr << "E> No such test" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,403 @@
+/**
+ * uring_reader.cpp
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "uring_reader.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+/******************************
+ * uring_context
+ ******************************/
+
+uring_context::uring_context(const unsigned int entries)
+  : _valid(false)
+  , _queued(0u) {
+  _valid = (io_uring_queue_init(entries,&_ring,0) == 0);
+}
+
+uring_context::~uring_context() {
+  if (_valid) {
+    io_uring_queue_exit(&_ring);
+  }
+}
+
+bool uring_context::submit_read(int fd,void* buf,unsigned int len,
+                                off_t offset,request& req) {
+  if (!_valid) {
+    return false;
+  }
+  
+  io_uring_sqe* sqe = io_uring_get_sqe(&_ring);
+  if (sqe == nullptr) {
+    // submission queue full: flush it and try again
+    submit();
+    sqe = io_uring_get_sqe(&_ring);
+    if (sqe == nullptr) {
+      return false;
+    }
+  }
+
+  io_uring_prep_read(sqe,fd,buf,len,offset);
+  io_uring_sqe_set_data(sqe,&req);
+  req.result  = 0;
+  req.pending = true;
+  ++_queued;
+  
+  return true;
+}
+
+void uring_context::submit() {
+  if (_valid && (_queued > 0u)) {
+    io_uring_submit(&_ring);
+    _queued = 0u;
+  }
+}
+
+void uring_context::reap(const bool wait) {
+  if (!_valid) {
+    return;
+  }
+  
+  submit();
+  
+  io_uring_cqe* cqe = nullptr;
+  
+  if (wait) {
+    int ret;
+    do {
+      ret = io_uring_wait_cqe(&_ring,&cqe);
+    } while (ret == -EINTR);
+    
+    if (ret < 0) {
+      return;
+    }
+  } else if (io_uring_peek_cqe(&_ring,&cqe) != 0) {
+    return;
+  }
+
+  // Dispatch the completion to its request, and all others available
+  do {
+    request* req = static_cast<request*>(io_uring_cqe_get_data(cqe));
+    if (req != nullptr) {
+      req->result  = cqe->res;
+      req->pending = false;
+    }
+    io_uring_cqe_seen(&_ring,cqe);
+  } while (io_uring_peek_cqe(&_ring,&cqe) == 0);
+}
+
+/******************************
+ * uring_reader
+ ******************************/
+
+void uring_reader::aligned_free::operator()(unsigned char* p) const {
+  std::free(p);
+}
+
+uring_reader::uring_reader(uring_context& ring)
+  : audio_reader()
+  , _ring(ring)
+  , _fd(-1)
+  , _format()
+  , _memory()
+  , _chunks(chunks)
+  , _head(0u)
+  , _next_offset(0)
+  , _position(0)
+  , _data_end(0)
+  , _carry_size(0u) {
+}
+
+uring_reader::~uring_reader() {
+  close();
+}
+
+bool uring_reader::open(const std::filesystem::path& file) {
+  close();
+
+  if (!_ring.valid()) {
+    return false;
+  }
+  
+  // The page cache is not bypassed with O_DIRECT, so that the kernel
+  // readahead and repeated playback of the same files still work, but
+  // the reads are aligned to pages anyway.
+  _fd = ::open(file.c_str(),O_RDONLY | O_CLOEXEC);
+  if (_fd < 0) {
+    return false;
+  }
+
+  if (!_memory) {
+    _memory.reset(static_cast<unsigned char*>
+                  (std::aligned_alloc(io_alignment,chunks*chunk_bytes)));
+    if (!_memory) {
+      close();
+      return false;
+    }
+    for (std::size_t i=0;i<chunks;++i) {
+      _chunks[i].data = _memory.get() + i*chunk_bytes;
+    }
+  }
+
+  // The header is read synchronously, into the first chunk
+  const ssize_t hbytes = pread(_fd,_chunks[0].data,chunk_bytes,0);
+  if ((hbytes <= 0) ||
+      !parse_pcm_header(_chunks[0].data,std::size_t(hbytes),_format) ||
+      (_format.frame_bytes() > sizeof(_carry))) {
+    close();
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(_fd,&st) != 0) {
+    close();
+    return false;
+  }
+
+  _channels    = _format.channels;
+  _sample_rate = _format.sample_rate;
+  
+  _position = off_t(_format.data_offset);
+  _data_end = off_t(st.st_size);
+  if (_format.data_bytes > 0u) {
+    _data_end = std::min(_data_end,off_t(_format.data_offset +
+                                         _format.data_bytes));
+  }
+  
+  _frames = std::size_t(_data_end - _position)/_format.frame_bytes();
+
+  return seek(0u);
+}
+
+bool uring_reader::seek(const std::size_t frame) {
+  if (_fd < 0) {
+    return false;
+  }
+  
+  // Requests in flight still write into the chunks
+  drain();
+
+  _position = off_t(_format.data_offset + frame*_format.frame_bytes());
+  _position = std::min(_position,_data_end);
+  _next_offset = (_position/off_t(io_alignment))*off_t(io_alignment);
+  _head = 0u;
+  _carry_size = 0u;
+  
+  for (auto& c : _chunks) {
+    request(c);
+  }
+  _ring.submit();
+  
+  return true;
+}
+
+void uring_reader::request(chunk& c) {
+  if (_next_offset >= _data_end) {
+    c.used = false;
+    return;
+  }
+
+  c.offset = _next_offset;
+  c.filled = 0u;
+  c.complete = false;
+  c.used = _ring.submit_read(_fd,c.data,chunk_bytes,c.offset,c.req);
+  _next_offset += off_t(chunk_bytes);
+
+  if (!c.used) {
+    // Without a request the data cannot arrive: end the file here
+    _data_end = c.offset;
+  }
+}
+
+/**
+ * A short read before the end of the data is resubmitted for the rest
+ * of the chunk, which stays incomplete until it arrives.  Only a read of
+ * zero bytes ends the file; an error ends it as well.
+ */
+void uring_reader::settle(chunk& c) {
+  if (!c.used || c.complete || c.req.pending) {
+    return;
+  }
+
+  const int result = c.req.result;
+  c.req.result = 0;
+  if (result > 0) {
+    c.filled += std::size_t(result);
+  }
+
+  const off_t end = c.offset + off_t(c.filled);
+  if ((result > 0) && (c.filled < chunk_bytes) && (end < _data_end)) {
+    const unsigned int rest = unsigned(chunk_bytes - c.filled);
+    if (_ring.submit_read(_fd,c.data+c.filled,rest,end,c.req)) {
+      _ring.submit();
+      return;
+    }
+  }
+
+  c.complete = true;
+  if ((c.filled < chunk_bytes) && (end < _data_end)) {
+    _data_end = end; // end of file or read error
+  }
+}
+
+bool uring_reader::ready(const std::size_t frames) {
+  if (_fd < 0) {
+    return true;
+  }
+  
+  _ring.reap(false);
+
+  std::size_t bytes = _carry_size;
+  off_t pos = _position;
+  
+  for (std::size_t k=0;k<chunks;++k) {
+    if (pos >= _data_end) {
+      return true; // the rest of the file is available
+    }
+    
+    chunk& c = _chunks[(_head+k)%chunks];
+    settle(c);
+    if (!c.used || (c.offset >= _data_end)) {
+      return true; // end of file or error, nothing to wait for
+    }
+    if (!c.complete) {
+      break; // still in flight, maybe the rest of a short read
+    }
+    
+    const off_t cend = std::min(c.offset + off_t(c.filled),_data_end);
+    const off_t begin = std::max(pos,c.offset);
+    if (cend > begin) {
+      bytes += std::size_t(cend-begin);
+      pos = cend;
+    }
+  }
+
+  return (pos >= _data_end) || (bytes >= frames*_format.frame_bytes());
+}
+
+std::size_t uring_reader::read(float* dst,const std::size_t frames) {
+  if (_fd < 0) {
+    return 0u;
+  }
+  
+  const std::size_t fb = _format.frame_bytes();
+  std::size_t done = 0u;
+
+  while ((done < frames) && (_position < _data_end)) {
+    chunk& c = _chunks[_head];
+    if (!c.used) {
+      break;
+    }
+
+    settle(c);
+    while (!c.complete) {
+      _ring.reap(true);
+      settle(c);
+    }
+
+    const off_t cend  = std::min(c.offset + off_t(c.filled),_data_end);
+    const off_t begin = std::max(_position,c.offset);
+
+    if (begin >= cend) {
+      // Chunk fully decoded: reuse it for the next region of the file
+      request(c);
+      _head = (_head+1u)%chunks;
+      continue;
+    }
+
+    const unsigned char* src = c.data + (begin - c.offset);
+    std::size_t avail = std::size_t(cend - begin);
+    
+    if (_carry_size > 0u) {
+      // complete the frame split at the end of the previous chunk
+      const std::size_t n = std::min(fb - _carry_size,avail);
+      std::memcpy(_carry+_carry_size,src,n);
+      _carry_size += n;
+      _position += off_t(n);
+      if (_carry_size == fb) {
+        decode_pcm(_carry,1u,_format,dst+done*_channels);
+        ++done;
+        _carry_size = 0u;
+      }
+      continue;
+    }
+
+    const std::size_t n = std::min(avail/fb,frames-done);
+    if (n > 0u) {
+      decode_pcm(src,n,_format,dst+done*_channels);
+      done += n;
+      _position += off_t(n*fb);
+      continue;
+    }
+
+    // Less than one frame left in this chunk
+    std::memcpy(_carry,src,avail);
+    _carry_size = avail;
+    _position += off_t(avail);
+  }
+
+  _ring.submit();
+  
+  return done;
+}
+
+void uring_reader::drain() {
+  for (const auto& c : _chunks) {
+    while (c.req.pending) {
+      _ring.reap(true);
+    }
+  }
+}
+
+void uring_reader::close() {
+  if (_fd >= 0) {
+    drain();
+    ::close(_fd);
+    _fd = -1;
+  }
+  for (auto& c : _chunks) {
+    c.used = false;
+    c.req = uring_context::request();
+  }
+}
@@ -0,0 +1,170 @@
+/**
+ * uring_reader.h
+ *
+ * Copyright (C) 2023-2024  Pablo Alvarado
+ * EL5805 Procesamiento Digital de Señales
+ * Escuela de Ingeniería Electrónica
+ * Tecnológico de Costa Rica
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors may be
+ *    used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _URING_READER_H
+#define _URING_READER_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <sys/types.h>
+#include <liburing.h>
+
+#include "audio_reader.h"
+#include "pcm_format.h"
+
+/**
+ * Owner of one io_uring instance, shared by all uring_reader objects
+ * created by the same thread.
+ *
+ * Readers queue their requests with submit_read(), and the completions
+ * are dispatched back to each request with reap().  All methods must
+ * be called from the same thread.
+ */
+class uring_context {
+public:
+  /// State of one read request
+  struct request {
+    int  result = 0;      ///< bytes read, or -errno
+    bool pending = false; ///< true while the kernel owns the request
+  };
+
+  /**
+   * Create the ring with the given number of submission entries.
+   *
+   * Check valid() afterwards: the kernel might not support io_uring or
+   * it might be forbidden for this process.
+   */
+  explicit uring_context(const unsigned int entries = 64u);
+  ~uring_context();
+
+  uring_context(const uring_context&) = delete; // not copyable
+  uring_context& operator=(const uring_context&) = delete; // not copyable
+
+  inline bool valid() const {return _valid;}
+  
+  /**
+   * Queue a read of len bytes from fd at the given offset into buf.
+   *
+   * The request is sent to the kernel on the next submit() or reap().
+   */
+  bool submit_read(int fd,void* buf,unsigned int len,off_t offset,
+                   request& req);
+
+  /// Send all queued requests to the kernel with one system call
+  void submit();
+  
+  /**
+   * Collect all available completions.  If wait is true, block until
+   * at least one completion arrives.
+   */
+  void reap(const bool wait);
+
+private:
+  io_uring _ring;
+  bool _valid;
+  unsigned int _queued;
+};
+
+/**
+ * Asynchronous reader of uncompressed WAV and AIFF files.
+ *
+ * It keeps several large, aligned reads in flight, and decodes the PCM
+ * samples from the completed buffers.  Other formats are rejected by
+ * open(), so that the caller can fall back to sndfile_reader.
+ */
+class uring_reader : public audio_reader {
+public:
+  /// Bytes of each read request
+  static constexpr std::size_t chunk_bytes = 256u*1024u;
+  /// Number of read requests kept in flight
+  static constexpr std::size_t chunks = 4u;
+  /// Alignment of offsets and buffers, as required by O_DIRECT
+  static constexpr std::size_t io_alignment = 4096u;
+  
+  explicit uring_reader(uring_context& ring);
+  virtual ~uring_reader();
+
+  virtual bool open(const std::filesystem::path& file) override;
+  virtual std::size_t read(float* dst,const std::size_t frames) override;
+  virtual bool ready(const std::size_t frames) override;
+  virtual bool seek(const std::size_t frame) override;
+  virtual void close() override;
+
+private:
+  /// One buffer of the file, with its read request
+  struct chunk {
+    unsigned char* data = nullptr;
+    off_t offset = 0;
+    uring_context::request req;
+    std::size_t filled = 0u; ///< bytes of the chunk already read
+    bool complete = false;   ///< no more requests for this chunk
+    bool used = false; ///< false if there was nothing left to read
+  };
+
+  uring_context& _ring;
+  int _fd;
+  pcm_format _format;
+
+  struct aligned_free {
+    void operator()(unsigned char* p) const;
+  };
+  std::unique_ptr<unsigned char[],aligned_free> _memory;
+  std::vector<chunk> _chunks;
+  std::size_t _head;
+
+  /// File offset where the next read request starts
+  off_t _next_offset;
+  /// File offset of the next byte to be decoded
+  off_t _position;
+  /// File offset after the last sample
+  off_t _data_end;
+
+  /// Bytes of a frame split between two chunks
+  unsigned char _carry[256];
+  std::size_t _carry_size;
+
+  /// Queue the read of the next region of the file into the chunk
+  void request(chunk& c);
+  /// Take the result of the finished request of the chunk
+  void settle(chunk& c);
+  /// Wait until all requests of this reader are done
+  void drain();
+};
+
+#endif
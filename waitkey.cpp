@@ -43,8 +43,7 @@
 
 #include <iostream>
 
-int waitkey(int timeout_ms) {
-
+namespace {
   class raii {
   private:
     termios _original_termios;
@@ -77,8 +76,15 @@ int waitkey(int timeout_ms) {
     }
   };
 
-  // Set terminal and restores at the end of program
-  static raii init_terminal;
+  void init_terminal() {
+    // Set terminal and restores at the end of program
+    static raii terminal;
+  }
+}
+
+int waitkey(int timeout_ms) {
+
+  init_terminal();
 
   // Wait for input using select with a timeout
   fd_set read_fds;
@@ -99,3 +105,17 @@ int waitkey(int timeout_ms) {
   
   return c;
 }
+
+void prepare_terminal() {
+  init_terminal();
+}
+
+int readkey() {
+  init_terminal();
+
+  char ch;
+  if (read(STDIN_FILENO, &ch, 1) == 1) {
+    return ch;
+  }
+  return -1;
+}
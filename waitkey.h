@@ -54,5 +54,25 @@
  */
 int waitkey(int timeout_ms=250);
 
+/**
+ * readkey
+ *
+ * Read a pending key without waiting, or return -1 if there is none.
+ *
+ * It configures the terminal like waitkey(), so that the standard input
+ * can be watched for single key presses (e.g. with epoll).
+ */
+int readkey();
+
+/**
+ * prepare_terminal
+ *
+ * Configure the terminal like waitkey() and readkey() do, without
+ * reading anything: single key presses, without echo.  It must be called
+ * before the standard input is watched with epoll, which otherwise only
+ * reports it once a whole line is entered.
+ */
+void prepare_terminal();
+
 
 #endif